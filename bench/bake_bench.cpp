@@ -0,0 +1,125 @@
+// Benchmark of baking procedural textures (bake_texture in src/texture.h):
+//  - the final scene's marble (noise of scale 0.1 on a sphere of radius 80) and a checker sphere,
+//    baked at a few sizes into a fresh cache directory, then baked again (read back from it),
+//  - lookups per second at the points a screen's rays hit the sphere, the procedural texture
+//    against the baked one (trilinear, with the footprint of a pixel),
+//  - the error of each bake against the procedural texture, as bake_texture reports it.
+// Baking pays where the texture costs more than a trilinear lookup: noise does, a checker doesn't.
+
+#include "../src/utility.h"
+#include "../src/parallel.h"
+#include "../src/object.h"
+#include "../src/sphere.h"
+#include "../src/texture.h"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static volatile double sink;
+
+struct lookup
+{
+    double u, v, du, dv;
+    point3 p;
+};
+
+// where the rays of a screen hit the near half of the sphere, row by row
+static std::vector<lookup> screen_lookups(const point3& center, double radius, int screen)
+{
+    std::vector<lookup> lookups;
+    for (int y = 0; y < screen; ++y)
+        for (int x = 0; x < screen; ++x)
+        {
+            auto sx = 2 * (x + 0.5) / screen - 1, sy = 2 * (y + 0.5) / screen - 1;
+            if (sx * sx + sy * sy >= 1)
+                continue;
+            auto n = vec3(sx, sy, -sqrt(1 - sx * sx - sy * sy));
+            lookup l;
+            sphere::get_sphere_uv(n, l.u, l.v);
+            sphere::get_sphere_uv_rates(n, radius, l.du, l.dv);
+            auto pixel = 2 * radius / screen / fmax(-n.z(), 0.125);   // the pixel's width on the surface
+            l.du *= pixel;
+            l.dv *= pixel;
+            l.p = center + radius * n;
+            lookups.push_back(l);
+        }
+    return lookups;
+}
+
+static double lookups_per_second(const texture& t, const std::vector<lookup>& lookups)
+{
+    double checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < 4; ++round)
+        for (const auto& l : lookups)
+            checksum += texture_value(t, l.u, l.v, l.p, l.du, l.dv).y();
+    sink = checksum;
+    return 4.0 * lookups.size() / seconds_since(begin) / 1e6;
+}
+
+int main()
+{
+    std::cout << std::unitbuf;   // in order with bake_texture's reports on std::clog
+    auto directory = std::filesystem::temp_directory_path() / "rtw_bake_bench";
+    std::filesystem::remove_all(directory);
+#if defined(_MSC_VER)
+    _putenv_s("RTW_TEXTURE_CACHE", directory.string().c_str());
+#else
+    setenv("RTW_TEXTURE_CACHE", directory.string().c_str(), 1);
+#endif
+
+    struct subject
+    {
+        std::string name;
+        std::shared_ptr<texture> procedural;
+        point3 center;
+        double radius;
+    };
+    subject subjects[] = {
+        { "marble", std::make_shared<noise_texture>(0.1), point3(220, 280, 300), 80 },
+        { "checker", std::make_shared<checker_board>(10, color(.2, .3, .1), color(.9, .9, .9)), point3(0, 0, 0), 100 },
+    };
+
+    for (const auto& s : subjects)
+    {
+        auto surface = [&](double u, double v) { return s.center + s.radius * sphere::get_sphere_point(u, v); };
+        auto lookups = screen_lookups(s.center, s.radius, 800);
+        std::cout << s.name << ", " << lookups.size() << " lookups:\n";
+        std::cout << "  procedural:      " << lookups_per_second(*s.procedural, lookups) << " M/s\n";
+
+        for (int width : { 512, 2048 })
+        {
+            auto name = s.name + "_sphere";
+            auto begin = std::chrono::steady_clock::now();
+            auto baked = bake_texture(s.procedural, name, surface, width, width / 2);
+            auto bake_seconds = seconds_since(begin);
+
+            auto& cache = texture_cache::global();
+            cache.reset();
+            auto rate = lookups_per_second(*baked, lookups);
+            std::cout << "  baked " << width << "x" << width / 2 << ": " << rate << " M/s, baked in " << bake_seconds
+                      << " s, " << cache.peak_bytes() / (1024.0 * 1024.0) << " MB of tiles\n";
+        }
+    }
+
+    // a bake whose file is there: the images above are let go and read back from the directory
+    std::cout << "again, from the files:\n";
+    for (const auto& s : subjects)
+    {
+        auto surface = [&](double u, double v) { return s.center + s.radius * sphere::get_sphere_point(u, v); };
+        bake_texture(s.procedural, s.name + "_sphere", surface, 2048, 1024);
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
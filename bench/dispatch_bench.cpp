@@ -0,0 +1,417 @@
+// Benchmark of static against virtual dispatch (src/variant_scene.h, material.h, texture.h):
+//  - geometry: the shipped scenes' spheres, quads and boxes as separate objects, intersected through
+//    bvh_node (a virtual call per node and object) and through variant_scene (a switch per object),
+//    camera rays plus one diffuse bounce from every hit, and a check that both find the same hits,
+//  - hit records filled per ray, for every hit the search finds against only for the closest
+//    (object::intersect_deferred), and for shadow rays against none, with the transcendental calls
+//    among them (sphere (u,v): an acos and an atan2),
+//  - shading: a mix of materials scattered at random hits, as heap objects with their own textures
+//    called through virtual functions (the materials as they were, below), and as material_table
+//    rows through material_scatter, with the hits in random order and sorted by material,
+//  - textures looked up at the same hits through their virtual functions and through texture_value.
+// Rays or lookups per second, best of three passes.
+
+#include "../src/utility.h"
+#include "../src/vector.h"
+#include "../src/ray.h"
+#include "../src/interval.h"
+#include "../src/object.h"
+#include "../src/scene.h"
+#include "../src/sphere.h"
+#include "../src/quad.h"
+#include "../src/cuboid.h"
+#include "../src/material.h"
+#include "../src/texture.h"
+#include "../src/bvh.h"
+#include "../src/variant_scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename Pass>
+static double best_rate(size_t operations, Pass pass)
+{
+    double best = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        pass();
+        best = fmax(best, operations / seconds_since(begin) / 1e6);
+    }
+    return best;
+}
+
+static shared_ptr<material> no_material;
+
+static point3 random_spheres(scene& world)
+{
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, no_material));
+    for (int a = -11; a < 11; a++)
+        for (int b = -11; b < 11; b++)
+        {
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+                world.add(make_shared<sphere>(center, 0.2, no_material));
+        }
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, no_material));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, no_material));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, no_material));
+    return point3(13,2,3);
+}
+
+static point3 cornell_box(scene& world)
+{
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), no_material));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), no_material));
+    world.add(make_shared<quad>(point3(213,554,227), vec3(130,0,0), vec3(0,0,105), no_material));
+
+    auto box1 = box(point3(0,0,0), point3(165,330,165), no_material);
+    box1->rotate(15.0, 1);
+    box1->translate(vec3(265,0,295));
+    auto box2 = box(point3(0,0,0), point3(165,165,165), no_material);
+    box2->rotate(-18.0, 1);
+    box2->translate(vec3(130,0,65));
+    world.add(box1);
+    world.add(box2);
+    return point3(278, 278, -800);
+}
+
+// one of a scene's primitives, counting the records filled for it
+class counted final : public object
+{
+public:
+    counted(shared_ptr<object> o) : inner(std::move(o)), is_sphere(std::dynamic_pointer_cast<sphere>(inner) != nullptr) {}
+
+    bbox get_bbox() const override { return inner->get_bbox(); }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        if (!inner->intersect(r, ray_t, rec))
+            return false;
+        count();
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        if (!defer)
+            return object::intersect_deferred(r, ray_t, rec, hit);   // a record for every hit, as the search was
+        if (!inner->intersect_deferred(r, ray_t, rec, hit))
+            return false;
+        if (hit.primitive)
+            hit.primitive = this;
+        else
+            count();
+        return true;
+    }
+
+    void fill_record(const ray& r, double t, intersect_record& rec) const override
+    {
+        inner->fill_record(r, t, rec);
+        count();
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        return defer ? inner->transmittance(r, ray_t) : object::transmittance(r, ray_t);   // the latter through intersect
+    }
+
+    static bool defer;
+    static long records, transcendentals;
+
+private:
+    shared_ptr<object> inner;
+    bool is_sphere;
+
+    void count() const
+    {
+        ++records;
+        transcendentals += is_sphere ? 2 : 0;
+    }
+};
+
+bool counted::defer = false;
+long counted::records = 0, counted::transcendentals = 0;
+
+static void geometry(const std::string& name, const std::function<point3(scene&)>& make_scene)
+{
+    scene world;
+    auto eye = make_scene(world);
+    bvh_node bvh(world);
+    variant_scene variants(world);
+
+    // rays from the eye through the scene's box, then one bounce from every hit
+    std::vector<ray> rays;
+    auto box = world.get_bbox();
+    for (int k = 0; k < 200000; ++k)
+    {
+        point3 target(random_double(box.x.min, box.x.max), random_double(box.y.min, box.y.max), random_double(box.z.min, box.z.max));
+        rays.emplace_back(eye, target - eye, random_double());
+    }
+    auto camera_rays = rays.size();
+    for (size_t k = 0; k < camera_rays; ++k)
+    {
+        intersect_record rec;
+        if (bvh.intersect(rays[k], interval(0, infinity), rec))
+            rays.push_back(spawn_ray(rec, rec.normal + randomSample_unit_vector_normalize(), rays[k].time()));
+    }
+
+    std::vector<double> t_virtual(rays.size()), t_static(rays.size());
+    auto trace = [&](const object& accel, std::vector<double>& t)
+    {
+        for (size_t k = 0; k < rays.size(); ++k)
+        {
+            intersect_record rec;
+            t[k] = accel.intersect(rays[k], interval(0, infinity), rec) ? rec.t : infinity;
+        }
+    };
+    auto virtual_rate = best_rate(rays.size(), [&]() { trace(bvh, t_virtual); });
+    auto static_rate = best_rate(rays.size(), [&]() { trace(variants, t_static); });
+
+    long differ = 0;
+    for (size_t k = 0; k < rays.size(); ++k)
+        differ += t_virtual[k] != t_static[k] && fabs(t_virtual[k] - t_static[k]) > 1e-9 * fabs(t_virtual[k]);
+
+    std::cout << name << ": " << world.objects.size() << " objects, " << rays.size() << " rays\n";
+    std::cout << "  bvh_node, virtual calls:       " << virtual_rate << " Mrays/s\n";
+    std::cout << "  variant_scene, static calls:   " << static_rate << " Mrays/s, "
+              << variants.fallback_count() << " objects through the fallback, " << differ << " hits differ\n";
+
+    // the same searches over counting primitives, filling a record at every hit and at the closest only
+    scene counting;
+    for (const auto& o : world.objects)
+        counting.add(make_shared<counted>(o));
+    bvh_node counting_bvh(counting);
+    variant_scene counting_variants(counting);
+    auto count = [&](const char* label, const object& accel)
+    {
+        double records[2], transcendentals[2], shadow[2];
+        for (bool defer : { false, true })
+        {
+            counted::defer = defer;
+            counted::records = counted::transcendentals = 0;
+            trace(accel, t_static);
+            records[defer] = static_cast<double>(counted::records) / rays.size();
+            transcendentals[defer] = static_cast<double>(counted::transcendentals) / rays.size();
+
+            counted::transcendentals = 0;
+            for (const auto& r : rays)
+                accel.transmittance(r, interval(0, infinity));
+            shadow[defer] = static_cast<double>(counted::transcendentals) / rays.size();
+        }
+        std::cout << label << "records per ray " << records[0] << " -> " << records[1]
+                  << ", transcendental calls per ray " << transcendentals[0] << " -> " << transcendentals[1]
+                  << ", per shadow ray " << shadow[0] << " -> " << shadow[1] << "\n";
+    };
+    count("  bvh_node, every hit -> closest:      ", counting_bvh);
+    count("  variant_scene, every hit -> closest: ", counting_variants);
+}
+
+// the materials as they were: a heap object each, holding a texture even for a constant color
+class heap_material
+{
+public:
+    virtual ~heap_material() = default;
+    virtual bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const { return false; }
+    virtual color emitted(const intersect_record& rec, double u, double v, const point3& p) const { return color(0,0,0); }
+};
+
+class heap_lambertian final : public heap_material
+{
+public:
+    heap_lambertian(shared_ptr<texture> t) : tex(t) {}
+
+    bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const override
+    {
+        onb uvw;
+        uvw.build_from_w(rec.normal);
+        ray_out = spawn_ray(rec, uvw.local(randomSample_cosine_direction()), ray_in.time());
+        pdf = dot(uvw.w(), ray_out.direction()) / pi;
+        albedo = tex->get_value(rec.u, rec.v, rec.p);
+        return true;
+    }
+
+    shared_ptr<texture> tex;
+};
+
+class heap_metal final : public heap_material
+{
+public:
+    heap_metal(const color& a, double f) : albedo(a), fuzz(f) {}
+
+    bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& alb, double& pdf) const override
+    {
+        auto reflected_direction = reflect(unit_vector(ray_in.direction()), rec.normal);
+        ray_out = spawn_ray(rec, reflected_direction + fuzz * randomSample_unit_vector_normalize(), ray_in.time());
+        alb = albedo;
+        pdf = 0;
+        return dot(ray_out.direction(), rec.normal) > 0;
+    }
+
+    color albedo;
+    double fuzz;
+};
+
+class heap_isotropic final : public heap_material
+{
+public:
+    heap_isotropic(shared_ptr<texture> t) : tex(t) {}
+
+    bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const override
+    {
+        ray_out = spawn_ray(rec, randomSample_unit_vector_normalize(), ray_in.time());
+        albedo = tex->get_value(rec.u, rec.v, rec.p);
+        pdf = 1 / (4 * pi);
+        return true;
+    }
+
+    shared_ptr<texture> tex;
+};
+
+class heap_light final : public heap_material
+{
+public:
+    heap_light(shared_ptr<texture> t) : tex(t) {}
+
+    color emitted(const intersect_record& rec, double u, double v, const point3& p) const override
+    {
+        return rec.front_face ? tex->get_value(u, v, p) : color(0,0,0);
+    }
+
+    shared_ptr<texture> tex;
+};
+
+static void shading()
+{
+    auto checker = make_shared<checker_board>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    auto gray = make_shared<solid_color>(color(.73, .73, .73));
+    auto white = make_shared<solid_color>(color(1, 1, 1));
+    auto glow = make_shared<solid_color>(color(4, 4, 4));
+
+    // the same mix both ways; mostly constant colors, as in the shipped scenes
+    std::vector<shared_ptr<heap_material>> heap = {
+        make_shared<heap_lambertian>(gray),
+        make_shared<heap_lambertian>(make_shared<solid_color>(color(.65, .05, .05))),
+        make_shared<heap_lambertian>(checker),
+        make_shared<heap_metal>(color(0.8, 0.6, 0.2), 0.1),
+        make_shared<heap_isotropic>(white),
+        make_shared<heap_light>(glow),
+    };
+    std::vector<material_id> ids = {
+        material_table::global().id(make_shared<lambertian>(color(.73, .73, .73))),
+        material_table::global().id(make_shared<lambertian>(color(.65, .05, .05))),
+        material_table::global().id(make_shared<lambertian>(checker)),
+        material_table::global().id(make_shared<metal>(color(0.8, 0.6, 0.2), 0.1)),
+        material_table::global().id(make_shared<isotropic>(color(1, 1, 1))),
+        material_table::global().id(make_shared<diffuse_light>(color(4, 4, 4))),
+    };
+    std::vector<shared_ptr<texture>> textures = { gray, checker, make_shared<noise_texture>(4) };
+
+    const size_t count = 1 << 20;
+    std::vector<intersect_record> hits(count);
+    std::vector<int> which(count);
+    std::vector<ray> in(count);
+    std::vector<const texture*> lookups(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        auto& rec = hits[k];
+        rec.p = point3::random(-10, 10);
+        rec.normal = randomSample_unit_vector_normalize();
+        rec.front_face = true;
+        which[k] = random_int(0, static_cast<int>(ids.size()) - 1);
+        rec.mat = ids[which[k]];
+        rec.u = random_double();
+        rec.v = random_double();
+        in[k] = ray(point3(0, 0, 0), rec.p);
+        lookups[k] = textures[random_int(0, static_cast<int>(textures.size()) - 1)].get();
+    }
+
+    // what shading does at a hit: scatter, and add what it emits
+    double sink = 0;
+    auto shade_heap = [&](const std::vector<intersect_record>& at, const std::vector<ray>& from, const std::vector<int>& m)
+    {
+        for (size_t k = 0; k < count; ++k)
+        {
+            const auto& rec = at[k];
+            ray out;
+            color albedo;
+            double pdf;
+            if (heap[m[k]]->scatter(rec, from[k], out, albedo, pdf))
+                sink += albedo.x() + pdf;
+            sink += heap[m[k]]->emitted(rec, rec.u, rec.v, rec.p).x();
+        }
+    };
+    auto shade_table = [&](const std::vector<intersect_record>& at, const std::vector<ray>& from)
+    {
+        for (size_t k = 0; k < count; ++k)
+        {
+            const auto& rec = at[k];
+            ray out;
+            color albedo;
+            double pdf;
+            if (material_scatter(rec.mat, rec, from[k], out, albedo, pdf))
+                sink += albedo.x() + pdf;
+            sink += material_emitted(rec.mat, rec, from[k], rec.u, rec.v, rec.p).x();
+        }
+    };
+
+    // the same hits sorted by material, as a renderer that sorts its rays before shading has them
+    std::vector<size_t> order(count);
+    for (size_t k = 0; k < count; ++k)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return which[a] < which[b]; });
+    std::vector<intersect_record> sorted_hits(count);
+    std::vector<ray> sorted_in(count);
+    std::vector<int> sorted_which(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        sorted_hits[k] = hits[order[k]];
+        sorted_in[k] = in[order[k]];
+        sorted_which[k] = which[order[k]];
+    }
+
+    auto heap_rate = best_rate(count, [&]() { shade_heap(hits, in, which); });
+    auto table_rate = best_rate(count, [&]() { shade_table(hits, in); });
+    auto heap_sorted_rate = best_rate(count, [&]() { shade_heap(sorted_hits, sorted_in, sorted_which); });
+    auto table_sorted_rate = best_rate(count, [&]() { shade_table(sorted_hits, sorted_in); });
+
+    auto virtual_rate = best_rate(count, [&]()
+    {
+        for (size_t k = 0; k < count; ++k)
+            sink += lookups[k]->get_value(hits[k].u, hits[k].v, hits[k].p).y();
+    });
+    auto static_rate = best_rate(count, [&]()
+    {
+        for (size_t k = 0; k < count; ++k)
+            sink += texture_value(*lookups[k], hits[k].u, hits[k].v, hits[k].p).y();
+    });
+
+    std::cout << "shading, " << ids.size() << " materials mixed at random (" << material_table::global().memory_bytes() / ids.size()
+              << " bytes a row, " << sizeof(heap_lambertian) + sizeof(solid_color) << " for a heap lambertian and its color):\n";
+    std::cout << "  heap objects, virtual calls:   " << heap_rate << " M shades/s, " << heap_sorted_rate << " sorted by material\n";
+    std::cout << "  material_table rows, switch:   " << table_rate << " M shades/s, " << table_sorted_rate << " sorted by material\n";
+    std::cout << "textures, " << textures.size() << " mixed at random:\n";
+    std::cout << "  virtual calls:                 " << virtual_rate << " M lookups/s\n";
+    std::cout << "  texture_value:                 " << static_rate << " M lookups/s (checksum " << sink << ")\n";
+}
+
+int main()
+{
+    geometry("random_spheres", random_spheres);
+    geometry("cornell_box", cornell_box);
+    shading();
+    return 0;
+}
@@ -0,0 +1,225 @@
+// Benchmark of the grid accelerator (src/uniform_grid.h) against the BVH (src/bvh.h):
+//  - the geometry of the shipped scenes, every sphere, quad and box as its own object
+//    (as the scenes were before the primitive pools), so the top-level structure does all the work,
+//  - camera rays through each scene's view and one diffuse bounce from every hit,
+//  - build time, rays per second (best of three passes) and a check that all three find the same hits.
+// Media and textures don't change the geometry and are left out.
+
+#include "../src/utility.h"
+#include "../src/vector.h"
+#include "../src/ray.h"
+#include "../src/interval.h"
+#include "../src/object.h"
+#include "../src/scene.h"
+#include "../src/sphere.h"
+#include "../src/quad.h"
+#include "../src/cuboid.h"
+#include "../src/bvh.h"
+#include "../src/uniform_grid.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+struct view
+{
+    point3 lookfrom, lookat;
+    double vfov, aspect_ratio;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static shared_ptr<material> no_material;
+
+static void random_spheres(scene& world, view& v)
+{
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, no_material));
+    for (int a = -11; a < 11; a++)
+        for (int b = -11; b < 11; b++)
+        {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                if (choose_mat < 0.8)
+                    world.add(make_shared<sphere>(center, center + vec3(0, random_double(0,.5), 0), 0.2, no_material));
+                else
+                    world.add(make_shared<sphere>(center, 0.2, no_material));
+            }
+        }
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, no_material));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, no_material));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, no_material));
+
+    v = { point3(13,2,3), point3(0,0,0), 20, 16.0 / 9.0 };
+}
+
+static void cornell_walls(scene& world)
+{
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), no_material));
+    world.add(make_shared<quad>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), no_material));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), no_material));
+}
+
+static void cornell_box(scene& world, view& v)
+{
+    cornell_walls(world);
+    world.add(make_shared<quad>(point3(213,554,227), vec3(130,0,0), vec3(0,0,105), no_material));
+
+    auto box1 = box(point3(0,0,0), point3(165,330,165), no_material);
+    box1->rotate(15.0, 1);
+    box1->translate(vec3(265,0,295));
+    auto box2 = box(point3(0,0,0), point3(165,165,165), no_material);
+    box2->rotate(-18.0, 1);
+    box2->translate(vec3(130,0,65));
+    world.add(box1);
+    world.add(box2);
+
+    v = { point3(278, 278, -800), point3(278, 278, 0), 40, 1.0 };
+}
+
+static void many_lights(scene& world, view& v)
+{
+    for (int i = 0; i < 20; ++i)
+        for (int j = 0; j < 20; ++j)
+            world.add(make_shared<quad>(point3(20 + i * 26, 554, 20 + j * 26), vec3(8,0,0), vec3(0,0,8), no_material));
+    cornell_walls(world);
+    world.add(make_shared<sphere>(point3(190,90,190), 90, no_material));
+    world.add(make_shared<sphere>(point3(380,120,330), 120, no_material));
+
+    v = { point3(278, 278, -800), point3(278, 278, 0), 40, 1.0 };
+}
+
+static void final_scene(scene& world, view& v)
+{
+    for (int i = 0; i < 20; i++)
+        for (int j = 0; j < 20; j++)
+        {
+            auto x0 = -1000.0 + i*100.0, z0 = -1000.0 + j*100.0;
+            world.add(box(point3(x0,0,z0), point3(x0 + 100,random_double(1,101),z0 + 100), no_material));
+        }
+
+    world.add(make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), no_material));
+    world.add(make_shared<sphere>(point3(400, 400, 200), point3(430, 400, 200), 50, no_material));
+    world.add(make_shared<sphere>(point3(260, 150, 45), 50, no_material));
+    world.add(make_shared<sphere>(point3(0, 150, 145), 50, no_material));
+    world.add(make_shared<sphere>(point3(360,150,145), 70, no_material));
+    world.add(make_shared<sphere>(point3(400,200,400), 100, no_material));
+    world.add(make_shared<sphere>(point3(220,280,300), 80, no_material));
+
+    for (int j = 0; j < 1000; j++)
+    {
+        auto s = make_shared<sphere>(point3::random(0,165), 10, no_material);
+        s->rotate(15.0, 1);
+        s->translate(vec3(-100, 270, 395));
+        world.add(s);
+    }
+
+    v = { point3(478, 278, -600), point3(278, 278, 0), 40, 1.0 };
+}
+
+// camera rays through the view, then one bounce from every hit the reference finds
+static std::vector<ray> make_rays(const object& reference, const view& v, int width)
+{
+    auto height = static_cast<int>(width / v.aspect_ratio);
+    auto w = unit_vector(v.lookfrom - v.lookat);
+    auto u = unit_vector(cross(vec3(0,1,0), w));
+    auto up = cross(w, u);
+    auto half_height = tan(degrees_to_radians(v.vfov) / 2);
+    auto half_width = half_height * v.aspect_ratio;
+
+    std::vector<ray> rays;
+    for (int j = 0; j < height; ++j)
+        for (int i = 0; i < width; ++i)
+        {
+            auto s = (2 * (i + random_double()) / width - 1) * half_width;
+            auto t = (1 - 2 * (j + random_double()) / height) * half_height;
+            rays.emplace_back(v.lookfrom, s * u + t * up - w, random_double());
+        }
+
+    auto camera_rays = rays.size();
+    for (size_t k = 0; k < camera_rays; ++k)
+    {
+        intersect_record rec;
+        if (reference.intersect(rays[k], interval(0.001, infinity), rec))
+            rays.emplace_back(rec.p, rec.normal + randomSample_unit_vector_normalize(), rays[k].time());
+    }
+    return rays;
+}
+
+static void run(const std::string& name, const std::function<void(scene&, view&)>& make_scene)
+{
+    scene world;
+    view v;
+    make_scene(world, v);
+
+    auto start = std::chrono::steady_clock::now();
+    bvh_node bvh(world);
+    auto bvh_build = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uniform_grid grid(world);
+    auto grid_build = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uniform_grid two_level(world, true);
+    auto two_level_build = seconds_since(start);
+
+    auto rays = make_rays(bvh, v, 400);
+
+    std::vector<double> reference(rays.size());
+    // best of three passes, the first one also checks the hits
+    auto measure = [&](const object& accel, bool record)
+    {
+        long mismatches = 0;
+        double best = 0;
+        for (int pass = 0; pass < 3; ++pass)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t k = 0; k < rays.size(); ++k)
+            {
+                intersect_record rec;
+                auto t = accel.intersect(rays[k], interval(0.001, infinity), rec) ? rec.t : infinity;
+                if (pass > 0)
+                    continue;
+                if (record)
+                    reference[k] = t;
+                else if (t != reference[k] && fabs(t - reference[k]) > 1e-9 * fabs(reference[k]))
+                    ++mismatches;
+            }
+            best = fmax(best, rays.size() / seconds_since(begin) / 1e6);
+        }
+        return std::make_pair(best, mismatches);
+    };
+
+    auto bvh_rate = measure(bvh, true);
+    auto grid_rate = measure(grid, false);
+    auto two_level_rate = measure(two_level, false);
+
+    std::cout << name << ": " << world.objects.size() << " objects, " << rays.size() << " rays\n";
+    std::cout << "  bvh_node:            " << bvh_rate.first << " Mrays/s, built in " << bvh_build * 1e3 << " ms\n";
+    std::cout << "  uniform grid:        " << grid_rate.first << " Mrays/s, built in " << grid_build * 1e3 << " ms, "
+              << grid.cells(0) << "x" << grid.cells(1) << "x" << grid.cells(2) << " cells, "
+              << grid.memory_bytes() / 1024.0 << " KB, " << grid_rate.second << " hits differ\n";
+    std::cout << "  two-level grid:      " << two_level_rate.first << " Mrays/s, built in " << two_level_build * 1e3 << " ms, "
+              << two_level.cells(0) << "x" << two_level.cells(1) << "x" << two_level.cells(2) << " cells, "
+              << two_level.subgrid_count() << " subgrids, " << two_level.memory_bytes() / 1024.0 << " KB, "
+              << two_level_rate.second << " hits differ\n";
+}
+
+int main()
+{
+    run("random_spheres", random_spheres);
+    run("cornell_box", cornell_box);
+    run("many_lights", many_lights);
+    run("final_scene", final_scene);
+    return 0;
+}
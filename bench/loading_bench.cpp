@@ -0,0 +1,147 @@
+// Benchmark of scene loading through the task graph (src/task_graph.h):
+//  - an asset-heavy scene's slow parts: large images decoded with their MIP levels (rtw_image)
+//    and meshes built with their BVHs (triangle_mesh),
+//  - loaded one after the other on the main thread, then as tasks of a graph on every core,
+//  - the time until everything is ready (the render could start), and for the graph the work its
+//    tasks did and their critical path, the time it would take given enough cores.
+// Both runs load the same assets; the checksums show it.
+
+#include "../src/utility.h"
+#include "../src/object.h"
+#include "../src/mesh.h"
+#include "../src/rtw_stb_image.h"
+#include "../src/task_graph.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a binary PPM (stb_image reads those)
+static void write_image(const std::string& name, int size, int seed)
+{
+    auto f = std::fopen(name.c_str(), "wb");
+    std::fprintf(f, "P6\n%d %d\n255\n", size, size);
+    std::vector<unsigned char> row(size * 3);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            row[3 * x]     = static_cast<unsigned char>((x ^ y) + seed * 37);
+            row[3 * x + 1] = static_cast<unsigned char>(((x / 16) + (y / 16)) % 2 ? 200 : 40);
+            row[3 * x + 2] = static_cast<unsigned char>(x * y + seed);
+        }
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+    std::fclose(f);
+}
+
+// a torus of rings x sides quads, moved apart from the others by `offset`
+static shared_ptr<triangle_mesh> make_torus(int rings, int sides, double offset)
+{
+    const double R = 140, r = 55;
+    std::vector<float> positions, normals, uvs;
+    std::vector<uint32_t> indices;
+    for (int i = 0; i <= rings; ++i)
+    {
+        for (int j = 0; j <= sides; ++j)
+        {
+            auto a = 2 * pi * i / rings, b = 2 * pi * j / sides;
+            auto n = vec3(cos(a) * cos(b), sin(b), sin(a) * cos(b));
+            auto p = vec3(R * cos(a) + offset, 0, R * sin(a)) + r * n;
+            for (int k = 0; k < 3; ++k)
+            {
+                positions.push_back(static_cast<float>(p[k]));
+                normals.push_back(static_cast<float>(n[k]));
+            }
+            uvs.push_back(static_cast<float>(i) / rings);
+            uvs.push_back(static_cast<float>(j) / sides);
+        }
+    }
+    for (int i = 0; i < rings; ++i)
+    {
+        for (int j = 0; j < sides; ++j)
+        {
+            uint32_t v0 = i * (sides + 1) + j, v1 = v0 + sides + 1;
+            indices.insert(indices.end(), { v0, v0 + 1, v1, v1, v0 + 1, v1 + 1 });
+        }
+    }
+    return make_shared<triangle_mesh>(positions, indices, normals, uvs, nullptr);
+}
+
+struct assets
+{
+    std::vector<std::unique_ptr<rtw_image>> images;
+    std::vector<shared_ptr<triangle_mesh>> meshes;
+
+    // what was loaded: a few pixels of every level and the meshes' bounds
+    double checksum() const
+    {
+        double sum = 0;
+        for (const auto& image : images)
+            for (int level = 0; level < image->levels(); ++level)
+                sum += image->pixel_data(image->width(level) / 3, image->height(level) / 2, level)[1];
+        for (const auto& mesh : meshes)
+            sum += mesh->triangle_count() + mesh->get_bbox().x.max;
+        return sum;
+    }
+};
+
+int main()
+{
+    const int image_count = 6, image_size = 2048, mesh_count = 6, rings = 384, sides = 192;
+
+    auto directory = std::filesystem::temp_directory_path() / "rtw_loading_bench";
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> names;
+    for (int i = 0; i < image_count; ++i)
+    {
+        names.push_back((directory / ("image" + std::to_string(i) + ".ppm")).string());
+        write_image(names.back(), image_size, i);
+    }
+
+    std::cout << image_count << " images of " << image_size << "x" << image_size << ", " << mesh_count << " meshes of "
+              << 2 * rings * sides << " triangles, " << hardware_thread_count() << " threads\n";
+
+    // one after the other
+    assets serial;
+    serial.images.resize(image_count);
+    serial.meshes.resize(mesh_count);
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < image_count; ++i)
+        serial.images[i] = std::make_unique<rtw_image>(names[i].c_str());
+    for (int i = 0; i < mesh_count; ++i)
+        serial.meshes[i] = make_torus(rings, sides, 400.0 * i);
+    auto serial_seconds = seconds_since(begin);
+    std::cout << "  serial: ready after " << serial_seconds * 1000 << " ms (checksum " << serial.checksum() << ")\n";
+
+    // as tasks
+    assets parallel;
+    parallel.images.resize(image_count);
+    parallel.meshes.resize(mesh_count);
+    begin = std::chrono::steady_clock::now();
+    {
+        task_graph tasks;
+        for (int i = 0; i < image_count; ++i)
+            tasks.add([&, i]() { parallel.images[i] = std::make_unique<rtw_image>(names[i].c_str()); });
+        for (int i = 0; i < mesh_count; ++i)
+            tasks.add([&, i]() { parallel.meshes[i] = make_torus(rings, sides, 400.0 * i); });
+        tasks.wait_all();
+        auto graph_seconds = seconds_since(begin);
+        std::cout << "  graph:  ready after " << graph_seconds * 1000 << " ms, " << serial_seconds / graph_seconds
+                  << "x (checksum " << parallel.checksum() << ")\n  ";
+        tasks.report(std::cout);
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Benchmark of the geometry types in float against double (src/vector.h, ray.h, interval.h, bbox.h):
+//  - the size of a vec3, ray and bbox and of a scene's worth of them,
+//  - three kernels of the renderer's inner loops, each compiled for both scalars:
+//    ray against box slabs (the BVH), ray against spheres, and normalizing/crossing vectors (shading),
+//  - millions of operations per second (best of three passes) and how many float results differ
+//    from double ones, with the same random inputs.
+// The renderer itself builds in float with `xmake f --float32=y`; this compares the math in one binary.
+
+#include "../src/utility.h"
+#include "../src/vector.h"
+#include "../src/ray.h"
+#include "../src/interval.h"
+#include "../src/bbox.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// inputs in double, converted once per precision
+struct workload
+{
+    std::vector<vec3> origins, directions;
+    std::vector<vec3> lo, hi;             // boxes
+    std::vector<vec3> centers;            // spheres
+    std::vector<double> radii;
+};
+
+template <typename T>
+struct kernels
+{
+    std::vector<basic_ray<T>> rays;
+    std::vector<basic_bbox<T>> boxes;
+    std::vector<basic_vec3<T>> centers;
+    std::vector<T> radii;
+
+    explicit kernels(const workload& w)
+    {
+        for (size_t i = 0; i < w.origins.size(); ++i)
+            rays.emplace_back(basic_vec3<T>(w.origins[i]), basic_vec3<T>(w.directions[i]), 0);
+        for (size_t i = 0; i < w.lo.size(); ++i)
+            boxes.emplace_back(basic_vec3<T>(w.lo[i]), basic_vec3<T>(w.hi[i]));
+        for (size_t i = 0; i < w.centers.size(); ++i)
+        {
+            centers.emplace_back(w.centers[i]);
+            radii.push_back(static_cast<T>(w.radii[i]));
+        }
+    }
+
+    size_t memory_bytes() const
+    {
+        return rays.size() * sizeof(basic_ray<T>) + boxes.size() * sizeof(basic_bbox<T>)
+             + centers.size() * sizeof(basic_vec3<T>) + radii.size() * sizeof(T);
+    }
+
+    // every ray against a stretch of boxes; out: hit or not per pair
+    void slabs(std::vector<char>& out) const
+    {
+        const size_t per_ray = 64;
+        for (size_t i = 0; i < rays.size(); ++i)
+            for (size_t k = 0; k < per_ray; ++k)
+                out[i * per_ray + k] = boxes[(i + k) % boxes.size()].intersect(rays[i], basic_interval<T>(0, infinity));
+    }
+
+    // nearest sphere root per pair, infinity for a miss
+    void spheres(std::vector<double>& out) const
+    {
+        const size_t per_ray = 64;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            const auto& r = rays[i];
+            auto a = r.direction().length_squared();
+            for (size_t k = 0; k < per_ray; ++k)
+            {
+                auto s = (i + k) % centers.size();
+                auto oc = r.origin() - centers[s];
+                auto half_b = dot(oc, r.direction());
+                auto c = oc.length_squared() - radii[s] * radii[s];
+                auto discriminant = half_b * half_b - a * c;
+                T t = infinity;
+                if (discriminant >= 0)
+                {
+                    auto sqrtd = sqrt(discriminant);
+                    t = (-half_b - sqrtd) / a;
+                    if (t <= 0)
+                        t = (-half_b + sqrtd) / a;
+                    if (t <= 0)
+                        t = infinity;
+                }
+                out[i * per_ray + k] = t;
+            }
+        }
+    }
+
+    // a frame from every direction, the kind of work shading does per hit
+    void frames(std::vector<double>& out) const
+    {
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            auto w = unit_vector(rays[i].direction());
+            auto a = fabs(w.x()) > 0.9 ? basic_vec3<T>(0, 1, 0) : basic_vec3<T>(1, 0, 0);
+            auto v = unit_vector(cross(w, a));
+            auto u = cross(w, v);
+            out[i] = dot(u + v, rays[i].origin());
+        }
+    }
+};
+
+template <typename T, typename Kernel, typename Out>
+static double rate(const kernels<T>& k, Kernel kernel, Out& out, size_t operations)
+{
+    double best = 0;
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        (k.*kernel)(out);
+        best = fmax(best, operations / seconds_since(begin) / 1e6);
+    }
+    return best;
+}
+
+int main()
+{
+    const size_t ray_count = 200000, object_count = 100000, per_ray = 64;
+
+    // scene-sized coordinates (the final scene spans about 2000 units)
+    workload w;
+    for (size_t i = 0; i < ray_count; ++i)
+    {
+        w.origins.push_back(vec3::random(-1000, 1000));
+        w.directions.push_back(randomSample_unit_vector_normalize());
+    }
+    for (size_t i = 0; i < object_count; ++i)
+    {
+        auto p = vec3::random(-1000, 1000);
+        auto size = vec3::random(1, 200);
+        w.lo.push_back(p);
+        w.hi.push_back(p + size);
+        w.centers.push_back(p);
+        w.radii.push_back(random_double(1, 200));
+    }
+
+    kernels<float> f(w);
+    kernels<double> d(w);
+
+    std::cout << "sizes (float / double bytes): vec3 " << sizeof(basic_vec3<float>) << " / " << sizeof(basic_vec3<double>)
+              << ", ray " << sizeof(basic_ray<float>) << " / " << sizeof(basic_ray<double>)
+              << ", bbox " << sizeof(basic_bbox<float>) << " / " << sizeof(basic_bbox<double>) << "\n";
+    std::cout << "workload: " << ray_count << " rays, " << object_count << " boxes and spheres, "
+              << f.memory_bytes() / (1024.0 * 1024.0) << " MB in float, "
+              << d.memory_bytes() / (1024.0 * 1024.0) << " MB in double\n";
+
+    auto pairs = ray_count * per_ray;
+
+    std::vector<char> hit_f(pairs), hit_d(pairs);
+    auto slab_f = rate(f, &kernels<float>::slabs, hit_f, pairs);
+    auto slab_d = rate(d, &kernels<double>::slabs, hit_d, pairs);
+    long slab_differ = 0;
+    for (size_t i = 0; i < pairs; ++i)
+        slab_differ += hit_f[i] != hit_d[i];
+
+    std::vector<double> t_f(pairs), t_d(pairs);
+    auto sphere_f = rate(f, &kernels<float>::spheres, t_f, pairs);
+    auto sphere_d = rate(d, &kernels<double>::spheres, t_d, pairs);
+    long sphere_differ = 0;
+    double worst = 0;
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        if ((t_f[i] == infinity) != (t_d[i] == infinity))
+            ++sphere_differ;
+        else if (t_d[i] != infinity)
+            worst = fmax(worst, fabs(t_f[i] - t_d[i]));
+    }
+
+    std::vector<double> frame_f(ray_count), frame_d(ray_count);
+    auto frame_rate_f = rate(f, &kernels<float>::frames, frame_f, ray_count);
+    auto frame_rate_d = rate(d, &kernels<double>::frames, frame_d, ray_count);
+
+    std::cout << "ray/box slabs:  float " << slab_f << " M/s, double " << slab_d << " M/s, "
+              << slab_differ << " of " << pairs << " hits differ\n";
+    std::cout << "ray/sphere:     float " << sphere_f << " M/s, double " << sphere_d << " M/s, "
+              << sphere_differ << " hits differ, largest t difference " << worst << "\n";
+    std::cout << "shading frames: float " << frame_rate_f << " M/s, double " << frame_rate_d << " M/s\n";
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Benchmark of the tiled texture cache (src/texture_cache.h) against images decoded whole (rtw_image):
+//  - a set of large images written to a temporary directory, converted to tiles once (timed) and
+//    opened again from the tiled files,
+//  - a render-like workload: the screen split into regions, each showing one image at its own scale
+//    (some magnified, most minified), trilinear lookups at every sample, rows in parallel,
+//  - lookups per second, the memory the images take, and for the cache the tiles read and its peak
+//    under a budget that holds everything and under one smaller than what the workload touches.
+// Every run returns the same pixels; the checksums show it.
+
+#include "../src/utility.h"
+#include "../src/parallel.h"
+#include "../src/texture_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a binary PPM (stb_image reads those) with a pattern that doesn't compress to nothing
+static void write_image(const std::string& name, int size, int seed)
+{
+    auto f = std::fopen(name.c_str(), "wb");
+    std::fprintf(f, "P6\n%d %d\n255\n", size, size);
+    std::vector<unsigned char> row(size * 3);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            row[3 * x]     = static_cast<unsigned char>((x ^ y) + seed * 37);
+            row[3 * x + 1] = static_cast<unsigned char>(((x / 16) + (y / 16)) % 2 ? 200 : 40);
+            row[3 * x + 2] = static_cast<unsigned char>(random_int(0, 255));
+        }
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+    std::fclose(f);
+}
+
+// trilinear lookup as image_texture does it, on either kind of image
+template <typename Image>
+static double sample(const Image& image, double u, double v, double lod)
+{
+    auto bilinear = [&](int level)
+    {
+        auto x = u * image.width(level) - 0.5, y = v * image.height(level) - 0.5;
+        auto x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        auto fx = x - x0, fy = y - y0;
+        unsigned char block[12];
+        image.pixel_block(x0, y0, level, block);
+        auto texel = [&](int k) { return block[3 * k] + block[3 * k + 1] + block[3 * k + 2]; };
+        return (1 - fy) * ((1 - fx) * texel(0) + fx * texel(1)) + fy * ((1 - fx) * texel(2) + fx * texel(3));
+    };
+
+    auto top = image.levels() - 1;
+    if (lod >= top)
+        return bilinear(top);
+    auto level = static_cast<int>(lod);
+    auto blend = lod - level;
+    return (1 - blend) * bilinear(level) + blend * bilinear(level + 1);
+}
+
+// screen regions of 256 x 256 pixels, region k showing image k % count at scale 2^(k % 5 - 1)
+template <typename Image>
+static double render(const std::vector<const Image*>& images, int screen, int spp, double& checksum)
+{
+    const int region = 256;
+    std::vector<double> row_sum(screen, 0.0);
+
+    auto begin = std::chrono::steady_clock::now();
+    parallel_for(screen, [&](int y, int)
+    {
+        for (int x = 0; x < screen; ++x)
+        {
+            auto k = (y / region) * (screen / region) + x / region;
+            const auto& image = *images[k % images.size()];
+            auto scale = ldexp(1.0, k % 5 - 1);            // image widths per region
+            auto texels = scale * image.width() / region;  // per pixel
+            auto lod = texels > 1 ? log2(texels) : 0.0;
+            for (int s = 0; s < spp; ++s)
+            {
+                // samples at fixed offsets, so every run looks up the same points
+                auto px = x % region + (s % 4 + 0.5) / 4, py = y % region + (s / 4 + 0.5) / 4;
+                auto u = fmod(px / region * scale, 1.0), v = fmod(py / region * scale, 1.0);
+                row_sum[y] += sample(image, u, v, lod);
+            }
+        }
+    });
+    auto seconds = seconds_since(begin);
+
+    checksum = 0;
+    for (auto s : row_sum)
+        checksum += s;
+    return static_cast<double>(screen) * screen * spp / seconds / 1e6;
+}
+
+int main()
+{
+    const int image_count = 8, image_size = 2048, screen = 1024, spp = 16;
+
+    auto directory = std::filesystem::temp_directory_path() / "rtw_texture_cache_bench";
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> names;
+    for (int i = 0; i < image_count; ++i)
+    {
+        names.push_back((directory / ("image" + std::to_string(i) + ".ppm")).string());
+        write_image(names.back(), image_size, i);
+    }
+    auto tiles = (directory / "tiles").string();
+#if defined(_MSC_VER)
+    _putenv_s("RTW_TEXTURE_CACHE", tiles.c_str());
+#else
+    setenv("RTW_TEXTURE_CACHE", tiles.c_str(), 1);
+#endif
+    std::filesystem::remove_all(directory / "tiles");
+
+    // whole images in memory, as rtw_image keeps them
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<rtw_image>> decoded;
+    std::vector<const rtw_image*> decoded_views;
+    size_t decoded_bytes = 0;
+    for (const auto& name : names)
+    {
+        decoded.push_back(std::make_unique<rtw_image>(name.c_str()));
+        decoded_views.push_back(decoded.back().get());
+        for (int level = 0; level < decoded.back()->levels(); ++level)
+            decoded_bytes += static_cast<size_t>(decoded.back()->width(level)) * decoded.back()->height(level) * 3;
+    }
+    auto decode_seconds = seconds_since(begin);
+
+    // tiled: converted on the first open, read from the tiled files after that
+    begin = std::chrono::steady_clock::now();
+    {
+        std::vector<std::shared_ptr<const tiled_image>> first;
+        for (const auto& name : names)
+            first.push_back(tiled_image::open(name.c_str()));
+    }
+    auto convert_seconds = seconds_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<const tiled_image>> tiled;
+    std::vector<const tiled_image*> tiled_views;
+    for (const auto& name : names)
+    {
+        tiled.push_back(tiled_image::open(name.c_str()));
+        tiled_views.push_back(tiled.back().get());
+    }
+    auto reopen_seconds = seconds_since(begin);
+
+    std::cout << image_count << " images of " << image_size << "x" << image_size << ", "
+              << decoded_bytes / (1024.0 * 1024.0) << " MB with their MIP levels\n";
+    std::cout << "  load: decode " << decode_seconds << " s, decode and write tiles " << convert_seconds
+              << " s, open tiled files " << reopen_seconds << " s\n";
+    std::cout << "workload: " << screen << "x" << screen << " pixels, " << spp << " trilinear lookups each, "
+              << hardware_thread_count() << " threads\n";
+
+    double checksum;
+    auto rate = render(decoded_views, screen, spp, checksum);
+    std::cout << "  decoded whole:           " << rate << " M lookups/s, " << decoded_bytes / (1024.0 * 1024.0)
+              << " MB resident (checksum " << checksum << ")\n";
+
+    auto& cache = texture_cache::global();
+    for (size_t budget_mb : { 1024, 1 })
+    {
+        cache.set_budget(budget_mb * 1024 * 1024);
+        cache.reset();
+        rate = render(tiled_views, screen, spp, checksum);
+        std::cout << "  tiled, " << budget_mb << " MB budget:" << (budget_mb < 100 ? "   " : " ") << rate << " M lookups/s, "
+                  << cache.peak_bytes() / (1024.0 * 1024.0) << " MB peak, " << cache.tiles_read() << " tiles read, "
+                  << cache.tiles_evicted() << " evicted (checksum " << checksum << ")\n";
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Benchmark of the compressed texel formats (src/texture_formats.h) in the tiled texture cache:
+//  - one image (a 2048x2048 test pattern, or the file given on the command line) converted to tiles
+//    in each format: RGB8, BC1 and BC7 (mode 6),
+//  - trilinear lookups over the screen as texture_cache_bench does them: lookups per second, the
+//    nanoseconds a lookup costs over RGB8 (the decoding), the tiles' memory at the cache's peak,
+//  - the error of each format against the image (PSNR of the full-size level),
+//  - half floats for HDR texels: memory against floats, the largest relative error, and the
+//    conversion rate with F16C against the scalar code.
+
+#include "../src/utility.h"
+#include "../src/parallel.h"
+#include "../src/texture_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static volatile double sink;
+
+// smooth gradients, hard edges and fine stripes, what photos and painted textures mix
+static void write_pattern(const std::string& name, int size)
+{
+    auto f = std::fopen(name.c_str(), "wb");
+    std::fprintf(f, "P6\n%d %d\n255\n", size, size);
+    std::vector<unsigned char> row(size * 3);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            double u = static_cast<double>(x) / size, v = static_cast<double>(y) / size;
+            double r = 0.5 + 0.5 * sin(6 * u + 2 * v), g = 0.5 + 0.4 * cos(9 * v), b = 0.3 + 0.3 * u * v;
+            if (((x / 64) + (y / 64)) % 2 && (u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5) < 0.1)
+                r *= 0.3, g = 1 - g;
+            if (y % 16 < 2)
+                b += 0.3 * sin(x * 0.2);
+            double c[3] = { r, g, b };
+            for (int k = 0; k < 3; ++k)
+                row[3 * x + k] = static_cast<unsigned char>(255.999 * fmin(fmax(c[k], 0.0), 1.0));
+        }
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+    std::fclose(f);
+}
+
+static double trilinear(const tiled_image& image, double u, double v, double lod)
+{
+    auto bilinear = [&](int level)
+    {
+        auto x = u * image.width(level) - 0.5, y = v * image.height(level) - 0.5;
+        auto x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        auto fx = x - x0, fy = y - y0;
+        unsigned char block[12];
+        image.pixel_block(x0, y0, level, block);
+        auto texel = [&](int k) { return block[3 * k] + block[3 * k + 1] + block[3 * k + 2]; };
+        return (1 - fy) * ((1 - fx) * texel(0) + fx * texel(1)) + fy * ((1 - fx) * texel(2) + fx * texel(3));
+    };
+    auto top = image.levels() - 1;
+    if (lod >= top)
+        return bilinear(top);
+    auto level = static_cast<int>(lod);
+    return (1 - (lod - level)) * bilinear(level) + (lod - level) * bilinear(level + 1);
+}
+
+// a screen of 1024x1024 pixels in regions of 256, each showing the image at its own scale
+static double lookups_per_second(const tiled_image& image)
+{
+    const int screen = 1024, region = 256, spp = 4;
+    double checksum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int y = 0; y < screen; ++y)
+        for (int x = 0; x < screen; ++x)
+        {
+            auto k = (y / region) * (screen / region) + x / region;
+            auto scale = ldexp(1.0, k % 5 - 1);
+            auto texels = scale * image.width() / region;
+            auto lod = texels > 1 ? log2(texels) : 0.0;
+            for (int s = 0; s < spp; ++s)
+            {
+                auto px = x % region + (s % 2 + 0.5) / 2, py = y % region + (s / 2 + 0.5) / 2;
+                checksum += trilinear(image, fmod(px / region * scale, 1.0), fmod(py / region * scale, 1.0), lod);
+            }
+        }
+    sink = checksum;
+    return static_cast<double>(screen) * screen * spp / seconds_since(begin) / 1e6;
+}
+
+static double psnr(const tiled_image& image, const rtw_image& original)
+{
+    double squared = 0;
+    for (int y = 0; y < original.height(); ++y)
+        for (int x = 0; x < original.width(); ++x)
+        {
+            auto a = image.pixel_data(x, y, 0);
+            auto b = original.pixel_data(x, y);
+            unsigned char p[3] = { a[0], a[1], a[2] };   // a is good until the next lookup
+            for (int c = 0; c < 3; ++c)
+                squared += (p[c] - b[c]) * (p[c] - b[c]);
+        }
+    auto mse = squared / (3.0 * original.width() * original.height());
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+static void set_env(const char* name, const std::string& value)
+{
+#if defined(_MSC_VER)
+    _putenv_s(name, value.c_str());
+#else
+    setenv(name, value.c_str(), 1);
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    auto directory = std::filesystem::temp_directory_path() / "rtw_texture_format_bench";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    set_env("RTW_TEXTURE_CACHE", (directory / "tiles").string());
+
+    std::string name = argc > 1 ? argv[1] : (directory / "pattern.ppm").string();
+    if (argc <= 1)
+        write_pattern(name, 2048);
+    rtw_image original(name.c_str());
+    if (original.width() == 0)
+        return 1;
+    std::cout << name << ": " << original.width() << "x" << original.height() << "\n";
+
+    auto& cache = texture_cache::global();
+    double rgb8_ns = 0;
+    for (const char* format : { "rgb8", "bc1", "bc7" })
+    {
+        set_env("RTW_TEXTURE_FORMAT", format);
+        auto begin = std::chrono::steady_clock::now();
+        auto image = tiled_image::open(name.c_str());
+        auto convert_seconds = seconds_since(begin);
+
+        cache.reset();
+        auto rate = lookups_per_second(*image);
+        auto peak = cache.peak_bytes();
+        auto ns = 1000 / rate;
+        if (image->format() == texel_format::rgb8)
+            rgb8_ns = ns;
+
+        std::cout << "  " << texel_format_name(image->format()) << ":" << std::string(9 - std::string(texel_format_name(image->format())).size(), ' ')
+                  << rate << " M lookups/s (" << ns << " ns, +" << ns - rgb8_ns << " to decode), "
+                  << peak / (1024.0 * 1024.0) << " MB of tiles, PSNR " << psnr(*image, original) << " dB, converted in "
+                  << convert_seconds << " s\n";
+    }
+
+    // HDR texels: a float image with values up to 64
+    const int hdr_size = 1024;
+    std::vector<float> hdr(static_cast<size_t>(hdr_size) * hdr_size * 3);
+    for (size_t i = 0; i < hdr.size(); ++i)
+        hdr[i] = static_cast<float>(exp2(6 * random_double()) * random_double());
+    rtw_hdr_image half;
+    half.load_pixels(hdr_size, hdr_size, hdr.data());
+    double largest = 0;
+    for (size_t i = 0; i < hdr.size(); ++i)
+        largest = fmax(largest, fabs(half_to_float(float_to_half(hdr[i])) - hdr[i]) / fmax(hdr[i], 1e-3));
+    std::cout << "half floats: " << half.memory_bytes() / (1024.0 * 1024.0) << " MB with MIP levels against "
+              << 2 * half.memory_bytes() / (1024.0 * 1024.0) << " as floats, largest relative error " << largest << "\n";
+
+    std::vector<uint16_t> halves(hdr.size() - hdr.size() % 4);
+    for (size_t i = 0; i < halves.size(); ++i)
+        halves[i] = float_to_half(hdr[i]);
+    std::vector<float> out(halves.size());
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < 8; ++round)
+        for (size_t i = 0; i < halves.size(); ++i)
+            out[i] = half_to_float(halves[i]);
+    sink = out[out.size() / 2];
+    auto scalar_rate = 8.0 * halves.size() / seconds_since(begin) / 1e6;
+    begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < 8; ++round)
+        for (size_t i = 0; i < halves.size(); i += 12)
+            halves_to_floats(halves.data() + i, out.data() + i, 12);
+    sink = out[out.size() / 2];
+    auto batch_rate = 8.0 * halves.size() / seconds_since(begin) / 1e6;
+    std::cout << "  converted 12 at a time (a bilinear footprint), " << simd_level_name(active_simd_level()) << ": "
+              << batch_rate << " M halves/s, scalar: " << scalar_rate << " M halves/s\n";
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
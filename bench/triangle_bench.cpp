@@ -0,0 +1,213 @@
+// Microbenchmark of the ray-triangle leaf kernel (src/triangle_packet.h):
+//  - throughput: triangles tested per second, scalar Moeller-Trumbore (double) against each
+//    build of the packet kernel, one ray against a few thousand triangles that stay in cache,
+//  - watertightness: rays from inside a closed mesh aimed exactly at its vertices and edge
+//    midpoints, which is where a non-watertight test lets rays escape.
+
+#include "../src/utility.h"
+#include "../src/vector.h"
+#include "../src/ray.h"
+#include "../src/interval.h"
+#include "../src/triangle_packet.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+
+struct triangle
+{
+    float p[3][3];
+};
+
+static bool moeller_trumbore(const triangle& tri, const ray& r, double t_min, double& t_max)
+{
+    point3 p0(tri.p[0][0], tri.p[0][1], tri.p[0][2]);
+    point3 p1(tri.p[1][0], tri.p[1][1], tri.p[1][2]);
+    point3 p2(tri.p[2][0], tri.p[2][1], tri.p[2][2]);
+    auto e1 = p1 - p0;
+    auto e2 = p2 - p0;
+
+    auto pvec = cross(r.direction(), e2);
+    auto det = dot(e1, pvec);
+    if (fabs(det) < 1e-12)
+        return false;
+    auto inv_det = 1 / det;
+
+    auto tvec = r.origin() - p0;
+    auto b1 = dot(tvec, pvec) * inv_det;
+    if (b1 < 0 || b1 > 1)
+        return false;
+
+    auto qvec = cross(tvec, e1);
+    auto b2 = dot(r.direction(), qvec) * inv_det;
+    if (b2 < 0 || b1 + b2 > 1)
+        return false;
+
+    auto t = dot(e2, qvec) * inv_det;
+    if (t <= t_min || t >= t_max)
+        return false;
+
+    t_max = t;
+    return true;
+}
+
+static std::vector<triangle_packet> pack(const std::vector<triangle>& tris)
+{
+    std::vector<triangle_packet> packets((tris.size() + triangle_packet::width - 1) / triangle_packet::width);
+    for (size_t i = 0; i < tris.size(); ++i)
+        packets[i / triangle_packet::width].set(i % triangle_packet::width, tris[i].p[0], tris[i].p[1], tris[i].p[2],
+                                                static_cast<uint32_t>(i));
+    return packets;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void throughput()
+{
+    // small random triangles in a unit cube, rays through the cube
+    const int triangle_count = 4096;
+    const int ray_count = 20000;
+
+    std::vector<triangle> tris(triangle_count);
+    for (auto& t : tris)
+    {
+        auto c = vec3::random(0, 1);
+        for (int i = 0; i < 3; ++i)
+        {
+            auto p = c + 0.05 * vec3::random(-1, 1);
+            for (int a = 0; a < 3; ++a)
+                t.p[i][a] = static_cast<float>(p[a]);
+        }
+    }
+    auto packets = pack(tris);
+
+    std::vector<ray> rays(ray_count);
+    for (auto& r : rays)
+    {
+        auto origin = vec3(-1, random_double(), random_double());
+        rays[&r - &rays[0]] = ray(origin, vec3(2, random_double(), random_double()) - origin);
+    }
+
+    long hits_scalar = 0, hits_packet = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+    {
+        double t_max = infinity;
+        bool hit = false;
+        for (const auto& t : tris)
+            hit |= moeller_trumbore(t, r, 0.001, t_max);
+        hits_scalar += hit;
+    }
+    auto scalar_time = seconds_since(start);
+
+    auto packet_rate = [&](intersect_packet_kernel kernel, long& hits)
+    {
+        hits = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (const auto& r : rays)
+        {
+            packet_ray pr(r);
+            float t_max = std::numeric_limits<float>::max(), b1, b2;
+            bool hit = false;
+            for (const auto& p : packets)
+                hit |= kernel(p, pr, 0.001f, t_max, b1, b2) >= 0;
+            hits += hit;
+        }
+        return seconds_since(begin);
+    };
+
+    double tested = static_cast<double>(triangle_count) * ray_count;
+    std::cout << "Scalar Moeller-Trumbore: " << tested / scalar_time / 1e6 << " M triangles/s (" << hits_scalar << " rays hit)\n";
+
+    // every build of the packet kernel this binary has, then the one picked for this CPU
+    auto report = [&](const char* name, intersect_packet_kernel kernel)
+    {
+        auto packet_time = packet_rate(kernel, hits_packet);
+        std::cout << "Packet kernel (" << triangle_packet::width << " wide, " << name << "): " << tested / packet_time / 1e6
+                  << " M triangles/s (" << hits_packet << " rays hit), " << scalar_time / packet_time << "x\n";
+    };
+    report("baseline", intersect_packet_baseline);
+#if defined(RT_SIMD_DISPATCH)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        report("AVX2", intersect_packet_avx2);
+#endif
+    std::cout << "Dispatch picks the " << simd_level_name(active_simd_level()) << " build\n";
+}
+
+static void watertightness()
+{
+    // a closed latitude-longitude sphere, rays from an off-centre inside point
+    // aimed at every vertex and every edge midpoint: all of them must hit.
+    const int rings = 64, sides = 128;
+    std::vector<vec3> vertices;
+    for (int i = 0; i <= rings; ++i)
+        for (int j = 0; j < sides; ++j)
+        {
+            auto a = pi * i / rings, b = 2 * pi * j / sides;
+            vertices.push_back(vec3(static_cast<float>(sin(a) * cos(b)), static_cast<float>(cos(a)), static_cast<float>(sin(a) * sin(b))));
+        }
+
+    std::vector<triangle> tris;
+    auto add = [&](int i0, int i1, int i2)
+    {
+        triangle t;
+        int ids[3] = { i0, i1, i2 };
+        for (int k = 0; k < 3; ++k)
+            for (int a = 0; a < 3; ++a)
+                t.p[k][a] = static_cast<float>(vertices[ids[k]][a]);
+        tris.push_back(t);
+    };
+    for (int i = 0; i < rings; ++i)
+        for (int j = 0; j < sides; ++j)
+        {
+            int v0 = i * sides + j, v1 = i * sides + (j + 1) % sides;
+            int v2 = v0 + sides, v3 = v1 + sides;
+            add(v0, v1, v3);
+            add(v0, v3, v2);
+        }
+    auto packets = pack(tris);
+
+    std::vector<point3> targets = vertices;
+    for (const auto& t : tris)
+        for (int k = 0; k < 3; ++k)
+        {
+            const auto* a = t.p[k];
+            const auto* b = t.p[(k + 1) % 3];
+            targets.push_back(point3(0.5 * (a[0] + b[0]), 0.5 * (a[1] + b[1]), 0.5 * (a[2] + b[2])));
+        }
+
+    auto origin = point3(0.1234, -0.0567, 0.0891);
+    long escaped_scalar = 0, escaped_packet = 0;
+    for (const auto& target : targets)
+    {
+        ray r(origin, target - origin);
+
+        double t_max = infinity;
+        bool hit = false;
+        for (const auto& t : tris)
+            hit |= moeller_trumbore(t, r, 0.001, t_max);
+        escaped_scalar += !hit;
+
+        packet_ray pr(r);
+        float t_max_f = std::numeric_limits<float>::max(), b1, b2;
+        hit = false;
+        for (const auto& p : packets)
+            hit |= intersect_packet(p, pr, 0.001f, t_max_f, b1, b2) >= 0;
+        escaped_packet += !hit;
+    }
+
+    std::cout << "Watertightness, " << targets.size() << " rays at vertices and edges of a closed mesh: "
+              << escaped_scalar << " escape Moeller-Trumbore, " << escaped_packet << " escape the packet kernel\n";
+}
+
+int main()
+{
+    throughput();
+    watertightness();
+    return 0;
+}
@@ -0,0 +1,223 @@
+#ifndef ASSET_REGISTRY_H
+#define ASSET_REGISTRY_H
+
+#include "utility.h"
+#include "object.h"
+#include "texture.h"
+#include "material.h"
+#include "task_graph.h"
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+// Textures and materials interned by what they are, so asking twice for the same one returns the same
+// object instead of a second allocation:
+//  - image textures by the file name asked for, so the file system is searched once per name
+//    (the pixels are shared per file by tiled_image either way),
+//  - solid colors, checkers, noise and the built-in materials by their exact parameters,
+//    textured materials by the identity of their texture,
+//  - materials made from colors by the color, which their material_table row holds: no solid color
+//    texture is made for them.
+// What the registry hands out is shared: it must not be changed after it is made (nothing in the
+// renderer does). Safe to call from several threads.
+
+class asset_registry
+{
+public:
+    static asset_registry& global()
+    {
+        static asset_registry registry;
+        return registry;
+    }
+
+
+    // Textures
+
+    shared_ptr<texture> intern_solid(const color& c)
+    {
+        return intern(textures, key(kind::solid, c.x(), c.y(), c.z()), [&]() { return make_shared<solid_color>(c); });
+    }
+
+    shared_ptr<texture> intern_checker(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+    {
+        return intern(textures, key(kind::checker, scale, 0, 0, 0, even.get(), odd.get()),
+                      [&]() { return make_shared<checker_board>(scale, even, odd); });
+    }
+
+    shared_ptr<texture> intern_checker(double scale, const color& even, const color& odd)
+    {
+        return intern_checker(scale, intern_solid(even), intern_solid(odd));
+    }
+
+    shared_ptr<texture> intern_image(const std::string& filename)
+    {
+        return intern_image(filename, nullptr);
+    }
+
+    // the image loaded by a task of `loads` (see image_texture), when it wasn't asked for before
+    shared_ptr<texture> intern_image(const std::string& filename, task_graph& loads)
+    {
+        return intern_image(filename, &loads);
+    }
+
+    shared_ptr<texture> intern_noise(double scale)
+    {
+        return intern(textures, key(kind::noise, scale), [&]() { return make_shared<noise_texture>(scale); });
+    }
+
+
+    // Materials
+
+    shared_ptr<material> intern_lambertian(const color& albedo)
+    {
+        return intern(materials, key(kind::lambertian, albedo.x(), albedo.y(), albedo.z()), [&]() { return make_shared<lambertian>(albedo); });
+    }
+    shared_ptr<material> intern_lambertian(shared_ptr<texture> tex)
+    {
+        return intern(materials, key(kind::lambertian, 0, 0, 0, 0, tex.get()), [&]() { return make_shared<lambertian>(tex); });
+    }
+
+    shared_ptr<material> intern_metal(const color& albedo, double fuzz)
+    {
+        return intern(materials, key(kind::metal, albedo.x(), albedo.y(), albedo.z(), fuzz),
+                      [&]() { return make_shared<metal>(albedo, fuzz); });
+    }
+
+    shared_ptr<material> intern_conductor(const color& f0, double roughness)
+    {
+        return intern(materials, key(kind::conductor, f0.x(), f0.y(), f0.z(), roughness),
+                      [&]() { return make_shared<conductor>(f0, roughness); });
+    }
+
+    shared_ptr<material> intern_rough_dielectric(double index_of_refraction, double roughness)
+    {
+        return intern(materials, key(kind::rough_dielectric, index_of_refraction, roughness),
+                      [&]() { return make_shared<rough_dielectric>(index_of_refraction, roughness); });
+    }
+
+    shared_ptr<material> intern_dielectric(double index_of_refraction)
+    {
+        return intern(materials, key(kind::dielectric, index_of_refraction),
+                      [&]() { return make_shared<dielectric>(index_of_refraction); });
+    }
+
+    shared_ptr<material> intern_light(const color& emit)
+    {
+        return intern(materials, key(kind::diffuse_light, emit.x(), emit.y(), emit.z()), [&]() { return make_shared<diffuse_light>(emit); });
+    }
+    shared_ptr<material> intern_light(shared_ptr<texture> emit)
+    {
+        return intern(materials, key(kind::diffuse_light, 0, 0, 0, 0, emit.get()), [&]() { return make_shared<diffuse_light>(emit); });
+    }
+
+    shared_ptr<material> intern_isotropic(const color& albedo)
+    {
+        return intern(materials, key(kind::isotropic, albedo.x(), albedo.y(), albedo.z()), [&]() { return make_shared<isotropic>(albedo); });
+    }
+    shared_ptr<material> intern_isotropic(shared_ptr<texture> albedo)
+    {
+        return intern(materials, key(kind::isotropic, 0, 0, 0, 0, albedo.get()), [&]() { return make_shared<isotropic>(albedo); });
+    }
+
+
+    // Report
+
+    size_t request_count() const { std::lock_guard<std::mutex> lock(mutex); return requests; }
+
+    void report(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "Assets: " << requests << " requested, " << requests - reused << " made ("
+            << textures.size() + images.size() << " textures, " << materials.size() << " materials), "
+            << reused << " shared, " << bytes_saved / 1024.0 << " KB not allocated" << std::endl;
+    }
+
+private:
+    enum class kind { solid, checker, noise, lambertian, metal, dielectric, diffuse_light, isotropic, conductor, rough_dielectric };
+
+    // the parameters of a texture or material, compared exactly
+    using key_t = std::tuple<kind, double, double, double, double, const void*, const void*>;
+
+    static key_t key(kind k, double a, double b = 0, double c = 0, double d = 0, const void* p = nullptr, const void* q = nullptr)
+    {
+        return key_t(k, a, b, c, d, p, q);
+    }
+
+    // what make_shared allocates besides the object
+    static const size_t control_block_bytes = 16;
+
+    mutable std::mutex mutex;
+    std::map<key_t, shared_ptr<texture>> textures;
+    std::map<std::string, shared_ptr<texture>> images;
+    std::map<key_t, shared_ptr<material>> materials;
+    size_t requests = 0, reused = 0, bytes_saved = 0;
+
+    shared_ptr<texture> intern_image(const std::string& filename, task_graph* loads)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++requests;
+        auto& t = images[filename];
+        if (t)
+        {
+            ++reused;
+            bytes_saved += sizeof(image_texture) + control_block_bytes;
+            return t;
+        }
+        t = loads ? make_shared<image_texture>(filename.c_str(), *loads) : make_shared<image_texture>(filename.c_str());
+        return t;
+    }
+
+    template <typename T, typename Make>
+    shared_ptr<T> intern(std::map<key_t, shared_ptr<T>>& table, const key_t& k, Make make)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++requests;
+        auto& entry = table[k];
+        if (entry)
+        {
+            ++reused;
+            bytes_saved += allocation_bytes(*entry);
+            return entry;
+        }
+        entry = make();
+        return entry;
+    }
+
+    template <typename T>
+    static size_t allocation_bytes(const T& object)
+    {
+        size_t bytes = control_block_bytes;
+        if constexpr (std::is_same_v<T, texture>)
+        {
+            switch (object.kind)
+            {
+            case texture::kind_t::solid:   bytes += sizeof(solid_color); break;
+            case texture::kind_t::checker: bytes += sizeof(checker_board); break;
+            case texture::kind_t::noise:   bytes += sizeof(noise_texture); break;
+            default:                       bytes += sizeof(texture); break;
+            }
+        }
+        else
+        {
+            switch (object.kind)
+            {
+            case material::kind_t::lambertian:    bytes += sizeof(lambertian); break;
+            case material::kind_t::metal:         bytes += sizeof(metal); break;
+            case material::kind_t::dielectric:    bytes += sizeof(dielectric); break;
+            case material::kind_t::diffuse_light: bytes += sizeof(diffuse_light); break;
+            case material::kind_t::isotropic:     bytes += sizeof(isotropic); break;
+            case material::kind_t::conductor:     bytes += sizeof(conductor); break;
+            case material::kind_t::rough_dielectric: bytes += sizeof(rough_dielectric); break;
+            default:                              bytes += sizeof(material); break;
+            }
+        }
+        return bytes;
+    }
+};
+
+
+#endif //ASSET_REGISTRY_H
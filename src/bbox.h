@@ -3,49 +3,50 @@
 
 #include "utility.h"
 
-class bbox
+template <typename T>
+class basic_bbox
 {
 public:
-    interval x, y, z;  // the axis-aligned "slab"
+    basic_interval<T> x, y, z;  // the axis-aligned "slab"
 
 
     // initialization
 
-    bbox() {};  // default empty bbox
-    bbox(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {}
-    bbox(const point3& p1, const point3& p2)
+    basic_bbox() {};  // default empty bbox
+    basic_bbox(const basic_interval<T>& ix, const basic_interval<T>& iy, const basic_interval<T>& iz) : x(ix), y(iy), z(iz) {}
+    basic_bbox(const basic_vec3<T>& p1, const basic_vec3<T>& p2)
     {
         // two point define a AABB
-        x = interval(fmin(p1[0], p2[0]), fmax(p1[0], p2[0]));
-        y = interval(fmin(p1[1], p2[1]), fmax(p1[1], p2[1]));
-        z = interval(fmin(p1[2], p2[2]), fmax(p1[2], p2[2]));
+        x = basic_interval<T>(fmin(p1[0], p2[0]), fmax(p1[0], p2[0]));
+        y = basic_interval<T>(fmin(p1[1], p2[1]), fmax(p1[1], p2[1]));
+        z = basic_interval<T>(fmin(p1[2], p2[2]), fmax(p1[2], p2[2]));
     }
-    bbox(const bbox& b1, const bbox& b2)
+    basic_bbox(const basic_bbox& b1, const basic_bbox& b2)
     {
-        x = interval(b1.x, b2.x);
-        y = interval(b1.y, b2.y);
-        z = interval(b1.z, b2.z);
+        x = basic_interval<T>(b1.x, b2.x);
+        y = basic_interval<T>(b1.y, b2.y);
+        z = basic_interval<T>(b1.z, b2.z);
     }
 
-    bbox pad() {
+    basic_bbox pad() {
         // Return an AABB that has no side narrower than some delta, padding if necessary.
-        double delta = 0.0001;
-        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
+        T delta = 0.0001;
+        basic_interval<T> new_x = (x.size() >= delta) ? x : x.expand(delta);
+        basic_interval<T> new_y = (y.size() >= delta) ? y : y.expand(delta);
+        basic_interval<T> new_z = (z.size() >= delta) ? z : z.expand(delta);
 
-        return bbox(new_x, new_y, new_z);
+        return basic_bbox(new_x, new_y, new_z);
     }
     
 
     // method
-    const interval& axis(int n) const {
+    const basic_interval<T>& axis(int n) const {
         if (n == 1) return y;
         if (n == 2) return z;
         return x;
     }
 
-    bool intersect(const ray& r, interval t) const
+    bool intersect(const basic_ray<T>& r, basic_interval<T> t) const
     {
         for(int i = 0; i < 3; ++i)
         {
@@ -74,6 +75,7 @@ public:
     }
 };
 
+using bbox = basic_bbox<real>;
 
 
 #endif // BBOX_H
\ No newline at end of file
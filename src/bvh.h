@@ -80,12 +80,43 @@ public:
             return false;
         }
 
-        bool intersect1 = left->intersect(r, t, rec);
-        bool intersect2 = right->intersect(r, interval(t.min, intersect1 ? rec.t : t.max), rec);
+        deferred_hit hit;
+        if (!intersect_deferred(r, t, rec, hit))
+            return false;
+
+        finish_hit(r, hit, rec);
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        if (!boundingBox.intersect(r, t))
+        {
+            return false;
+        }
+
+        bool intersect1 = left->intersect_deferred(r, t, rec, hit);
+        bool intersect2 = right->intersect_deferred(r, interval(t.min, intersect1 ? hit.t : t.max), rec, hit);
         
         return intersect1 || intersect2;
     }
 
+    double transmittance(const ray& r, interval t) const override
+    {
+        if (!boundingBox.intersect(r, t))
+        {
+            return 1;
+        }
+
+        auto tr = left->transmittance(r, t);
+        if (tr <= 0 || left == right)
+        {
+            return tr;
+        }
+
+        return tr * right->transmittance(r, t);
+    }
+
 
 private:
     std::shared_ptr<object> left;
@@ -6,10 +6,17 @@
 #include "color.h"
 #include "object.h"
 #include "material.h"
+#include "asset_registry.h"
 #include "pdf.h"
 #include "quad.h"
+#include "guiding.h"
+#include "photon_map.h"
+#include "parallel.h"
+#include "reservoir.h"
 
 #include <iostream>
+#include <memory>
+#include <vector>
 
 class camera
 {
@@ -32,10 +39,23 @@ class camera
 
         color  background;                // Scene background color
 
+        bool   path_guiding            = false;  // Learn incident radiance in training passes and guide bounces with it
+        int    guiding_training_passes = 5;      // Training passes of 2, 4, 8, ... samples per pixel before the final render
+        double guiding_memory_mb       = 64;     // Upper bound on the memory of the learned SD-tree
+
+        bool   photon_caustics         = false;   // Estimate caustics (light -> specular -> diffuse) from a photon map
+        int    caustic_photons         = 500000;  // Photons emitted from the lights in the pre-pass
+        int    caustic_gather_count    = 50;      // Nearest photons in each radiance estimate
+        double caustic_gather_radius   = 0;       // Search radius bound, 0 picks 2% of the caustics' extent
+
+        int    light_candidates        = 0;       // Light candidates resampled per vertex (RIS), 0 keeps one-sample next-event estimation
+        bool   light_reuse             = false;   // Also merge the light reservoirs of neighbouring pixels of a tile
+        int    light_reuse_neighbors   = 5;       // Neighbours merged into each pixel's reservoir
+
 
         // render
 
-        void render(const object& world, const object& lights)
+        void render(const object& world, const scene& lights)
         {
             // timer
 
@@ -45,36 +65,53 @@ class camera
 
             initialize();
 
-            // output imga
+            // shoot caustic photons before any camera ray needs them
 
-            std::cout << "P3\n" << img_width << ' ' << img_height << "\n255\n";
+            if (photon_caustics)
+            {
+                build_caustic_map(world, lights);
+            }
 
-            for(int j = 0; j < img_height; ++j)
+            // learn where light comes from before the final pass
+
+            if (path_guiding)
             {
-                std::clog << "\rScanlines remaining: " << (img_height - j) << ' ' << std::flush;
-                for (int i = 0; i < img_width; ++i)
-                {
-                    color pixel_color(0, 0, 0);
+                train_guiding(world, lights);
+            }
 
-                    // multi-sampling
+            // render image
 
-                    for(int sample = 0; sample < samples_per_pixel; ++sample)
-                    {
-                        // cast ray
-                        ray r = cast_cay(i, j);  // each casted ray randomly offset from center location
+            std::vector<color> image(img_width * img_height);
+            auto variance = render_pass(world, lights, samples_per_pixel, image);
+            if (path_guiding)
+            {
+                std::clog << "\rFinal pass: " << samples_per_pixel << " spp, variance " << variance << "          " << std::endl;
+            }
 
-                        // trace ray
-                        pixel_color += trace(r, sample_max_depth, world, lights);
-                    }
+            // output imga
 
-                    // write pixel color to image
+            std::cout << "P3\n" << img_width << ' ' << img_height << "\n255\n";
 
-                    pixel_to_image(std::cout, pixel_color, samples_per_pixel);
-                }
+            for (const auto& pixel_color : image)
+            {
+                pixel_to_image(std::cout, pixel_color, samples_per_pixel);
             }
+
             auto end = std::chrono::steady_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(end - start);
             std::clog << "\rDone with " << duration.count() << "s                  " << std::endl;
+            if (asset_registry::global().request_count() > 0)
+            {
+                asset_registry::global().report(std::clog);
+            }
+            if (material_table::global().size() > 0)
+            {
+                material_table::global().report(std::clog);
+            }
+            if (texture_cache::global().tiles_read() > 0)
+            {
+                texture_cache::global().report(std::clog);
+            }
         }
 
 
@@ -88,6 +125,39 @@ class camera
         vec3 u, v, w;
         vec3 defocus_disk_u;
         vec3 defocus_disk_v;
+        double pixel_spread;   // angle one pixel subtends from the camera
+        double primary_spread; // spread of the camera rays' cones in the pass being rendered
+
+        // A ray cone, the one-number form of ray differentials: how wide the pixel's footprint is where
+        // the ray starts and how fast it widens along it. Bounces keep the spread (surface curvature and
+        // roughness are not accounted for); the width at each hit sizes the texture filters there.
+        struct ray_cone
+        {
+            double width;
+            double spread;   // radians
+
+            ray_cone() : width(0), spread(0) {}
+            ray_cone(double w, double s) : width(w), spread(s) {}
+            ray_cone at(double distance) const { return ray_cone(width + spread * distance, spread); }
+        };
+
+        std::unique_ptr<sd_tree> guide;   // learned incident radiance (path guiding)
+        bool guiding_training = false;    // record radiance into `guide` while tracing
+
+        std::unique_ptr<photon_map> caustic_map;
+
+        // where a path stands with respect to caustics, so light paths the photon map
+        // already covers (diffuse -> specular+ -> light) are not counted twice.
+        enum class caustic_path { none, after_diffuse, after_diffuse_specular };
+
+        // what material_scatter drew at a vertex, kept for shading it
+        struct scatter_sample
+        {
+            bool scattered = false;
+            ray r;
+            color albedo;
+            double pdf = 0;
+        };
 
         // a camera maintains image and viewport.
 
@@ -126,6 +196,7 @@ class camera
             // differential distance between pixels.
             viewport_delta_u = viewport_u / img_width;
             viewport_delta_v = viewport_v / img_height; // we define upper-left as the viewport origin.
+            pixel_spread = 2.0 * h / img_height;
 
             // pixel location in 3D world space.
             auto viewport_upper_left = center - (focus_distance * w) - viewport_u / 2 - viewport_v / 2;
@@ -137,7 +208,395 @@ class camera
             defocus_disk_v = v * defocus_radius;
         }
 
-        color trace(const ray& r, int depth, const object& world, const object& lights) const 
+        double render_pass(const object& world, const scene& lights, int spp, std::vector<color>& image)
+        {
+            // Renders every pixel with `spp` samples into `image` (sums, not averages), scanlines in parallel.
+            // Returns the mean per-pixel variance of a single sample's luminance, the quantity
+            // guiding is meant to reduce.
+
+            // the pixel's samples already average over its area; each one's cone only needs to cover its share
+            // (1/sqrt(spp) of a pixel across, at least 1/8), or textures would be blurred twice
+            primary_spread = pixel_spread * fmax(1 / sqrt(static_cast<double>(spp)), 0.125);
+
+            if (light_candidates > 0 && light_reuse)
+            {
+                return render_pass_tiled(world, lights, spp, image);
+            }
+
+            std::atomic<int> rows_done{0};
+            std::vector<double> row_variance(img_height, 0.0);
+
+            parallel_for(img_height, [&](int j, int thread_id)
+            {
+                for (int i = 0; i < img_width; ++i)
+                {
+                    color pixel_color(0, 0, 0);
+                    double sum = 0, sum_squared = 0;
+
+                    // multi-sampling
+
+                    for(int sample = 0; sample < spp; ++sample)
+                    {
+                        // cast ray
+                        ray_cone cone;
+                        ray r = cast_cay(i, j, cone);  // each casted ray randomly offset from center location
+
+                        // trace ray
+                        auto sample_color = trace(r, sample_max_depth, world, lights, caustic_path::none, 0, cone);
+                        pixel_color += sample_color;
+
+                        auto l = luminance(sample_color);
+                        sum += l;
+                        sum_squared += l * l;
+                    }
+
+                    image[j * img_width + i] = pixel_color;
+                    if (spp > 1)
+                    {
+                        row_variance[j] += (sum_squared - sum * sum / spp) / (spp - 1);
+                    }
+                }
+
+                auto remaining = img_height - ++rows_done;
+                if (thread_id == 0)
+                {
+                    std::clog << "\rScanlines remaining: " << remaining << ' ' << std::flush;
+                }
+            });
+
+            double variance = 0;
+            for (auto v : row_variance)
+            {
+                variance += v;
+            }
+            return variance / (static_cast<double>(img_width) * img_height);
+        }
+
+        double render_pass_tiled(const object& world, const scene& lights, int spp, std::vector<color>& image)
+        {
+            // render_pass with spatial light reuse. Merging needs the primary hits of all neighbours before
+            // any pixel is shaded, so tiles are rendered one sample at a time in three steps:
+            //  1. primary hits, each streaming `light_candidates` candidates into its own reservoir,
+            //  2. every reservoir merges those of a few random neighbours lying on similar surfaces,
+            //  3. shading, with the merged reservoir as the primary vertex's direct light.
+
+            const int tile = 16;
+            const int radius = 5;   // neighbours are picked within this many pixels (and the tile)
+            int tiles_x = (img_width + tile - 1) / tile;
+            int tiles_y = (img_height + tile - 1) / tile;
+
+            std::atomic<int> tiles_done{0};
+            std::vector<double> tile_variance(tiles_x * tiles_y, 0.0);
+
+            parallel_for(tiles_x * tiles_y, [&](int t, int thread_id)
+            {
+                int x0 = (t % tiles_x) * tile;
+                int y0 = (t / tiles_x) * tile;
+                int w = std::min(tile, img_width - x0);
+                int h = std::min(tile, img_height - y0);
+                int n = w * h;
+
+                struct primary_hit
+                {
+                    ray r;
+                    ray_cone cone;
+                    intersect_record rec;
+                    scatter_sample scatter;   // drawn once: decides reuse, then shading follows it
+                    double distance;
+                    bool hit;
+                    bool reuse;    // diffuse, medium or glossy vertex (not specular): takes part in light reuse
+                };
+                std::vector<primary_hit> primary(n);
+                std::vector<reservoir> initial(n), merged(n);
+                std::vector<double> sum(n, 0.0), sum_squared(n, 0.0);
+
+                for (int k = 0; k < n; ++k)
+                {
+                    image[(y0 + k / w) * img_width + x0 + k % w] = color(0, 0, 0);
+                }
+
+                for (int sample = 0; sample < spp; ++sample)
+                {
+                    for (int k = 0; k < n; ++k)
+                    {
+                        auto& p = primary[k];
+                        p.r = cast_cay(x0 + k % w, y0 + k / w, p.cone);
+                        p.hit = world.intersect(p.r, interval(0, infinity), p.rec);
+                        if (p.hit)
+                        {
+                            set_footprint(p.r, p.cone, p.rec);
+                        }
+                        p.reuse = false;
+                        initial[k] = reservoir();
+
+                        auto& s = p.scatter;
+                        s.scattered = p.hit && material_scatter(p.rec.mat, p.rec, p.r, s.r, s.albedo, s.pdf);
+                        if (s.scattered && (s.pdf > 0 || material_is_glossy(p.rec.mat)))
+                        {
+                            p.reuse = true;
+                            p.distance = (p.rec.p - p.r.origin()).length();
+                            initial[k] = resample_lights(p.rec, p.r, lights, p.scatter.albedo);
+
+                            // visibility reuse: an occluded survivor is not worth handing to the neighbours
+                            if (initial[k].W > 0 && world.transmittance(spawn_ray_to(p.rec, initial[k].y.p, p.r.time()), interval(0, 0.999)) <= 0)
+                            {
+                                initial[k].W = 0;
+                            }
+                        }
+                    }
+
+                    for (int k = 0; k < n; ++k)
+                    {
+                        const auto& p = primary[k];
+                        if (!p.reuse)
+                        {
+                            continue;
+                        }
+
+                        // a reservoir enters with weight target_here(y) * W * M, i.e. as M candidates at once
+                        reservoir s;
+                        color f;
+                        auto merge = [&](const reservoir& other)
+                        {
+                            auto target = other.W > 0 ? light_target(p.rec, p.r, p.scatter.albedo, other.y, f) : 0.0;
+                            s.update(other.y, target * other.W * other.M, other.M);
+                        };
+
+                        merge(initial[k]);
+                        for (int c = 0; c < light_reuse_neighbors; ++c)
+                        {
+                            int qx = std::min(std::max(k % w + random_int(-radius, radius), 0), w - 1);
+                            int qy = std::min(std::max(k / w + random_int(-radius, radius), 0), h - 1);
+                            int q = qy * w + qx;
+                            const auto& neighbor = primary[q];
+
+                            // only neighbours whose target function resembles ours
+                            if (q == k || !neighbor.reuse || dot(p.rec.normal, neighbor.rec.normal) < 0.9
+                                || fabs(neighbor.distance - p.distance) > 0.1 * p.distance)
+                            {
+                                continue;
+                            }
+                            merge(initial[q]);
+                        }
+
+                        s.finalize(light_target(p.rec, p.r, p.scatter.albedo, s.y, f));
+                        merged[k] = s;
+                    }
+
+                    for (int k = 0; k < n; ++k)
+                    {
+                        const auto& p = primary[k];
+                        auto sample_color = !p.hit ? background
+                                                   : shade(p.r, p.rec, sample_max_depth, world, lights, caustic_path::none, 0,
+                                                           p.cone, p.reuse ? &merged[k] : nullptr, &p.scatter);
+                        image[(y0 + k / w) * img_width + x0 + k % w] += sample_color;
+
+                        auto l = luminance(sample_color);
+                        sum[k] += l;
+                        sum_squared[k] += l * l;
+                    }
+                }
+
+                if (spp > 1)
+                {
+                    for (int k = 0; k < n; ++k)
+                    {
+                        tile_variance[t] += (sum_squared[k] - sum[k] * sum[k] / spp) / (spp - 1);
+                    }
+                }
+
+                auto remaining = tiles_x * tiles_y - ++tiles_done;
+                if (thread_id == 0)
+                {
+                    std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+                }
+            });
+
+            double variance = 0;
+            for (auto v : tile_variance)
+            {
+                variance += v;
+            }
+            return variance / (static_cast<double>(img_width) * img_height);
+        }
+
+        void train_guiding(const object& world, const scene& lights)
+        {
+            // Training passes double their sample count; each one samples from the
+            // distribution learned so far and records into a refined copy of it.
+
+            guide = std::make_unique<sd_tree>(world.get_bbox(), static_cast<size_t>(guiding_memory_mb * 1024 * 1024));
+            std::vector<color> scratch(img_width * img_height);
+            double first_variance = 0;
+
+            guiding_training = true;
+            for (int pass = 0; pass < guiding_training_passes; ++pass)
+            {
+                int spp = 2 << pass;
+                auto variance = render_pass(world, lights, spp, scratch);
+                if (pass == 0)
+                {
+                    first_variance = variance;
+                }
+
+                guide->refine(pass);
+
+                std::clog << "\rGuiding pass " << pass + 1 << ": " << spp << " spp, variance " << variance
+                          << " (" << (variance > 0 ? first_variance / variance : 1.0) << "x reduction), "
+                          << guide->leaf_count() << " cells, " << guide->memory_bytes() / 1024 << " KB" << std::endl;
+            }
+            guiding_training = false;
+        }
+
+        void build_caustic_map(const object& world, const scene& lights)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            caustic_map = std::make_unique<photon_map>();
+            caustic_map->build(world, lights, caustic_photons, sample_max_depth);
+            if (caustic_gather_radius <= 0)
+            {
+                caustic_gather_radius = 0.02 * caustic_map->extent();
+            }
+
+            auto end = std::chrono::steady_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+            std::clog << "Caustic photons: " << caustic_map->size() << " stored of " << caustic_photons
+                      << " emitted in " << duration.count() << "ms" << std::endl;
+        }
+
+        color sample_light(const intersect_record& rec, const ray& r, const object& world, const scene& lights,
+                           const color& albedo, const pdf& scatter_sampling) const
+        {
+            // next-event estimation: connect to a point on a light, attenuated by the transmittance
+            // of everything in between (0 behind a surface, ratio tracking through media).
+
+            auto to_light = spawn_ray(rec, lights.randomDir(rec.p), r.time());
+            auto light_pdf = lights.get_pdf(to_light.origin(), to_light.direction());
+            if (light_pdf <= 0)
+            {
+                return color(0, 0, 0);
+            }
+
+            intersect_record light_rec;
+            if (!lights.intersect(to_light, interval(0, infinity), light_rec))
+            {
+                return color(0, 0, 0);
+            }
+
+            // lights may be listed as bare geometry (no material): the emitter is the world surface there
+            if (!light_rec.mat && !world.intersect(to_light, interval(light_rec.t * 0.999, light_rec.t * 1.001), light_rec))
+            {
+                return color(0, 0, 0);
+            }
+
+            auto Le = material_emitted(light_rec.mat, light_rec, to_light, light_rec.u, light_rec.v, light_rec.p);
+            if (Le.near_zero())
+            {
+                return color(0, 0, 0);
+            }
+
+            // stop just short of the light, which is part of the world as well
+            auto tr = world.transmittance(to_light, interval(0, light_rec.t * 0.999));
+            if (tr <= 0)
+            {
+                return color(0, 0, 0);
+            }
+
+            auto f = material_bsdf_cos(rec.mat, rec, r, to_light, albedo);
+            auto weight = power_heuristic(light_pdf, scatter_sampling.get_value(to_light.direction()));
+
+            return f * Le * tr * weight / light_pdf;
+        }
+
+        double light_target(const intersect_record& rec, const ray& r, const color& albedo, const light_sample& y, color& f) const
+        {
+            // Resampling target: the unshadowed contribution of light point y, in area measure.
+            // f receives it as a color, the luminance is the target value.
+
+            auto d = y.p - rec.p;
+            auto distance_squared = d.length_squared();
+            auto cos_light = -dot(y.normal, d);
+            if (distance_squared <= 0 || cos_light <= 0)
+            {
+                f = color(0, 0, 0);
+                return 0;
+            }
+            cos_light /= sqrt(distance_squared);
+
+            f = material_bsdf_cos(rec.mat, rec, r, ray(rec.p, d, r.time()), albedo) * y.Le * cos_light / distance_squared;
+            return luminance(f);
+        }
+
+        reservoir resample_lights(const intersect_record& rec, const ray& r, const scene& lights, const color& albedo) const
+        {
+            // streams light_candidates points on the lights through a reservoir,
+            // weighted by target / source pdf (area pdf of scene::sample_surface).
+
+            reservoir res;
+            color f;
+            for (int c = 0; c < light_candidates; ++c)
+            {
+                surface_sample s;
+                if (!lights.sample_surface(s) || s.pdf <= 0)
+                {
+                    res.update(res.y, 0);
+                    continue;
+                }
+
+                light_sample y;
+                y.p = s.p;
+                y.normal = s.normal;
+                y.emission_known = static_cast<bool>(s.mat);
+                y.Le = color(1, 1, 1);
+                if (s.mat)
+                {
+                    intersect_record emitter;
+                    emitter.p = s.p;
+                    emitter.normal = s.normal;
+                    emitter.front_face = dot(s.normal, rec.p - s.p) > 0;
+                    emitter.mat = s.mat;
+                    emitter.u = s.u;
+                    emitter.v = s.v;
+                    y.Le = material_emitted(s.mat, emitter, r, s.u, s.v, s.p);
+                }
+
+                res.update(y, light_target(rec, r, albedo, y, f) / s.pdf);
+            }
+
+            res.finalize(res.w_sum > 0 ? light_target(rec, r, albedo, res.y, f) : 0);
+            return res;
+        }
+
+        color shade_reservoir(const intersect_record& rec, const ray& r, const object& world,
+                              const color& albedo, const reservoir& res) const
+        {
+            // the reservoir's survivor with its one shadow ray: f(y) * V(y) * W
+
+            color f;
+            if (res.W <= 0 || light_target(rec, r, albedo, res.y, f) <= 0)
+            {
+                return color(0, 0, 0);
+            }
+
+            auto to_light = spawn_ray_to(rec, res.y.p, r.time());   // reaches the light at t = 1
+            if (!res.y.emission_known)
+            {
+                // bare light geometry: the emitter is the world surface there
+                intersect_record light_rec;
+                if (!world.intersect(to_light, interval(0.999, 1.001), light_rec))
+                {
+                    return color(0, 0, 0);
+                }
+                f = f * material_emitted(light_rec.mat, light_rec, to_light, light_rec.u, light_rec.v, light_rec.p);
+            }
+
+            auto tr = world.transmittance(to_light, interval(0, 0.999));
+            return f * tr * res.W;
+        }
+
+        color trace(const ray& r, int depth, const object& world, const scene& lights,
+                    caustic_path caustics = caustic_path::none, double light_mis_pdf = 0, const ray_cone& cone = ray_cone()) const 
         {
             intersect_record rec;
             
@@ -147,31 +606,97 @@ class camera
             }
             
 
-            if(!world.intersect(r, interval(0.001, infinity), rec))
+            if(!world.intersect(r, interval(0, infinity), rec))
             {
                 return background;
             }
+            set_footprint(r, cone, rec);
 
+            return shade(r, rec, depth, world, lights, caustics, light_mis_pdf, cone);
+        }
+
+        static void set_footprint(const ray& r, const ray_cone& cone, intersect_record& rec)
+        {
+            // the cone's cross-section where it meets the surface, stretched by the surface's slant
+            // (at most 8 times: the texture filters are isotropic and would blur the other direction as much)
+            auto length = r.direction().length();
+            auto cos_theta = fabs(dot(rec.normal, r.direction())) / length;
+            rec.footprint = cone.at(rec.t * length).width / fmax(cos_theta, 0.125);
+        }
+
+        // Radiance leaving the hit `rec` along -r.
+        // light_mis_pdf: pdf with which the previous vertex sampled r, to weigh emission here against its
+        //                next-event estimation (0: no such estimate; < 0: that vertex resampled its lights,
+        //                emission here is already counted)
+        // cone:          ray cone of r, for the footprints of the hits further along the path
+        // direct:        light reservoir prepared for this vertex by the caller (spatial reuse), or nullptr
+        // drawn:         material_scatter at this vertex if the caller drew it already, or nullptr
+        color shade(const ray& r, const intersect_record& rec, int depth, const object& world, const scene& lights,
+                    caustic_path caustics, double light_mis_pdf, const ray_cone& cone, const reservoir* direct = nullptr,
+                    const scatter_sample* drawn = nullptr) const
+        {
             // gather color contribution
             
             ray r_bounce;
             color albedo;
-            double pdf;
+            double pdf_value;
 
             // direct
 
-            color c_dir = rec.mat->emitted(rec, r, rec.u, rec.v, rec.p);
+            // light reached over specular bounces after a diffuse one is a caustic, already in the photon map
+            color c_dir = (caustics == caustic_path::after_diffuse_specular) ? color(0, 0, 0)
+                                                                              : material_emitted(rec.mat, rec, r, rec.u, rec.v, rec.p);
+
+            // light also reachable by the previous vertex's next-event estimation: weight against it
+            if (light_mis_pdf > 0 && !c_dir.near_zero())
+            {
+                c_dir = c_dir * power_heuristic(light_mis_pdf, lights.get_pdf(r.origin(), r.direction()));
+            }
+            else if (light_mis_pdf < 0 && !c_dir.near_zero() && lights.get_pdf(r.origin(), r.direction()) > 0)
+            {
+                c_dir = color(0, 0, 0);   // a listed light: the reservoir accounted for it
+            }
 
 
             // indirect
 
             
             // if there are no indirect contributions return only direct contributions
-            if (!rec.mat->scatter(rec, r, r_bounce, albedo, pdf))
+            auto bounce_cone = cone.at(rec.t * r.direction().length());
+            bool scattered;
+            if (drawn)
+            {
+                scattered = drawn->scattered;
+                r_bounce = drawn->r;
+                albedo = drawn->albedo;
+                pdf_value = drawn->pdf;
+            }
+            else
+            {
+                scattered = material_scatter(rec.mat, rec, r, r_bounce, albedo, pdf_value);
+            }
+            if (!scattered)
             {
                 return c_dir;
             }
 
+            // specular (metal, dielectric): the material already picked the only direction worth following.
+            // (a glossy material's pdf is 0 only where its draw left the lobe)
+            bool glossy = material_is_glossy(rec.mat);
+            if (pdf_value == 0 && !glossy)
+            {
+                auto next = (caustics == caustic_path::none) ? caustic_path::none : caustic_path::after_diffuse_specular;
+                return c_dir + albedo * trace(r_bounce, depth - 1, world, lights, next, 0, bounce_cone);
+            }
+
+            // caustics: density estimation from the photons that landed around this point
+            bool in_medium = material_is_volumetric(rec.mat);
+            if (caustic_map && !in_medium && !glossy)
+            {
+                auto irradiance = caustic_map->estimate_irradiance(rec.p, rec.normal, caustic_gather_count, caustic_gather_radius);
+                c_dir += albedo / pi * irradiance;
+            }
+
             // cosine diffuse and pdf
             // cosine_pdf surface_pdf(rec.normal);
             // r_bounce = ray(rec.p, surface_pdf.generate_randomDir(), r.time());
@@ -183,22 +708,68 @@ class camera
             // pdf = light_pdf.get_value(r_bounce.direction());
 
             // mixture pdf: light and surface(cosine)
-            auto p0 = make_shared<object_pdf>(lights, rec.p);  // light source pdf
-            auto p1 = make_shared<cosine_pdf>(rec.normal);     // cosine surface pdf
-            mixture_pdf mixed_pdf(p0, p1);
+            // auto p0 = make_shared<object_pdf>(lights, rec.p);  // light source pdf
+            // auto p1 = make_shared<cosine_pdf>(rec.normal);     // cosine surface pdf
+            // mixture_pdf mixed_pdf(p0, p1);
+
+            // next-event estimation and scatter sampling, combined with the power heuristic:
+            // lights are connected explicitly with the transmittance of whatever lies in between
+            // (ratio tracking through media), so light behind smoke no longer has to be found by
+            // a random walk. Scattering samples the phase function inside media (isotropic, the whole
+            // sphere), the cosine lobe on diffuse surfaces and the material's own lobe on glossy ones.
+            shared_ptr<pdf> scatter_pdf = make_shared<cosine_pdf>(rec.normal);
+            if (in_medium)
+            {
+                scatter_pdf = make_shared<uniform_sphere_pdf>();
+            }
+            else if (glossy)
+            {
+                scatter_pdf = make_shared<material_pdf>(rec.mat, rec, r, r_bounce.direction());
+            }
 
-            r_bounce = ray(rec.p, mixed_pdf.generate_randomDir(), r.time());
-            pdf = mixed_pdf.get_value(r_bounce.direction());
+            // path guiding: mix in the incident radiance learned around this point
+            const dtree* guide_tree = guide ? guide->sampling_tree(rec.p) : nullptr;
+            auto sampling_pdf = guide_tree ? make_shared<mixture_pdf>(make_shared<guided_pdf>(*guide_tree), scatter_pdf)
+                                           : scatter_pdf;
 
-            auto scattering_pdf = rec.mat->scattering_pdf(rec, r, r_bounce);
+            auto bounce_direction = sampling_pdf->generate_randomDir();
+            r_bounce = spawn_ray(rec, bounce_direction, r.time());
+            pdf_value = bounce_direction.near_zero() ? 0 : sampling_pdf->get_value(r_bounce.direction());
+
+            color c_light(0, 0, 0);
+            bool has_lights = !lights.objects.empty();   // scenes lit only by the background have no lights to sample
+            if (has_lights && light_candidates > 0)
+            {
+                c_light = direct ? shade_reservoir(rec, r, world, albedo, *direct)
+                                 : shade_reservoir(rec, r, world, albedo, resample_lights(rec, r, lights, albedo));
+            }
+            else if (has_lights)
+            {
+                c_light = sample_light(rec, r, world, lights, albedo, *sampling_pdf);
+            }
+
+            // a glossy lobe's sample can leave the lobe (below the surface): no light comes that way
+            if (pdf_value <= 0)
+            {
+                return c_dir + c_light;
+            }
+
+            auto f = material_bsdf_cos(rec.mat, rec, r, r_bounce, albedo);
 
             // else we keep tracing on
-            color c_indir = (albedo * scattering_pdf * trace(r_bounce, depth - 1, world, lights)) / pdf;
+            auto next = (caustic_map && !in_medium && !glossy) ? caustic_path::after_diffuse : caustic_path::none;
+            auto next_mis_pdf = !has_lights ? 0.0 : (light_candidates > 0 ? -1.0 : pdf_value);
+            color c_in = trace(r_bounce, depth - 1, world, lights, next, next_mis_pdf, bounce_cone);
+            if (guiding_training)
+            {
+                guide->record(rec.p, r_bounce.direction(), luminance(c_in) / pdf_value);
+            }
+            color c_indir = (f * c_in) / pdf_value;
 
-            return c_dir + c_indir;
+            return c_dir + c_light + c_indir;
         }
 
-        ray cast_cay(int i, int j)
+        ray cast_cay(int i, int j, ray_cone& cone) const
         {
             // get random point on a pixel
 
@@ -212,6 +783,9 @@ class camera
             auto ray_direction = pixel_sample - ray_origin;
             auto ray_time = random_double();   /// randomly generate a shutter time for rendering 
 
+            // a point at the lens, widening with the angle of the sample's share of the pixel
+            cone = ray_cone(0, primary_spread);
+
             return ray(ray_origin, ray_direction, ray_time);
         }
 
@@ -222,7 +796,7 @@ class camera
             return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
         }
 
-        vec3 pixel_random_sample()
+        vec3 pixel_random_sample() const
         {
             auto px = -0.5 + random_double();
             auto py = -0.5 + random_double();
@@ -11,6 +11,11 @@ inline double linear_to_gamma(double linear_component)
     return sqrt(linear_component);
 }
 
+inline double luminance(const color& c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 void pixel_to_image(std::ostream &os, color pixel_color, int sample_per_pixel)
 {
     auto r = pixel_color.x();
@@ -0,0 +1,336 @@
+#ifndef CUBOID_H
+#define CUBOID_H
+
+#include "utility.h"
+#include "object.h"
+#include "material.h"
+
+// Box primitive: an axis-aligned box [lo, hi] in its own frame, placed in the world by the
+// rotations and translations applied to it.
+//  - one slab test gives both crossings of the line, the face each one goes through,
+//    and from the face the normal and the (u,v) of the six quads box() used to build,
+//  - rays are taken into the box frame only when it has been rotated or moved.
+
+
+class cuboid final : public object
+{
+public:
+    cuboid(const point3& a, const point3& b, shared_ptr<material> _material) : mat(material_table::global().id(_material))
+    {
+        lo = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
+        hi = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
+        set_bbox();
+    }
+
+
+    // Method
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        double t;
+        if (!hit_distance(r, ray_t, t))
+            return false;
+
+        fill_record(r, t, rec);
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        if (!hit_distance(r, ray_t, hit.t))
+            return false;
+        hit.primitive = this;
+        return true;
+    }
+
+    void fill_record(const ray& r, double t, intersect_record& rec) const override
+    {
+        // the slab test again, now for the face
+        auto local = to_local(r);
+
+        double t_near, t_far;
+        int near_face, far_face;
+        slab(lo, hi, local.origin(), local.direction(), t_near, near_face, t_far, far_face);
+        auto face = t == t_near ? near_face : far_face;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+        rec.set_face_normal(r, to_world(face_normal(face)));
+        face_uv(face, local.at(t), lo, hi, rec.u, rec.v);
+        face_uv_rates(face, lo, hi, rec.u_rate, rec.v_rate);
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        double t;
+        return hit_distance(r, ray_t, t) ? 0.0 : 1.0;
+    }
+
+    // the entry crossing within ray_t, or the exit crossing for rays starting inside
+    bool hit_distance(const ray& r, interval ray_t, double& t) const
+    {
+        auto local = to_local(r);
+
+        double t_near, t_far;
+        int near_face, far_face;
+        if (!slab(lo, hi, local.origin(), local.direction(), t_near, near_face, t_far, far_face))
+            return false;
+
+        auto root = t_near;
+        if (!ray_t.surrounds(root))
+        {
+            root = t_far;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+        t = root;
+        return true;
+    }
+
+    bool intersect_span(const ray& r, interval& span) const override
+    {
+        auto local = to_local(r);
+
+        double t_near, t_far;
+        int near_face, far_face;
+        if (!slab(lo, hi, local.origin(), local.direction(), t_near, near_face, t_far, far_face))
+            return false;
+
+        span = interval(t_near, t_far);
+        return true;
+    }
+
+    bool sample_surface(surface_sample& s) const override
+    {
+        // a face proportional to its area, then a uniform point on it
+        auto size = hi - lo;
+        double area[3] = { size.y() * size.z(), size.z() * size.x(), size.x() * size.y() };
+        auto total = 2 * (area[0] + area[1] + area[2]);
+        if (total <= 0)
+            return false;
+
+        auto pick = random_double() * total / 2;
+        int axis = pick < area[0] ? 0 : (pick < area[0] + area[1] ? 1 : 2);
+        int face = 2 * axis + (random_double() < 0.5 ? 0 : 1);
+
+        point3 p;
+        for (int a = 0; a < 3; ++a)
+            p[a] = lo[a] + random_double() * size[a];
+        p[axis] = (face & 1) ? hi[axis] : lo[axis];
+
+        face_uv(face, p, lo, hi, s.u, s.v);
+        s.p = to_world_point(p);
+        s.normal = to_world(face_normal(face));
+        s.pdf = 1 / total;
+        s.mat = mat;
+        return true;
+    }
+
+    double get_pdf(const point3& origin, const vec3& direction) const override
+    {
+        // solid-angle density of sample_surface, summed over both crossings of the box
+        auto size = hi - lo;
+        auto total = 2 * (size.y() * size.z() + size.z() * size.x() + size.x() * size.y());
+        if (total <= 0)
+            return 0;
+
+        ray r(origin, direction);
+        auto local = to_local(r);
+
+        double t_near, t_far;
+        int near_face, far_face;
+        if (!slab(lo, hi, local.origin(), local.direction(), t_near, near_face, t_far, far_face))
+            return 0;
+
+        auto pdf = 0.0;
+        auto add = [&](double t, int face)
+        {
+            if (t <= 0)
+                return;
+            auto distance_squared = t * t * direction.length_squared();
+            auto cosine = fabs(dot(direction, to_world(face_normal(face))) / direction.length());
+            if (cosine > 0)
+                pdf += distance_squared / (cosine * total);
+        };
+        add(t_near, near_face);
+        add(t_far, far_face);
+        return pdf;
+    }
+
+    vec3 randomDir(const point3& origin) const override
+    {
+        surface_sample s;
+        sample_surface(s);
+        return s.p - origin;
+    }
+
+    void rotate(double degree, int axis) override
+    {
+        // rotation matrix parameter
+        auto radians = degrees_to_radians(degree);
+        auto cos_theta = cos(radians);
+        auto sin_theta = sin(radians);
+
+        // construct rotation matrix
+        vec3 row_x, row_y, row_z;
+        switch (axis)
+        {
+        case 0:
+            row_x = vec3(1.0,         0.0,          0.0);
+            row_y = vec3(0.0,   cos_theta,   -sin_theta);
+            row_z = vec3(0.0,   sin_theta,    cos_theta);
+            break;
+        case 1:
+            row_x = vec3(cos_theta,    0.0,  sin_theta);
+            row_y = vec3(0.0,          1.0,        0.0);
+            row_z = vec3(-sin_theta,   0.0,  cos_theta);
+            break;
+        case 2:
+            row_x = vec3(cos_theta,  -sin_theta,   0.0);
+            row_y = vec3(sin_theta,   cos_theta,   0.0);
+            row_z = vec3(      0.0,         0.0,   1.0);
+            break;
+        default:
+            return;
+        }
+
+        // compose with the current placement: world = M * (R * local + offset)
+        auto turn = [&](const vec3& x) { return vec3(dot(row_x, x), dot(row_y, x), dot(row_z, x)); };
+        auto column_0 = turn(vec3(rows[0][0], rows[1][0], rows[2][0]));
+        auto column_1 = turn(vec3(rows[0][1], rows[1][1], rows[2][1]));
+        auto column_2 = turn(vec3(rows[0][2], rows[1][2], rows[2][2]));
+        for (int i = 0; i < 3; ++i)
+            rows[i] = vec3(column_0[i], column_1[i], column_2[i]);
+        offset = turn(offset);
+
+        transformed = true;
+        set_bbox();
+    }
+
+    void translate(vec3 dir) override
+    {
+        offset += dir;
+        transformed = true;
+        set_bbox();
+    }
+
+
+    // Slab test of the line o + t d against [lo, hi]: both crossings and the faces they go through
+    // (face = 2 * axis, +1 on the hi side). False if the line misses.
+    static bool slab(const point3& lo, const point3& hi, const point3& o, const vec3& d,
+                     double& t_near, int& near_face, double& t_far, int& far_face)
+    {
+        t_near = -infinity;
+        t_far = infinity;
+        near_face = far_face = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            auto inv_dir = 1 / d[a];
+            auto t0 = (lo[a] - o[a]) * inv_dir;
+            auto t1 = (hi[a] - o[a]) * inv_dir;
+            int face0 = 2 * a, face1 = 2 * a + 1;
+            if (inv_dir < 0)
+            {
+                std::swap(t0, t1);
+                std::swap(face0, face1);
+            }
+            if (t0 > t_near)
+            {
+                t_near = t0;
+                near_face = face0;
+            }
+            if (t1 < t_far)
+            {
+                t_far = t1;
+                far_face = face1;
+            }
+        }
+        return t_near <= t_far;
+    }
+
+    static vec3 face_normal(int face)
+    {
+        vec3 n(0, 0, 0);
+        n[face / 2] = (face & 1) ? 1 : -1;
+        return n;
+    }
+
+    // (u,v) on a face, laid out as the quads of box() in quad.h were
+    static void face_uv(int face, const point3& p, const point3& lo, const point3& hi, double& u, double& v)
+    {
+        auto size = hi - lo;
+        auto along = [&](int a) { return size[a] > 0 ? (p[a] - lo[a]) / size[a] : 0.0; };
+        switch (face)
+        {
+        case 5: u = along(0);     v = along(1);     break;  // front  (+z)
+        case 1: u = 1 - along(2); v = along(1);     break;  // right  (+x)
+        case 4: u = 1 - along(0); v = along(1);     break;  // back   (-z)
+        case 0: u = along(2);     v = along(1);     break;  // left   (-x)
+        case 3: u = along(0);     v = 1 - along(2); break;  // top    (+y)
+        default: u = along(0);    v = along(2);     break;  // bottom (-y)
+        }
+    }
+
+    // change of face_uv's (u,v) per unit length on a face
+    static void face_uv_rates(int face, const point3& lo, const point3& hi, double& u_rate, double& v_rate)
+    {
+        auto size = hi - lo;
+        auto rate = [&](int a) { return size[a] > 0 ? 1 / size[a] : 0.0; };
+        auto axis = face / 2;
+        u_rate = rate(axis == 0 ? 2 : 0);
+        v_rate = rate(axis == 1 ? 2 : 1);
+    }
+
+private:
+    point3 lo, hi;                  // in the box frame
+    material_id mat;
+    bool transformed = false;
+    vec3 rows[3] = { vec3(1,0,0), vec3(0,1,0), vec3(0,0,1) };   // rotation box frame -> world
+    vec3 offset = vec3(0, 0, 0);    // translation box frame -> world
+    bbox bounding_box;
+
+    ray to_local(const ray& r) const
+    {
+        if (!transformed)
+            return r;
+
+        // the inverse of a rotation is its transpose
+        auto o = r.origin() - offset;
+        const auto& d = r.direction();
+        auto back = [&](const vec3& x) { return x[0] * rows[0] + x[1] * rows[1] + x[2] * rows[2]; };
+        return ray(back(o), back(d), r.time());
+    }
+
+    vec3 to_world(const vec3& x) const
+    {
+        if (!transformed)
+            return x;
+        return vec3(dot(rows[0], x), dot(rows[1], x), dot(rows[2], x));
+    }
+
+    point3 to_world_point(const point3& p) const { return to_world(p) + (transformed ? offset : vec3(0, 0, 0)); }
+
+    void set_bbox()
+    {
+        bounding_box = bbox();
+        for (int i = 0; i < 8; ++i)
+        {
+            auto corner = to_world_point(point3((i & 1) ? hi.x() : lo.x(), (i & 2) ? hi.y() : lo.y(), (i & 4) ? hi.z() : lo.z()));
+            bounding_box = bbox(bounding_box, bbox(corner, corner));
+        }
+        bounding_box = bounding_box.pad();
+    }
+};
+
+
+// box with opposite vertices a and b
+inline shared_ptr<cuboid> box(const point3& a, const point3& b, shared_ptr<material> mat)
+{
+    return make_shared<cuboid>(a, b, mat);
+}
+
+
+#endif //CUBOID_H
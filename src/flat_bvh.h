@@ -0,0 +1,298 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "utility.h"
+#include "ray.h"
+#include "interval.h"
+#include "bbox.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Bounding volume hierarchy over primitives known only by their float bounds, for the objects that
+// keep their own primitives in flat arrays (triangle meshes, primitive pools):
+//  - binned SAH build, nodes in one array in depth-first order,
+//  - the build reorders the caller's refs so every leaf covers a contiguous range of them;
+//    the owner then lays out its primitive data in that order,
+//  - traversal is iterative, near child first, and hands each leaf reached to the owner,
+//  - a node's box is tested on all three axes at once, in float lanes (simd.h).
+
+
+class flat_bvh
+{
+public:
+    struct node
+    {
+        float lo[3], hi[3];
+        uint32_t offset;   // leaf: first ref (owners may renumber it); interior: right child (the left one is the next node)
+        uint16_t count;    // primitives in a leaf, 0 for interior nodes
+        uint16_t axis;     // split axis of an interior node
+    };
+
+    // build-time copy of a primitive's bounds and centroid; the build partitions these in place,
+    // so every pass over a node's primitives reads memory sequentially.
+    struct build_ref
+    {
+        float lo[3], hi[3], centroid[3];
+        uint32_t index;    // the owner's primitive
+    };
+
+    static const int max_depth = 96;       // SAH splits up to depth 64, median splits below
+
+    std::vector<node> nodes;
+
+
+    // Method
+
+    bool empty() const { return nodes.empty(); }
+    size_t memory_bytes() const { return nodes.size() * sizeof(node); }
+
+    // Builds over refs and reorders them into leaf order. Leaves hold at most max_leaf_size refs,
+    // or up to twice that where no split pays off.
+    void build(std::vector<build_ref>& refs, int max_leaf_size)
+    {
+        nodes.clear();
+        leaf_size = max_leaf_size;
+        if (refs.empty())
+            return;
+
+        nodes.reserve(2 * refs.size() / max_leaf_size + 1);
+        build_node(refs, 0, refs.size(), 0);
+    }
+
+    bbox bounds() const
+    {
+        if (nodes.empty())
+            return bbox();
+        const auto& root = nodes[0];
+        return bbox(point3(root.lo[0], root.lo[1], root.lo[2]), point3(root.hi[0], root.hi[1], root.hi[2])).pad();
+    }
+
+    // Calls visit(leaf) for the leaves r may reach within ray_t, near ones first. visit may shrink
+    // ray_t.max (ray_t is shared by reference) to cull everything behind a hit.
+    template<typename Func>
+    void traverse(const ray& r, interval& ray_t, Func visit) const
+    {
+        if (nodes.empty())
+            return;
+
+        node_ray q(r);
+
+        uint32_t stack[max_depth + 1];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0)
+        {
+            auto index = stack[--stack_size];
+            const auto& n = nodes[index];
+            if (!hit_node(n, q, ray_t))
+                continue;
+
+            if (n.count > 0)
+            {
+                visit(n);
+                continue;
+            }
+
+            // near child last, so it is popped first
+            auto first = index + 1;   // the left child directly follows its parent
+            auto second = n.offset;
+            if (r.direction()[n.axis] < 0)
+                std::swap(first, second);
+            stack[stack_size++] = second;
+            stack[stack_size++] = first;
+        }
+    }
+
+private:
+    static const int bin_count = 12;
+    int leaf_size = 4;
+
+    struct float_bounds
+    {
+        float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        float hi[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+
+        void grow(const float l[3], const float h[3])
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], l[a]);
+                hi[a] = std::max(hi[a], h[a]);
+            }
+        }
+
+        double area() const
+        {
+            if (lo[0] > hi[0]) return 0;   // empty
+            double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    // the ray in float lanes, like the boxes
+    struct node_ray
+    {
+        float4 origin, inv_dir;
+        float4 negative;   // mask of the axes the ray runs backwards along: their near plane is hi
+        float4 slack;      // how far rounding moved the origin; boxes grow by it
+
+        node_ray(const ray& r)
+        {
+            float o[3], inv[3], rounding[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                o[a] = static_cast<float>(r.origin()[a]);
+                inv[a] = static_cast<float>(1 / r.direction()[a]);
+                rounding[a] = static_cast<float>(fabs(r.origin()[a] - o[a]));
+                rounding[a] = std::nextafter(rounding[a], std::numeric_limits<float>::max());
+            }
+            origin = float4(o[0], o[1], o[2], 0);
+            inv_dir = float4(inv[0], inv[1], inv[2], 0);
+            negative = inv_dir < float4(0.0f);
+            slack = float4(rounding[0], rounding[1], rounding[2], 0);
+        }
+    };
+
+    static bool hit_node(const node& n, const node_ray& q, const interval& ray_t)
+    {
+        // lanes 0-2 of both loads are the box; lane 3 is whatever follows and is never reduced
+        auto lo = float4::load(n.lo) - q.slack;
+        auto hi = float4::load(n.hi) + q.slack;
+        auto t0 = (select(q.negative, hi, lo) - q.origin) * q.inv_dir;
+        auto t1 = (select(q.negative, lo, hi) - q.origin) * q.inv_dir;
+
+        // NaN (an origin on a slab plane of an axis the ray is parallel to) leaves the bound alone.
+        // The far distance widens by twice the 1 + 2 gamma(3) of Pharr, Jakob and Humphreys, which also
+        // covers rounding the slack and ray_t, so no box a double test would hit is missed.
+        const float far_scale = 1 + 2 * 3 * std::numeric_limits<float>::epsilon();
+        auto t_min = max3(max(t0, float4(static_cast<float>(ray_t.min))));
+        auto t_max = min3(min(t1, float4(static_cast<float>(ray_t.max)))) * far_scale;
+        return t_min <= t_max;
+    }
+
+    void build_node(std::vector<build_ref>& refs, size_t begin, size_t end, int depth)
+    {
+        auto index = nodes.size();
+        nodes.emplace_back();
+
+        float_bounds bounds, centroid_bounds;
+        for (auto i = begin; i < end; ++i)
+        {
+            bounds.grow(refs[i].lo, refs[i].hi);
+            centroid_bounds.grow(refs[i].centroid, refs[i].centroid);
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            // one ulp outwards: the float box must contain the primitives intersected in double
+            nodes[index].lo[a] = std::nextafter(bounds.lo[a], -std::numeric_limits<float>::max());
+            nodes[index].hi[a] = std::nextafter(bounds.hi[a], std::numeric_limits<float>::max());
+        }
+
+        auto count = end - begin;
+        auto make_leaf = [&]()
+        {
+            nodes[index].offset = static_cast<uint32_t>(begin);
+            nodes[index].count = static_cast<uint16_t>(count);
+            nodes[index].axis = 0;
+        };
+
+        if (count <= static_cast<size_t>(leaf_size))
+        {
+            make_leaf();
+            return;
+        }
+
+        // binned SAH over the centroids on the widest centroid axis
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+            if (centroid_bounds.hi[a] - centroid_bounds.lo[a] > centroid_bounds.hi[axis] - centroid_bounds.lo[axis])
+                axis = a;
+
+        auto lo = centroid_bounds.lo[axis];
+        auto extent = centroid_bounds.hi[axis] - lo;
+
+        size_t mid;
+        if (extent <= 0)
+        {
+            mid = begin + count / 2;   // all centroids coincide: any split will do
+        }
+        else
+        {
+            auto scale = bin_count / extent;
+            auto bin_of = [&](const build_ref& ref)
+            {
+                return std::min(static_cast<int>((ref.centroid[axis] - lo) * scale), bin_count - 1);
+            };
+
+            float_bounds bin_bounds[bin_count];
+            size_t bin_size[bin_count] = {};
+            for (auto i = begin; i < end; ++i)
+            {
+                auto b = bin_of(refs[i]);
+                bin_bounds[b].grow(refs[i].lo, refs[i].hi);
+                ++bin_size[b];
+            }
+
+            // sweep: cost of splitting after bin s
+            double right_area[bin_count];
+            size_t right_count[bin_count];
+            float_bounds acc;
+            size_t n = 0;
+            for (int s = bin_count - 1; s > 0; --s)
+            {
+                acc.grow(bin_bounds[s].lo, bin_bounds[s].hi);
+                n += bin_size[s];
+                right_area[s] = acc.area();
+                right_count[s] = n;
+            }
+
+            int best = -1;
+            auto best_cost = static_cast<double>(count) * bounds.area();   // cost of not splitting
+            acc = float_bounds();
+            n = 0;
+            for (int s = 0; s < bin_count - 1; ++s)
+            {
+                acc.grow(bin_bounds[s].lo, bin_bounds[s].hi);
+                n += bin_size[s];
+                auto cost = n * acc.area() + right_count[s + 1] * right_area[s + 1];
+                if (n > 0 && right_count[s + 1] > 0 && cost < best_cost)
+                {
+                    best_cost = cost;
+                    best = s;
+                }
+            }
+
+            if (best < 0 && count <= static_cast<size_t>(2 * leaf_size))
+            {
+                make_leaf();   // no split pays off and the leaf is still small
+                return;
+            }
+
+            if (best < 0 || depth >= 64)
+            {
+                mid = begin + count / 2;
+                std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                                 [axis](const build_ref& a, const build_ref& b) { return a.centroid[axis] < b.centroid[axis]; });
+            }
+            else
+            {
+                mid = std::partition(refs.begin() + begin, refs.begin() + end,
+                                     [&](const build_ref& ref) { return bin_of(ref) <= best; }) - refs.begin();
+            }
+        }
+
+        nodes[index].axis = static_cast<uint16_t>(axis);
+        nodes[index].count = 0;
+        build_node(refs, begin, mid, depth + 1);
+        nodes[index].offset = static_cast<uint32_t>(nodes.size());
+        build_node(refs, mid, end, depth + 1);
+    }
+};
+
+
+#endif //FLAT_BVH_H
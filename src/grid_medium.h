@@ -0,0 +1,184 @@
+#ifndef GRID_MEDIUM_H
+#define GRID_MEDIUM_H
+
+#include "utility.h"
+
+#include "medium.h"
+#include "material.h"
+#include "cuboid.h"
+#include "voxel_grid.h"
+
+// Heterogeneous medium whose density comes from a voxel grid stretched over the box [a, b].
+// Tracking walks the grid's coarse brick cells with a 3D DDA and uses each cell's own majorant,
+// so empty bricks are crossed in one step and dense ones do not slow down the thin parts.
+
+class grid_medium : public medium {
+  public:
+    grid_medium(shared_ptr<voxel_grid> g, const point3& a, const point3& b, double density_scale, color albedo)
+      : medium(box(a, b, nullptr), make_shared<isotropic>(albedo)), grid(g), bounds(a, b), scale(density_scale)
+    {
+        lo = point3(bounds.x.min, bounds.y.min, bounds.z.min);
+        to_grid = vec3(grid->size_x() / bounds.x.size(), grid->size_y() / bounds.y.size(), grid->size_z() / bounds.z.size());
+    }
+
+    double density(const point3& p) const override {
+        auto g = (p - lo) * to_grid;
+        return scale * grid->density(g.x(), g.y(), g.z());
+    }
+
+    double majorant() const override { return scale * grid->max_density(); }
+
+
+    // Method
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override {
+        // delta tracking, one majorant per brick cell. The remaining optical depth `tau`
+        // carries over cell borders: exponential free flights are memoryless.
+        auto ray_length = r.direction().length();
+        auto tau = -log(1 - random_double());
+        auto hit_t = infinity;
+
+        traverse(r, ray_t, [&](double t0, double t1, double sigma)
+        {
+            if (sigma <= 0)
+                return true;   // empty brick: skip it whole
+
+            auto t = t0;
+            while (true) {
+                auto step = tau / (sigma * ray_length);
+                if (t + step >= t1) {
+                    tau -= sigma * ray_length * (t1 - t);
+                    return true;
+                }
+
+                t += step;
+                if (random_double() * sigma < density(r.at(t))) {
+                    hit_t = t;
+                    return false;
+                }
+                tau = -log(1 - random_double());  // null collision
+            }
+        });
+
+        if (hit_t == infinity)
+            return false;
+
+        rec.t = hit_t;
+        rec.p = r.at(rec.t);
+        rec.normal = vec3(1,0,0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = phase_function;
+        rec.u_rate = rec.v_rate = 0;
+
+        return true;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override {
+        // ratio tracking with the same per-cell majorants
+        auto ray_length = r.direction().length();
+        auto tau = -log(1 - random_double());
+        auto tr = 1.0;
+
+        traverse(r, ray_t, [&](double t0, double t1, double sigma)
+        {
+            if (sigma <= 0)
+                return true;
+
+            auto t = t0;
+            while (true) {
+                auto step = tau / (sigma * ray_length);
+                if (t + step >= t1) {
+                    tau -= sigma * ray_length * (t1 - t);
+                    return true;
+                }
+
+                t += step;
+                tr *= 1 - density(r.at(t)) / sigma;
+                if (tr <= 0) {
+                    tr = 0;
+                    return false;
+                }
+                tau = -log(1 - random_double());
+            }
+        });
+
+        return tr;
+    }
+
+  private:
+    shared_ptr<voxel_grid> grid;
+    bbox bounds;
+    double scale;
+    point3 lo;
+    vec3 to_grid;   // world -> voxel units per axis
+
+    // Calls visit(t0, t1, majorant) for every brick cell the ray crosses within ray_t, front to back,
+    // until visit returns false.
+    template<typename Func>
+    void traverse(const ray& r, interval ray_t, Func visit) const
+    {
+        // clip to the box
+        auto t_min = fmax(ray_t.min, 0.0);
+        auto t_max = ray_t.max;
+        for (int i = 0; i < 3; ++i)
+        {
+            auto inv_dir = 1 / r.direction()[i];
+            auto t0 = (bounds.axis(i).min - r.origin()[i]) * inv_dir;
+            auto t1 = (bounds.axis(i).max - r.origin()[i]) * inv_dir;
+            if (inv_dir < 0)
+                std::swap(t0, t1);
+            t_min = fmax(t_min, t0);
+            t_max = fmin(t_max, t1);
+        }
+        if (t_min >= t_max)
+            return;
+
+        // ray in brick units
+        const int cells[3] = { grid->bricks_x(), grid->bricks_y(), grid->bricks_z() };
+        auto origin = (r.origin() - lo) * to_grid / voxel_grid::brick_size;
+        auto dir = r.direction() * to_grid / voxel_grid::brick_size;
+        auto start = origin + t_min * dir;
+
+        int cell[3], step[3];
+        double t_next[3], t_delta[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            cell[i] = std::min(std::max(static_cast<int>(floor(start[i])), 0), cells[i] - 1);
+            if (dir[i] > 0) {
+                step[i] = 1;
+                t_next[i] = t_min + (cell[i] + 1 - start[i]) / dir[i];
+                t_delta[i] = 1 / dir[i];
+            } else if (dir[i] < 0) {
+                step[i] = -1;
+                t_next[i] = t_min + (cell[i] - start[i]) / dir[i];
+                t_delta[i] = -1 / dir[i];
+            } else {
+                step[i] = 0;
+                t_next[i] = infinity;
+                t_delta[i] = infinity;
+            }
+        }
+
+        auto t = t_min;
+        while (true)
+        {
+            int axis = 0;
+            if (t_next[1] < t_next[axis]) axis = 1;
+            if (t_next[2] < t_next[axis]) axis = 2;
+
+            auto t_exit = fmin(t_next[axis], t_max);
+            auto sigma = scale * grid->brick_majorant(cell[0], cell[1], cell[2]);
+            if (!visit(t, t_exit, sigma) || t_exit >= t_max)
+                return;
+
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= cells[axis])
+                return;
+
+            t = t_exit;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+#endif
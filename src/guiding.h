@@ -0,0 +1,383 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "utility.h"
+#include "bbox.h"
+#include "pdf.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Path guiding with a spatial-directional tree (SD-tree, Mueller et al. 2017):
+//  - a binary spatial tree subdivides the scene bounds,
+//  - every spatial leaf owns a directional quadtree approximating incident radiance there.
+// Each training pass records into a "building" quadtree while sampling from the one
+// learned in the previous pass; between passes both trees are refined.
+
+
+// float accumulator that render threads can add into without locks.
+// copyable so that trees can be duplicated between passes (never while rendering).
+class atomic_float
+{
+public:
+    atomic_float(float v = 0) : value(v) {}
+    atomic_float(const atomic_float& other) : value(other.load()) {}
+    atomic_float& operator=(const atomic_float& other) { value.store(other.load(), std::memory_order_relaxed); return *this; }
+
+    float load() const { return value.load(std::memory_order_relaxed); }
+
+    void add(float v)
+    {
+        auto current = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(current, current + v, std::memory_order_relaxed)) {}
+    }
+
+private:
+    std::atomic<float> value;
+};
+
+
+// directional quadtree over the cylindrical mapping (cos_theta, phi) -> [0,1]^2.
+// the mapping is area preserving, so a density on the square is turned into a density
+// over the unit sphere by the constant factor 1 / (4*pi).
+class dtree
+{
+public:
+    struct node
+    {
+        atomic_float sum[4];            // flux recorded into each quadrant
+        uint32_t child[4] = {0, 0, 0, 0}; // 0 marks a leaf quadrant (the root is never a child)
+
+        float total() const { return sum[0].load() + sum[1].load() + sum[2].load() + sum[3].load(); }
+    };
+
+    dtree() : nodes(1) {}
+
+
+    // Method
+
+    size_t node_count() const { return nodes.size(); }
+    double flux() const { return nodes[0].total(); }
+
+    void record(const vec3& direction, double weight)
+    {
+        double x, y;
+        to_square(direction, x, y);
+
+        uint32_t idx = 0;
+        while (true)
+        {
+            int q = quadrant(x, y);
+            nodes[idx].sum[q].add(static_cast<float>(weight));
+            if (nodes[idx].child[q] == 0)
+                return;
+            idx = nodes[idx].child[q];
+        }
+    }
+
+    double get_pdf(const vec3& direction) const
+    {
+        double x, y;
+        to_square(direction, x, y);
+
+        double density = 1.0;
+        uint32_t idx = 0;
+        while (true)
+        {
+            auto total = nodes[idx].total();
+            if (total <= 0)
+                return 0;
+
+            int q = quadrant(x, y);
+            density *= 4.0 * nodes[idx].sum[q].load() / total;
+            if (nodes[idx].child[q] == 0)
+                break;
+            idx = nodes[idx].child[q];
+        }
+
+        return density / (4 * pi);
+    }
+
+    vec3 sample() const
+    {
+        // pick a quadrant proportionally to its flux on every level,
+        // then sample the reached leaf region uniformly.
+        double origin_x = 0, origin_y = 0, size = 1;
+        uint32_t idx = 0;
+        while (true)
+        {
+            const auto& n = nodes[idx];
+            auto target = random_double() * n.total();
+
+            int q = 0;
+            for (; q < 3; ++q)
+            {
+                target -= n.sum[q].load();
+                if (target < 0)
+                    break;
+            }
+
+            size *= 0.5;
+            origin_x += (q & 1) * size;
+            origin_y += (q >> 1) * size;
+            if (n.child[q] == 0)
+                break;
+            idx = n.child[q];
+        }
+
+        return from_square(origin_x + random_double() * size, origin_y + random_double() * size);
+    }
+
+    // Rebuild this tree's structure from the flux recorded in `previous`:
+    // quadrants holding more than `threshold` of the total energy are subdivided.
+    // Refinement is breadth first, so when `max_nodes` cuts it short the coarse levels still exist.
+    void refine_from(const dtree& previous, double threshold, int max_depth, size_t max_nodes)
+    {
+        struct item { uint32_t idx; int64_t prev_idx; int depth; double fraction; };
+
+        nodes.assign(1, node());
+        auto total = previous.flux();
+        if (total <= 0)
+            return;
+
+        std::deque<item> queue;
+        queue.push_back({0, 0, 1, 1.0});
+        while (!queue.empty())
+        {
+            auto it = queue.front();
+            queue.pop_front();
+
+            for (int q = 0; q < 4; ++q)
+            {
+                // quadrants the previous tree did not resolve inherit an even share of their parent.
+                auto fraction = it.prev_idx >= 0 ? previous.nodes[it.prev_idx].sum[q].load() / total
+                                                 : it.fraction / 4;
+                if (it.depth >= max_depth || fraction <= threshold || nodes.size() + 1 > max_nodes)
+                    continue;
+
+                int64_t prev_child = -1;
+                if (it.prev_idx >= 0 && previous.nodes[it.prev_idx].child[q] != 0)
+                    prev_child = previous.nodes[it.prev_idx].child[q];
+
+                auto child = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+                nodes[it.idx].child[q] = child;
+                queue.push_back({child, prev_child, it.depth + 1, fraction});
+            }
+        }
+    }
+
+private:
+    std::vector<node> nodes;
+
+    static int quadrant(double& x, double& y)
+    {
+        // return the quadrant of (x, y) and rescale (x, y) into that quadrant.
+        int qx = x >= 0.5;
+        int qy = y >= 0.5;
+        x = 2 * x - qx;
+        y = 2 * y - qy;
+        return qx + 2 * qy;
+    }
+
+    static void to_square(const vec3& direction, double& x, double& y)
+    {
+        auto d = unit_vector(direction);
+        auto cos_theta = fmin(fmax(d.z(), -1.0), 1.0);
+        auto phi = atan2(d.y(), d.x());
+        if (phi < 0)
+            phi += 2 * pi;
+
+        x = fmin((cos_theta + 1) * 0.5, 0.99999999);
+        y = fmin(phi / (2 * pi), 0.99999999);
+    }
+
+    static vec3 from_square(double x, double y)
+    {
+        auto cos_theta = 2 * x - 1;
+        auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+        auto phi = 2 * pi * y;
+        return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+    }
+};
+
+
+class sd_tree
+{
+public:
+    double spatial_threshold = 4000;  // samples a spatial leaf may collect in the first pass before it splits
+    double flux_threshold    = 0.01;  // energy fraction above which a quadtree node is subdivided
+    int    max_dtree_depth   = 20;
+
+    sd_tree(const bbox& scene_bounds, size_t memory_budget_bytes) : budget(memory_budget_bytes)
+    {
+        // use a cube around the scene so that alternating splits keep the cells cubic.
+        auto extent = fmax(scene_bounds.x.size(), fmax(scene_bounds.y.size(), scene_bounds.z.size()));
+        origin = point3(scene_bounds.x.min, scene_bounds.y.min, scene_bounds.z.min);
+        inv_extent = extent > 0 ? 1 / extent : 1;
+
+        nodes.push_back(snode(0, 0));
+        leaves.emplace_back();
+    }
+
+
+    // Method
+
+    // quadtree learned in the previous passes, or nullptr where nothing has been learned yet.
+    const dtree* sampling_tree(const point3& p) const
+    {
+        const auto& l = leaves[find_leaf(p)];
+        return l.sampling.flux() > 0 ? &l.sampling : nullptr;
+    }
+
+    // thread safe: only atomics are touched while rendering.
+    void record(const point3& p, const vec3& direction, double weight)
+    {
+        if (!(weight > 0) || !std::isfinite(weight))
+            return;
+
+        auto& l = leaves[find_leaf(p)];
+        l.building.record(direction, weight);
+        l.samples.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Called between training passes (0-based `pass`), never concurrently with rendering.
+    void refine(int pass)
+    {
+        // 1. the quadtrees just filled become the sampling distribution of the next pass.
+        for (auto& l : leaves)
+            l.sampling = l.building;
+
+        // 2. split spatial leaves that received many samples; the threshold grows with sqrt(2^pass)
+        //    like the per-pass sample count, so cells are not over-refined as passes double in size.
+        auto threshold = spatial_threshold * sqrt(pow(2.0, pass));
+        for (size_t n = 0; n < nodes.size(); ++n)
+        {
+            if (!nodes[n].is_leaf)
+                continue;
+
+            auto& l = leaves[nodes[n].leaf];
+            if (l.samples.load() <= threshold || memory_bytes() + split_cost(l) > budget)
+                continue;
+
+            split(n);  // appended children are visited by this loop as well
+        }
+
+        // 3. rebuild the building quadtrees from the learned flux, sharing what is left of the budget.
+        auto used = nodes.size() * sizeof(snode);
+        for (const auto& l : leaves)
+            used += l.sampling.node_count() * sizeof(dtree::node);
+        auto spare_nodes = budget > used ? (budget - used) / sizeof(dtree::node) : 0;
+        auto max_nodes = std::max<size_t>(1, spare_nodes / leaves.size());
+
+        for (auto& l : leaves)
+        {
+            l.building.refine_from(l.sampling, flux_threshold, max_dtree_depth, max_nodes);
+            l.samples.store(0);
+        }
+    }
+
+    size_t memory_bytes() const
+    {
+        auto bytes = nodes.size() * sizeof(snode) + leaves.size() * sizeof(leaf);
+        for (const auto& l : leaves)
+            bytes += (l.sampling.node_count() + l.building.node_count()) * sizeof(dtree::node);
+        return bytes;
+    }
+
+    size_t leaf_count() const { return leaves.size(); }
+
+private:
+    struct snode
+    {
+        int axis;            // split axis of an interior node
+        uint32_t child[2];
+        uint32_t leaf;       // index into leaves
+        bool is_leaf = true;
+
+        snode(int a, uint32_t l) : axis(a), child{0, 0}, leaf(l) {}
+    };
+
+    struct leaf
+    {
+        dtree sampling;
+        dtree building;
+        std::atomic<uint64_t> samples{0};
+
+        leaf() {}
+        leaf(const leaf& other) : sampling(other.sampling), building(other.building), samples(other.samples.load()) {}
+    };
+
+    std::vector<snode> nodes;
+    std::vector<leaf> leaves;
+    point3 origin;
+    double inv_extent;
+    size_t budget;
+
+    uint32_t find_leaf(const point3& p) const
+    {
+        double c[3];
+        for (int i = 0; i < 3; ++i)
+            c[i] = fmin(fmax((p[i] - origin[i]) * inv_extent, 0.0), 1.0);
+
+        uint32_t n = 0;
+        while (!nodes[n].is_leaf)
+        {
+            auto& x = c[nodes[n].axis];
+            int side = x >= 0.5;
+            x = 2 * x - side;
+            n = nodes[n].child[side];
+        }
+        return nodes[n].leaf;
+    }
+
+    size_t split_cost(const leaf& l) const
+    {
+        // one extra leaf with a copy of both quadtrees, plus two tree nodes.
+        return 2 * sizeof(snode) + sizeof(leaf) + (l.sampling.node_count() + l.building.node_count()) * sizeof(dtree::node);
+    }
+
+    void split(size_t n)
+    {
+        auto child_axis = (nodes[n].axis + 1) % 3;  // children split along the next axis
+
+        auto parent_leaf = nodes[n].leaf;
+        leaves[parent_leaf].samples.store(leaves[parent_leaf].samples.load() / 2);
+        leaf copy = leaves[parent_leaf];            // both halves start from the parent's distribution
+        leaves.push_back(copy);
+
+        auto first = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(snode(child_axis, parent_leaf));
+        nodes.push_back(snode(child_axis, static_cast<uint32_t>(leaves.size() - 1)));
+
+        nodes[n].is_leaf = false;
+        nodes[n].child[0] = first;
+        nodes[n].child[1] = first + 1;
+    }
+};
+
+
+// pdf following the learned incident radiance of one spatial cell.
+class guided_pdf : public pdf
+{
+public:
+    guided_pdf(const dtree& _tree) : tree(_tree) {}
+
+    double get_value(const vec3& direction) const override
+    {
+        return tree.get_pdf(direction);
+    }
+
+    vec3 generate_randomDir() const override
+    {
+        return tree.sample();
+    }
+
+private:
+    const dtree& tree;
+};
+
+
+#endif //GUIDING_H
@@ -0,0 +1,317 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include "utility.h"
+#include "object.h"
+#include "material.h"
+#include "cuboid.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Terrain as a 2D array of heights over a regular grid in the xz plane:
+//  - columns:  every cell is a flat-topped box from the base up to its height (a grid of boxes),
+//  - bilinear: heights sit on the grid vertices and every cell is the bilinear patch between them.
+// A ray walks the cells it crosses with a 2D DDA. A pyramid of per-block maximum heights lets it
+// jump over whole blocks it passes above, so the cost grows with the cells along the ray and not
+// with the size of the terrain. A float per height plus about a third of that for the pyramid.
+
+
+class heightfield : public object
+{
+public:
+    enum cell_shape { columns, bilinear };
+
+    // corner: the grid's (min x, base y, min z). heights: absolute y, cells_x * cells_z of them
+    // row by row along x for columns, (cells_x + 1) * (cells_z + 1) vertices for bilinear patches.
+    heightfield(const point3& _corner, double _cell_x, double _cell_z, int _cells_x, int _cells_z,
+                std::vector<float> _heights, shared_ptr<material> _material, cell_shape _shape = columns)
+      : corner(_corner), cell_x(_cell_x), cell_z(_cell_z), nx(_cells_x), nz(_cells_z),
+        heights(std::move(_heights)), mat(material_table::global().id(_material)), shape(_shape)
+    {
+        // too few or too many heights for the grid: an empty terrain rather than reads past the end
+        size_t expected = nx <= 0 || nz <= 0 ? 0 : shape == columns ? cell_count() : static_cast<size_t>(nx + 1) * (nz + 1);
+        if (heights.size() != expected)
+        {
+            std::cerr << "ERROR: Heightfield of " << nx << " x " << nz << (shape == columns ? " columns" : " patches")
+                      << " needs " << expected << " heights, got " << heights.size() << ".\n";
+            nx = nz = 0;
+            heights.clear();
+        }
+        build();
+    }
+
+
+    // Method
+
+    size_t cell_count() const { return static_cast<size_t>(nx) * nz; }
+
+    size_t memory_bytes() const
+    {
+        size_t bytes = heights.size() * sizeof(float);
+        for (const auto& level : max_heights)
+            bytes += level.size() * sizeof(float);
+        return bytes;
+    }
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        if (nx <= 0 || nz <= 0)
+            return false;
+
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+
+        // the part of the ray inside the terrain's bounds
+        auto t = ray_t.min, t_exit = ray_t.max;
+        for (int a = 0; a < 3; ++a)
+        {
+            auto inv_dir = 1 / d[a];
+            auto t0 = (bounds.axis(a).min - o[a]) * inv_dir;
+            auto t1 = (bounds.axis(a).max - o[a]) * inv_dir;
+            if (inv_dir < 0)
+                std::swap(t0, t1);
+            t = fmax(t, t0);
+            t_exit = fmin(t_exit, t1);
+        }
+        if (t > t_exit)
+            return false;
+
+        int ix = cell_along(o.x() + t * d.x() - corner.x(), cell_x, 0, nx - 1);
+        int iz = cell_along(o.z() + t * d.z() - corner.z(), cell_z, 0, nz - 1);
+        int level = top_level;
+
+        while (true)
+        {
+            // the block of `level` holding the current cell, in cells, and where the ray leaves it
+            int bx = ix >> level, bz = iz >> level;
+            int x_lo = bx << level, x_hi = std::min((bx + 1) << level, nx);
+            int z_lo = bz << level, z_hi = std::min((bz + 1) << level, nz);
+
+            auto tx = d.x() > 0 ? (corner.x() + x_hi * cell_x - o.x()) / d.x()
+                    : d.x() < 0 ? (corner.x() + x_lo * cell_x - o.x()) / d.x() : infinity;
+            auto tz = d.z() > 0 ? (corner.z() + z_hi * cell_z - o.z()) / d.z()
+                    : d.z() < 0 ? (corner.z() + z_lo * cell_z - o.z()) / d.z() : infinity;
+            bool exit_x = tx < tz;
+            auto t_out = fmin(fmin(tx, tz), t_exit);
+
+            // y is linear along the ray: its lowest point over the block is at one end
+            auto y_low = fmin(o.y() + t * d.y(), o.y() + t_out * d.y());
+            if (y_low <= max_heights[level][bz * level_width(level) + bx])
+            {
+                if (level > 0)
+                {
+                    --level;   // may hit something in there: look closer
+                    continue;
+                }
+                if (hit_cell(ix, iz, r, t, t_out, ray_t, rec))
+                    return true;
+            }
+
+            // step over the block, into the neighbouring cell across the face the ray leaves by
+            if (t_out >= t_exit)
+                return false;
+            t = t_out;
+            if (exit_x)
+            {
+                ix = d.x() > 0 ? x_hi : x_lo - 1;
+                iz = cell_along(o.z() + t * d.z() - corner.z(), cell_z, z_lo, z_hi - 1);
+            }
+            else
+            {
+                iz = d.z() > 0 ? z_hi : z_lo - 1;
+                ix = cell_along(o.x() + t * d.x() - corner.x(), cell_x, x_lo, x_hi - 1);
+            }
+            if (ix < 0 || ix >= nx || iz < 0 || iz >= nz)
+                return false;
+
+            if (level < top_level)
+                ++level;   // and try coarser blocks again
+        }
+    }
+
+    void translate(vec3 dir) override
+    {
+        corner += dir;
+        for (auto& h : heights)
+            h += static_cast<float>(dir.y());
+        build();
+    }
+
+private:
+    point3 corner;
+    double cell_x, cell_z;
+    int nx, nz;
+    std::vector<float> heights;
+    material_id mat;
+    cell_shape shape;
+
+    std::vector<std::vector<float>> max_heights;   // level 0: per cell; level k: per 2^k x 2^k block
+    int top_level = 0;                              // its one block covers the whole grid
+    bbox bounds;                                    // tight, for clipping rays
+    bbox bounding_box;
+
+    int level_width(int level) const { return (nx + (1 << level) - 1) >> level; }
+    int level_depth(int level) const { return (nz + (1 << level) - 1) >> level; }
+
+    float vertex_height(int i, int j) const { return heights[static_cast<size_t>(j) * (nx + 1) + i]; }
+
+    static int cell_along(double offset, double size, int lo, int hi)
+    {
+        auto c = static_cast<int>(floor(offset / size));
+        return std::min(std::max(c, lo), hi);
+    }
+
+    void build()
+    {
+        max_heights.clear();
+        if (nx <= 0 || nz <= 0)
+            return;
+
+        // level 0: highest point of every cell
+        std::vector<float> level(cell_count());
+        for (int j = 0; j < nz; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                level[static_cast<size_t>(j) * nx + i] = shape == columns
+                    ? heights[static_cast<size_t>(j) * nx + i]
+                    : std::max(std::max(vertex_height(i, j), vertex_height(i + 1, j)),
+                               std::max(vertex_height(i, j + 1), vertex_height(i + 1, j + 1)));   // a bilinear patch peaks at a corner
+            }
+        }
+        max_heights.push_back(std::move(level));
+
+        // coarser levels: maximum of up to 2 x 2 blocks below
+        top_level = 0;
+        while (level_width(top_level) > 1 || level_depth(top_level) > 1)
+        {
+            const auto& below = max_heights[top_level];
+            int below_width = level_width(top_level), below_depth = level_depth(top_level);
+            ++top_level;
+
+            int width = level_width(top_level), depth = level_depth(top_level);
+            std::vector<float> coarse(static_cast<size_t>(width) * depth, -std::numeric_limits<float>::max());
+            for (int j = 0; j < below_depth; ++j)
+                for (int i = 0; i < below_width; ++i)
+                {
+                    auto& m = coarse[static_cast<size_t>(j / 2) * width + i / 2];
+                    m = std::max(m, below[static_cast<size_t>(j) * below_width + i]);
+                }
+            max_heights.push_back(std::move(coarse));
+        }
+
+        double lowest = corner.y();
+        if (shape == bilinear)
+            lowest = *std::min_element(heights.begin(), heights.end());
+        double highest = max_heights[top_level][0];
+
+        bounds = bbox(point3(corner.x(), lowest, corner.z()),
+                      point3(corner.x() + nx * cell_x, fmax(lowest, highest), corner.z() + nz * cell_z));
+        bounding_box = bounds.pad();
+    }
+
+    // hit inside cell (ix, iz), which the ray crosses over [t_in, t_out]
+    bool hit_cell(int ix, int iz, const ray& r, double t_in, double t_out, const interval& ray_t, intersect_record& rec) const
+    {
+        auto x0 = corner.x() + ix * cell_x;
+        auto z0 = corner.z() + iz * cell_z;
+
+        if (shape == columns)
+        {
+            // the cell's box; any hit of it lies in this cell's stretch of the ray
+            auto lo = point3(x0, corner.y(), z0);
+            auto hi = point3(x0 + cell_x, heights[static_cast<size_t>(iz) * nx + ix], z0 + cell_z);
+
+            double t_near, t_far;
+            int near_face, far_face;
+            if (!cuboid::slab(lo, hi, r.origin(), r.direction(), t_near, near_face, t_far, far_face))
+                return false;
+
+            auto t = t_near;
+            auto face = near_face;
+            if (!ray_t.surrounds(t))
+            {
+                t = t_far;
+                face = far_face;
+                if (!ray_t.surrounds(t))
+                    return false;
+            }
+
+            rec.t = t;
+            rec.p = r.at(t);
+            rec.mat = mat;
+            rec.set_face_normal(r, cuboid::face_normal(face));
+            cuboid::face_uv(face, rec.p, lo, hi, rec.u, rec.v);
+            cuboid::face_uv_rates(face, lo, hi, rec.u_rate, rec.v_rate);
+            return true;
+        }
+
+        // bilinear patch H(u,v) = A + B u + C v + D u v over the cell, u and v in [0, 1].
+        // Along the ray, from t_in, u and v are linear in s = t - t_in and y - H is quadratic.
+        auto h00 = vertex_height(ix, iz), h10 = vertex_height(ix + 1, iz);
+        auto h01 = vertex_height(ix, iz + 1), h11 = vertex_height(ix + 1, iz + 1);
+        double A = h00, B = h10 - h00, C = h01 - h00, D = h00 - h10 - h01 + h11;
+
+        const auto& d = r.direction();
+        auto p = r.at(t_in);
+        auto u0 = (p.x() - x0) / cell_x, v0 = (p.z() - z0) / cell_z;
+        auto du = d.x() / cell_x, dv = d.z() / cell_z;
+
+        auto qa = -D * du * dv;
+        auto qb = d.y() - B * du - C * dv - D * (u0 * dv + v0 * du);
+        auto qc = p.y() - (A + B * u0 + C * v0 + D * u0 * v0);
+
+        // roots, smallest first; a little slack past the cell's ends so rays through a shared edge
+        // cannot slip between two patches
+        auto slack = 1e-6 * (t_out - t_in) + 1e-9;
+        double roots[2];
+        int root_count = 0;
+        if (fabs(qa) < 1e-12 * (fabs(qb) + fabs(qc)) || qa == 0)
+        {
+            if (qb != 0)
+                roots[root_count++] = -qc / qb;
+        }
+        else
+        {
+            auto discriminant = qb * qb - 4 * qa * qc;
+            if (discriminant < 0)
+                return false;
+            auto q = -0.5 * (qb + (qb < 0 ? -sqrt(discriminant) : sqrt(discriminant)));   // no cancellation
+            auto s0 = q / qa;
+            auto s1 = q != 0 ? qc / q : s0;
+            roots[root_count++] = fmin(s0, s1);
+            roots[root_count++] = fmax(s0, s1);
+        }
+
+        for (int k = 0; k < root_count; ++k)
+        {
+            auto s = roots[k];
+            auto t = t_in + s;
+            if (s < -slack || t > t_out + slack || !ray_t.surrounds(t))
+                continue;
+
+            auto u = std::min(std::max(u0 + s * du, 0.0), 1.0);
+            auto v = std::min(std::max(v0 + s * dv, 0.0), 1.0);
+            auto dh_du = B + D * v;
+            auto dh_dv = C + D * u;
+
+            rec.t = t;
+            rec.p = r.at(t);
+            rec.mat = mat;
+            rec.set_face_normal(r, unit_vector(vec3(-dh_du / cell_x, 1, -dh_dv / cell_z)));
+            rec.u = (ix + u) / nx;   // the whole terrain spans [0, 1] x [0, 1]
+            rec.v = (iz + v) / nz;
+            rec.u_rate = 1 / (nx * cell_x);   // over the ground plan, slopes aside
+            rec.v_rate = 1 / (nz * cell_z);
+            return true;
+        }
+        return false;
+    }
+};
+
+
+#endif //HEIGHTFIELD_H
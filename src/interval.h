@@ -1,44 +1,49 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 
-class interval {
+template <typename T>
+class basic_interval {
   public:
-    double min, max;
+    T min, max;
 
-    interval() : min(+infinity), max(-infinity) {} // Default interval is empty
+    basic_interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double _min, double _max) : min(_min), max(_max) {}
-    interval(const interval& a, const interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+    basic_interval(T _min, T _max) : min(_min), max(_max) {}
+    basic_interval(const basic_interval& a, const basic_interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
 
-    bool contains(double x) const {
+    bool contains(T x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(T x) const {
         return min < x && x < max;
     }
     
     // ensure final color [0, 1]
     
-    double clamp(double x) const {
+    T clamp(T x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    double size() const {
+    T size() const {
         return max - min;
     }
 
-    interval expand(double delta) const {
+    basic_interval expand(T delta) const {
         auto padding = delta/2;
-        return interval(min - padding, max + padding);
+        return basic_interval(min - padding, max + padding);
     }
 
-    static const interval empty, universe;
+    static const basic_interval empty, universe;
 };
 
-const interval interval::empty    = interval(+infinity, -infinity);
-const interval interval::universe = interval(-infinity, +infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::empty    = basic_interval<T>(+infinity, -infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::universe = basic_interval<T>(-infinity, +infinity);
 
-#endif
\ No newline at end of file
+using interval = basic_interval<real>;
+
+#endif
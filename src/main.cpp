@@ -8,10 +8,21 @@
 #include "scene.h"
 #include "material.h"
 #include "bvh.h"
+#include "uniform_grid.h"
 #include "bbox.h"
 #include "texture.h"
 #include "quad.h"
+#include "cuboid.h"
 #include "constant_medium.h"
+#include "grid_medium.h"
+#include "perlin.h"
+#include "mesh_loader.h"
+#include "primitive_pool.h"
+#include "heightfield.h"
+#include "sphere_cloud.h"
+#include "variant_scene.h"
+#include "asset_registry.h"
+#include "task_graph.h"
 #include "pdf.h"
 
 
@@ -24,6 +35,9 @@ void quads();
 void simple_light();
 void cornell_box();
 void cornell_smoke();
+void cornell_cloud();
+void many_lights();
+void cornell_mesh();
 void rayTracingtheNextWeek_final_scene(int image_width, int samples_per_pixel, int max_depth);
 
 int main()
@@ -61,6 +75,15 @@ int main()
     case 9:
         rayTracingtheNextWeek_final_scene(800, 200, 40);
         break;
+    case 10:
+        cornell_cloud();
+        break;
+    case 11:
+        many_lights();
+        break;
+    case 12:
+        cornell_mesh();
+        break;
     default:
         rayTracingtheNextWeek_final_scene(400, 100,  4);
         break;
@@ -71,16 +94,17 @@ int main()
 
 void materials()
 {
+    auto& assets = asset_registry::global();
     camera cam;
     scene world;
     scene lights;
     
     // Objects
 
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left   = make_shared<dielectric>(1.5);
-    auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.3);
+    auto material_ground = assets.intern_lambertian(color(0.8, 0.8, 0.0));
+    auto material_center = assets.intern_lambertian(color(0.1, 0.2, 0.5));
+    auto material_left   = assets.intern_dielectric(1.5);
+    auto material_right  = assets.intern_metal(color(0.8, 0.6, 0.2), 0.3);
 
     world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0),  100.0, material_ground));
     world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),    0.5, material_center));
@@ -114,12 +138,15 @@ void materials()
 
 void random_spheres()
 {
+    auto& assets = asset_registry::global();
     camera cam;
     scene world;
     scene lights;
     
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    auto spheres = make_shared<primitive_pool>();   // ~480 spheres in one pool
+
+    auto ground_material = assets.intern_lambertian(color(0.5, 0.5, 0.5));
+    spheres->add_sphere(point3(0,-1000,0), 1000, ground_material);
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -132,35 +159,36 @@ void random_spheres()
                 if (choose_mat < 0.8) {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = assets.intern_lambertian(albedo);
                     auto center2 = center + vec3(0, random_double(0,.5), 0);                   // motion blur: random destination
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));     // motion blur: add new sphere with start and end location
-                    // world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    spheres->add_sphere(center, center2, 0.2, sphere_material);     // motion blur: add new sphere with start and end location
+                    // spheres->add_sphere(center, 0.2, sphere_material);
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = assets.intern_metal(albedo, fuzz);
+                    spheres->add_sphere(center, 0.2, sphere_material);
                 } else {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = assets.intern_dielectric(1.5);
+                    spheres->add_sphere(center, 0.2, sphere_material);
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = assets.intern_dielectric(1.5);
+    spheres->add_sphere(point3(0, 1, 0), 1.0, material1);
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = assets.intern_lambertian(color(0.4, 0.2, 0.1));
+    spheres->add_sphere(point3(-4, 1, 0), 1.0, material2);
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = assets.intern_metal(color(0.7, 0.6, 0.5), 0.0);
+    spheres->add_sphere(point3(4, 1, 0), 1.0, material3);
 
-    world = scene(make_shared<bvh_node>(world));  // build BVH
+    spheres->build();  // build BVH
+    world.add(spheres);
 
     cam.aspect_ratio      = 16.0 / 9.0;
     cam.img_width         = 400;
@@ -183,13 +211,14 @@ void random_spheres()
 
 void two_spheres()
 {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
-    auto checker = make_shared<checker_board>(0.8, color(.2, .3, .1), color(.9, .9, .9));
+    auto checker = assets.intern_checker(0.8, color(.2, .3, .1), color(.9, .9, .9));
 
-    world.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+    world.add(make_shared<sphere>(point3(0,-10, 0), 10, assets.intern_lambertian(checker)));
+    world.add(make_shared<sphere>(point3(0, 10, 0), 10, assets.intern_lambertian(checker)));
 
     camera cam;
 
@@ -211,10 +240,11 @@ void two_spheres()
 }
 
 void earth() {
+    auto& assets = asset_registry::global();
     scene lights;
 
-    auto earth_texture = make_shared<image_texture>("../image/earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
+    auto earth_texture = assets.intern_image("../image/earthmap.jpg");
+    auto earth_surface = assets.intern_lambertian(earth_texture);
     auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
 
     camera cam;
@@ -237,12 +267,13 @@ void earth() {
 }
 
 void two_perlin_spheres() {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = assets.intern_noise(4);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, assets.intern_lambertian(pertext)));
+    world.add(make_shared<sphere>(point3(0,2,0), 2, assets.intern_lambertian(pertext)));
 
     camera cam;
 
@@ -265,15 +296,16 @@ void two_perlin_spheres() {
 
 
 void quads() {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
     // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    auto left_red     = assets.intern_lambertian(color(1.0, 0.2, 0.2));
+    auto back_green   = assets.intern_lambertian(color(0.2, 1.0, 0.2));
+    auto right_blue   = assets.intern_lambertian(color(0.2, 0.2, 1.0));
+    auto upper_orange = assets.intern_lambertian(color(1.0, 0.5, 0.0));
+    auto lower_teal   = assets.intern_lambertian(color(0.2, 0.8, 0.8));
 
     // Quads
     world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
@@ -298,20 +330,21 @@ void quads() {
 
     cam.background        = color(0.70, 0.80, 1.00);
 
-    cam.render(world, lights);
+    cam.render(variant_scene(world), lights);
 }
 
 void simple_light() {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
     // world objects
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = assets.intern_noise(4);
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, assets.intern_lambertian(pertext)));
+    world.add(make_shared<sphere>(point3(0,2,0), 2, assets.intern_lambertian(pertext)));
 
     // light sources
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
+    auto difflight = assets.intern_light(color(4,4,4));
     world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
     world.add(make_shared<quad>(point3(3,1,-2), vec3(2,0,0), vec3(0,2,0), difflight));
     lights.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
@@ -333,18 +366,19 @@ void simple_light() {
 
     cam.background        = color(0,0,0);
 
-    cam.render(world, lights);
+    cam.render(variant_scene(world), lights);
 }
 
 void cornell_box() {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(30, 30, 30));
-    // auto light = make_shared<diffuse_light>(8.0f * color(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * color(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f * color(0.737f+0.642f,0.737f+0.159f,0.737f));
+    auto red   = assets.intern_lambertian(color(.65, .05, .05));
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto green = assets.intern_lambertian(color(.12, .45, .15));
+    auto light = assets.intern_light(color(30, 30, 30));
+    // auto light = assets.intern_light(8.0f * color(0.747f+0.058f, 0.747f+0.258f, 0.747f) + 15.6f * color(0.740f+0.287f,0.740f+0.160f,0.740f) + 18.4f * color(0.737f+0.642f,0.737f+0.159f,0.737f));
     
 
     // world objects
@@ -362,16 +396,10 @@ void cornell_box() {
     auto box2 = box(point3(0,0,0), point3(165,165,165), white);
 
     // world space rotation and translation
-    for (auto quad : box1->objects)
-    {
-        quad->rotate(15.0, 1);  // x = 0, y = 1, z = 2
-        quad->translate(vec3(265,0,295));
-    }
-    for (auto quad : box2->objects)
-    {
-        quad->rotate(-18.0, 1); // x = 0, y = 1, z = 2
-        quad->translate(vec3(130,0,65));
-    }
+    box1->rotate(15.0, 1);  // x = 0, y = 1, z = 2
+    box1->translate(vec3(265,0,295));
+    box2->rotate(-18.0, 1); // x = 0, y = 1, z = 2
+    box2->translate(vec3(130,0,65));
 
     world.add(box1);
     world.add(box2);
@@ -395,17 +423,20 @@ void cornell_box() {
 
     cam.defocus_angle     = 0;
 
-    cam.render(world, lights);
+    cam.path_guiding      = false;  // set true to learn an SD-tree in training passes and guide bounces with it
+
+    cam.render(variant_scene(world), lights);   // spheres, quads, boxes and meshes by static dispatch
 }
 
 void cornell_smoke() {
+    auto& assets = asset_registry::global();
     scene world;
     scene lights;
 
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    auto red   = assets.intern_lambertian(color(.65, .05, .05));
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto green = assets.intern_lambertian(color(.12, .45, .15));
+    auto light = assets.intern_light(color(7, 7, 7));
 
     // light soureces
     world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
@@ -418,27 +449,132 @@ void cornell_smoke() {
     world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
     world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
 
-    shared_ptr<scene> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    shared_ptr<scene> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    for (auto quad : box1->objects)
+    auto box1 = box(point3(0,0,0), point3(165,330,165), white);
+    auto box2 = box(point3(0,0,0), point3(165,165,165), white);
+    box1->rotate(15.0, 1);
+    box1->translate(vec3(265,0,295));
+    box2->rotate(-18.0, 1);
+    box2->translate(vec3(130,0,65));
+
+    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
+    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.img_width         = 400;
+    cam.samples_per_pixel = 100;
+    cam.sample_max_depth  = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov              = 40;
+    cam.lookfrom          = point3(278, 278, -800);
+    cam.lookat            = point3(278, 278, 0);
+    cam.vup               = vec3(0,1,0);
+
+    cam.defocus_angle     = 0;
+
+    cam.path_guiding      = false;  // set true to learn an SD-tree in training passes and guide bounces with it
+
+    cam.render(world, lights);
+}
+
+void cornell_cloud() {
+    auto& assets = asset_registry::global();
+    scene world;
+    scene lights;
+
+    auto red   = assets.intern_lambertian(color(.65, .05, .05));
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto green = assets.intern_lambertian(color(.12, .45, .15));
+    auto light = assets.intern_light(color(7, 7, 7));
+
+    // light soureces
+    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+    lights.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    // density from a voxel file if there is one, else a procedural cloud: turbulence inside a sphere
+    auto grid = make_shared<voxel_grid>();
+    if (!grid->load("cloud.vox"))
     {
-        quad->rotate(15.0, 1);
-        quad->translate(vec3(265,0,295));
+        const int n = 128;
+        perlin noise;
+        grid = make_shared<voxel_grid>(n, n, n);
+        for (int z = 0; z < n; ++z)
+            for (int y = 0; y < n; ++y)
+                for (int x = 0; x < n; ++x)
+                {
+                    auto p = (point3(x, y, z) + vec3(0.5, 0.5, 0.5)) / n - vec3(0.5, 0.5, 0.5);
+                    auto falloff = 1 - p.length() / 0.5 - 0.6 * noise.turb(4 * p);
+                    if (falloff > 0)
+                        grid->set(x, y, z, static_cast<float>(fmin(3 * falloff, 1.0)));
+                }
+        grid->build_majorants();
     }
-    for (auto quad : box2->objects)
+    world.add(make_shared<grid_medium>(grid, point3(100,50,150), point3(455,405,505), 0.05, color(.9,.9,.9)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.img_width         = 400;
+    cam.samples_per_pixel = 100;
+    cam.sample_max_depth  = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov              = 40;
+    cam.lookfrom          = point3(278, 278, -800);
+    cam.lookat            = point3(278, 278, 0);
+    cam.vup               = vec3(0,1,0);
+
+    cam.defocus_angle     = 0;
+
+    cam.render(world, lights);
+}
+
+void many_lights() {
+    auto& assets = asset_registry::global();
+    scene world;
+    scene lights;
+
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto red   = assets.intern_lambertian(color(.65, .05, .05));
+    auto blue  = assets.intern_lambertian(color(.1, .2, .6));
+
+    // a 20 x 20 grid of small tinted panels under the ceiling: 400 emissive quads
+    scene panels;
+    for (int i = 0; i < 20; ++i)
     {
-        quad->rotate(-18.0, 1);
-        quad->translate(vec3(130,0,65));
+        for (int j = 0; j < 20; ++j)
+        {
+            auto tint = color(0.5 + 0.5 * random_double(), 0.5 + 0.5 * random_double(), 0.5 + 0.5 * random_double());
+            auto light = assets.intern_light(40 * tint);
+            auto panel = make_shared<quad>(point3(20 + i * 26, 554, 20 + j * 26), vec3(8,0,0), vec3(0,0,8), light);
+            panels.add(panel);
+            lights.add(panel);
+        }
     }
+    world.add(make_shared<uniform_grid>(panels));   // one flat layer of equal panels: a 2D grid of cells
 
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    world.add(make_shared<sphere>(point3(190,90,190), 90, red));
+    world.add(make_shared<sphere>(point3(380,120,330), 120, blue));
 
     camera cam;
 
     cam.aspect_ratio      = 1.0;
     cam.img_width         = 400;
-    cam.samples_per_pixel = 100;
+    cam.samples_per_pixel = 16;
     cam.sample_max_depth  = 50;
     cam.background        = color(0,0,0);
 
@@ -449,73 +585,178 @@ void cornell_smoke() {
 
     cam.defocus_angle     = 0;
 
+    cam.light_candidates  = 8;      // resample 8 of the 400 panels at every vertex
+    cam.light_reuse       = true;   // and share the winners between neighbouring pixels
+
     cam.render(world, lights);
 }
 
+void cornell_mesh() {
+    auto& assets = asset_registry::global();
+    scene world;
+    scene lights;
+
+    auto red   = assets.intern_lambertian(color(.65, .05, .05));
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto green = assets.intern_lambertian(color(.12, .45, .15));
+
+    // a model from disk if there is one, else a smooth torus built in place; loaded (or built) and its
+    // BVH built by a task, while the room is put together
+    task_graph tasks;
+    auto gold = assets.intern_metal(color(0.8, 0.6, 0.2), 0.2);
+    shared_ptr<triangle_mesh> model;
+    tasks.add([&]()
+    {
+        model = load_mesh("model.obj", gold);
+        if (!model)
+        {
+            const int rings = 128, sides = 64;
+            const double R = 140, r = 55;
+            std::vector<float> positions, normals, uvs;
+            std::vector<uint32_t> indices;
+            for (int i = 0; i <= rings; ++i)
+            {
+                for (int j = 0; j <= sides; ++j)
+                {
+                    auto a = 2 * pi * i / rings, b = 2 * pi * j / sides;
+                    auto n = vec3(cos(a) * cos(b), sin(b), sin(a) * cos(b));
+                    auto p = vec3(R * cos(a), 0, R * sin(a)) + r * n;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        positions.push_back(static_cast<float>(p[k]));
+                        normals.push_back(static_cast<float>(n[k]));
+                    }
+                    uvs.push_back(static_cast<float>(i) / rings);
+                    uvs.push_back(static_cast<float>(j) / sides);
+                }
+            }
+            for (int i = 0; i < rings; ++i)
+            {
+                for (int j = 0; j < sides; ++j)
+                {
+                    uint32_t v0 = i * (sides + 1) + j, v1 = v0 + sides + 1;
+                    indices.insert(indices.end(), { v0, v0 + 1, v1, v1, v0 + 1, v1 + 1 });
+                }
+            }
+            model = make_shared<triangle_mesh>(positions, indices, normals, uvs, gold);
+            model->rotate(-30, 0);
+            model->translate(vec3(278, 200, 278));
+        }
+    });
+
+    auto light = assets.intern_light(color(15, 15, 15));
+
+    // light soureces
+    world.add(make_shared<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), light));
+    lights.add(make_shared<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), light));
+
+    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    tasks.wait_all();
+    tasks.report(std::clog);
+    world.add(model);
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.img_width         = 400;
+    cam.samples_per_pixel = 100;
+    cam.sample_max_depth  = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov              = 40;
+    cam.lookfrom          = point3(278, 278, -800);
+    cam.lookat            = point3(278, 278, 0);
+    cam.vup               = vec3(0,1,0);
+
+    cam.defocus_angle     = 0;
+
+    cam.render(variant_scene(world), lights);
+}
+
 void rayTracingtheNextWeek_final_scene(int image_width, int samples_per_pixel, int max_depth) {
-    scene boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    auto& assets = asset_registry::global();
+
+    // The ground's grid, the sphere cloud's BVH and the earth's image are made by tasks, each one
+    // as soon as its random numbers are drawn here; the objects go into the world once all are done.
+    task_graph tasks;
+
+    auto ground = assets.intern_lambertian(color(0.48, 0.83, 0.53));
 
     int boxes_per_side = 20;
+    std::vector<float> heights(boxes_per_side * boxes_per_side);
     for (int i = 0; i < boxes_per_side; i++) {
         for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
             auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+            heights[j*boxes_per_side + i] = static_cast<float>(y1);
         }
     }
+    shared_ptr<heightfield> boxes1;
+    tasks.add([&]()
+    {
+        boxes1 = make_shared<heightfield>(point3(-1000,0,-1000), 100.0, 100.0, boxes_per_side, boxes_per_side, heights, ground);
+    });
+
+    auto white = assets.intern_lambertian(color(.73, .73, .73));
+    auto boxes2 = make_shared<sphere_cloud>(white);
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2->add(point3::random(0,165), 10);
+    }
+    tasks.add([&]()
+    {
+        boxes2->rotate(15.0, 1);
+        boxes2->translate(vec3(-100, 270, 395));
+    });
+
+    auto emat = assets.intern_lambertian(assets.intern_image("../../../../image/earthmap.jpg", tasks));
 
     scene world;
     scene lights;
 
     // light sources
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light));
+    auto light = assets.intern_light(color(7, 7, 7));
+    auto ceiling = make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light);
     lights.add(make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light));
 
-
     // world objects
-    world.add(make_shared<bvh_node>(boxes1));
-
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30,0,0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-    ));
-
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
+    auto sphere_material = assets.intern_lambertian(color(0.7, 0.3, 0.1));
+    auto moving = make_shared<sphere>(center1, center2, 50, sphere_material);
+
+    auto glass = make_shared<sphere>(point3(260, 150, 45), 50, assets.intern_dielectric(1.5));
+    auto brushed = make_shared<sphere>(
+        point3(0, 150, 145), 50, assets.intern_conductor(color(0.8, 0.8, 0.9), 0.7)
+    );
+
+    auto boundary = make_shared<sphere>(point3(360,150,145), 70, assets.intern_dielectric(1.5));
+    auto subsurface = make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9));
+    auto mist = make_shared<constant_medium>(make_shared<sphere>(point3(0,0,0), 5000, assets.intern_dielectric(1.5)),
+                                             .0001, color(1,1,1));
+
+    auto earth = make_shared<sphere>(point3(400,200,400), 100, emat);
+    auto pertext = assets.intern_noise(0.1);
+    auto marble = make_shared<sphere>(point3(220,280,300), 80, assets.intern_lambertian(pertext));
+
+    tasks.wait_all();
+    tasks.report(std::clog);
+
+    world.add(ceiling);
+    world.add(boxes1);
+    world.add(moving);
+    world.add(glass);
+    world.add(brushed);
     world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0,0,0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("../../../../image/earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1);
-    world.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-    scene boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
-    }
-    for (auto sphere : boxes2.objects)
-    {
-        sphere->rotate(15.0, 1);
-        sphere->translate(vec3(-100, 270, 395));
-    }
-    world.add(std::make_shared<bvh_node>(boxes2));
+    world.add(subsurface);
+    world.add(mist);
+    world.add(earth);
+    world.add(marble);
+    world.add(boxes2);
 
     camera cam;
 
@@ -532,5 +773,7 @@ void rayTracingtheNextWeek_final_scene(int image_width, int samples_per_pixel, i
 
     cam.defocus_angle     = 0;
 
+    cam.photon_caustics   = true;   // the glass spheres focus the ceiling light onto the floor
+
     cam.render(world, lights);
 }
\ No newline at end of file
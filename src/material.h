@@ -2,139 +2,225 @@
 #define MATERIAL_H
 
 #include "utility.h"
+#include "object.h"
 #include "texture.h"
 #include "onb.h"
+#include "pdf.h"
+#include "microfacet.h"
 
-class intersect_record;
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// What a surface or medium is made of. Shading goes through material_table by material_id
+// (material_scatter, material_emitted, ... at the end of this file).
 
 class material
 {
     public:
+        // the materials of this file, kept as rows of material_table and shaded by its switch; any
+        // other material is a custom_material, `other` to the table and called through its virtual functions
+        enum class kind_t : uint8_t { other, lambertian, metal, dielectric, diffuse_light, isotropic, conductor, rough_dielectric };
+        const kind_t kind;
+
         virtual ~material() = default;
 
-        // virtual bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& attenuation) const = 0;
-        virtual bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const { return 0; };
-        virtual color emitted(const intersect_record&rec, const ray& ray_in, double u, double v, const point3& p) const { return color(0,0,0); };
-        virtual double scattering_pdf(const intersect_record&rec, const ray& ray_in, const ray& ray_out) const { return 0; }
+    private:
+        // a kind is what material_table casts a material back to: only the classes of this file may claim one,
+        // so anything else derives from custom_material
+        explicit material(kind_t k) : kind(k) {}
+
+        friend class custom_material;
+        friend class lambertian;
+        friend class metal;
+        friend class dielectric;
+        friend class conductor;
+        friend class rough_dielectric;
+        friend class diffuse_light;
+        friend class isotropic;
 };
 
 
-// lambertian diffuse
+// base of materials that shade themselves
 
-class lambertian : public material
+class custom_material : public material
 {
     public:
-        // lambertian(const color& a) : albedo(a) {}
-        lambertian(const color& a) : tex(std::make_shared<solid_color>(a)) {}
-        lambertian(std::shared_ptr<texture> t) : tex(t) {}
-        
+        custom_material() : material(kind_t::other) {}
 
-        // bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& attenuation) const override 
-        // {
-        //     // auto scatter_direction = rec.normal + randomSample_unit_vector_normalize(); // lambertian diffuse
-        //     auto scatter_direction = randomSample_unit_hemisphere(rec.normal);             // uniform diffuse
+        virtual bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const { return false; }
+        virtual color emitted(const intersect_record& rec, const ray& ray_in, double u, double v, const point3& p) const { return color(0,0,0); }
+        virtual double scattering_pdf(const intersect_record& rec, const ray& ray_in, const ray& ray_out) const { return 0; }
+        virtual bool is_volumetric() const { return false; }   // phase function of a medium rather than a surface
+};
 
-        //     // if randomly generated vector is opposite to the normal, 
-        //     // the sum will be zero leading to bad scenario of NaNs.
 
-        //     if (scatter_direction.near_zero())
-        //         scatter_direction = rec.normal;   // if the direction is near zero, then let the normal be the direction
+// The built-in materials below only describe themselves: material_table copies what they hold
+// into its rows, and shades them there.
 
-        //     ray_out = ray(rec.p, scatter_direction, ray_in.time());
-        //     attenuation = tex->get_value(rec.u, rec.v, rec.p);
+// lambertian diffuse
 
-        //     return true;
-        // }
+class lambertian final : public material
+{
+    public:
+        lambertian(const color& a) : material(kind_t::lambertian), albedo(a) {}
+        lambertian(std::shared_ptr<texture> t) : material(kind_t::lambertian), tex(t) {}
 
-        bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const override 
-        {
-            // ---uniform hemisphere diffuse---
-            // auto bounce_direction = randomSample_unit_hemisphere(rec.normal);             // uniform diffuse
-            // pdf = 1 / (2 * pi);
-            // // update parameter
-            // ray_out = ray(rec.p, bounce_direction, ray_in.time());
-
-            // ---lambertian diffuse---
-            // auto bounce_direction = rec.normal + randomSample_unit_vector_normalize(); // lambertian diffuse
-            
-            // // if randomly generated vector is opposite to the normal, 
-            // // the sum will be zero leading to bad scenario of NaNs.
-            // if (bounce_direction.near_zero())
-            //     bounce_direction = rec.normal;   // if the direction is near zero, then let the normal be the direction
-            // // update parameter
-            // ray_out = ray(rec.p, bounce_direction, ray_in.time());
-            // auto cos_theta = dot(rec.normal, unit_vector(ray_out.direction()));
-            // pdf = cos_theta < 0 ? 0 : cos_theta / pi;
+        color albedo;                   // when there is no texture
+        std::shared_ptr<texture> tex;
+};
 
-            // ---cosine diffuse---
-            // create a coordinate system based on normal
-            onb uvw;
-            uvw.build_from_w(rec.normal);
 
-            auto bounce_direction = uvw.local(randomSample_cosine_direction());
-            ray_out = ray(rec.p, bounce_direction, ray_in.time());
-            pdf = dot(uvw.w(), ray_out.direction()) / pi;   // PDF for cosine diffuse = cos_theta / pi
+class metal final : public material
+{
+    public:
+        metal(const color& a, double f) : material(kind_t::metal), albedo(a), fuzz(f) {}
 
+        color albedo;
+        double fuzz;
+};
 
-            // update parameters
 
-            albedo = tex->get_value(rec.u, rec.v, rec.p);
+class dielectric final : public material
+{
+    public:
+        dielectric(double index_of_refraction) : material(kind_t::dielectric), ir(index_of_refraction) {}
 
-            return true;
-        }
+        double ir;
+};
 
-        double scattering_pdf(const intersect_record& rec, const ray& ray_in, const ray& ray_out) const override
-        {
-            // ---lambertian PDF---
-            auto cos_theta = dot(rec.normal, unit_vector(ray_out.direction()));
-            return cos_theta < 0 ? 0 : cos_theta / pi;
-            
-            // ---uniform hemisphere PDF---
-            // return 1 / (2 * pi);
 
-            // ---cosine PDF---
-            // onb uvw;
-            // uvw.build_from_w(rec.normal);
-            // return dot(uvw.w(), ray_out.direction()) / pi;
-        }
+// GGX microfacet metal: mirror reflection off microfacets drawn from the visible normals, with
+// Schlick's Fresnel from its color. Unlike metal's fuzz, a proper BRDF: it has a pdf, so lights
+// are sampled for it and combined by MIS.
+
+class conductor final : public material
+{
+    public:
+        conductor(const color& f0, double r) : material(kind_t::conductor), albedo(f0), roughness(r) {}
 
-  private:
-    std::shared_ptr<texture> tex;
-    // color albedo;
+        color albedo;                   // reflectance at normal incidence
+        double roughness;               // 0 a mirror, 1 very rough; GGX alpha is its square
 };
 
 
-class metal : public material
+// GGX microfacet glass (Walter et al. 2007): reflection or refraction through a microfacet, chosen
+// by its Fresnel reflectance. Like dielectric, radiance is not scaled by eta^2 across the surface.
+
+class rough_dielectric final : public material
 {
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f) {}
+        rough_dielectric(double index_of_refraction, double r, const color& t = color(1, 1, 1))
+            : material(kind_t::rough_dielectric), ir(index_of_refraction), roughness(r), tint(t) {}
 
-        bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& alb, double& pdf) const override
-        {
-            auto reflected_direction = reflect(unit_vector(ray_in.direction()), rec.normal);
+        double ir;
+        double roughness;
+        color tint;
+};
 
-            ray_out = ray(rec.p, reflected_direction + fuzz * randomSample_unit_vector_normalize(), ray_in.time());  // add a fuzzy factor and current time
-            alb = albedo;
-            pdf = 0.0;
 
-            return (dot(ray_out.direction(), rec.normal) > 0);
-        }
+class diffuse_light final : public material
+{
+  public:
+    diffuse_light(shared_ptr<texture> a) : material(kind_t::diffuse_light), emit(a) {}
+    diffuse_light(color c) : material(kind_t::diffuse_light), emit_color(c) {}
 
-    private:
-        color albedo;
-        double fuzz;
+    shared_ptr<texture> emit;
+    color emit_color;               // when there is no texture
+};
+
+class isotropic final : public material {
+  public:
+    isotropic(color c) : material(kind_t::isotropic), albedo_color(c) {}
+    isotropic(shared_ptr<texture> a) : material(kind_t::isotropic), albedo(a) {}
+
+    shared_ptr<texture> albedo;
+    color albedo_color;             // when there is no texture
 };
 
 
-class dielectric : public material
+// Materials as rows of flat tables, one per kind above, each a structure of arrays:
+//  - a material_id (object.h) names the kind and the row; primitives and hit records carry it
+//    instead of a shared_ptr, so a hit copies 4 bytes rather than counting a reference,
+//  - constant albedos are stored in the row, a texture pointer only where there is a texture
+//    (a solid_color is stored as its color),
+//  - shading is a switch on the kind and a lookup in its table; custom materials (`other`) are
+//    called through their virtual functions.
+// Ids are handed out while the scene is built (id() is safe from several threads, and gives a
+// material the same id every time). Rendering reads the tables without a lock: nothing may be
+// added while it runs.
+
+class material_table
 {
-    public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+public:
+    static material_table& global()
+    {
+        static material_table table;
+        return table;
+    }
+
+    // the id of m, which gets its row the first time; no material (bare geometry) has no id
+    material_id id(const shared_ptr<material>& m)
+    {
+        if (!m)
+            return material_id();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = ids.find(m.get());
+        if (found != ids.end())
+            return found->second;
+
+        auto id = add_row(*m);
+        ids[m.get()] = id;
+        owners.push_back(m);   // keeps its textures (and `other` materials) alive, and its address unused
+        return id;
+    }
+
+
+    // Shading
+
+    bool scatter(material_id m, const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const
+    {
+        auto row = m.row();
+        switch (kind_of(m))
+        {
+        case material::kind_t::lambertian:
+        {
+            // ---uniform hemisphere diffuse---
+            // auto bounce_direction = randomSample_unit_hemisphere(rec.normal);             // uniform diffuse
+            // pdf = 1 / (2 * pi);
+
+            // ---cosine diffuse---
+            // create a coordinate system based on normal
+            onb uvw;
+            uvw.build_from_w(rec.normal);
+
+            auto bounce_direction = uvw.local(randomSample_cosine_direction());
+            ray_out = spawn_ray(rec, bounce_direction, ray_in.time());
+            pdf = dot(uvw.w(), ray_out.direction()) / pi;   // PDF for cosine diffuse = cos_theta / pi
 
-        bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf) const override
+            auto tex = lambertians.tex[row];
+            albedo = tex ? texture_value(*tex, rec.u, rec.v, rec.p, rec.footprint * rec.u_rate, rec.footprint * rec.v_rate)
+                         : lambertians.value[row];
+            return true;
+        }
+        case material::kind_t::metal:
+        {
+            auto reflected_direction = reflect(unit_vector(ray_in.direction()), rec.normal);
+
+            ray_out = spawn_ray(rec, reflected_direction + metals.fuzz[row] * randomSample_unit_vector_normalize(), ray_in.time());  // add a fuzzy factor and current time
+            albedo = metals.albedo[row];
+            pdf = 0.0;
+
+            return (dot(ray_out.direction(), rec.normal) > 0);
+        }
+        case material::kind_t::dielectric:
         {
             albedo = color(1.0, 1.0, 1.0);
             pdf = 0.0;
+            auto ir = dielectrics.ir[row];
             double refract_ratio = rec.front_face ? (1.0 / ir) : ir;
 
             vec3 unit_direction = unit_vector(ray_in.direction());
@@ -153,66 +239,419 @@ class dielectric : public material
             {
                 direction = refract(unit_direction, rec.normal, refract_ratio);   // refrac if it has solution to Snell's law.
             }
-            
 
-            ray_out = ray(rec.p, direction, ray_in.time());
+            ray_out = spawn_ray(rec, direction, ray_in.time());
             return true;
         }
+        case material::kind_t::diffuse_light:
+            return false;
+        case material::kind_t::conductor:
+        case material::kind_t::rough_dielectric:
+        {
+            albedo = kind_of(m) == material::kind_t::conductor ? conductors.albedo[row] : rough_dielectrics.tint[row];
+            // scatters even where the draw leaves the lobe (pdf 0): the vertex still gathers its direct light
+            auto direction = sample(m, rec, ray_in);
+            ray_out = spawn_ray(rec, direction, ray_in.time());
+            pdf = direction.near_zero() ? 0 : scattering_pdf(m, rec, ray_in, ray_out);
+            return true;
+        }
+        case material::kind_t::isotropic:
+        {
+            ray_out = spawn_ray(rec, randomSample_unit_vector_normalize(), ray_in.time());
+            auto tex = isotropics.tex[row];
+            albedo = tex ? texture_value(*tex, rec.u, rec.v, rec.p) : isotropics.value[row];
+            pdf = 1 / (4 * pi);
+            return true;
+        }
+        default:
+            return others[row]->scatter(rec, ray_in, ray_out, albedo, pdf);
+        }
+    }
 
-    private:
-        double ir;
+    color emitted(material_id m, const intersect_record& rec, const ray& ray_in, double u, double v, const point3& p) const
+    {
+        auto row = m.row();
+        switch (kind_of(m))
+        {
+        case material::kind_t::diffuse_light:
+        {
+            if (!rec.front_face)
+                return color(0,0,0);
+            auto tex = lights.tex[row];
+            return tex ? texture_value(*tex, u, v, p, rec.footprint * rec.u_rate, rec.footprint * rec.v_rate) : lights.value[row];
+        }
+        case material::kind_t::other:
+            return others[row]->emitted(rec, ray_in, u, v, p);
+        default:
+            return color(0,0,0);
+        }
+    }
 
-        static double reflectance(double cosine, double ref_idx) 
+    double scattering_pdf(material_id m, const intersect_record& rec, const ray& ray_in, const ray& ray_out) const
+    {
+        switch (kind_of(m))
         {
-            // Use Schlick's approximation for reflectance.
-            auto r0 = (1 - ref_idx) / (1 + ref_idx);
-            r0 = r0 * r0;
-            return r0 + (1 - r0) * pow((1 - cosine), 5);
+        case material::kind_t::lambertian:
+        {
+            // ---lambertian PDF---
+            auto cos_theta = dot(rec.normal, unit_vector(ray_out.direction()));
+            return cos_theta < 0 ? 0 : cos_theta / pi;
         }
-};
+        case material::kind_t::isotropic:
+            return 1 / (4 * pi);
+        case material::kind_t::conductor:
+        {
+            onb uvw;
+            uvw.build_from_w(rec.normal);
+            auto wo = to_local(uvw, -unit_vector(ray_in.direction()));
+            auto wi = to_local(uvw, unit_vector(ray_out.direction()));
+            if (wo.z() <= 0 || wi.z() <= 0)
+                return 0;
+            auto h = unit_vector(wo + wi);
+            return conductors.distribution[m.row()].visible_pdf(wo, h) / (4 * dot(wo, h));
+        }
+        case material::kind_t::rough_dielectric:
+        {
+            vec3 wo, wi, wm;
+            double F, etap;
+            if (!rough_dielectric_frame(m, rec, ray_in, ray_out, wo, wi, wm, F, etap))
+                return 0;
+            const auto& distribution = rough_dielectrics.distribution[m.row()];
+            if (wo.z() * wi.z() > 0)
+                return distribution.visible_pdf(wo, wm) / (4 * fabs(dot(wo, wm))) * F;
+            auto denom = dot(wi, wm) + dot(wo, wm) / etap;
+            return distribution.visible_pdf(wo, wm) * fabs(dot(wi, wm)) / (denom * denom) * (1 - F);
+        }
+        case material::kind_t::other:
+            return others[m.row()]->scattering_pdf(rec, ray_in, ray_out);
+        default:
+            return 0;
+        }
+    }
 
+    // the BSDF times the cosine towards ray_out, given the albedo scatter() returned: the factor of
+    // the light arriving along ray_out. albedo * scattering_pdf() for the diffuse materials.
+    color bsdf_cos(material_id m, const intersect_record& rec, const ray& ray_in, const ray& ray_out, const color& albedo) const
+    {
+        switch (kind_of(m))
+        {
+        case material::kind_t::conductor:
+        {
+            onb uvw;
+            uvw.build_from_w(rec.normal);
+            auto wo = to_local(uvw, -unit_vector(ray_in.direction()));
+            auto wi = to_local(uvw, unit_vector(ray_out.direction()));
+            if (wo.z() <= 0 || wi.z() <= 0)
+                return color(0, 0, 0);
+            auto h = unit_vector(wo + wi);
+            const auto& distribution = conductors.distribution[m.row()];
+            return ggx::fresnel_schlick(albedo, dot(wi, h)) * (distribution.D(h) * distribution.G2(wo, wi) / (4 * wo.z()));
+        }
+        case material::kind_t::rough_dielectric:
+        {
+            vec3 wo, wi, wm;
+            double F, etap;
+            if (!rough_dielectric_frame(m, rec, ray_in, ray_out, wo, wi, wm, F, etap))
+                return color(0, 0, 0);
+            const auto& distribution = rough_dielectrics.distribution[m.row()];
+            auto dg = distribution.D(wm) * distribution.G2(wo, wi);
+            if (wo.z() * wi.z() > 0)
+                return albedo * (dg * F / (4 * fabs(wo.z())));
+            auto denom = dot(wi, wm) + dot(wo, wm) / etap;
+            return albedo * (dg * (1 - F) * fabs(dot(wi, wm) * dot(wo, wm)) / (fabs(wo.z()) * denom * denom));
+        }
+        default:
+            return albedo * scattering_pdf(m, rec, ray_in, ray_out);
+        }
+    }
 
-class diffuse_light : public material 
-{
-  public:
-    diffuse_light(shared_ptr<texture> a) : emit(a) {}
-    diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
+    // a direction drawn from the material's own lobe, with scattering_pdf(); for the glossy materials.
+    // (0, 0, 0) where the sample leaves the lobe: a reflection through the surface, a refraction that isn't
+    vec3 sample(material_id m, const intersect_record& rec, const ray& ray_in) const
+    {
+        auto row = m.row();
+        if (kind_of(m) == material::kind_t::conductor)
+        {
+            onb uvw;
+            uvw.build_from_w(rec.normal);
+            auto wo = to_local(uvw, -unit_vector(ray_in.direction()));
+            auto h = conductors.distribution[row].sample_visible_normal(wo);
+            return uvw.local(2 * dot(wo, h) * h - wo);
+        }
 
-    bool scatter(const intersect_record& rec, const ray& r_in, ray& ray_out, color& albedo, double& pdf) const override 
+        // rough dielectric, in the frame of the outward normal
+        onb uvw;
+        uvw.build_from_w(rec.front_face ? rec.normal : -rec.normal);
+        auto wo = to_local(uvw, -unit_vector(ray_in.direction()));
+        auto h = rough_dielectrics.distribution[row].sample_visible_normal(wo);
+        auto ir = rough_dielectrics.ir[row];
+        vec3 wi;
+        double etap;
+        bool reflected = random_double() < ggx::fresnel_dielectric(dot(wo, h), ir) || !ggx::refract(wo, h, ir, wi, etap);
+        if (reflected)
+            wi = 2 * dot(wo, h) * h - wo;
+        if (reflected != (wo.z() * wi.z() > 0))
+            return vec3(0, 0, 0);
+        return uvw.local(wi);
+    }
+
+    bool is_volumetric(material_id m) const
     {
-        return false;
+        switch (kind_of(m))
+        {
+        case material::kind_t::isotropic: return true;
+        case material::kind_t::other:     return others[m.row()]->is_volumetric();
+        default:                          return false;
+        }
     }
 
-    color emitted(const intersect_record& rec, const ray& ray_in, double u, double v, const point3& p) const override {
-        if (!rec.front_face)
-            return color(0,0,0);
-        return emit->get_value(u, v, p);
+
+    // microfacet materials: a lobe of their own to sample, and not diffuse (no photons, no caustic gathering)
+    bool is_glossy(material_id m) const
+    {
+        return kind_of(m) == material::kind_t::conductor || kind_of(m) == material::kind_t::rough_dielectric;
     }
 
-  private:
-    shared_ptr<texture> emit;
-};
 
-class isotropic : public material {
-  public:
-    isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
-    isotropic(shared_ptr<texture> a) : albedo(a) {}
+    // Report
+
+    size_t size() const { std::lock_guard<std::mutex> lock(mutex); return owners.size(); }
+
+    size_t memory_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto textured_bytes = sizeof(color) + sizeof(const texture*);
+        return (lambertians.value.size() + lights.value.size() + isotropics.value.size()) * textured_bytes
+             + metals.albedo.size() * (sizeof(color) + sizeof(double)) + dielectrics.ir.size() * sizeof(double)
+             + conductors.albedo.size() * (sizeof(color) + sizeof(ggx))
+             + rough_dielectrics.ir.size() * (sizeof(double) + sizeof(ggx) + sizeof(color))
+             + others.size() * sizeof(const custom_material*);
+    }
+
+    void report(std::ostream& out) const
+    {
+        auto bytes = memory_bytes();
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "Materials: " << owners.size() << " rows (" << lambertians.value.size() << " lambertian, "
+            << metals.albedo.size() << " metal, " << dielectrics.ir.size() << " dielectric, " << lights.value.size()
+            << " light, " << isotropics.value.size() << " isotropic, " << conductors.albedo.size() << " conductor, "
+            << rough_dielectrics.ir.size() << " rough dielectric, " << others.size() << " other), "
+            << bytes / 1024.0 << " KB" << std::endl;
+    }
+
+private:
+    // a color, or a texture where it isn't constant (null otherwise)
+    struct textured_rows
+    {
+        std::vector<color> value;
+        std::vector<const texture*> tex;
+
+        material_id add(material::kind_t k, const color& c, const shared_ptr<texture>& t)
+        {
+            auto id = material_id(static_cast<uint8_t>(k), static_cast<uint32_t>(value.size()));
+            bool solid = t && t->kind == texture::kind_t::solid;
+            value.push_back(!t ? c : solid ? t->get_value(0, 0, point3()) : color(0, 0, 0));
+            tex.push_back(solid ? nullptr : t.get());
+            return id;
+        }
+    };
+
+    struct metal_rows
+    {
+        std::vector<color> albedo;
+        std::vector<double> fuzz;
+    };
 
-    bool scatter(const intersect_record& rec, const ray& ray_in, ray& ray_out, color& alb, double& pdf) const override 
+    struct dielectric_rows
     {
-        ray_out = ray(rec.p, randomSample_unit_vector_normalize(), ray_in.time());
-        alb = albedo->get_value(rec.u, rec.v, rec.p);
-        pdf = 1 / (4 * pi);
+        std::vector<double> ir;
+    };
+
+    struct conductor_rows
+    {
+        std::vector<color> albedo;
+        std::vector<ggx> distribution;
+    };
+
+    struct rough_dielectric_rows
+    {
+        std::vector<double> ir;
+        std::vector<ggx> distribution;
+        std::vector<color> tint;
+    };
+
+    textured_rows lambertians;
+    metal_rows metals;
+    dielectric_rows dielectrics;
+    textured_rows lights;
+    textured_rows isotropics;
+    conductor_rows conductors;
+    rough_dielectric_rows rough_dielectrics;
+    std::vector<const custom_material*> others;
+
+    mutable std::mutex mutex;
+    std::unordered_map<const material*, material_id> ids;
+    std::vector<shared_ptr<material>> owners;
+
+    static material::kind_t kind_of(material_id m) { return static_cast<material::kind_t>(m.kind()); }
+
+    material_id add_row(const material& m)
+    {
+        switch (m.kind)
+        {
+        case material::kind_t::lambertian:
+        {
+            const auto& l = static_cast<const lambertian&>(m);
+            return lambertians.add(m.kind, l.albedo, l.tex);
+        }
+        case material::kind_t::metal:
+        {
+            const auto& metal_m = static_cast<const metal&>(m);
+            auto id = material_id(static_cast<uint8_t>(m.kind), static_cast<uint32_t>(metals.albedo.size()));
+            metals.albedo.push_back(metal_m.albedo);
+            metals.fuzz.push_back(metal_m.fuzz);
+            return id;
+        }
+        case material::kind_t::dielectric:
+        {
+            auto id = material_id(static_cast<uint8_t>(m.kind), static_cast<uint32_t>(dielectrics.ir.size()));
+            dielectrics.ir.push_back(static_cast<const dielectric&>(m).ir);
+            return id;
+        }
+        case material::kind_t::diffuse_light:
+        {
+            const auto& light = static_cast<const diffuse_light&>(m);
+            return lights.add(m.kind, light.emit_color, light.emit);
+        }
+        case material::kind_t::isotropic:
+        {
+            const auto& iso = static_cast<const isotropic&>(m);
+            return isotropics.add(m.kind, iso.albedo_color, iso.albedo);
+        }
+        case material::kind_t::conductor:
+        {
+            const auto& c = static_cast<const conductor&>(m);
+            auto id = material_id(static_cast<uint8_t>(m.kind), static_cast<uint32_t>(conductors.albedo.size()));
+            conductors.albedo.push_back(c.albedo);
+            conductors.distribution.push_back(ggx(c.roughness));
+            return id;
+        }
+        case material::kind_t::rough_dielectric:
+        {
+            const auto& d = static_cast<const rough_dielectric&>(m);
+            auto id = material_id(static_cast<uint8_t>(m.kind), static_cast<uint32_t>(rough_dielectrics.ir.size()));
+            rough_dielectrics.ir.push_back(d.ir);
+            rough_dielectrics.distribution.push_back(ggx(d.roughness));
+            rough_dielectrics.tint.push_back(d.tint);
+            return id;
+        }
+        default:
+        {
+            auto id = material_id(static_cast<uint8_t>(m.kind), static_cast<uint32_t>(others.size()));
+            others.push_back(static_cast<const custom_material*>(&m));
+            return id;
+        }
+        }
+    }
+
+    static vec3 to_local(const onb& uvw, const vec3& d)
+    {
+        return vec3(dot(d, uvw.u()), dot(d, uvw.v()), dot(d, uvw.w()));
+    }
+
+    // wo and wi in the frame of the outward normal, the microfacet normal that turns one into the
+    // other (reflected or refracted, in the upper hemisphere), its Fresnel reflectance and the
+    // relative index along wi; false where no microfacet facing both does
+    bool rough_dielectric_frame(material_id m, const intersect_record& rec, const ray& ray_in, const ray& ray_out,
+                                vec3& wo, vec3& wi, vec3& wm, double& F, double& etap) const
+    {
+        onb uvw;
+        uvw.build_from_w(rec.front_face ? rec.normal : -rec.normal);
+        wo = to_local(uvw, -unit_vector(ray_in.direction()));
+        wi = to_local(uvw, unit_vector(ray_out.direction()));
+        if (wo.z() == 0 || wi.z() == 0)
+            return false;
+
+        auto ir = rough_dielectrics.ir[m.row()];
+        etap = wo.z() * wi.z() > 0 ? 1.0 : (wo.z() > 0 ? ir : 1 / ir);
+        wm = wi * etap + wo;
+        if (wm.length_squared() == 0)
+            return false;
+        wm = unit_vector(wm);
+        if (wm.z() < 0)
+            wm = -wm;
+        if (dot(wm, wi) * wi.z() < 0 || dot(wm, wo) * wo.z() < 0)
+            return false;   // a microfacet seen from its back
+
+        F = ggx::fresnel_dielectric(dot(wo, wm), ir);
         return true;
     }
 
-    double scattering_pdf(const intersect_record& rec, const ray& ray_in, const ray& ray_out) const override
+    static double reflectance(double cosine, double ref_idx)
     {
-        return 1 / (4 * pi);
+        // Use Schlick's approximation for reflectance.
+        auto r0 = (1 - ref_idx) / (1 + ref_idx);
+        r0 = r0 * r0;
+        return r0 + (1 - r0) * pow((1 - cosine), 5);
     }
+};
 
-  private:
-    shared_ptr<texture> albedo;
+
+// the calls of the render loop, through the global material_table
+inline bool material_scatter(material_id m, const intersect_record& rec, const ray& ray_in, ray& ray_out, color& albedo, double& pdf)
+{
+    return material_table::global().scatter(m, rec, ray_in, ray_out, albedo, pdf);
+}
+
+inline color material_emitted(material_id m, const intersect_record& rec, const ray& ray_in, double u, double v, const point3& p)
+{
+    return material_table::global().emitted(m, rec, ray_in, u, v, p);
+}
+
+inline double material_scattering_pdf(material_id m, const intersect_record& rec, const ray& ray_in, const ray& ray_out)
+{
+    return material_table::global().scattering_pdf(m, rec, ray_in, ray_out);
+}
+
+inline color material_bsdf_cos(material_id m, const intersect_record& rec, const ray& ray_in, const ray& ray_out, const color& albedo)
+{
+    return material_table::global().bsdf_cos(m, rec, ray_in, ray_out, albedo);
+}
+
+inline bool material_is_volumetric(material_id m)
+{
+    return material_table::global().is_volumetric(m);
+}
+
+inline bool material_is_glossy(material_id m)
+{
+    return material_table::global().is_glossy(m);
+}
+
+
+// a glossy material's own sampling as a pdf, to mix with others (path guiding) and weigh lights against.
+// Its one sample is the direction material_scatter drew at the vertex already, so the lobe is drawn once.
+class material_pdf : public pdf
+{
+public:
+    material_pdf(material_id _m, const intersect_record& _rec, const ray& _ray_in, const vec3& _drawn)
+      : m(_m), rec(_rec), ray_in(_ray_in), drawn(_drawn) {}
+
+    double get_value(const vec3& direction) const override
+    {
+        return material_scattering_pdf(m, rec, ray_in, ray(rec.p, direction, ray_in.time()));
+    }
+
+    vec3 generate_randomDir() const override
+    {
+        return drawn;
+    }
+
+private:
+    material_id m;
+    const intersect_record& rec;
+    const ray& ray_in;
+    vec3 drawn;   // (0, 0, 0) where the draw left the lobe
 };
 
-#endif //MATERIAL_H
\ No newline at end of file
+#endif //MATERIAL_H
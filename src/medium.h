@@ -0,0 +1,97 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include "utility.h"
+
+#include "object.h"
+#include "material.h"
+
+// A participating medium filling the inside of a boundary object.
+// Media only describe their density and an upper bound of it (the majorant):
+//  - free flights are sampled with delta tracking: tentative collisions are drawn against
+//    the majorant and accepted with probability density / majorant,
+//  - transmittance along shadow rays is estimated with ratio tracking: the same tentative
+//    collisions each scale the estimate by 1 - density / majorant.
+// Both are unbiased for any density below the majorant; the closer the bound, the fewer steps.
+
+class medium : public object {
+  public:
+    medium(shared_ptr<object> b, shared_ptr<material> phase) : boundary(b), phase_function(material_table::global().id(phase)) {}
+
+    virtual double density(const point3& p) const = 0;
+    virtual double majorant() const = 0;
+
+
+    // Method
+
+    bbox get_bbox() const override { return boundary->get_bbox(); }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override {
+        // delta tracking
+        interval span;
+        if (!inside_span(r, ray_t, span))
+            return false;
+
+        auto sigma = majorant();
+        auto ray_length = r.direction().length();
+        auto t = span.min;
+
+        while (true) {
+            t -= log(1 - random_double()) / (sigma * ray_length);
+            if (t >= span.max)
+                return false;
+
+            if (random_double() * sigma < density(r.at(t)))
+                break;   // real collision; otherwise a null collision, keep walking
+        }
+
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.normal = vec3(1,0,0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = phase_function;
+        rec.u_rate = rec.v_rate = 0;
+
+        return true;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override {
+        // ratio tracking
+        interval span;
+        if (!inside_span(r, ray_t, span))
+            return 1;
+
+        auto sigma = majorant();
+        auto ray_length = r.direction().length();
+        auto t = span.min;
+        auto tr = 1.0;
+
+        while (true) {
+            t -= log(1 - random_double()) / (sigma * ray_length);
+            if (t >= span.max)
+                return tr;
+
+            tr *= 1 - density(r.at(t)) / sigma;
+            if (tr <= 0)
+                return 0;
+        }
+    }
+
+  protected:
+    shared_ptr<object> boundary;
+    material_id phase_function;
+
+    // part of ray_t that lies inside the boundary
+    bool inside_span(const ray& r, interval ray_t, interval& span) const {
+        if (!boundary->intersect_span(r, span))
+            return false;
+
+        if (span.min < ray_t.min) span.min = ray_t.min;
+        if (span.max > ray_t.max) span.max = ray_t.max;
+        if (span.min < 0) span.min = 0;
+
+        return span.min < span.max;
+    }
+};
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "utility.h"
+#include "object.h"
+#include "material.h"
+#include "bbox.h"
+#include "flat_bvh.h"
+#include "triangle_packet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Indexed triangle mesh:
+//  - vertex attributes live in shared contiguous float arrays (positions, optional normals and uvs),
+//    triangles are three uint32 indices into them; no object per triangle,
+//  - a BVH over the triangles (flat_bvh.h) is built once per mesh,
+//    the index array itself is reordered so that every leaf is a contiguous range,
+//  - leaves keep their triangles again as packets of eight for the SIMD kernel (triangle_packet.h).
+// About 100 bytes per triangle for a typical closed mesh, BVH and packets included.
+
+
+class triangle_mesh final : public object
+{
+public:
+    triangle_mesh(std::vector<float> _positions, std::vector<uint32_t> _indices,
+                  std::vector<float> _normals, std::vector<float> _uvs, shared_ptr<material> _material)
+      : positions(std::move(_positions)), normals(std::move(_normals)), uvs(std::move(_uvs)),
+        indices(std::move(_indices)), mat(material_table::global().id(_material))
+    {
+        build();
+    }
+
+
+    // Method
+
+    size_t triangle_count() const { return indices.size() / 3; }
+    size_t vertex_count() const { return positions.size() / 3; }
+
+    size_t memory_bytes() const
+    {
+        return (positions.size() + normals.size() + uvs.size() + area_cdf.size()) * sizeof(float)
+             + indices.size() * sizeof(uint32_t) + bvh.memory_bytes() + packets.size() * sizeof(triangle_packet);
+    }
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        packet_ray pr(r);
+        auto t_min = static_cast<float>(ray_t.min);
+        auto t_max = static_cast<float>(fmin(ray_t.max, std::numeric_limits<float>::max()));
+
+        size_t hit_triangle = SIZE_MAX;
+        float hit_b1 = 0, hit_b2 = 0;
+
+        bvh.traverse(r, ray_t, [&](const flat_bvh::node& leaf)
+        {
+            auto packet_count = (leaf.count + triangle_packet::width - 1) / triangle_packet::width;
+            for (uint32_t k = leaf.offset; k < leaf.offset + packet_count; ++k)
+            {
+                auto lane = intersect_packet(packets[k], pr, t_min, t_max, hit_b1, hit_b2);
+                if (lane >= 0)
+                {
+                    ray_t.max = t_max;
+                    hit_triangle = packets[k].triangle[lane];
+                }
+            }
+        });
+
+        if (hit_triangle == SIZE_MAX)
+            return false;
+
+        fill_record(hit_triangle, r, ray_t.max, hit_b1, hit_b2, rec);
+        return true;
+    }
+
+    double get_pdf(const point3& origin, const vec3& direction) const override
+    {
+        intersect_record rec;
+        if (!this->intersect(ray(origin, direction), interval(0, infinity), rec))
+            return 0;
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+
+        return distance_squared / (cosine * total_area);
+    }
+
+    vec3 randomDir(const point3& origin) const override
+    {
+        surface_sample s;
+        sample_surface(s);
+        return s.p - origin;
+    }
+
+    bool sample_surface(surface_sample& s) const override
+    {
+        // triangle proportional to area, then a uniform point on it
+        if (area_cdf.empty())
+            return false;
+
+        auto target = static_cast<float>(random_double() * area_cdf.back());
+        size_t tri = std::upper_bound(area_cdf.begin(), area_cdf.end(), target) - area_cdf.begin();
+        tri = std::min(tri, triangle_count() - 1);
+
+        auto su = sqrt(random_double());
+        auto b1 = 1 - su;
+        auto b2 = random_double() * su;
+
+        point3 p0, p1, p2;
+        corners(tri, p0, p1, p2);
+        s.p = p0 + b1 * (p1 - p0) + b2 * (p2 - p0);
+        s.normal = unit_vector(cross(p1 - p0, p2 - p0));
+        s.pdf = 1 / total_area;
+        s.mat = mat;
+        texture_uv(tri, b1, b2, s.u, s.v);   // as a hit on the same point sees it
+        return true;
+    }
+
+    void rotate(double degree, int axis) override
+    {
+        // rotation matrix parameter
+        auto radians = degrees_to_radians(degree);
+        auto cos_theta = cos(radians);
+        auto sin_theta = sin(radians);
+
+        // construct rotation matrix
+        vec3 row_x, row_y, row_z;
+        switch (axis)
+        {
+        case 0:
+            row_x = vec3(1.0,         0.0,          0.0);
+            row_y = vec3(0.0,   cos_theta,   -sin_theta);
+            row_z = vec3(0.0,   sin_theta,    cos_theta);
+            break;
+        case 1:
+            row_x = vec3(cos_theta,    0.0,  sin_theta);
+            row_y = vec3(0.0,          1.0,        0.0);
+            row_z = vec3(-sin_theta,   0.0,  cos_theta);
+            break;
+        case 2:
+            row_x = vec3(cos_theta,  -sin_theta,   0.0);
+            row_y = vec3(sin_theta,   cos_theta,   0.0);
+            row_z = vec3(      0.0,         0.0,   1.0);
+            break;
+        default:
+            return;
+        }
+
+        // positions and normals turn alike, then the BVH is rebuilt around them
+        auto turn = [&](std::vector<float>& a)
+        {
+            for (size_t i = 0; i < a.size(); i += 3)
+            {
+                vec3 x(a[i], a[i + 1], a[i + 2]);
+                a[i]     = static_cast<float>(dot(row_x, x));
+                a[i + 1] = static_cast<float>(dot(row_y, x));
+                a[i + 2] = static_cast<float>(dot(row_z, x));
+            }
+        };
+        turn(positions);
+        turn(normals);
+        build();
+    }
+
+    void translate(vec3 dir) override
+    {
+        for (size_t i = 0; i < positions.size(); i += 3)
+        {
+            positions[i]     += static_cast<float>(dir.x());
+            positions[i + 1] += static_cast<float>(dir.y());
+            positions[i + 2] += static_cast<float>(dir.z());
+        }
+        build();
+    }
+
+private:
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<uint32_t> indices;
+    flat_bvh bvh;             // leaf offsets renumbered to their first packet
+    std::vector<triangle_packet> packets;
+    std::vector<float> area_cdf;
+    double total_area = 0;
+    material_id mat;
+    bbox bounding_box;
+
+    static const int max_leaf_size = triangle_packet::width;
+
+    point3 vertex(uint32_t i) const { return point3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]); }
+
+    void corners(size_t tri, point3& p0, point3& p1, point3& p2) const
+    {
+        p0 = vertex(indices[3 * tri]);
+        p1 = vertex(indices[3 * tri + 1]);
+        p2 = vertex(indices[3 * tri + 2]);
+    }
+
+    // texture coordinates at barycentrics b1, b2 of a triangle: the mesh's uvs interpolated, the barycentrics without them
+    void texture_uv(size_t tri, double b1, double b2, double& u, double& v) const
+    {
+        if (uvs.empty())
+        {
+            u = b1;
+            v = b2;
+            return;
+        }
+        auto b0 = 1 - b1 - b2;
+        auto i0 = indices[3 * tri], i1 = indices[3 * tri + 1], i2 = indices[3 * tri + 2];
+        u = b0 * uvs[2 * i0] + b1 * uvs[2 * i1] + b2 * uvs[2 * i2];
+        v = b0 * uvs[2 * i0 + 1] + b1 * uvs[2 * i1 + 1] + b2 * uvs[2 * i2 + 1];
+    }
+
+    void fill_record(size_t tri, const ray& r, double t, double b1, double b2, intersect_record& rec) const
+    {
+        point3 p0, p1, p2;
+        corners(tri, p0, p1, p2);
+        auto b0 = 1 - b1 - b2;
+        auto i0 = indices[3 * tri], i1 = indices[3 * tri + 1], i2 = indices[3 * tri + 2];
+
+        // the kernel's t is float; redo it in double against the plane so hit points stay accurate far from the origin
+        auto plane_normal = cross(p1 - p0, p2 - p0);
+        auto denominator = dot(plane_normal, r.direction());
+        if (fabs(denominator) > 1e-12)
+            t = dot(plane_normal, p0 - r.origin()) / denominator;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+
+        // the face decides the side, the interpolated normal (if any) the shading
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+        if (!normals.empty())
+        {
+            auto n = b0 * vec3(normals[3 * i0], normals[3 * i0 + 1], normals[3 * i0 + 2])
+                   + b1 * vec3(normals[3 * i1], normals[3 * i1 + 1], normals[3 * i1 + 2])
+                   + b2 * vec3(normals[3 * i2], normals[3 * i2 + 1], normals[3 * i2 + 2]);
+            if (n.length_squared() > 0)
+            {
+                n = unit_vector(n);
+                rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+            }
+        }
+
+        // texture filters are sized from the triangle's uv area against its area, the same rate both ways
+        texture_uv(tri, b1, b2, rec.u, rec.v);
+        auto uv_area = 0.5;
+        if (!uvs.empty())
+        {
+            uv_area = 0.5 * fabs((uvs[2 * i1] - uvs[2 * i0]) * (uvs[2 * i2 + 1] - uvs[2 * i0 + 1])
+                               - (uvs[2 * i2] - uvs[2 * i0]) * (uvs[2 * i1 + 1] - uvs[2 * i0 + 1]));
+        }
+        auto area = 0.5 * plane_normal.length();
+        rec.u_rate = rec.v_rate = area > 0 ? sqrt(uv_area / area) : 0.0;
+    }
+
+    void build()
+    {
+        auto count = triangle_count();
+        bvh = flat_bvh();
+        packets.clear();
+        area_cdf.clear();
+        total_area = 0;
+        bounding_box = bbox();
+        if (count == 0)
+            return;
+
+        std::vector<flat_bvh::build_ref> refs(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& ref = refs[i];
+            ref.index = static_cast<uint32_t>(i);
+            const float* p[3] = { &positions[3 * indices[3 * i]], &positions[3 * indices[3 * i + 1]], &positions[3 * indices[3 * i + 2]] };
+            for (int a = 0; a < 3; ++a)
+            {
+                ref.lo[a] = std::min(p[0][a], std::min(p[1][a], p[2][a]));
+                ref.hi[a] = std::max(p[0][a], std::max(p[1][a], p[2][a]));
+                ref.centroid[a] = (p[0][a] + p[1][a] + p[2][a]) / 3;
+            }
+        }
+
+        bvh.build(refs, max_leaf_size);
+        bounding_box = bvh.bounds();
+
+        // triangles in leaf order
+        std::vector<uint32_t> sorted(indices.size());
+        for (size_t i = 0; i < count; ++i)
+            for (int k = 0; k < 3; ++k)
+                sorted[3 * i + k] = indices[3 * refs[i].index + k];
+        indices.swap(sorted);
+
+        // pack every leaf's range of triangles into packets
+        for (auto& n : bvh.nodes)
+        {
+            if (n.count == 0)
+                continue;
+
+            auto first = n.offset;
+            n.offset = static_cast<uint32_t>(packets.size());
+            for (uint32_t i = 0; i < n.count; ++i)
+            {
+                if (i % triangle_packet::width == 0)
+                    packets.emplace_back();
+
+                auto tri = first + i;
+                packets.back().set(i % triangle_packet::width, &positions[3 * indices[3 * tri]],
+                                   &positions[3 * indices[3 * tri + 1]], &positions[3 * indices[3 * tri + 2]], tri);
+            }
+        }
+
+        area_cdf.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            point3 p0, p1, p2;
+            corners(i, p0, p1, p2);
+            total_area += 0.5 * cross(p1 - p0, p2 - p0).length();
+            area_cdf[i] = static_cast<float>(total_area);
+        }
+    }
+};
+
+
+#endif //MESH_H
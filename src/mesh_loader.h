@@ -0,0 +1,545 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "utility.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Loaders building a triangle_mesh:
+//  - OBJ: v / vt / vn / f (polygons are fanned, negative indices allowed), read in 1 MB chunks
+//    and parsed in place; groups, objects and materials are ignored, the whole file is one mesh.
+//  - PLY: binary little or big endian; vertex x y z, optional nx ny nz and u v (or s t),
+//    faces as a list property vertex_indices (or vertex_index).
+// Both print an error and return nullptr on failure.
+
+
+namespace mesh_loader_detail
+{
+    // fast number parsing on a null terminated line; advances p past the number.
+    inline double parse_number(const char*& p)
+    {
+        while (*p == ' ' || *p == '\t') ++p;
+
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+') ++p;
+
+        double value = 0;
+        while (*p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+
+        if (*p == '.')
+        {
+            ++p;
+            double scale = 0.1;
+            while (*p >= '0' && *p <= '9')
+            {
+                value += (*p++ - '0') * scale;
+                scale *= 0.1;
+            }
+        }
+
+        if (*p == 'e' || *p == 'E')
+        {
+            ++p;
+            bool negative_exponent = *p == '-';
+            if (*p == '-' || *p == '+') ++p;
+            int exponent = 0;
+            while (*p >= '0' && *p <= '9')
+                exponent = exponent * 10 + (*p++ - '0');
+            value *= pow(10.0, negative_exponent ? -exponent : exponent);
+        }
+
+        return negative ? -value : value;
+    }
+
+    inline long parse_index(const char*& p)
+    {
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+') ++p;
+        long value = 0;
+        while (*p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        return negative ? -value : value;
+    }
+
+    // calls line(const char*) for every line of the stream, reading it in chunks.
+    template<typename Func>
+    void for_each_line(std::istream& in, Func line)
+    {
+        const size_t chunk = 1 << 20;
+        std::vector<char> buffer(chunk + 1);
+        size_t kept = 0;   // bytes of an unfinished line carried over from the previous chunk
+
+        while (true)
+        {
+            in.read(buffer.data() + kept, static_cast<std::streamsize>(buffer.size() - 1 - kept));
+            auto size = kept + static_cast<size_t>(in.gcount());
+            if (size == 0)
+                return;
+
+            bool last = !in;
+            size_t start = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (buffer[i] != '\n')
+                    continue;
+                buffer[i] = '\0';
+                line(buffer.data() + start);
+                start = i + 1;
+            }
+
+            if (last)
+            {
+                if (start < size)
+                {
+                    buffer[size] = '\0';
+                    line(buffer.data() + start);
+                }
+                return;
+            }
+
+            kept = size - start;
+            if (kept == buffer.size() - 1)
+                buffer.resize(buffer.size() * 2 + 1);   // a line longer than the buffer
+            std::memmove(buffer.data(), buffer.data() + start, kept);
+        }
+    }
+
+    inline void report(const std::string& filename, const triangle_mesh& mesh, std::chrono::steady_clock::time_point start)
+    {
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::clog << "Mesh '" << filename << "': " << mesh.triangle_count() << " triangles, " << mesh.vertex_count()
+                  << " vertices, " << mesh.memory_bytes() / (1024 * 1024) << " MB, loaded in " << duration.count() << "ms, "
+                  << simd_level_name(active_simd_level()) << " triangle kernel" << std::endl;
+    }
+}
+
+
+inline shared_ptr<triangle_mesh> load_obj(const std::string& filename, shared_ptr<material> mat)
+{
+    using namespace mesh_loader_detail;
+
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    // attributes as the file lists them
+    std::vector<float> file_positions, file_uvs, file_normals;
+
+    // mesh vertices: one per distinct (position, uv, normal) triple used by a face
+    struct key
+    {
+        long p, t, n;
+        bool operator==(const key& o) const { return p == o.p && t == o.t && n == o.n; }
+    };
+    struct key_hash
+    {
+        size_t operator()(const key& k) const { return (k.p * 73856093) ^ (k.t * 19349663) ^ (k.n * 83492791); }
+    };
+    std::unordered_map<key, uint32_t, key_hash> vertex_of;
+    std::vector<key> vertices;
+    std::vector<uint32_t> indices;
+    bool bad_index = false;
+
+    std::vector<uint32_t> polygon;
+    for_each_line(in, [&](const char* p)
+    {
+        while (*p == ' ' || *p == '\t') ++p;
+
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 1;
+            for (int i = 0; i < 3; ++i)
+                file_positions.push_back(static_cast<float>(parse_number(p)));
+        }
+        else if (p[0] == 'v' && p[1] == 't')
+        {
+            p += 2;
+            for (int i = 0; i < 2; ++i)
+                file_uvs.push_back(static_cast<float>(parse_number(p)));
+        }
+        else if (p[0] == 'v' && p[1] == 'n')
+        {
+            p += 2;
+            for (int i = 0; i < 3; ++i)
+                file_normals.push_back(static_cast<float>(parse_number(p)));
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 1;
+            polygon.clear();
+            while (true)
+            {
+                while (*p == ' ' || *p == '\t') ++p;
+                if (!(*p == '-' || (*p >= '0' && *p <= '9')))
+                    break;
+
+                // v, v/vt, v//vn or v/vt/vn; 1-based, negative counts back from the last attribute
+                key k{parse_index(p), 0, 0};
+                if (*p == '/')
+                {
+                    ++p;
+                    if (*p != '/')
+                        k.t = parse_index(p);
+                    if (*p == '/')
+                    {
+                        ++p;
+                        k.n = parse_index(p);
+                    }
+                }
+                auto resolve = [&](long& i, size_t count)
+                {
+                    if (i < 0) i += static_cast<long>(count) + 1;
+                    if (i < 0 || i > static_cast<long>(count)) { bad_index = true; i = 0; }
+                };
+                resolve(k.p, file_positions.size() / 3);
+                resolve(k.t, file_uvs.size() / 2);
+                resolve(k.n, file_normals.size() / 3);
+                if (k.p == 0)
+                    bad_index = true;
+
+                auto found = vertex_of.find(k);
+                if (found == vertex_of.end())
+                {
+                    found = vertex_of.emplace(k, static_cast<uint32_t>(vertices.size())).first;
+                    vertices.push_back(k);
+                }
+                polygon.push_back(found->second);
+            }
+
+            for (size_t i = 2; i < polygon.size(); ++i)
+            {
+                indices.push_back(polygon[0]);
+                indices.push_back(polygon[i - 1]);
+                indices.push_back(polygon[i]);
+            }
+        }
+    });
+
+    if (bad_index)
+    {
+        std::cerr << "ERROR: Mesh file '" << filename << "' has faces referring to missing vertices.\n";
+        return nullptr;
+    }
+
+    // gather the attributes of the distinct vertices into the shared arrays
+    bool has_uvs = !file_uvs.empty(), has_normals = !file_normals.empty();
+    std::vector<float> positions, uvs, normals;
+    positions.reserve(vertices.size() * 3);
+    if (has_uvs) uvs.reserve(vertices.size() * 2);
+    if (has_normals) normals.reserve(vertices.size() * 3);
+
+    for (const auto& k : vertices)
+    {
+        for (int i = 0; i < 3; ++i)
+            positions.push_back(file_positions[3 * (k.p - 1) + i]);
+        for (int i = 0; has_uvs && i < 2; ++i)
+            uvs.push_back(k.t > 0 ? file_uvs[2 * (k.t - 1) + i] : 0.0f);
+        for (int i = 0; has_normals && i < 3; ++i)
+            normals.push_back(k.n > 0 ? file_normals[3 * (k.n - 1) + i] : 0.0f);   // zero: fall back to the face normal
+    }
+
+    auto mesh = make_shared<triangle_mesh>(std::move(positions), std::move(indices), std::move(normals), std::move(uvs), mat);
+    report(filename, *mesh, start);
+    return mesh;
+}
+
+
+inline shared_ptr<triangle_mesh> load_ply(const std::string& filename, shared_ptr<material> mat)
+{
+    using namespace mesh_loader_detail;
+
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    struct property
+    {
+        std::string name;
+        int size = 0;          // bytes of a scalar, or of each list item
+        char type = 'f';       // 'i' signed, 'u' unsigned, 'f' floating point
+        bool is_list = false;
+        int count_size = 0;    // bytes of the list length
+    };
+    struct element
+    {
+        std::string name;
+        size_t count = 0;
+        std::vector<property> properties;
+    };
+
+    auto scalar_type = [](const std::string& t, int& size, char& type)
+    {
+        if (t == "char" || t == "int8")         { size = 1; type = 'i'; }
+        else if (t == "uchar" || t == "uint8")  { size = 1; type = 'u'; }
+        else if (t == "short" || t == "int16")  { size = 2; type = 'i'; }
+        else if (t == "ushort" || t == "uint16"){ size = 2; type = 'u'; }
+        else if (t == "int" || t == "int32")    { size = 4; type = 'i'; }
+        else if (t == "uint" || t == "uint32")  { size = 4; type = 'u'; }
+        else if (t == "float" || t == "float32"){ size = 4; type = 'f'; }
+        else if (t == "double" || t == "float64"){ size = 8; type = 'f'; }
+        else return false;
+        return true;
+    };
+
+    // header
+    std::string line, format;
+    std::vector<element> elements;
+    std::getline(in, line);
+    if (line.compare(0, 3, "ply") != 0)
+    {
+        std::cerr << "ERROR: '" << filename << "' is not a PLY file.\n";
+        return nullptr;
+    }
+
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream words(line);
+        std::string word;
+        words >> word;
+        if (word == "format")
+        {
+            words >> format;
+        }
+        else if (word == "element")
+        {
+            element e;
+            words >> e.name >> e.count;
+            elements.push_back(e);
+        }
+        else if (word == "property" && !elements.empty())
+        {
+            property prop;
+            std::string type;
+            words >> type;
+            bool known;
+            if (type == "list")
+            {
+                std::string count_type;
+                char count_kind;
+                words >> count_type >> type;
+                prop.is_list = true;
+                known = scalar_type(count_type, prop.count_size, count_kind) && scalar_type(type, prop.size, prop.type);
+            }
+            else
+            {
+                known = scalar_type(type, prop.size, prop.type);
+            }
+            words >> prop.name;
+
+            if (!known)
+            {
+                std::cerr << "ERROR: Unknown PLY property type '" << type << "' in '" << filename << "'.\n";
+                return nullptr;
+            }
+            elements.back().properties.push_back(prop);
+        }
+        else if (word == "end_header")
+        {
+            break;
+        }
+    }
+
+    bool swap_bytes;
+    if (format == "binary_little_endian")
+        swap_bytes = false;
+    else if (format == "binary_big_endian")
+        swap_bytes = true;
+    else
+    {
+        std::cerr << "ERROR: Only binary PLY files are supported, '" << filename << "' is " << format << ".\n";
+        return nullptr;
+    }
+
+    // the body is read whole; elements are decoded straight from it
+    auto body_start = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::vector<char> body(static_cast<size_t>(in.tellg() - body_start));
+    in.seekg(body_start);
+    in.read(body.data(), static_cast<std::streamsize>(body.size()));
+    size_t pos = 0;
+    bool truncated = false;
+
+    auto read_value = [&](int size, char type) -> double
+    {
+        if (pos + size > body.size())
+        {
+            truncated = true;
+            return 0;
+        }
+        unsigned char bytes[8];
+        std::memcpy(bytes, body.data() + pos, size);
+        pos += size;
+        if (swap_bytes)
+            std::reverse(bytes, bytes + size);
+
+        switch (type)
+        {
+        case 'f':
+            if (size == 4) { float f; std::memcpy(&f, bytes, 4); return f; }
+            else           { double d; std::memcpy(&d, bytes, 8); return d; }
+        case 'i':
+            if (size == 1) { int8_t i; std::memcpy(&i, bytes, 1); return i; }
+            if (size == 2) { int16_t i; std::memcpy(&i, bytes, 2); return i; }
+            { int32_t i; std::memcpy(&i, bytes, 4); return i; }
+        default:
+            if (size == 1) return bytes[0];
+            if (size == 2) { uint16_t i; std::memcpy(&i, bytes, 2); return i; }
+            { uint32_t i; std::memcpy(&i, bytes, 4); return i; }
+        }
+    };
+
+    std::vector<float> positions, normals, uvs;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> polygon;
+
+    for (const auto& e : elements)
+    {
+        if (e.name == "vertex")
+        {
+            // slot of every property in (x y z nx ny nz u v), -1 if unused
+            std::vector<int> slot;
+            bool has_normals = false, has_uvs = false;
+            for (const auto& p : e.properties)
+            {
+                const char* names[] = { "x", "y", "z", "nx", "ny", "nz", "u", "v" };
+                int s = -1;
+                for (int i = 0; i < 8; ++i)
+                    if (p.name == names[i]) s = i;
+                if (p.name == "s" || p.name == "texture_u") s = 6;
+                if (p.name == "t" || p.name == "texture_v") s = 7;
+                has_normals |= (s >= 3 && s <= 5);
+                has_uvs |= (s >= 6);
+                slot.push_back(p.is_list ? -2 : s);
+            }
+
+            positions.resize(e.count * 3);
+            if (has_normals) normals.resize(e.count * 3);
+            if (has_uvs) uvs.resize(e.count * 2);
+
+            for (size_t v = 0; v < e.count && !truncated; ++v)
+            {
+                for (size_t k = 0; k < e.properties.size(); ++k)
+                {
+                    const auto& p = e.properties[k];
+                    if (p.is_list)
+                    {
+                        auto n = static_cast<size_t>(read_value(p.count_size, 'u'));
+                        pos += n * p.size;
+                        continue;
+                    }
+
+                    auto value = static_cast<float>(read_value(p.size, p.type));
+                    auto s = slot[k];
+                    if (s >= 0 && s < 3) positions[3 * v + s] = value;
+                    else if (s >= 3 && s < 6) normals[3 * v + s - 3] = value;
+                    else if (s >= 6) uvs[2 * v + s - 6] = value;
+                }
+            }
+        }
+        else if (e.name == "face")
+        {
+            indices.reserve(e.count * 3);
+            for (size_t f = 0; f < e.count && !truncated; ++f)
+            {
+                for (const auto& p : e.properties)
+                {
+                    if (!p.is_list)
+                    {
+                        pos += p.size;
+                        continue;
+                    }
+
+                    auto n = static_cast<size_t>(read_value(p.count_size, 'u'));
+                    if (p.name != "vertex_indices" && p.name != "vertex_index")
+                    {
+                        pos += n * p.size;
+                        continue;
+                    }
+
+                    polygon.clear();
+                    for (size_t i = 0; i < n; ++i)
+                        polygon.push_back(static_cast<uint32_t>(read_value(p.size, p.type)));
+                    for (size_t i = 2; i < polygon.size(); ++i)
+                    {
+                        indices.push_back(polygon[0]);
+                        indices.push_back(polygon[i - 1]);
+                        indices.push_back(polygon[i]);
+                    }
+                }
+            }
+        }
+        else
+        {
+            // skip elements we don't use (edges, materials, ...)
+            for (size_t i = 0; i < e.count && !truncated; ++i)
+                for (const auto& p : e.properties)
+                {
+                    auto n = p.is_list ? static_cast<size_t>(read_value(p.count_size, 'u')) : 1;
+                    pos += n * p.size;
+                }
+        }
+    }
+
+    if (truncated || pos > body.size())
+    {
+        std::cerr << "ERROR: Mesh file '" << filename << "' is truncated.\n";
+        return nullptr;
+    }
+
+    auto vertex_count = positions.size() / 3;
+    for (auto i : indices)
+    {
+        if (i >= vertex_count)
+        {
+            std::cerr << "ERROR: Mesh file '" << filename << "' has faces referring to missing vertices.\n";
+            return nullptr;
+        }
+    }
+
+    auto mesh = make_shared<triangle_mesh>(std::move(positions), std::move(indices), std::move(normals), std::move(uvs), mat);
+    report(filename, *mesh, start);
+    return mesh;
+}
+
+
+// picks the loader from the file extension
+inline shared_ptr<triangle_mesh> load_mesh(const std::string& filename, shared_ptr<material> mat)
+{
+    auto dot_pos = filename.find_last_of('.');
+    auto extension = dot_pos == std::string::npos ? std::string() : filename.substr(dot_pos + 1);
+    for (auto& c : extension)
+        c = static_cast<char>(tolower(c));
+
+    if (extension == "obj")
+        return load_obj(filename, mat);
+    if (extension == "ply")
+        return load_ply(filename, mat);
+
+    std::cerr << "ERROR: Unknown mesh format '" << filename << "'.\n";
+    return nullptr;
+}
+
+
+#endif //MESH_LOADER_H
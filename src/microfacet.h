@@ -0,0 +1,122 @@
+#ifndef MICROFACET_H
+#define MICROFACET_H
+
+#include "utility.h"
+
+// The GGX (Trowbridge-Reitz) microfacet distribution, isotropic, in a local frame with the
+// surface normal along +z:
+//  - D, Smith's masking (height-correlated G2) and the distribution of visible normals,
+//  - sample_visible_normal: a normal drawn from the visible normals of w (Heitz 2018), so the
+//    weight of a reflection sample is F * G2 / G1 and never much above 1,
+//  - Fresnel: Schlick's for conductors (with a color F0), the exact one for dielectrics.
+// alpha is the width of the distribution, roughness squared as artists set it.
+
+class ggx
+{
+public:
+    explicit ggx(double roughness) : alpha(fmax(roughness * roughness, min_alpha)) {}
+
+    double D(const vec3& m) const
+    {
+        auto cos2 = m.z() * m.z();
+        auto a2 = alpha * alpha;
+        auto d = cos2 * (a2 - 1) + 1;
+        return a2 / (pi * d * d);
+    }
+
+    double lambda(const vec3& w) const
+    {
+        auto cos2 = w.z() * w.z();
+        if (cos2 <= 0)
+            return infinity;
+        auto tan2 = fmax(0.0, 1 - cos2) / cos2;
+        return (sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+    }
+
+    double G1(const vec3& w) const { return 1 / (1 + lambda(w)); }
+    double G2(const vec3& wo, const vec3& wi) const { return 1 / (1 + lambda(wo) + lambda(wi)); }
+
+    // density of m among the normals seen from w (either side of the surface)
+    double visible_pdf(const vec3& w, const vec3& m) const
+    {
+        auto cos_w = fabs(w.z());
+        if (cos_w <= 0)
+            return 0;
+        return G1(w) * fabs(dot(w, m)) * D(m) / cos_w;
+    }
+
+    // a normal in the upper hemisphere, drawn with visible_pdf(w, m)
+    vec3 sample_visible_normal(const vec3& w) const
+    {
+        auto ws = w.z() < 0 ? -w : w;
+
+        // the view direction in the frame where the distribution is a hemisphere
+        auto vh = unit_vector(vec3(alpha * ws.x(), alpha * ws.y(), ws.z()));
+        auto length2 = vh.x() * vh.x() + vh.y() * vh.y();
+        auto t1 = length2 > 0 ? vec3(-vh.y(), vh.x(), 0) / sqrt(length2) : vec3(1, 0, 0);
+        auto t2 = cross(vh, t1);
+
+        // a point on the disk, squeezed towards the part of the hemisphere vh sees
+        auto r = sqrt(random_double());
+        auto phi = 2 * pi * random_double();
+        auto p1 = r * cos(phi);
+        auto p2 = r * sin(phi);
+        auto s = (1 + vh.z()) / 2;
+        p2 = (1 - s) * sqrt(fmax(0.0, 1 - p1 * p1)) + s * p2;
+
+        auto nh = p1 * t1 + p2 * t2 + sqrt(fmax(0.0, 1 - p1 * p1 - p2 * p2)) * vh;
+        return unit_vector(vec3(alpha * nh.x(), alpha * nh.y(), fmax(1e-9, nh.z())));
+    }
+
+    static color fresnel_schlick(const color& f0, double cos_theta)
+    {
+        auto c = 1 - fmin(fmax(cos_theta, 0.0), 1.0);
+        auto c5 = c * c * c * c * c;
+        return f0 + (color(1, 1, 1) - f0) * c5;
+    }
+
+    // reflectance of a dielectric with relative index eta (inside over outside); cos_theta < 0 from inside
+    static double fresnel_dielectric(double cos_theta, double eta)
+    {
+        cos_theta = fmin(fmax(cos_theta, -1.0), 1.0);
+        if (cos_theta < 0)
+        {
+            eta = 1 / eta;
+            cos_theta = -cos_theta;
+        }
+        auto sin2_t = (1 - cos_theta * cos_theta) / (eta * eta);
+        if (sin2_t >= 1)
+            return 1;   // total internal reflection
+        auto cos_t = sqrt(1 - sin2_t);
+        auto r_parallel = (eta * cos_theta - cos_t) / (eta * cos_theta + cos_t);
+        auto r_perpendicular = (cos_theta - eta * cos_t) / (cos_theta + eta * cos_t);
+        return (r_parallel * r_parallel + r_perpendicular * r_perpendicular) / 2;
+    }
+
+    // w refracted through the microfacet m (w and m on the same side); false on total internal reflection
+    static bool refract(const vec3& w, vec3 m, double eta, vec3& refracted, double& relative_eta)
+    {
+        auto cos_i = dot(m, w);
+        if (cos_i < 0)
+        {
+            eta = 1 / eta;
+            cos_i = -cos_i;
+            m = -m;
+        }
+        auto sin2_t = fmax(0.0, 1 - cos_i * cos_i) / (eta * eta);
+        if (sin2_t >= 1)
+            return false;
+        auto cos_t = sqrt(1 - sin2_t);
+        refracted = -w / eta + (cos_i / eta - cos_t) * m;
+        relative_eta = eta;
+        return true;
+    }
+
+    double alpha;
+
+private:
+    static constexpr double min_alpha = 1e-3;   // smoother than this is a mirror in all but name
+};
+
+
+#endif //MICROFACET_H
@@ -5,7 +5,23 @@
 #include "utility.h"
 #include "bbox.h"
 
-class material;
+#include <cstdint>
+
+// a material as its kind and its row in material_table (material.h); the default is no material,
+// for bare geometry
+class material_id {
+  public:
+    material_id() = default;
+    material_id(uint8_t kind, uint32_t row) : bits(static_cast<uint32_t>(kind) << 24 | row) {}
+
+    uint8_t kind() const { return static_cast<uint8_t>(bits >> 24); }
+    uint32_t row() const { return bits & 0xffffff; }
+    explicit operator bool() const { return bits != none; }
+
+  private:
+    static const uint32_t none = 0xffffffff;
+    uint32_t bits = none;
+};
 
 // record of newest intersection points
 class intersect_record {
@@ -14,9 +30,12 @@ class intersect_record {
     vec3 normal;
     double t;
     bool front_face;
-    shared_ptr<material> mat;
+    material_id mat;
     double u;
     double v;
+    double u_rate = 0;          // change of u and v per unit length across the surface at p (0: unknown),
+    double v_rate = 0;          // for sizing texture filters
+    double footprint = 0;       // width of the ray's footprint on the surface at p, set by the camera (0: a point)
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the intersect record normal vector.
@@ -27,6 +46,42 @@ class intersect_record {
     }
 };
 
+// a point sampled on an object's surface, e.g. where a light path starts
+class surface_sample {
+  public:
+    point3 p;
+    vec3 normal;                // outward unit normal
+    double pdf;                 // density with respect to surface area
+    material_id mat;
+    double u;
+    double v;
+};
+
+// a hit whose record isn't filled yet: the primitive that was hit and the distance along the ray.
+// Searches for the closest of many hits (lists, BVHs) keep one of these while they look, and
+// have only the closest primitive fill its record (see object::intersect_deferred).
+class object;
+
+class deferred_hit {
+  public:
+    const object* primitive = nullptr;   // nullptr: the record is filled already
+    double t;
+};
+
+// ray leaving the surface of `rec` in `direction`; its origin is pushed off the surface
+// (offset_ray_origin in ray.h), so it is traced from t = 0 without hitting where it starts
+inline ray spawn_ray(const intersect_record& rec, const vec3& direction, double time)
+{
+    return ray(offset_ray_origin(rec.p, rec.normal, direction), direction, time);
+}
+
+// the same towards a point, e.g. on a light: the ray reaches `target` at t = 1
+inline ray spawn_ray_to(const intersect_record& rec, const point3& target, double time)
+{
+    auto origin = offset_ray_origin(rec.p, rec.normal, target - rec.p);
+    return ray(origin, target - origin, time);
+}
+
 // define a virtual hittable object class
 
 class object
@@ -42,12 +97,62 @@ class object
         virtual bbox get_bbox() const = 0;
         virtual bool intersect(const ray& r, interval ray_t, intersect_record& rec) const = 0; // the passed-in tmin and tmax are orignially 0 and infinity.
         
+        // the closest-hit search in two steps: find a hit within ray_t and set hit.t to its distance
+        // (a miss leaves rec and hit as they were). primitives whose record costs something (sphere (u,v):
+        // an acos and an atan2) only set hit.primitive and leave rec alone, and the search calls their
+        // fill_record once, for the closest hit; everything else fills rec as intersect does (the default).
+        virtual bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const
+        {
+            if (!intersect(r, ray_t, rec))
+                return false;
+            hit.primitive = nullptr;
+            hit.t = rec.t;
+            return true;
+        }
+
+        // the record intersect would have filled for the hit at t
+        virtual void fill_record(const ray& r, double t, intersect_record& rec) const {}
+
         // not pure virtual function
         virtual void rotate(double degree, int axis) {}
         virtual void translate(vec3 dir) {}
+        // solid-angle density of picking `direction` from `origin` by randomDir. origin is where the ray
+        // is spawned from (spawn_ray), so hits count from t = 0 as they do when that ray is traced.
         virtual double get_pdf(const point3& origin, const vec3& direction) const { return 0; }
         virtual vec3 randomDir(const point3& origin) const { return vec3(1, 0, 0); }
+        virtual bool sample_surface(surface_sample& s) const { return false; }   // false if the object can't be sampled by area
+
+        // entry and exit distance of the line through r, for objects enclosing a volume (media boundaries).
+        // the default finds them with two full intersections; primitives with a closed form override it.
+        virtual bool intersect_span(const ray& r, interval& span) const
+        {
+            intersect_record rec1, rec2;
+
+            if (!intersect(r, interval::universe, rec1))
+                return false;
+
+            if (!intersect(r, interval(rec1.t + 0.0001, infinity), rec2))
+                return false;
+
+            span = interval(rec1.t, rec2.t);
+            return true;
+        }
+
+        // fraction of light that makes it along r within ray_t (shadow rays):
+        // surfaces block completely, media attenuate.
+        virtual double transmittance(const ray& r, interval ray_t) const
+        {
+            intersect_record rec;
+            return intersect(r, ray_t, rec) ? 0.0 : 1.0;
+        }
 };
 
+// rec for a hit found by intersect_deferred, filled now if it was put off
+inline void finish_hit(const ray& r, const deferred_hit& hit, intersect_record& rec)
+{
+    if (hit.primitive)
+        hit.primitive->fill_record(r, hit.t, rec);
+}
+
 
 #endif //OBJECT_H
\ No newline at end of file
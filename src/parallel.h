@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline int hardware_thread_count()
+{
+    auto n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// Runs func(index, thread_id) for every index in [0, count).
+// Indices are handed out one at a time, so uneven work (e.g. scanlines crossing
+// a bright light or a dense BVH) still balances across the threads.
+template <typename Func>
+void parallel_for(int count, Func func, int thread_count = hardware_thread_count())
+{
+    std::atomic<int> next_index{0};
+
+    auto worker = [&](int thread_id) {
+        for (int i = next_index++; i < count; i = next_index++)
+            func(i, thread_id);
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; ++t)
+        threads.emplace_back(worker, t);
+
+    worker(0);  // the calling thread takes part as thread 0
+
+    for (auto& t : threads)
+        t.join();
+}
+
+
+#endif //PARALLEL_H
@@ -6,6 +6,13 @@
 #include "onb.h"
 #include "scene.h"
 
+// multiple importance sampling weight of a sample drawn with density f, against a competing density g
+inline double power_heuristic(double f, double g)
+{
+    return (f * f) / (f * f + g * g);
+}
+
+
 class pdf
 {
 public:
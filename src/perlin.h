@@ -2,48 +2,67 @@
 #define PERLIN_H
 
 #include "utility.h"
+#include "bbox.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Perlin noise: gradients on the integer lattice, blended across each cell.
+//  - One gradient and permutation table for the whole program, made on first use from a fixed seed.
+//    Every perlin shows the same pattern and is the size of a pointer. It draws none of
+//    random_double()'s numbers, so one can be made on any thread without shifting the scene's
+//    random numbers.
+//  - noise() takes the 8 corners of a cell four at a time in float4 lanes: gradients are stored
+//    padded to 4 floats, loaded whole and transposed to x, y and z across the corners.
 
 class perlin {
   public:
-    perlin() {
-        ranvec = new vec3[point_count];
-        for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = unit_vector(vec3::random(-1, 1));
-        }
+    static const int point_count = 256;
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
-    }
+    struct table {
+        alignas(16) float gradient[point_count][4];   // unit vectors, lane 3 zero
+        uint8_t perm_x[point_count], perm_y[point_count], perm_z[point_count];
+    };
+
+    perlin() : tables(&shared_table()) {}
 
-    ~perlin() {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+    static const table& shared_table() {
+        static const table t = make_table();
+        return t;
     }
 
     double noise(const point3& p) const {
-        auto u = p.x() - floor(p.x());
-        auto v = p.y() - floor(p.y());
-        auto w = p.z() - floor(p.z());
-
-        auto i = static_cast<int>(floor(p.x()));
-        auto j = static_cast<int>(floor(p.y()));
-        auto k = static_cast<int>(floor(p.z()));
-        vec3 c[2][2][2];
-
-
-        for (int di=0; di < 2; di++)
-            for (int dj=0; dj < 2; dj++)
-                for (int dk=0; dk < 2; dk++)
-                    c[di][dj][dk] = ranvec[
-                        perm_x[(i+di) & 255] ^
-                        perm_y[(j+dj) & 255] ^
-                        perm_z[(k+dk) & 255]
-                    ];
-
-        return perlin_interp(c, u, v, w);
+        auto fx = floor(p.x()), fy = floor(p.y()), fz = floor(p.z());
+        auto u = static_cast<float>(p.x() - fx);
+        auto v = static_cast<float>(p.y() - fy);
+        auto w = static_cast<float>(p.z() - fz);
+
+        auto i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+        const auto& t = *tables;
+        int x0 = t.perm_x[i & 255], x1 = t.perm_x[(i+1) & 255];
+        int y0 = t.perm_y[j & 255], y1 = t.perm_y[(j+1) & 255];
+        int z0 = t.perm_z[k & 255], z1 = t.perm_z[(k+1) & 255];
+
+        // corners (dj,dk) = 00 01 10 11 in the lanes; di = 0 in a, di = 1 in b
+        auto ax = float4::load(t.gradient[x0 ^ y0 ^ z0]), ay = float4::load(t.gradient[x0 ^ y0 ^ z1]);
+        auto az = float4::load(t.gradient[x0 ^ y1 ^ z0]), aw = float4::load(t.gradient[x0 ^ y1 ^ z1]);
+        auto bx = float4::load(t.gradient[x1 ^ y0 ^ z0]), by = float4::load(t.gradient[x1 ^ y0 ^ z1]);
+        auto bz = float4::load(t.gradient[x1 ^ y1 ^ z0]), bw = float4::load(t.gradient[x1 ^ y1 ^ z1]);
+        transpose(ax, ay, az, aw);
+        transpose(bx, by, bz, bw);
+
+        // each corner's gradient dotted with the offset from it
+        float4 dy(v, v, v-1, v-1), dz(w, w-1, w, w-1);
+        auto a = ax * float4(u) + ay * dy + az * dz;
+        auto b = bx * float4(u-1) + by * dy + bz * dz;
+
+        // Hermitian smoothing, then the trilinear weights
+        auto uu = u*u*(3-2*u), vv = v*v*(3-2*v), ww = w*w*(3-2*w);
+        float4 wy(1-vv, 1-vv, vv, vv), wz(1-ww, ww, 1-ww, ww);
+        return sum((float4(1-uu) * a + float4(uu) * b) * wy * wz);
     }
 
     double turb(const point3& p, int depth=7) const {
@@ -61,50 +80,94 @@ class perlin {
     }
 
   private:
-    static const int point_count = 256;
-    vec3* ranvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
+    const table* tables;
 
-    static int* perlin_generate_perm() {
-        auto p = new int[point_count];
+    static table make_table() {
+        std::mt19937 generator(0x5eed);
+        std::uniform_real_distribution<double> distribution(-1.0, 1.0);
 
-        for (int i = 0; i < perlin::point_count; i++)
-            p[i] = i;
+        table t;
+        for (int i = 0; i < point_count; ++i) {
+            vec3 g;
+            do {
+                g = vec3(distribution(generator), distribution(generator), distribution(generator));
+            } while (g.length_squared() < 1e-6);
+            g = unit_vector(g);
+            for (int k = 0; k < 3; ++k)
+                t.gradient[i][k] = static_cast<float>(g[k]);
+            t.gradient[i][3] = 0;
+        }
 
-        permute(p, point_count);
+        permute(t.perm_x, generator);
+        permute(t.perm_y, generator);
+        permute(t.perm_z, generator);
+        return t;
+    }
 
-        return p;
+    static void permute(uint8_t* p, std::mt19937& generator) {
+        for (int i = 0; i < point_count; i++)
+            p[i] = static_cast<uint8_t>(i);
+        for (int i = point_count-1; i > 0; i--) {
+            int target = std::uniform_int_distribution<int>(0, i)(generator);
+            std::swap(p[i], p[target]);
+        }
     }
+};
+
 
-    static void permute(int* p, int n) {
-        for (int i = n-1; i > 0; i--) {
-            int target = random_int(0, i);
-            int tmp = p[i];
-            p[i] = p[target];
-            p[target] = tmp;
+// Turbulence baked on a grid of resolution^3 points over a box, then read with one trilinear
+// lookup instead of depth octaves of noise. Meant for procedural textures on objects that don't move.
+// Detail finer than a cell is smoothed away: about 4 cells per period of the finest octave keep
+// every octave. Points outside the box are evaluated as usual.
+class baked_turbulence {
+  public:
+    baked_turbulence(const bbox& region, int resolution, int octaves=7)
+      : origin(region.x.min, region.y.min, region.z.min), n(resolution < 2 ? 2 : resolution), depth(octaves),
+        values(static_cast<size_t>(n) * n * n)
+    {
+        auto size = vec3(region.x.size(), region.y.size(), region.z.size());
+        for (int k = 0; k < 3; ++k) {
+            cell[k] = size[k] / (n - 1);
+            inv_cell[k] = cell[k] > 0 ? 1 / cell[k] : 0;
         }
+
+        parallel_for(n, [&](int z, int) {
+            for (int y = 0; y < n; ++y)
+                for (int x = 0; x < n; ++x)
+                    values[index(x, y, z)] = static_cast<float>(
+                        noise.turb(origin + vec3(x * cell[0], y * cell[1], z * cell[2]), depth));
+        });
     }
 
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-        auto uu = u*u*(3-2*u);
-        auto vv = v*v*(3-2*v);
-        auto ww = w*w*(3-2*w);
-        auto accum = 0.0;
+    double turb(const point3& p) const {
+        auto g = p - origin;
+        double f[3];
+        int c[3];
+        for (int k = 0; k < 3; ++k) {
+            f[k] = g[k] * inv_cell[k];
+            if (!(f[k] >= 0 && f[k] <= n - 1))
+                return noise.turb(p, depth);
+            c[k] = std::min(static_cast<int>(f[k]), n - 2);
+            f[k] -= c[k];
+        }
 
-        for (int i=0; i < 2; i++)
-            for (int j=0; j < 2; j++)
-                for (int k=0; k < 2; k++) {
-                    vec3 weight_v(u-i, v-j, w-k);
-                    accum += (i*uu + (1-i)*(1-uu))
-                           * (j*vv + (1-j)*(1-vv))
-                           * (k*ww + (1-k)*(1-ww))
-                           * dot(c[i][j][k], weight_v);
-                }
-
-        return accum;
+        auto at = [&](int dx, int dy, int dz) { return values[index(c[0] + dx, c[1] + dy, c[2] + dz)]; };
+        auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+        auto x00 = lerp(at(0,0,0), at(1,0,0), f[0]), x10 = lerp(at(0,1,0), at(1,1,0), f[0]);
+        auto x01 = lerp(at(0,0,1), at(1,0,1), f[0]), x11 = lerp(at(0,1,1), at(1,1,1), f[0]);
+        return lerp(lerp(x00, x10, f[1]), lerp(x01, x11, f[1]), f[2]);
     }
+
+    size_t memory_bytes() const { return values.size() * sizeof(float); }
+
+  private:
+    perlin noise;
+    point3 origin;
+    vec3 cell, inv_cell;
+    int n, depth;
+    std::vector<float> values;
+
+    size_t index(int x, int y, int z) const { return (static_cast<size_t>(z) * n + y) * n + x; }
 };
 
-#endif
\ No newline at end of file
+#endif
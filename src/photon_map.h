@@ -0,0 +1,262 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "utility.h"
+#include "object.h"
+#include "material.h"
+#include "scene.h"
+#include "onb.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <vector>
+
+// Caustic photon map:
+//  - photons leave the lights, bounce through specular surfaces (metal, dielectric)
+//    and are stored where they first land on a diffuse surface (light -> specular+ -> diffuse),
+//  - stored photons are organised in a balanced kd-tree (median splits, kept in place in one array),
+//  - radiance at a diffuse hit is estimated from its k nearest photons.
+
+
+class photon {
+  public:
+    float position[3];
+    float power[3];
+    float direction[3];   // direction of travel when the photon landed
+    int axis;             // kd-tree split axis of this node
+};
+
+
+class photon_map {
+  public:
+    photon_map() {}
+
+
+    // Method
+
+    size_t size() const { return photons.size(); }
+    double extent() const { return bounds_extent; }
+
+    // Emits `photon_count` photons from the lights, traces them in parallel and builds the kd-tree.
+    void build(const object& world, const scene& lights, int photon_count, int max_depth)
+    {
+        const int batch = 4096;
+        int batch_count = (photon_count + batch - 1) / batch;
+        std::vector<std::vector<photon>> stored(hardware_thread_count());
+
+        parallel_for(batch_count, [&](int b, int thread_id)
+        {
+            auto end = std::min(photon_count, (b + 1) * batch);
+            for (int i = b * batch; i < end; ++i)
+                trace_photon(world, lights, max_depth, 1.0 / photon_count, stored[thread_id]);
+        });
+
+        photons.clear();
+        for (auto& s : stored)
+            photons.insert(photons.end(), s.begin(), s.end());
+
+        bbox bounds;
+        for (const auto& ph : photons)
+        {
+            point3 p(ph.position[0], ph.position[1], ph.position[2]);
+            bounds = bbox(bounds, bbox(p, p));
+        }
+        bounds_extent = photons.empty() ? 0 : (point3(bounds.x.max, bounds.y.max, bounds.z.max)
+                                             - point3(bounds.x.min, bounds.y.min, bounds.z.min)).length();
+
+        balance(0, photons.size());
+    }
+
+    // Irradiance at p from the k nearest photons within max_radius that arrive on the side `normal` faces.
+    // The caller multiplies by its BRDF (albedo / pi for lambertian).
+    color estimate_irradiance(const point3& p, const vec3& normal, int k, double max_radius) const
+    {
+        if (photons.empty())
+            return color(0, 0, 0);
+
+        std::vector<std::pair<float, uint32_t>> heap;   // max-heap on squared distance
+        heap.reserve(k + 1);
+        double max_d2 = max_radius * max_radius;
+        nearest(0, photons.size(), p, k, heap, max_d2);
+
+        if (heap.empty())
+            return color(0, 0, 0);
+
+        color flux(0, 0, 0);
+        for (const auto& h : heap)
+        {
+            const auto& ph = photons[h.second];
+            auto arriving = ph.direction[0] * normal[0] + ph.direction[1] * normal[1] + ph.direction[2] * normal[2];
+            if (arriving < 0)
+                flux += color(ph.power[0], ph.power[1], ph.power[2]);
+        }
+
+        // radius of the disc actually covered: the k-th photon, or the search bound if fewer were found
+        auto r2 = static_cast<int>(heap.size()) == k ? static_cast<double>(heap.front().first) : max_radius * max_radius;
+        return flux / (pi * r2);
+    }
+
+  private:
+    std::vector<photon> photons;
+    double bounds_extent = 0;
+
+    static void trace_photon(const object& world, const scene& lights, int max_depth, double scale, std::vector<photon>& out)
+    {
+        surface_sample s;
+        if (!lights.sample_surface(s))
+            return;
+
+        // radiance leaving the light sample, evaluated like a hit on its front face
+        intersect_record emitter;
+        emitter.p = s.p;
+        emitter.normal = s.normal;
+        emitter.front_face = true;
+        emitter.mat = s.mat;
+        emitter.u = s.u;
+        emitter.v = s.v;
+
+        // lights may be listed as bare geometry (no material): the emitter is the world surface there,
+        // found by a ray dropped onto the sample from just above it
+        if (!s.mat)
+        {
+            auto above = offset_ray_origin(s.p, s.normal, s.normal);
+            intersect_record surface;
+            if (!world.intersect(ray(above, -s.normal), interval(0, 2 * (above - s.p).length()), surface))
+                return;
+            emitter.mat = surface.mat;
+            emitter.u = surface.u;
+            emitter.v = surface.v;
+        }
+
+        ray dummy;
+        auto Le = material_emitted(emitter.mat, emitter, dummy, emitter.u, emitter.v, s.p);
+        if (Le.near_zero())
+            return;
+
+        // cosine-weighted emission: flux = Le * cos / (pdf_area * cos / pi)
+        onb uvw;
+        uvw.build_from_w(s.normal);
+        auto direction = uvw.local(randomSample_cosine_direction());
+        ray r(offset_ray_origin(s.p, s.normal, direction), direction, random_double());
+        color power = Le * (pi * scale / s.pdf);
+
+        bool through_specular = false;
+        for (int depth = 0; depth < max_depth; ++depth)
+        {
+            intersect_record rec;
+            if (!world.intersect(r, interval(0, infinity), rec))
+                return;
+
+            ray scattered;
+            color albedo;
+            double pdf;
+            if (!material_scatter(rec.mat, rec, r, scattered, albedo, pdf))
+                return;   // absorbed, e.g. by a light
+
+            if (pdf == 0 && !material_is_glossy(rec.mat))
+            {
+                // specular: follow the one direction the material chose
+                power = power * albedo;
+                r = scattered;
+                through_specular = true;
+                continue;
+            }
+
+            // first diffuse hit: keep the photon only if it is a caustic one
+            // (scattering inside a medium or off a glossy surface ends the photon without storing it:
+            // the map is for diffuse surfaces)
+            if (through_specular && !material_is_volumetric(rec.mat) && !material_is_glossy(rec.mat))
+            {
+                auto d = unit_vector(r.direction());
+                photon ph;
+                for (int i = 0; i < 3; ++i)
+                {
+                    ph.position[i] = static_cast<float>(rec.p[i]);
+                    ph.power[i] = static_cast<float>(power[i]);
+                    ph.direction[i] = static_cast<float>(d[i]);
+                }
+                ph.axis = 0;
+                out.push_back(ph);
+            }
+            return;
+        }
+    }
+
+    void balance(size_t begin, size_t end)
+    {
+        // the median along the widest axis becomes the node, the halves become its subtrees.
+        if (end - begin < 2)
+        {
+            if (begin < end)
+                photons[begin].axis = 0;
+            return;
+        }
+
+        const auto big = std::numeric_limits<float>::max();
+        float lo[3] = { big,  big,  big};
+        float hi[3] = {-big, -big, -big};
+        for (auto i = begin; i < end; ++i)
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], photons[i].position[a]);
+                hi[a] = std::max(hi[a], photons[i].position[a]);
+            }
+
+        int axis = 0;
+        if (hi[1] - lo[1] > hi[axis] - lo[axis]) axis = 1;
+        if (hi[2] - lo[2] > hi[axis] - lo[axis]) axis = 2;
+
+        auto mid = begin + (end - begin) / 2;
+        std::nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end,
+                         [axis](const photon& a, const photon& b) { return a.position[axis] < b.position[axis]; });
+        photons[mid].axis = axis;
+
+        balance(begin, mid);
+        balance(mid + 1, end);
+    }
+
+    void nearest(size_t begin, size_t end, const point3& p, int k,
+                 std::vector<std::pair<float, uint32_t>>& heap, double& max_d2) const
+    {
+        if (begin >= end)
+            return;
+
+        auto mid = begin + (end - begin) / 2;
+        const auto& ph = photons[mid];
+        auto d = p[ph.axis] - ph.position[ph.axis];
+
+        // near side first, far side only if the splitting plane is inside the search radius
+        if (d < 0)
+        {
+            nearest(begin, mid, p, k, heap, max_d2);
+            if (d * d < max_d2)
+                nearest(mid + 1, end, p, k, heap, max_d2);
+        }
+        else
+        {
+            nearest(mid + 1, end, p, k, heap, max_d2);
+            if (d * d < max_d2)
+                nearest(begin, mid, p, k, heap, max_d2);
+        }
+
+        auto dx = p[0] - ph.position[0];
+        auto dy = p[1] - ph.position[1];
+        auto dz = p[2] - ph.position[2];
+        auto d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 >= max_d2)
+            return;
+
+        heap.emplace_back(static_cast<float>(d2), static_cast<uint32_t>(mid));
+        std::push_heap(heap.begin(), heap.end());
+        if (static_cast<int>(heap.size()) > k)
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+        if (static_cast<int>(heap.size()) == k)
+            max_d2 = heap.front().first;   // shrink the search to the current k-th neighbour
+    }
+};
+
+
+#endif //PHOTON_MAP_H
@@ -0,0 +1,620 @@
+#ifndef PRIMITIVE_POOL_H
+#define PRIMITIVE_POOL_H
+
+#include "utility.h"
+#include "object.h"
+#include "flat_bvh.h"
+#include "material.h"
+#include "sphere.h"
+#include "cuboid.h"
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Many spheres, quads and boxes as one object, instead of one heap object and one virtual call each:
+//  - each primitive type lives in its own structure-of-arrays pool (floats, a material id),
+//  - one BVH (flat_bvh.h) spans the pools; a leaf points at a range of each type,
+//  - leaves are intersected by one loop per type, branch-free over the range, which the compiler
+//    can vectorize, and only the closest hit gets a full intersect_record (a shadow ray none).
+// Geometry only: lights keep their own sphere/quad objects in the lights list.
+// Call build() after the last add_*, before rendering.
+
+
+class primitive_pool : public object
+{
+public:
+    primitive_pool() {}
+
+
+    // Method
+
+    // stationary sphere
+    void add_sphere(const point3& center, double radius, shared_ptr<material> m)
+    {
+        add_sphere(center, center, radius, m);
+    }
+
+    // moving sphere, from center1 at time 0 to center2 at time 1
+    void add_sphere(const point3& center1, const point3& center2, double radius, shared_ptr<material> m)
+    {
+        auto motion = center2 - center1;
+        for (int a = 0; a < 3; ++a)
+        {
+            spheres.center[a].push_back(static_cast<float>(center1[a]));
+            spheres.motion[a].push_back(static_cast<float>(motion[a]));
+        }
+        spheres.radius.push_back(static_cast<float>(radius));
+        spheres.mat.push_back(material_table::global().id(m));
+    }
+
+    void add_quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> m)
+    {
+        add_quad(Q, u, v, material_table::global().id(m));
+    }
+
+    void add_quad(const point3& Q, const vec3& u, const vec3& v, material_id m)
+    {
+        auto n = cross(u, v);
+        auto normal = unit_vector(n);
+        auto w = n / dot(n, n);
+        auto to_alpha = cross(v, w);   // alpha = dot(p - Q, to_alpha), same as dot(w, cross(p - Q, v))
+        auto to_beta = cross(w, u);    // beta  = dot(p - Q, to_beta),  same as dot(w, cross(u, p - Q))
+
+        for (int a = 0; a < 3; ++a)
+        {
+            quads.Q[a].push_back(static_cast<float>(Q[a]));
+            quads.u[a].push_back(static_cast<float>(u[a]));
+            quads.v[a].push_back(static_cast<float>(v[a]));
+            quads.normal[a].push_back(static_cast<float>(normal[a]));
+            quads.to_alpha[a].push_back(static_cast<float>(to_alpha[a]));
+            quads.to_beta[a].push_back(static_cast<float>(to_beta[a]));
+        }
+        quads.D.push_back(static_cast<float>(dot(normal, Q)));
+        quads.mat.push_back(m);
+    }
+
+    // axis-aligned box with opposite vertices a and b (see cuboid.h)
+    void add_box(const point3& a, const point3& b, shared_ptr<material> m)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            boxes.lo[i].push_back(static_cast<float>(fmin(a[i], b[i])));
+            boxes.hi[i].push_back(static_cast<float>(fmax(a[i], b[i])));
+        }
+        boxes.mat.push_back(material_table::global().id(m));
+    }
+
+    size_t sphere_count() const { return spheres.radius.size(); }
+    size_t quad_count() const { return quads.D.size(); }
+    size_t box_count() const { return boxes.mat.size(); }
+
+    size_t memory_bytes() const
+    {
+        return sphere_count() * (7 * sizeof(float) + sizeof(material_id))
+             + quad_count() * (19 * sizeof(float) + sizeof(material_id))
+             + box_count() * (6 * sizeof(float) + sizeof(material_id))
+             + bvh.memory_bytes() + leaves.size() * sizeof(leaf_range);
+    }
+
+    // Sorts the sphere, quad and box pools into BVH leaf order and builds the BVH over them.
+    void build()
+    {
+        build_bvh();
+        std::clog << "Primitive pool: " << sphere_count() << " spheres, " << quad_count() << " quads, "
+                  << box_count() << " boxes, " << memory_bytes() / 1024.0 << " KB\n";
+    }
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        hit_kind hit_type;
+        int64_t hit;
+        if (!closest(r, ray_t, hit_type, hit))
+            return false;
+
+        switch (hit_type)
+        {
+        case sphere_hit: fill_sphere_record(static_cast<size_t>(hit), r, ray_t.max, rec); break;
+        case quad_hit:   fill_quad_record(static_cast<size_t>(hit), r, ray_t.max, rec);   break;
+        default:         fill_box_record(static_cast<size_t>(hit), r, ray_t.max, rec);    break;
+        }
+
+        return true;
+    }
+
+    // shadow rays: the same search, without a record
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        hit_kind hit_type;
+        int64_t hit;
+        return closest(r, ray_t, hit_type, hit) ? 0.0 : 1.0;
+    }
+
+    void rotate(double degree, int axis) override
+    {
+        // rotation matrix parameter
+        auto radians = degrees_to_radians(degree);
+        auto cos_theta = cos(radians);
+        auto sin_theta = sin(radians);
+
+        // construct rotation matrix
+        vec3 row_x, row_y, row_z;
+        switch (axis)
+        {
+        case 0:
+            row_x = vec3(1.0,         0.0,          0.0);
+            row_y = vec3(0.0,   cos_theta,   -sin_theta);
+            row_z = vec3(0.0,   sin_theta,    cos_theta);
+            break;
+        case 1:
+            row_x = vec3(cos_theta,    0.0,  sin_theta);
+            row_y = vec3(0.0,          1.0,        0.0);
+            row_z = vec3(-sin_theta,   0.0,  cos_theta);
+            break;
+        case 2:
+            row_x = vec3(cos_theta,  -sin_theta,   0.0);
+            row_y = vec3(sin_theta,   cos_theta,   0.0);
+            row_z = vec3(      0.0,         0.0,   1.0);
+            break;
+        default:
+            return;
+        }
+
+        // boxes stop being axis-aligned: they go on as their six quads
+        boxes_to_quads();
+
+        // every stored point and direction turns alike (a rotation keeps cross products and D),
+        // then the BVH is rebuilt around them
+        auto turn = [&](std::vector<float>* a)
+        {
+            for (size_t i = 0; i < a[0].size(); ++i)
+            {
+                vec3 x(a[0][i], a[1][i], a[2][i]);
+                a[0][i] = static_cast<float>(dot(row_x, x));
+                a[1][i] = static_cast<float>(dot(row_y, x));
+                a[2][i] = static_cast<float>(dot(row_z, x));
+            }
+        };
+        turn(spheres.center);
+        turn(spheres.motion);
+        turn(quads.Q);
+        turn(quads.u);
+        turn(quads.v);
+        turn(quads.normal);
+        turn(quads.to_alpha);
+        turn(quads.to_beta);
+        build_bvh();
+    }
+
+    void translate(vec3 dir) override
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            for (auto& c : spheres.center[a])
+                c += static_cast<float>(dir[a]);
+            for (auto& q : quads.Q[a])
+                q += static_cast<float>(dir[a]);
+            for (auto& l : boxes.lo[a])
+                l += static_cast<float>(dir[a]);
+            for (auto& h : boxes.hi[a])
+                h += static_cast<float>(dir[a]);
+        }
+        for (size_t i = 0; i < quad_count(); ++i)
+            quads.D[i] += static_cast<float>(quads.normal[0][i] * dir[0] + quads.normal[1][i] * dir[1] + quads.normal[2][i] * dir[2]);
+        build_bvh();
+    }
+
+private:
+    enum hit_kind { none, sphere_hit, quad_hit, box_hit };
+
+    struct sphere_pool
+    {
+        std::vector<float> center[3];   // at time 0
+        std::vector<float> motion[3];   // center at time 1 minus center at time 0
+        std::vector<float> radius;
+        std::vector<material_id> mat;
+
+        void append(const sphere_pool& from, size_t i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                center[a].push_back(from.center[a][i]);
+                motion[a].push_back(from.motion[a][i]);
+            }
+            radius.push_back(from.radius[i]);
+            mat.push_back(from.mat[i]);
+        }
+    };
+
+    struct quad_pool
+    {
+        std::vector<float> Q[3];
+        std::vector<float> u[3], v[3];    // edges, for bounds only
+        std::vector<float> normal[3];
+        std::vector<float> to_alpha[3];
+        std::vector<float> to_beta[3];
+        std::vector<float> D;
+        std::vector<material_id> mat;
+
+        void append(const quad_pool& from, size_t i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                Q[a].push_back(from.Q[a][i]);
+                u[a].push_back(from.u[a][i]);
+                v[a].push_back(from.v[a][i]);
+                normal[a].push_back(from.normal[a][i]);
+                to_alpha[a].push_back(from.to_alpha[a][i]);
+                to_beta[a].push_back(from.to_beta[a][i]);
+            }
+            D.push_back(from.D[i]);
+            mat.push_back(from.mat[i]);
+        }
+    };
+
+    struct box_pool
+    {
+        std::vector<float> lo[3], hi[3];
+        std::vector<material_id> mat;
+
+        void append(const box_pool& from, size_t i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a].push_back(from.lo[a][i]);
+                hi[a].push_back(from.hi[a][i]);
+            }
+            mat.push_back(from.mat[i]);
+        }
+    };
+
+    struct leaf_range
+    {
+        uint32_t first_sphere, first_quad, first_box;
+        uint16_t sphere_count, quad_count, box_count;
+    };
+
+    sphere_pool spheres;
+    quad_pool quads;
+    box_pool boxes;
+    flat_bvh bvh;                   // leaf offsets renumbered to their leaf_range
+    static const int lanes = 8;     // primitives per pass of the leaf loops
+    std::vector<leaf_range> leaves;
+    bbox bounding_box;
+
+    static const int max_leaf_size = 4;   // rays grazing a grid of boxes cross many leaves: keep them small
+
+    void build_bvh()
+    {
+        auto first_quad = sphere_count(), first_box = first_quad + quad_count();
+        auto count = first_box + box_count();
+        std::vector<flat_bvh::build_ref> refs(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& ref = refs[i];
+            ref.index = static_cast<uint32_t>(i);   // spheres first, then quads, then boxes
+            bbox b = i < first_quad ? sphere_bbox(i) : (i < first_box ? quad_bbox(i - first_quad) : box_bbox(i - first_box));
+            for (int a = 0; a < 3; ++a)
+            {
+                ref.lo[a] = static_cast<float>(b.axis(a).min);
+                ref.hi[a] = static_cast<float>(b.axis(a).max);
+                ref.centroid[a] = 0.5f * (ref.lo[a] + ref.hi[a]);
+            }
+        }
+
+        bvh.build(refs, max_leaf_size);
+        bounding_box = bvh.bounds();
+
+        // leaf by leaf: its spheres, quads and boxes, each type contiguous in its own pool
+        sphere_pool sorted_spheres;
+        quad_pool sorted_quads;
+        box_pool sorted_boxes;
+        leaves.clear();
+        for (auto& n : bvh.nodes)
+        {
+            if (n.count == 0)
+                continue;
+
+            leaf_range leaf;
+            leaf.first_sphere = static_cast<uint32_t>(sorted_spheres.radius.size());
+            leaf.first_quad = static_cast<uint32_t>(sorted_quads.D.size());
+            leaf.first_box = static_cast<uint32_t>(sorted_boxes.mat.size());
+            for (uint32_t k = n.offset; k < n.offset + n.count; ++k)
+            {
+                auto i = refs[k].index;
+                if (i < first_quad)
+                    sorted_spheres.append(spheres, i);
+                else if (i < first_box)
+                    sorted_quads.append(quads, i - first_quad);
+                else
+                    sorted_boxes.append(boxes, i - first_box);
+            }
+            leaf.sphere_count = static_cast<uint16_t>(sorted_spheres.radius.size() - leaf.first_sphere);
+            leaf.quad_count = static_cast<uint16_t>(sorted_quads.D.size() - leaf.first_quad);
+            leaf.box_count = static_cast<uint16_t>(sorted_boxes.mat.size() - leaf.first_box);
+
+            n.offset = static_cast<uint32_t>(leaves.size());
+            leaves.push_back(leaf);
+        }
+        spheres = std::move(sorted_spheres);
+        quads = std::move(sorted_quads);
+        boxes = std::move(sorted_boxes);
+    }
+
+    void boxes_to_quads()
+    {
+        // the six sides as box() used to build them
+        for (size_t i = 0; i < box_count(); ++i)
+        {
+            auto min = point3(boxes.lo[0][i], boxes.lo[1][i], boxes.lo[2][i]);
+            auto max = point3(boxes.hi[0][i], boxes.hi[1][i], boxes.hi[2][i]);
+            auto m = boxes.mat[i];
+
+            auto dx = vec3(max.x() - min.x(), 0, 0);
+            auto dy = vec3(0, max.y() - min.y(), 0);
+            auto dz = vec3(0, 0, max.z() - min.z());
+
+            add_quad(point3(min.x(), min.y(), max.z()),  dx,  dy, m); // front
+            add_quad(point3(max.x(), min.y(), max.z()), -dz,  dy, m); // right
+            add_quad(point3(max.x(), min.y(), min.z()), -dx,  dy, m); // back
+            add_quad(point3(min.x(), min.y(), min.z()),  dz,  dy, m); // left
+            add_quad(point3(min.x(), max.y(), max.z()),  dx, -dz, m); // top
+            add_quad(point3(min.x(), min.y(), min.z()),  dx,  dz, m); // bottom
+        }
+        boxes = box_pool();
+    }
+
+    bbox sphere_bbox(size_t i) const
+    {
+        auto c1 = point3(spheres.center[0][i], spheres.center[1][i], spheres.center[2][i]);
+        auto c2 = c1 + vec3(spheres.motion[0][i], spheres.motion[1][i], spheres.motion[2][i]);
+        auto r = fabs(spheres.radius[i]);
+        auto r_vec = vec3(r, r, r);
+        return bbox(bbox(c1 - r_vec, c1 + r_vec), bbox(c2 - r_vec, c2 + r_vec));
+    }
+
+    bbox quad_bbox(size_t i) const
+    {
+        // all four corners: the quad may be turned
+        auto Q = point3(quads.Q[0][i], quads.Q[1][i], quads.Q[2][i]);
+        auto u = vec3(quads.u[0][i], quads.u[1][i], quads.u[2][i]);
+        auto v = vec3(quads.v[0][i], quads.v[1][i], quads.v[2][i]);
+        return bbox(bbox(Q, Q + u + v), bbox(Q + u, Q + v)).pad();
+    }
+
+    bbox box_bbox(size_t i) const
+    {
+        return bbox(point3(boxes.lo[0][i], boxes.lo[1][i], boxes.lo[2][i]),
+                    point3(boxes.hi[0][i], boxes.hi[1][i], boxes.hi[2][i])).pad();
+    }
+
+    // The closest hit within ray_t, which is shrunk to end at it: its type and index in that type's pool.
+    bool closest(const ray& r, interval& ray_t, hit_kind& hit_type, int64_t& hit) const
+    {
+        hit_type = none;
+        hit = -1;
+
+        bvh.traverse(r, ray_t, [&](const flat_bvh::node& n)
+        {
+            const auto& leaf = leaves[n.offset];
+            if (leaf.sphere_count > 0)
+            {
+                auto s = closest_sphere(leaf.first_sphere, leaf.sphere_count, r, ray_t);
+                if (s >= 0)
+                {
+                    hit_type = sphere_hit;
+                    hit = s;
+                }
+            }
+            if (leaf.quad_count > 0)
+            {
+                auto q = closest_quad(leaf.first_quad, leaf.quad_count, r, ray_t);
+                if (q >= 0)
+                {
+                    hit_type = quad_hit;
+                    hit = q;
+                }
+            }
+            if (leaf.box_count > 0)
+            {
+                auto b = closest_box(leaf.first_box, leaf.box_count, r, ray_t);
+                if (b >= 0)
+                {
+                    hit_type = box_hit;
+                    hit = b;
+                }
+            }
+        });
+
+        return hit_type != none;
+    }
+
+    // Closest sphere of [first, first + count) hit within ray_t; shrinks ray_t.max to it. -1 if none.
+    int64_t closest_sphere(uint32_t first, uint32_t count, const ray& r, interval& ray_t) const
+    {
+        // in double in both builds, like sphere::intersect
+        const basic_vec3<double> o(r.origin()), d(r.direction());
+        double time = r.time();
+        auto a = d.length_squared();
+        auto t_min = ray_t.min;
+
+        int64_t hit = -1;
+        for (uint32_t base = first; base < first + count; base += lanes)
+        {
+            auto n = std::min<uint32_t>(lanes, first + count - base);
+            double root[lanes];
+
+            // the same arithmetic on every lane, misses become infinity
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                auto i = base + l;
+                double ocx = o[0] - (spheres.center[0][i] + time * spheres.motion[0][i]);
+                double ocy = o[1] - (spheres.center[1][i] + time * spheres.motion[1][i]);
+                double ocz = o[2] - (spheres.center[2][i] + time * spheres.motion[2][i]);
+                double radius = spheres.radius[i];
+
+                auto half_b = ocx * d[0] + ocy * d[1] + ocz * d[2];
+                auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+                auto discriminant = half_b * half_b - a * c;
+                auto sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+
+                auto t = (-half_b - sqrtd) / a;
+                t = t > t_min ? t : (-half_b + sqrtd) / a;
+                root[l] = (discriminant >= 0 && t > t_min) ? t : infinity;
+            }
+
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                if (root[l] < ray_t.max)
+                {
+                    ray_t.max = root[l];
+                    hit = base + l;
+                }
+            }
+        }
+        return hit;
+    }
+
+    // Closest quad of [first, first + count) hit within ray_t; shrinks ray_t.max to it. -1 if none.
+    int64_t closest_quad(uint32_t first, uint32_t count, const ray& r, interval& ray_t) const
+    {
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        auto t_min = ray_t.min;
+
+        int64_t hit = -1;
+        for (uint32_t base = first; base < first + count; base += lanes)
+        {
+            auto n = std::min<uint32_t>(lanes, first + count - base);
+            double root[lanes];
+
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                auto i = base + l;
+                double nx = quads.normal[0][i], ny = quads.normal[1][i], nz = quads.normal[2][i];
+                auto denominator = nx * d[0] + ny * d[1] + nz * d[2];
+                auto t = (quads.D[i] - (nx * o[0] + ny * o[1] + nz * o[2])) / denominator;
+
+                // hit point relative to Q, in the quad's plane coordinates
+                auto px = o[0] + t * d[0] - quads.Q[0][i];
+                auto py = o[1] + t * d[1] - quads.Q[1][i];
+                auto pz = o[2] + t * d[2] - quads.Q[2][i];
+                auto alpha = px * quads.to_alpha[0][i] + py * quads.to_alpha[1][i] + pz * quads.to_alpha[2][i];
+                auto beta = px * quads.to_beta[0][i] + py * quads.to_beta[1][i] + pz * quads.to_beta[2][i];
+
+                auto inside = fabs(denominator) >= 1e-8 && t >= t_min
+                           && alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1;
+                root[l] = inside ? t : infinity;
+            }
+
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                if (root[l] < ray_t.max)
+                {
+                    ray_t.max = root[l];
+                    hit = base + l;
+                }
+            }
+        }
+        return hit;
+    }
+
+    // Closest box of [first, first + count) hit within ray_t; shrinks ray_t.max to it. -1 if none.
+    int64_t closest_box(uint32_t first, uint32_t count, const ray& r, interval& ray_t) const
+    {
+        const auto& o = r.origin();
+        double inv_dir[3] = { 1 / r.direction()[0], 1 / r.direction()[1], 1 / r.direction()[2] };
+        auto t_min = ray_t.min;
+
+        int64_t hit = -1;
+        for (uint32_t base = first; base < first + count; base += lanes)
+        {
+            auto n = std::min<uint32_t>(lanes, first + count - base);
+            double root[lanes];
+
+            // slab test; rays starting inside take the exit
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                auto i = base + l;
+                auto t_near = -infinity, t_far = infinity;
+                for (int a = 0; a < 3; ++a)
+                {
+                    auto t0 = (boxes.lo[a][i] - o[a]) * inv_dir[a];
+                    auto t1 = (boxes.hi[a][i] - o[a]) * inv_dir[a];
+                    t_near = fmax(t_near, fmin(t0, t1));
+                    t_far = fmin(t_far, fmax(t0, t1));
+                }
+                auto t = t_near > t_min ? t_near : t_far;
+                root[l] = (t_near <= t_far && t > t_min) ? t : infinity;
+            }
+
+            for (uint32_t l = 0; l < n; ++l)
+            {
+                if (root[l] < ray_t.max)
+                {
+                    ray_t.max = root[l];
+                    hit = base + l;
+                }
+            }
+        }
+        return hit;
+    }
+
+    void fill_sphere_record(size_t i, const ray& r, double t, intersect_record& rec) const
+    {
+        auto center = point3(spheres.center[0][i], spheres.center[1][i], spheres.center[2][i])
+                    + r.time() * vec3(spheres.motion[0][i], spheres.motion[1][i], spheres.motion[2][i]);
+        auto radius = static_cast<double>(spheres.radius[i]);
+
+        rec.t = t;
+        rec.p = r.at(t);
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+        sphere::get_sphere_uv_rates(outward_normal, radius, rec.u_rate, rec.v_rate);
+        rec.mat = spheres.mat[i];
+    }
+
+    void fill_quad_record(size_t i, const ray& r, double t, intersect_record& rec) const
+    {
+        auto Q = point3(quads.Q[0][i], quads.Q[1][i], quads.Q[2][i]);
+        auto normal = vec3(quads.normal[0][i], quads.normal[1][i], quads.normal[2][i]);
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = quads.mat[i];
+        rec.set_face_normal(r, normal);
+
+        auto p = rec.p - Q;
+        auto to_alpha = vec3(quads.to_alpha[0][i], quads.to_alpha[1][i], quads.to_alpha[2][i]);
+        auto to_beta = vec3(quads.to_beta[0][i], quads.to_beta[1][i], quads.to_beta[2][i]);
+        rec.u = dot(p, to_alpha);
+        rec.v = dot(p, to_beta);
+        rec.u_rate = to_alpha.length();   // both lie in the plane: the gradients of u and v
+        rec.v_rate = to_beta.length();
+    }
+
+    void fill_box_record(size_t i, const ray& r, double t, intersect_record& rec) const
+    {
+        auto lo = point3(boxes.lo[0][i], boxes.lo[1][i], boxes.lo[2][i]);
+        auto hi = point3(boxes.hi[0][i], boxes.hi[1][i], boxes.hi[2][i]);
+
+        // the slab test again, now for the face
+        double t_near, t_far;
+        int near_face, far_face;
+        cuboid::slab(lo, hi, r.origin(), r.direction(), t_near, near_face, t_far, far_face);
+        auto face = t == t_near ? near_face : far_face;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = boxes.mat[i];
+        rec.set_face_normal(r, cuboid::face_normal(face));
+        cuboid::face_uv(face, rec.p, lo, hi, rec.u, rec.v);
+        cuboid::face_uv_rates(face, lo, hi, rec.u_rate, rec.v_rate);
+    }
+};
+
+
+#endif //PRIMITIVE_POOL_H
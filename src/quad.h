@@ -3,15 +3,16 @@
 
 #include "utility.h"
 #include "object.h"
+#include "material.h"
 #include "scene.h"
 
-class quad : public object
+class quad final : public object
 {
 private:
     point3 Q;
     vec3 u;
     vec3 v;
-    std::shared_ptr<material> mat;
+    material_id mat;
     vec3 normal;
     double area;
     double D;
@@ -22,7 +23,7 @@ public:
     
     // initialization
     
-    quad(const point3& _Q, const vec3 _u, const vec3 _v, std::shared_ptr<material> _material) : Q(_Q), u(_u), v(_v), mat(_material)
+    quad(const point3& _Q, const vec3 _u, const vec3 _v, std::shared_ptr<material> _material) : Q(_Q), u(_u), v(_v), mat(material_table::global().id(_material))
     {
         set_bbox();
 
@@ -46,14 +47,14 @@ public:
 
     double get_pdf(const point3& origin, const vec3& direction) const override
     {
-        intersect_record rec;
+        double t;
 
         // test if light's ray intersect with this quad
-        if (!this->intersect(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!hit_distance(ray(origin, direction), interval(0, infinity), t))
             return 0;
 
-        auto distance_squared = rec.t * rec.t * direction.length_squared();
-        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+        auto distance_squared = t * t * direction.length_squared();
+        auto cosine = fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
@@ -64,8 +65,59 @@ public:
         return p - origin;
     }
 
+    bool sample_surface(surface_sample& s) const override
+    {
+        s.u = random_double();
+        s.v = random_double();
+        s.p = Q + (s.u * u) + (s.v * v);
+        s.normal = normal;
+        s.pdf = 1 / area;
+        s.mat = mat;
+        return true;
+    }
+
 
     bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        double t;
+        if (!hit_distance(r, ray_t, t))
+            return false;
+
+        fill_record(r, t, rec);
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        if (!hit_distance(r, ray_t, hit.t))
+            return false;
+        hit.primitive = this;
+        return true;
+    }
+
+    void fill_record(const ray& r, double t, intersect_record& rec) const override
+    {
+        auto p_intersect = r.at(t);
+        auto p_vec = p_intersect - Q;
+
+        rec.p = p_intersect;
+        rec.t = t;
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+        rec.u = dot(w, cross(p_vec, v));
+        rec.v = dot(w, cross(u, p_vec));
+        rec.u_rate = 1 / u.length();
+        rec.v_rate = 1 / v.length();
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        double t;
+        return hit_distance(r, ray_t, t) ? 0.0 : 1.0;
+    }
+
+    // distance to the plane within ray_t, if the ray meets it inside the quad
+    bool hit_distance(const ray& r, interval ray_t, double& t) const
     {
         // ray-plane intersection
         
@@ -77,14 +129,14 @@ public:
             return false;
         }
         
-        auto t = numerator / denominator;
+        auto root = numerator / denominator;
         // test if t is in valid interval
-        if (!ray_t.contains(t))
+        if (!ray_t.contains(root))
         {
             return false;
         }
         
-        auto p_intersect = r.at(t);
+        auto p_intersect = r.at(root);
         // test if intersection is inside or outside the quad
         auto p_vec = p_intersect - Q;
         auto alpha = dot(w, cross(p_vec, v));
@@ -93,15 +145,8 @@ public:
         {
             return false;
         }
-        
-        // update record
-        rec.p = p_intersect;
-        rec.t = t;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
-        rec.u = alpha;
-        rec.v = beta;
 
+        t = root;
         return true;
     }
 
@@ -185,29 +230,4 @@ public:
     
 };
 
-// box
-inline shared_ptr<scene> box(const point3& a, const point3& b, shared_ptr<material> mat)
-{
-    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
-
-    auto sides = make_shared<scene>();
-
-    // Construct the two opposite vertices with the minimum and maximum coordinates.
-    auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
-    auto max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
-
-    auto dx = vec3(max.x() - min.x(), 0, 0);
-    auto dy = vec3(0, max.y() - min.y(), 0);
-    auto dz = vec3(0, 0, max.z() - min.z());
-
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
-
-    return sides;
-}
-
 #endif //QUAD_H
\ No newline at end of file
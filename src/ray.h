@@ -3,33 +3,49 @@
 
 #include "vector.h"
 
-class ray
+template <typename T>
+class basic_ray
 {
     public:
         // initialize
         
 
-        ray() {}
-        ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction), tm(0) {}
-        ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
+        basic_ray() {}
+        basic_ray(const basic_vec3<T>& origin, const basic_vec3<T>& direction) : orig(origin), dir(direction), tm(0) {}
+        basic_ray(const basic_vec3<T>& origin, const basic_vec3<T>& direction, T time) : orig(origin), dir(direction), tm(time) {}
 
 
         // function
 
 
-        point3 origin() const  { return orig; }
-        vec3 direction() const { return dir; }
-        double time() const { return tm; }
+        basic_vec3<T> origin() const  { return orig; }
+        basic_vec3<T> direction() const { return dir; }
+        T time() const { return tm; }
 
-        point3 at(double t) const {
+        basic_vec3<T> at(T t) const {
             return orig + t*dir;
         }
 
     private:
-        point3 orig;
-        vec3 dir;
-        double tm;   // contain time variable
+        basic_vec3<T> orig;
+        basic_vec3<T> dir;
+        T tm;   // contain time variable
 };
 
+using ray = basic_ray<real>;
 
-#endif //RAY_H
\ No newline at end of file
+
+// Origin for a ray leaving a surface at p with normal n in direction w: p pushed off the surface
+// to the side w goes to, by a gap that grows with the size of p's coordinates, so the ray cannot
+// hit the surface it starts on through rounding and needs no fixed minimum t. The gap is counted
+// in float epsilons in both builds: meshes, pools and BVH nodes store their geometry in float.
+inline point3 offset_ray_origin(const point3& p, const vec3& n, const vec3& w)
+{
+    const double ulps = 32;
+    auto scale = fmax(fmax(fabs(p.x()), fabs(p.y())), fabs(p.z())) + 1;
+    auto gap = ulps * std::numeric_limits<float>::epsilon() * scale;
+    return dot(w, n) < 0 ? p - gap * n : p + gap * n;
+}
+
+
+#endif //RAY_H
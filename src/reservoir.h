@@ -0,0 +1,55 @@
+#ifndef RESERVOIR_H
+#define RESERVOIR_H
+
+#include "utility.h"
+#include "color.h"
+
+// Resampled importance sampling of lights (ReSTIR style, Bitterli et al. 2020):
+//  - many cheap light candidates stream through a weighted reservoir that keeps one of them,
+//    with probability proportional to a target function (the unshadowed contribution),
+//  - only the survivor gets a shadow ray,
+//  - reservoirs of neighbouring pixels can be merged, which multiplies the candidates seen
+//    without drawing new ones.
+
+
+// a point on a light offered to resampling.
+class light_sample
+{
+public:
+    point3 p;
+    vec3 normal;
+    color Le;                 // emitted radiance towards the shading point
+    bool emission_known = true;   // false for lights given as bare geometry: Le is a stand-in of 1
+};
+
+
+class reservoir
+{
+public:
+    light_sample y;           // the candidate kept so far
+    double w_sum = 0;         // sum of resampling weights seen
+    double M = 0;             // number of candidates seen
+    double W = 0;             // unbiased contribution weight of y: w_sum / (M * target(y))
+
+    // Streams one candidate (or a whole reservoir of `count` candidates) with resampling weight w.
+    bool update(const light_sample& candidate, double w, double count = 1)
+    {
+        w_sum += w;
+        M += count;
+        if (w > 0 && random_double() * w_sum < w)
+        {
+            y = candidate;
+            return true;
+        }
+        return false;
+    }
+
+    // Call after the last update, with the target function of the shading point at y.
+    void finalize(double target)
+    {
+        W = (target > 0 && M > 0) ? w_sum / (M * target) : 0;
+    }
+};
+
+
+#endif //RESERVOIR_H
@@ -11,9 +11,14 @@
 
 
 #include "../external/stb_image.h"
+#include "texture_formats.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class rtw_image {
   public:
@@ -27,21 +32,29 @@ class rtw_image {
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
 
+        auto path = locate(image_filename);
+        if (!path.empty() && load(path)) return;
+
+        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    }
+
+    static std::string locate(const char* image_filename) {
+        // Returns the first of the locations above where the file exists, or "" if there is none.
+
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
+        auto exists = [](const std::string& name) { return std::ifstream(name, std::ios::binary).good(); };
 
         // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
-
-        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+        if (imagedir) {
+            auto name = std::string(imagedir) + "/" + image_filename;
+            return exists(name) ? name : "";
+        }
+        for (auto prefix : { "", "images/", "../images/", "../../images/", "../../../images/",
+                             "../../../../images/", "../../../../../images/", "../../../../../../images/" }) {
+            if (exists(prefix + filename)) return prefix + filename;
+        }
+        return "";
     }
 
     ~rtw_image() { STBI_FREE(data); }
@@ -51,9 +64,23 @@ class rtw_image {
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
         data = stbi_load(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
         bytes_per_scanline = image_width * bytes_per_pixel;
+        if (data != nullptr) build_mips();
         return data != nullptr;
     }
 
+    bool load_pixels(int width, int height, const unsigned char* rgb) {
+        // Takes the image from memory instead: width x height pixels of three bytes, row by row.
+        STBI_FREE(data);
+        data = static_cast<unsigned char*>(STBI_MALLOC(static_cast<size_t>(width) * height * bytes_per_pixel));
+        if (data == nullptr) return false;
+        std::copy(rgb, rgb + static_cast<size_t>(width) * height * bytes_per_pixel, data);
+        image_width = width;
+        image_height = height;
+        bytes_per_scanline = image_width * bytes_per_pixel;
+        build_mips();
+        return true;
+    }
+
     int width()  const { return (data == nullptr) ? 0 : image_width; }
     int height() const { return (data == nullptr) ? 0 : image_height; }
 
@@ -68,9 +95,60 @@ class rtw_image {
         return data + y*bytes_per_scanline + x*bytes_per_pixel;
     }
 
+    // MIP pyramid, built when the image loads: level 0 is the image itself and every further level
+    // halves the one before (a 2x2 box filter), down to a single pixel.
+
+    int levels() const { return (data == nullptr) ? 0 : 1 + static_cast<int>(mips.size()); }
+    int width(int level)  const { return level == 0 ? width()  : mips[level - 1].width; }
+    int height(int level) const { return level == 0 ? height() : mips[level - 1].height; }
+
+    const unsigned char* pixel_data(int x, int y, int level) const {
+        // Return the address of the three bytes of the pixel at x,y of a level, clamped to its edges.
+        if (level == 0) return pixel_data(x, y);
+
+        const auto& mip = mips[level - 1];
+        x = clamp(x, 0, mip.width);
+        y = clamp(y, 0, mip.height);
+        return mip.texels.data() + (y*mip.width + x)*bytes_per_pixel;
+    }
+
+    void pixel_block(int x, int y, int level, unsigned char block[12]) const {
+        // Copy the 2x2 pixels from x,y to x+1,y+1 of a level (clamped to its edges), row by row.
+        for (int k = 0; k < 4; ++k) {
+            auto pixel = pixel_data(x + (k & 1), y + (k >> 1), level);
+            std::copy(pixel, pixel + 3, block + 3*k);
+        }
+    }
+
   private:
+    struct mip_level {
+        int width, height;
+        std::vector<unsigned char> texels;
+    };
+    std::vector<mip_level> mips;   // levels 1, 2, ...
+
+    void build_mips() {
+        mips.clear();
+        for (int level = 0; width(level) > 1 || height(level) > 1; ++level) {
+            mip_level next;
+            next.width = std::max(1, width(level) / 2);
+            next.height = std::max(1, height(level) / 2);
+            next.texels.resize(static_cast<size_t>(next.width) * next.height * bytes_per_pixel);
+
+            for (int y = 0; y < next.height; ++y)
+                for (int x = 0; x < next.width; ++x)
+                    for (int c = 0; c < bytes_per_pixel; ++c) {
+                        int sum = pixel_data(2*x, 2*y, level)[c] + pixel_data(2*x + 1, 2*y, level)[c]
+                                + pixel_data(2*x, 2*y + 1, level)[c] + pixel_data(2*x + 1, 2*y + 1, level)[c];
+                        next.texels[(y*next.width + x)*bytes_per_pixel + c] = static_cast<unsigned char>((sum + 2) / 4);
+                    }
+
+            mips.push_back(std::move(next));
+        }
+    }
+
     const int bytes_per_pixel = 3;
-    unsigned char *data;
+    unsigned char *data = nullptr;
     int image_width, image_height;
     int bytes_per_scanline;
 
@@ -82,6 +160,87 @@ class rtw_image {
     }
 };
 
+
+// An HDR image (Radiance .hdr, or any image stb_image reads, as linear floats) kept in half floats:
+// 6 bytes a texel against 12, values past 1 kept. MIP levels as rtw_image builds them, averaged in float.
+class rtw_hdr_image {
+  public:
+    rtw_hdr_image() = default;
+
+    explicit rtw_hdr_image(const char* image_filename) {
+        // Searched for as rtw_image does; if it can't be loaded width() and height() are 0.
+        auto path = rtw_image::locate(image_filename);
+        if (!path.empty() && load(path)) return;
+
+        std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+    }
+
+    bool load(const std::string& filename) {
+        int w, h, n;
+        float* pixels = stbi_loadf(filename.c_str(), &w, &h, &n, 3);
+        if (pixels == nullptr) return false;
+        load_pixels(w, h, pixels);
+        stbi_image_free(pixels);
+        return true;
+    }
+
+    void load_pixels(int w, int h, const float* rgb) {
+        // w x h texels of three floats, row by row
+        level_data.clear();
+        level top{ w, h, std::vector<uint16_t>(static_cast<size_t>(w) * h * 3) };
+        for (size_t i = 0; i < top.texels.size(); ++i)
+            top.texels[i] = float_to_half(rgb[i]);
+        level_data.push_back(std::move(top));
+
+        while (width(levels() - 1) > 1 || height(levels() - 1) > 1) {
+            int l = levels() - 1;
+            level next{ std::max(1, width(l) / 2), std::max(1, height(l) / 2), {} };
+            next.texels.resize(static_cast<size_t>(next.width) * next.height * 3);
+            for (int y = 0; y < next.height; ++y)
+                for (int x = 0; x < next.width; ++x) {
+                    float block[12];
+                    texel_block(2*x, 2*y, l, block);
+                    for (int c = 0; c < 3; ++c)
+                        next.texels[(static_cast<size_t>(y)*next.width + x)*3 + c] =
+                            float_to_half(0.25f * (block[c] + block[3 + c] + block[6 + c] + block[9 + c]));
+                }
+            level_data.push_back(std::move(next));
+        }
+    }
+
+    int levels() const { return static_cast<int>(level_data.size()); }
+    int width()  const { return levels() ? level_data[0].width : 0; }
+    int height() const { return levels() ? level_data[0].height : 0; }
+    int width(int level)  const { return level_data[level].width; }
+    int height(int level) const { return level_data[level].height; }
+
+    void texel_block(int x, int y, int level, float block[12]) const {
+        // The 2x2 texels from x,y to x+1,y+1 of a level (clamped to its edges), row by row, 3 floats
+        // each: their 12 halves gathered and converted together.
+        const auto& l = level_data[level];
+        int x0 = std::min(std::max(x, 0), l.width - 1), x1 = std::min(std::max(x + 1, 0), l.width - 1);
+        int y0 = std::min(std::max(y, 0), l.height - 1), y1 = std::min(std::max(y + 1, 0), l.height - 1);
+        uint16_t halves[12];
+        const int xs[4] = { x0, x1, x0, x1 }, ys[4] = { y0, y0, y1, y1 };
+        for (int k = 0; k < 4; ++k)
+            std::memcpy(halves + 3*k, l.texels.data() + (static_cast<size_t>(ys[k])*l.width + xs[k])*3, 6);
+        halves_to_floats(halves, block, 12);
+    }
+
+    size_t memory_bytes() const {
+        size_t bytes = 0;
+        for (const auto& l : level_data) bytes += l.texels.size() * sizeof(uint16_t);
+        return bytes;
+    }
+
+  private:
+    struct level {
+        int width, height;
+        std::vector<uint16_t> texels;
+    };
+    std::vector<level> level_data;
+};
+
 // Restore MSVC compiler warnings
 #ifdef _MSC_VER
     #pragma warning (pop)
@@ -31,21 +31,45 @@ public:
     }
 
     bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override {
+        deferred_hit hit;
+        if (!intersect_deferred(r, ray_t, rec, hit))
+            return false;
+
+        finish_hit(r, hit, rec);   // only the closest hit's record is filled
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override {
         intersect_record temp_rec;
+        deferred_hit temp_hit;
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
-            if (object->intersect(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            if (object->intersect_deferred(r, interval(ray_t.min, closest_so_far), temp_rec, temp_hit)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = temp_hit.t;
+                hit = temp_hit;
+                if (!hit.primitive)
+                    rec = temp_rec;
             }
         }
 
         return hit_anything;
     }
 
+    double transmittance(const ray& r, interval ray_t) const override {
+        auto tr = 1.0;
+
+        for (const auto& object : objects) {
+            tr *= object->transmittance(r, ray_t);
+            if (tr <= 0)
+                return 0;   // blocked, no need to look further
+        }
+
+        return tr;
+    }
+
     double get_pdf(const point3& o, const vec3& v) const override {
         auto weight = 1.0/objects.size();
         auto sum = 0.0;
@@ -62,6 +86,19 @@ public:
         return objects[random_int(0, int_size-1)]->randomDir(o);
     }
 
+    bool sample_surface(surface_sample& s) const override
+    {
+        if (objects.empty())
+            return false;
+
+        auto int_size = static_cast<int>(objects.size());
+        if (!objects[random_int(0, int_size-1)]->sample_surface(s))
+            return false;
+
+        s.pdf /= int_size;   // each object is picked with probability 1/size
+        return true;
+    }
+
 
 private:
     bbox boundingBox;
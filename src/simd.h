@@ -0,0 +1,252 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+// Four float lanes in one register, for the kernels that work on float data (BVH nodes, packets):
+//  - SSE on x86-64 (always there), NEON on 64-bit ARM, plain arrays elsewhere or with RT_NO_SIMD,
+//  - 3D values keep x y z in lanes 0-2; what lane 3 holds is unspecified and the 3-lane
+//    reductions below never read it.
+// Kernels that gain from wider registers are compiled a second time for AVX2 (RT_TARGET_AVX2)
+// and one of the builds is picked when the program starts, from what the CPU reports.
+
+#if !defined(RT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define RT_SIMD_SSE 1
+#include <immintrin.h>
+#elif !defined(RT_NO_SIMD) && defined(__aarch64__)
+#define RT_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang can compile single functions for other x86 levels and ask the CPU at run time
+#if defined(RT_SIMD_SSE) && (defined(__GNUC__) || defined(__clang__))
+#define RT_SIMD_DISPATCH 1
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define RT_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define RT_TARGET_AVX2
+#if defined(_MSC_VER)
+#define RT_ALWAYS_INLINE __forceinline
+#else
+#define RT_ALWAYS_INLINE inline
+#endif
+#endif
+
+
+class float4
+{
+public:
+#if defined(RT_SIMD_SSE)
+    __m128 v;
+    explicit float4(__m128 _v) : v(_v) {}
+#elif defined(RT_SIMD_NEON)
+    float32x4_t v;
+    explicit float4(float32x4_t _v) : v(_v) {}
+#else
+    float v[4];
+#endif
+
+    float4() : float4(0.0f) {}
+
+#if defined(RT_SIMD_SSE)
+    explicit float4(float s) : v(_mm_set1_ps(s)) {}
+    float4(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+    static float4 load(const float* p) { return float4(_mm_loadu_ps(p)); }   // any alignment
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+#elif defined(RT_SIMD_NEON)
+    explicit float4(float s) : v(vdupq_n_f32(s)) {}
+    float4(float x, float y, float z, float w) { float e[4] = { x, y, z, w }; v = vld1q_f32(e); }
+    static float4 load(const float* p) { return float4(vld1q_f32(p)); }
+    void store(float* p) const { vst1q_f32(p, v); }
+#else
+    explicit float4(float s) : v{ s, s, s, s } {}
+    float4(float x, float y, float z, float w) : v{ x, y, z, w } {}
+    static float4 load(const float* p) { float4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+    void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+#endif
+
+    float operator[](int i) const
+    {
+        float e[4];
+        store(e);
+        return e[i];
+    }
+
+
+    // Lane-wise arithmetic
+
+#if defined(RT_SIMD_SSE)
+    friend float4 operator+(float4 a, float4 b) { return float4(_mm_add_ps(a.v, b.v)); }
+    friend float4 operator-(float4 a, float4 b) { return float4(_mm_sub_ps(a.v, b.v)); }
+    friend float4 operator*(float4 a, float4 b) { return float4(_mm_mul_ps(a.v, b.v)); }
+    friend float4 operator/(float4 a, float4 b) { return float4(_mm_div_ps(a.v, b.v)); }
+    friend float4 sqrt(float4 a) { return float4(_mm_sqrt_ps(a.v)); }
+
+    // min and max return b where either lane is NaN, like the scalar `a < b ? a : b`
+    friend float4 min(float4 a, float4 b) { return float4(_mm_min_ps(a.v, b.v)); }
+    friend float4 max(float4 a, float4 b) { return float4(_mm_max_ps(a.v, b.v)); }
+
+    // lanes of a where mask is set (all bits of a lane, as from a comparison), of b elsewhere
+    friend float4 select(float4 mask, float4 a, float4 b)
+    {
+        return float4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+    }
+    friend float4 operator<(float4 a, float4 b) { return float4(_mm_cmplt_ps(a.v, b.v)); }
+#elif defined(RT_SIMD_NEON)
+    friend float4 operator+(float4 a, float4 b) { return float4(vaddq_f32(a.v, b.v)); }
+    friend float4 operator-(float4 a, float4 b) { return float4(vsubq_f32(a.v, b.v)); }
+    friend float4 operator*(float4 a, float4 b) { return float4(vmulq_f32(a.v, b.v)); }
+    friend float4 operator/(float4 a, float4 b) { return float4(vdivq_f32(a.v, b.v)); }
+    friend float4 sqrt(float4 a) { return float4(vsqrtq_f32(a.v)); }
+    friend float4 min(float4 a, float4 b) { return select(a < b, a, b); }
+    friend float4 max(float4 a, float4 b) { return select(b < a, a, b); }
+    friend float4 select(float4 mask, float4 a, float4 b)
+    {
+        return float4(vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v));
+    }
+    friend float4 operator<(float4 a, float4 b) { return float4(vreinterpretq_f32_u32(vcltq_f32(a.v, b.v))); }
+#else
+    friend float4 operator+(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x + y; }); }
+    friend float4 operator-(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x - y; }); }
+    friend float4 operator*(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x * y; }); }
+    friend float4 operator/(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x / y; }); }
+    friend float4 sqrt(float4 a) { return lanes(a, a, [](float x, float) { return std::sqrt(x); }); }
+    friend float4 min(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    friend float4 max(float4 a, float4 b) { return lanes(a, b, [](float x, float y) { return x > y ? x : y; }); }
+    friend float4 select(float4 mask, float4 a, float4 b)
+    {
+        float4 r;
+        for (int i = 0; i < 4; ++i)
+        {
+            uint32_t m;
+            std::memcpy(&m, &mask.v[i], sizeof(m));
+            r.v[i] = m ? a.v[i] : b.v[i];
+        }
+        return r;
+    }
+    friend float4 operator<(float4 a, float4 b)
+    {
+        float4 r;
+        for (int i = 0; i < 4; ++i)
+        {
+            uint32_t m = a.v[i] < b.v[i] ? 0xffffffffu : 0;
+            std::memcpy(&r.v[i], &m, sizeof(m));
+        }
+        return r;
+    }
+#endif
+
+
+    // Lanes 0-2 as a 3D vector
+
+#if defined(RT_SIMD_SSE)
+    friend float max3(float4 a)
+    {
+        auto y = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 1, 1, 1));
+        auto z = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 2, 2, 2));
+        return _mm_cvtss_f32(_mm_max_ss(_mm_max_ss(a.v, y), z));
+    }
+    friend float min3(float4 a)
+    {
+        auto y = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 1, 1, 1));
+        auto z = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 2, 2, 2));
+        return _mm_cvtss_f32(_mm_min_ss(_mm_min_ss(a.v, y), z));
+    }
+#else
+    friend float max3(float4 a) { auto m = a[0] > a[1] ? a[0] : a[1]; return m > a[2] ? m : a[2]; }
+    friend float min3(float4 a) { auto m = a[0] < a[1] ? a[0] : a[1]; return m < a[2] ? m : a[2]; }
+#endif
+
+
+    // Across all four lanes
+
+#if defined(RT_SIMD_SSE)
+    friend float sum(float4 a)
+    {
+        auto s = _mm_add_ps(a.v, _mm_movehl_ps(a.v, a.v));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1))));
+    }
+    // four vectors in lanes 0-3 of a b c d become their x y z w in a b c d
+    friend void transpose(float4& a, float4& b, float4& c, float4& d)
+    {
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    }
+#elif defined(RT_SIMD_NEON)
+    friend float sum(float4 a) { return vaddvq_f32(a.v); }
+    friend void transpose(float4& a, float4& b, float4& c, float4& d)
+    {
+        auto ab = vtrnq_f32(a.v, b.v), cd = vtrnq_f32(c.v, d.v);
+        a = float4(vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0])));
+        b = float4(vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1])));
+        c = float4(vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0])));
+        d = float4(vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1])));
+    }
+#else
+    friend float sum(float4 a) { return (a.v[0] + a.v[1]) + (a.v[2] + a.v[3]); }
+    friend void transpose(float4& a, float4& b, float4& c, float4& d)
+    {
+        float4* rows[4] = { &a, &b, &c, &d };
+        for (int i = 0; i < 4; ++i)
+            for (int j = i + 1; j < 4; ++j)
+                std::swap(rows[i]->v[j], rows[j]->v[i]);
+    }
+#endif
+
+#if !defined(RT_SIMD_SSE) && !defined(RT_SIMD_NEON)
+private:
+    template <typename F>
+    static float4 lanes(float4 a, float4 b, F f)
+    {
+        float4 r;
+        for (int i = 0; i < 4; ++i)
+            r.v[i] = f(a.v[i], b.v[i]);
+        return r;
+    }
+#endif
+};
+
+
+// Instruction sets the kernels run on: x86 builds dispatch between sse2 and avx2
+enum class simd_level { scalar, sse2, avx2, neon };
+
+inline const char* simd_level_name(simd_level level)
+{
+    switch (level)
+    {
+    case simd_level::sse2: return "SSE2";
+    case simd_level::avx2: return "AVX2+FMA";
+    case simd_level::neon: return "NEON";
+    default:               return "scalar";
+    }
+}
+
+// What this CPU runs, asked once. RT_SIMD=sse2 (or scalar) in the environment keeps the
+// dispatched kernels on their baseline build, to compare the builds on one machine.
+inline simd_level active_simd_level()
+{
+    static const simd_level level = []()
+    {
+#if defined(RT_SIMD_DISPATCH)
+        __builtin_cpu_init();
+        auto best = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? simd_level::avx2 : simd_level::sse2;
+        const char* cap = std::getenv("RT_SIMD");
+        if (cap && (std::strcmp(cap, "sse2") == 0 || std::strcmp(cap, "scalar") == 0))
+            best = simd_level::sse2;
+        return best;
+#elif defined(RT_SIMD_SSE)
+        return simd_level::sse2;
+#elif defined(RT_SIMD_NEON)
+        return simd_level::neon;
+#else
+        return simd_level::scalar;
+#endif
+    }();
+    return level;
+}
+
+
+#endif //SIMD_H
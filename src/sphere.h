@@ -2,13 +2,14 @@
 #define SPHERE_H
 
 #include "object.h"
+#include "material.h"
 #include "utility.h"
 
-class sphere : public object {
+class sphere final : public object {
   public:
     // stationary sphere
     sphere(point3 _center, double _radius, shared_ptr<material> _material) 
-      : center1(_center), radius(_radius), mat(_material), is_moving(false)
+      : center1(_center), radius(_radius), mat(material_table::global().id(_material)), is_moving(false)
       {
           auto rVec = vec3(radius, radius, radius);
           boundingBox = bbox(center1 - rVec, center1 + rVec);
@@ -16,7 +17,7 @@ class sphere : public object {
 
     // dynamic sphere
     sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material) 
-      : center1(_center1), radius(_radius), mat(_material), is_moving(true) 
+      : center1(_center1), radius(_radius), mat(material_table::global().id(_material)), is_moving(true) 
     {
         moving_dir = _center2 - _center1;
         auto rVec = vec3(radius, radius, radius);
@@ -40,14 +41,69 @@ class sphere : public object {
     //     return vec3(0, 0, 0);
     // }
 
+    bool sample_surface(surface_sample& s) const override
+    {
+        // uniform over the sphere at its start position
+        auto direction = randomSample_unit_vector_normalize();
+        s.p = center1 + radius * direction;
+        s.normal = direction;
+        s.pdf = 1 / (4 * pi * radius * radius);
+        s.mat = mat;
+        get_sphere_uv(direction, s.u, s.v);
+        return true;
+    }
+
     bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override 
     {    
-        // intersection 
-        
+        double t;
+        if (!hit_distance(r, ray_t, t))
+            return false;
+
+        fill_record(r, t, rec);
+        return true;
+    }
+
+    // the distance is all a search needs until it knows which hit is the closest
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        if (!hit_distance(r, ray_t, hit.t))
+            return false;
+        hit.primitive = this;
+        return true;
+    }
+
+    void fill_record(const ray& r, double t, intersect_record& rec) const override
+    {
+        vec3 center = is_moving ? get_current_center(r.time()) : center1;
+
+        rec.t = t;
+        rec.p = r.at(rec.t);
+
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);    // update (u,v) for records 
+        get_sphere_uv_rates(outward_normal, radius, rec.u_rate, rec.v_rate);
+        rec.mat = mat;
+    }
+
+    // shadow rays: blocked or not, no record
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        double t;
+        return hit_distance(r, ray_t, t) ? 0.0 : 1.0;
+    }
+
+    // distance to the nearest root within ray_t
+    bool hit_distance(const ray& r, interval ray_t, double& t) const
+    {
         vec3 center = is_moving ? get_current_center(r.time()) : center1;   // if sphere is movable, get current center location
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
+
+        // the quadratic is solved in double in both builds: c cancels |oc|^2 against radius^2,
+        // which leaves a float too few digits to tell a big sphere's surface from a point just off it
+        auto oc = basic_vec3<double>(r.origin()) - basic_vec3<double>(center);
+        auto d = basic_vec3<double>(r.direction());
+        auto a = d.length_squared();
+        auto half_b = dot(oc, d);
         auto c = oc.length_squared() - radius*radius;
 
         // simplified of b^2 - 4ac
@@ -64,17 +120,26 @@ class sphere : public object {
                 return false;
         }
 
+        t = root;
+        return true;
+    }
 
-        // update intersection record
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
+    bool intersect_span(const ray& r, interval& span) const override
+    {
+        // both roots of the quadratic at once, without building records
+        vec3 center = is_moving ? get_current_center(r.time()) : center1;
+        auto oc = basic_vec3<double>(r.origin()) - basic_vec3<double>(center);
+        auto d = basic_vec3<double>(r.direction());
+        auto a = d.length_squared();
+        auto half_b = dot(oc, d);
+        auto c = oc.length_squared() - radius*radius;
 
-        vec3 outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);    // update (u,v) for records 
-        rec.mat = mat;
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant <= 0)
+            return false;
 
+        auto sqrtd = sqrt(discriminant);
+        span = interval((-half_b - sqrtd) / a, (-half_b + sqrtd) / a);
         return true;
     }
 
@@ -161,14 +226,15 @@ class sphere : public object {
     bool is_moving;
     vec3 moving_dir;
     double radius;
-    shared_ptr<material> mat;
+    material_id mat;
     bbox boundingBox;
 
     point3 get_current_center(double time) const
     {
       return center1 + time * moving_dir;
     }
-    
+
+  public:
     static void get_sphere_uv(const point3& p, double& u, double& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -184,6 +250,23 @@ class sphere : public object {
         v = theta / pi;
     }
 
+    static point3 get_sphere_point(double u, double v) {
+        // The inverse of get_sphere_uv: the point of the unit sphere at (u,v).
+        auto theta = v * pi;
+        auto phi = u * 2*pi - pi;
+        return point3(cos(phi) * sin(theta), -cos(theta), -sin(phi) * sin(theta));
+    }
+
+    static void get_sphere_uv_rates(const vec3& n, double radius, double& u_rate, double& v_rate) {
+        // n: the unit normal get_sphere_uv was given, on a sphere of this radius.
+        // v runs over half a great circle; u around a circle of latitude, which shrinks towards the poles.
+
+        auto r = fabs(radius);
+        auto sin_theta = sqrt(fmax(1e-6, 1 - n.y()*n.y()));
+        u_rate = 1 / (2*pi * r * sin_theta);
+        v_rate = 1 / (pi * r);
+    }
+
 };
 
 #endif
\ No newline at end of file
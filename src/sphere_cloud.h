@@ -0,0 +1,281 @@
+#ifndef SPHERE_CLOUD_H
+#define SPHERE_CLOUD_H
+
+#include "utility.h"
+#include "object.h"
+#include "material.h"
+#include "flat_bvh.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Particles: very many static spheres of one object, e.g. the output of a simulation:
+//  - every sphere is one packed float4 (center, radius), 16 bytes, in BVH leaf order,
+//  - one material for all of them, or a small palette and a 16-bit index per sphere,
+//  - its own BVH (flat_bvh.h) with leaves of up to 8 spheres, about 8 more bytes per sphere.
+// Call build() after the last add(), before rendering. No motion blur.
+
+
+class sphere_cloud : public object
+{
+public:
+    struct packed_sphere
+    {
+        float x, y, z, radius;
+    };
+
+    // every sphere of the one material
+    sphere_cloud(shared_ptr<material> _material) : palette{ material_table::global().id(_material) } {}
+
+    // spheres pick their material from the palette by index
+    sphere_cloud(const std::vector<shared_ptr<material>>& _palette)
+    {
+        for (const auto& m : _palette)
+            palette.push_back(material_table::global().id(m));
+    }
+
+
+    // Method
+
+    void reserve(size_t count)
+    {
+        spheres.reserve(count);
+        if (palette.size() > 1)
+            material_index.reserve(count);
+    }
+
+    void add(const point3& center, double radius, uint16_t palette_index = 0)
+    {
+        spheres.push_back({ static_cast<float>(center.x()), static_cast<float>(center.y()),
+                            static_cast<float>(center.z()), static_cast<float>(radius) });
+        if (palette.size() > 1)
+            material_index.push_back(palette_index);
+    }
+
+    size_t sphere_count() const { return spheres.size(); }
+
+    size_t memory_bytes() const
+    {
+        return spheres.size() * sizeof(packed_sphere) + material_index.size() * sizeof(uint16_t) + bvh.memory_bytes();
+    }
+
+    // Sorts the spheres into BVH leaf order and builds the BVH over them.
+    void build()
+    {
+        build_bvh();
+        std::clog << "Sphere cloud: " << sphere_count() << " spheres, " << bvh.nodes.size() << " nodes, "
+                  << memory_bytes() / (1024.0 * 1024.0) << " MB ("
+                  << (spheres.empty() ? 0.0 : static_cast<double>(memory_bytes()) / spheres.size()) << " bytes per sphere)\n";
+    }
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        auto hit = closest(r, ray_t);
+        if (hit < 0)
+            return false;
+
+        const auto& s = spheres[hit];
+        auto center = point3(s.x, s.y, s.z);
+
+        rec.t = ray_t.max;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / static_cast<double>(s.radius);
+        rec.set_face_normal(r, outward_normal);
+        sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+        sphere::get_sphere_uv_rates(outward_normal, s.radius, rec.u_rate, rec.v_rate);
+        rec.mat = palette[material_index.empty() ? 0 : material_index[hit]];
+        return true;
+    }
+
+    // shadow rays: the same search, without a record
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        return closest(r, ray_t) >= 0 ? 0.0 : 1.0;
+    }
+
+    void rotate(double degree, int axis) override
+    {
+        // rotation matrix parameter
+        auto radians = degrees_to_radians(degree);
+        auto cos_theta = cos(radians);
+        auto sin_theta = sin(radians);
+
+        // construct rotation matrix
+        vec3 row_x, row_y, row_z;
+        switch (axis)
+        {
+        case 0:
+            row_x = vec3(1.0,         0.0,          0.0);
+            row_y = vec3(0.0,   cos_theta,   -sin_theta);
+            row_z = vec3(0.0,   sin_theta,    cos_theta);
+            break;
+        case 1:
+            row_x = vec3(cos_theta,    0.0,  sin_theta);
+            row_y = vec3(0.0,          1.0,        0.0);
+            row_z = vec3(-sin_theta,   0.0,  cos_theta);
+            break;
+        case 2:
+            row_x = vec3(cos_theta,  -sin_theta,   0.0);
+            row_y = vec3(sin_theta,   cos_theta,   0.0);
+            row_z = vec3(      0.0,         0.0,   1.0);
+            break;
+        default:
+            return;
+        }
+
+        // centers turn, radii stay; then the BVH is rebuilt around them
+        for (auto& s : spheres)
+        {
+            vec3 x(s.x, s.y, s.z);
+            s.x = static_cast<float>(dot(row_x, x));
+            s.y = static_cast<float>(dot(row_y, x));
+            s.z = static_cast<float>(dot(row_z, x));
+        }
+        build_bvh();
+    }
+
+    void translate(vec3 dir) override
+    {
+        for (auto& s : spheres)
+        {
+            s.x += static_cast<float>(dir.x());
+            s.y += static_cast<float>(dir.y());
+            s.z += static_cast<float>(dir.z());
+        }
+        build_bvh();
+    }
+
+private:
+    std::vector<packed_sphere> spheres;
+    std::vector<uint16_t> material_index;   // empty with a single material
+    std::vector<material_id> palette;
+    flat_bvh bvh;                           // leaf offsets are the first sphere of the leaf
+    bbox bounding_box;
+
+    static const int max_leaf_size = 8;
+
+    // The closest sphere hit within ray_t, which is shrunk to end at it. -1 if none.
+    int64_t closest(const ray& r, interval& ray_t) const
+    {
+        // in double in both builds, like sphere::intersect
+        const basic_vec3<double> o(r.origin()), d(r.direction());
+        auto a = d.length_squared();
+        auto t_min = ray_t.min;
+
+        int64_t hit = -1;
+        bvh.traverse(r, ray_t, [&](const flat_bvh::node& leaf)
+        {
+            double root[2 * max_leaf_size];   // a leaf may take up to twice the size where no split pays
+
+            // the same arithmetic on every lane, misses become infinity
+            for (uint32_t l = 0; l < leaf.count; ++l)
+            {
+                const auto& s = spheres[leaf.offset + l];
+                double ocx = o[0] - s.x, ocy = o[1] - s.y, ocz = o[2] - s.z;
+                double radius = s.radius;
+
+                auto half_b = ocx * d[0] + ocy * d[1] + ocz * d[2];
+                auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+                auto discriminant = half_b * half_b - a * c;
+                auto sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+
+                auto t = (-half_b - sqrtd) / a;
+                t = t > t_min ? t : (-half_b + sqrtd) / a;
+                root[l] = (discriminant >= 0 && t > t_min) ? t : infinity;
+            }
+
+            for (uint32_t l = 0; l < leaf.count; ++l)
+            {
+                if (root[l] < ray_t.max)
+                {
+                    ray_t.max = root[l];
+                    hit = leaf.offset + l;
+                }
+            }
+        });
+
+        return hit;
+    }
+
+    void build_bvh()
+    {
+        auto count = spheres.size();
+        std::vector<flat_bvh::build_ref> refs(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& ref = refs[i];
+            const auto& s = spheres[i];
+            ref.index = static_cast<uint32_t>(i);
+            float center[3] = { s.x, s.y, s.z };
+            auto radius = fabs(s.radius);
+            for (int a = 0; a < 3; ++a)
+            {
+                ref.lo[a] = center[a] - radius;
+                ref.hi[a] = center[a] + radius;
+                ref.centroid[a] = center[a];
+            }
+        }
+
+        bvh.build(refs, max_leaf_size);
+        bounding_box = bvh.bounds();
+
+        // spheres (and their material indices) in leaf order; leaf offsets already point at them
+        std::vector<packed_sphere> sorted(count);
+        for (size_t i = 0; i < count; ++i)
+            sorted[i] = spheres[refs[i].index];
+        spheres.swap(sorted);
+
+        if (!material_index.empty())
+        {
+            std::vector<uint16_t> sorted_index(count);
+            for (size_t i = 0; i < count; ++i)
+                sorted_index[i] = material_index[refs[i].index];
+            material_index.swap(sorted_index);
+        }
+    }
+};
+
+
+// Reads particles from a raw binary file of little endian float32 records x y z radius,
+// the layout of packed_sphere. Prints an error and returns nullptr on failure.
+inline shared_ptr<sphere_cloud> load_sphere_cloud(const std::string& filename, shared_ptr<material> mat)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not open particle file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    auto size = static_cast<size_t>(file.tellg());
+    if (size % sizeof(sphere_cloud::packed_sphere) != 0)
+    {
+        std::cerr << "ERROR: Particle file '" << filename << "' is not a whole number of x y z radius records.\n";
+        return nullptr;
+    }
+
+    std::vector<sphere_cloud::packed_sphere> records(size / sizeof(sphere_cloud::packed_sphere));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(records.data()), size);
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not read particle file '" << filename << "'.\n";
+        return nullptr;
+    }
+
+    auto cloud = make_shared<sphere_cloud>(mat);
+    cloud->reserve(records.size());
+    for (const auto& s : records)
+        cloud->add(point3(s.x, s.y, s.z), s.radius);
+    cloud->build();
+    return cloud;
+}
+
+
+#endif //SPHERE_CLOUD_H
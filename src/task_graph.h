@@ -0,0 +1,189 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The slow parts of putting a scene together - image decodes, mesh loads, BVH builds - as tasks
+// on a pool of threads, each one starting as soon as the tasks it depends on are done:
+//  - add() returns the task's id, to name it among the dependencies of later tasks,
+//  - wait(id) and wait_all() run queued tasks on the waiting thread until the ones waited for are
+//    done; what a task wrote is visible to the thread that waited for it,
+//  - tasks must not draw random numbers: a pool thread would take one of random_double()'s seeds,
+//    handed out in thread start order, and render passes would no longer reproduce. The scene code
+//    on the main thread draws them, around the tasks.
+// report() prints the work done and its critical path, what the graph takes given enough cores.
+
+
+class task_graph
+{
+public:
+    using task_id = size_t;
+
+    // the thread that waits works as well: one fewer pool thread than there are cores
+    explicit task_graph(int thread_count = hardware_thread_count() - 1)
+      : start(std::chrono::steady_clock::now())
+    {
+        for (int t = 0; t < thread_count; ++t)
+        {
+            workers.emplace_back([this]()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true)
+                {
+                    changed.wait(lock, [this]() { return stopping || !ready.empty(); });
+                    if (ready.empty())
+                    {
+                        return;
+                    }
+                    run_one(lock);
+                }
+            });
+        }
+    }
+
+    ~task_graph()
+    {
+        wait_all();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+    }
+
+    task_graph(const task_graph&) = delete;
+    task_graph& operator=(const task_graph&) = delete;
+
+
+    // Method
+
+    task_id add(std::function<void()> work, const std::vector<task_id>& after = {})
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task_id id = tasks.size();
+        tasks.emplace_back();
+        auto& t = tasks.back();
+        t.work = std::move(work);
+        t.after = after;
+        for (auto d : after)
+        {
+            if (!tasks[d].done)
+            {
+                tasks[d].dependents.push_back(id);
+                ++t.pending;
+            }
+        }
+        if (t.pending == 0)
+        {
+            ready.push_back(id);
+            changed.notify_one();
+        }
+        return id;
+    }
+
+    void wait(task_id id)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!tasks[id].done)
+        {
+            if (!ready.empty())
+                run_one(lock);
+            else
+                changed.wait(lock);
+        }
+    }
+
+    void wait_all()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (done_count < tasks.size())
+        {
+            if (!ready.empty())
+                run_one(lock);
+            else
+                changed.wait(lock);
+        }
+    }
+
+    // the tasks' total time, their critical path and the graph's time on the wall so far
+    void report(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        double work = 0, critical = 0;
+        std::vector<double> path(tasks.size(), 0.0);   // tasks only depend on earlier ones
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            for (auto d : tasks[i].after)
+                path[i] = std::max(path[i], path[d]);
+            path[i] += tasks[i].seconds;
+            work += tasks[i].seconds;
+            critical = std::max(critical, path[i]);
+        }
+        auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        out << "Scene tasks: " << tasks.size() << " on " << workers.size() + 1 << " threads, "
+            << work * 1000 << "ms of work, " << critical * 1000 << "ms critical path, "
+            << wall * 1000 << "ms since the graph started" << std::endl;
+    }
+
+private:
+    struct task
+    {
+        std::function<void()> work;
+        std::vector<task_id> after;        // dependencies
+        std::vector<task_id> dependents;   // the tasks waiting for this one
+        int pending = 0;                   // dependencies not done yet
+        bool done = false;
+        double seconds = 0;
+    };
+
+    std::chrono::steady_clock::time_point start;
+    std::deque<task> tasks;                // by id; a deque keeps them in place as it grows
+    std::deque<task_id> ready;
+    size_t done_count = 0;
+    bool stopping = false;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::thread> workers;
+
+    // takes a ready task and runs it with the lock released
+    void run_one(std::unique_lock<std::mutex>& lock)
+    {
+        auto id = ready.front();
+        ready.pop_front();
+        auto work = std::move(tasks[id].work);
+
+        lock.unlock();
+        auto begin = std::chrono::steady_clock::now();
+        work();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        lock.lock();
+
+        auto& t = tasks[id];
+        t.seconds = seconds;
+        t.done = true;
+        ++done_count;
+        for (auto d : t.dependents)
+        {
+            if (--tasks[d].pending == 0)
+                ready.push_back(d);
+        }
+        changed.notify_all();
+    }
+};
+
+
+#endif //TASK_GRAPH_H
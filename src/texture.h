@@ -2,22 +2,59 @@
 #define TEXTURE_H
 
 #include "utility.h"
-#include "rtw_stb_image.h"
+#include "texture_cache.h"
+#include "task_graph.h"
 #include "perlin.h"
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
 class texture
 {
 public:
+    // the textures of this file, for the switch in texture_value(); any other texture is `other`
+    // and is looked up through its virtual get_value
+    enum class kind_t : uint8_t { other, solid, checker, image, noise };
+    const kind_t kind = kind_t::other;
+
+    texture() = default;
     virtual ~texture() = default;
-    virtual color get_value(double u, double v, const point3& p) const = 0 {};
+    virtual color get_value(double u, double v, const point3& p) const = 0;
+
+    // the texture averaged over a footprint du x dv wide in (u,v) around (u,v);
+    // textures that don't filter return their value at (u,v)
+    virtual color get_filtered(double u, double v, const point3& p, double du, double dv) const
+    {
+        return get_value(u, v, p);
+    }
+
+    // everything the texture's values depend on, as text: what bake_texture() files a bake under.
+    // Empty where that can't be told, and such textures aren't baked.
+    virtual std::string parameters() const { return ""; }
+
+protected:
+    explicit texture(kind_t k) : kind(k) {}
+
+    // a number written exactly (hexadecimal floating point), for parameters()
+    static std::string exact(double x)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%a", x);
+        return text;
+    }
 };
 
+inline color texture_value(const texture& t, double u, double v, const point3& p, double du = 0, double dv = 0);
 
-class solid_color : public texture
+
+class solid_color final : public texture
 {
 public:
-    solid_color(color c) : color_value(c) {} 
-    solid_color(double red, double green, double blue) : color_value(color(red, green, blue)) {}
+    solid_color(color c) : texture(kind_t::solid), color_value(c) {} 
+    solid_color(double red, double green, double blue) : texture(kind_t::solid), color_value(color(red, green, blue)) {}
 
     // Method
     color get_value(double u, double v, const point3& p) const override
@@ -25,16 +62,21 @@ public:
         return color_value;
     }
 
+    std::string parameters() const override
+    {
+        return "solid(" + exact(color_value.x()) + "," + exact(color_value.y()) + "," + exact(color_value.z()) + ")";
+    }
+
 private:
     color color_value;
 };
 
 
-class checker_board : public texture
+class checker_board final : public texture
 {
 public:
-    checker_board(double _scale, std::shared_ptr<texture> _even, std::shared_ptr<texture> _odd) : inv_scale(1.0 / _scale), even(_even), odd(_odd) {}
-    checker_board(double _scale, color c1, color c2) : inv_scale(1.0f / _scale), 
+    checker_board(double _scale, std::shared_ptr<texture> _even, std::shared_ptr<texture> _odd) : texture(kind_t::checker), inv_scale(1.0 / _scale), even(_even), odd(_odd) {}
+    checker_board(double _scale, color c1, color c2) : texture(kind_t::checker), inv_scale(1.0f / _scale), 
                                                        even(std::make_shared<solid_color>(c1)), 
                                                        odd(std::make_shared<solid_color>(c2)) {}
 
@@ -49,7 +91,24 @@ public:
         // if the sum of a point is odd,  return another color
         bool isEven = (x + y + z) % 2 == 0;
         
-        return isEven ? even->get_value(u, v, p) : odd->get_value(u, v, p);
+        return isEven ? texture_value(*even, u, v, p) : texture_value(*odd, u, v, p);
+    }
+
+    color get_filtered(double u, double v, const point3& p, double du, double dv) const override
+    {
+        // the squares are picked by point; the footprint is passed on to the textures inside them
+        auto x = static_cast<int>(std::floor(p.x() * inv_scale));
+        auto y = static_cast<int>(std::floor(p.y() * inv_scale));
+        auto z = static_cast<int>(std::floor(p.z() * inv_scale));
+        bool isEven = (x + y + z) % 2 == 0;
+
+        return isEven ? texture_value(*even, u, v, p, du, dv) : texture_value(*odd, u, v, p, du, dv);
+    }
+
+    std::string parameters() const override
+    {
+        auto e = even->parameters(), o = odd->parameters();
+        return e.empty() || o.empty() ? "" : "checker(" + exact(inv_scale) + "," + e + "," + o + ")";
     }
 
 private:
@@ -59,46 +118,229 @@ private:
 };
 
 
-class image_texture : public texture {
+class image_texture final : public texture {
   public:
-    image_texture(const char* filename) : image(filename) {}
+    image_texture(const char* filename) : texture(kind_t::image), image(tiled_image::open(filename)) {}
+
+    // an image made in memory, such as a baked texture
+    explicit image_texture(std::shared_ptr<const tiled_image> _image) : texture(kind_t::image), image(std::move(_image)) {}
+
+    // Loaded by a task of `loads`: not to be looked up until the graph has been waited on.
+    image_texture(const char* filename, task_graph& loads) : texture(kind_t::image) {
+        loads.add([this, name = std::string(filename)]() { image = tiled_image::open(name.c_str()); });
+    }
 
     color get_value(double u, double v, const point3& p) const override {
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0) return color(0,1,1);
+        if (image->height() <= 0) return color(0,1,1);
 
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0,1).clamp(u);
         v = 1.0 - interval(0,1).clamp(v);  // Flip V to image coordinates
 
-        auto i = static_cast<int>(u * image.width());
-        auto j = static_cast<int>(v * image.height());
-        auto pixel = image.pixel_data(i,j);
+        auto i = static_cast<int>(u * image->width());
+        auto j = static_cast<int>(v * image->height());
+        auto pixel = image->pixel_data(i,j);
 
         auto color_scale = 1.0 / 255.0;
         return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
     }
 
+    color get_filtered(double u, double v, const point3& p, double du, double dv) const override {
+        // Trilinear filtering: the MIP level whose pixels are as wide as the footprint's larger side,
+        // bilinear within the two levels around it and linear between them.
+        // A footprint of zero (nothing known about it) keeps the point sample of get_value.
+        if (image->height() <= 0 || (du <= 0 && dv <= 0)) return get_value(u, v, p);
+
+        u = interval(0,1).clamp(u);
+        v = 1.0 - interval(0,1).clamp(v);
+
+        auto texels = fmax(du * image->width(), dv * image->height());
+        auto lod = texels > 1 ? log2(texels) : 0.0;
+        auto top = image->levels() - 1;
+        if (lod >= top) return bilinear(u, v, top);
+
+        auto level = static_cast<int>(lod);
+        auto blend = lod - level;
+        auto fine = bilinear(u, v, level);
+        return blend > 0 ? (1 - blend) * fine + blend * bilinear(u, v, level + 1) : fine;
+    }
+
+  private:
+    std::shared_ptr<const tiled_image> image;   // paged through texture_cache::global(), shared by path
+
+    color bilinear(double u, double v, int level) const {
+        // (u,v) in image coordinates, [0,1] x [0,1] from the top left; pixel centers at half-integers
+        auto x = u * image->width(level) - 0.5;
+        auto y = v * image->height(level) - 0.5;
+        auto x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        auto fx = x - x0, fy = y - y0;
+
+        unsigned char block[12];
+        image->pixel_block(x0, y0, level, block);
+        auto texel = [&](int k) { return color(block[3*k], block[3*k + 1], block[3*k + 2]); };
+        auto top = (1 - fx) * texel(0) + fx * texel(1);
+        auto bottom = (1 - fx) * texel(2) + fx * texel(3);
+        return ((1 - fy) * top + fy * bottom) / 255.0;
+    }
+};
+
+
+// An HDR image texture (see rtw_hdr_image): colors past 1 are kept, for emitters and environments.
+// Filtered as image_texture is; looked up through the virtual call.
+class hdr_texture final : public texture {
+  public:
+    hdr_texture(const char* filename) : image(std::make_shared<rtw_hdr_image>(filename)) {}
+    explicit hdr_texture(std::shared_ptr<const rtw_hdr_image> _image) : image(std::move(_image)) {}
+
+    color get_value(double u, double v, const point3& p) const override {
+        if (image->height() <= 0) return color(0,1,1);
+        return bilinear(interval(0,1).clamp(u), 1.0 - interval(0,1).clamp(v), 0);
+    }
+
+    color get_filtered(double u, double v, const point3& p, double du, double dv) const override {
+        if (image->height() <= 0 || (du <= 0 && dv <= 0)) return get_value(u, v, p);
+
+        u = interval(0,1).clamp(u);
+        v = 1.0 - interval(0,1).clamp(v);
+
+        auto texels = fmax(du * image->width(), dv * image->height());
+        auto lod = texels > 1 ? log2(texels) : 0.0;
+        auto top = image->levels() - 1;
+        if (lod >= top) return bilinear(u, v, top);
+
+        auto level = static_cast<int>(lod);
+        auto blend = lod - level;
+        auto fine = bilinear(u, v, level);
+        return blend > 0 ? (1 - blend) * fine + blend * bilinear(u, v, level + 1) : fine;
+    }
+
   private:
-    rtw_image image;
+    std::shared_ptr<const rtw_hdr_image> image;
+
+    color bilinear(double u, double v, int level) const {
+        auto x = u * image->width(level) - 0.5;
+        auto y = v * image->height(level) - 0.5;
+        auto x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        auto fx = x - x0, fy = y - y0;
+
+        float block[12];
+        image->texel_block(x0, y0, level, block);
+        auto texel = [&](int k) { return color(block[3*k], block[3*k + 1], block[3*k + 2]); };
+        auto top = (1 - fx) * texel(0) + fx * texel(1);
+        auto bottom = (1 - fx) * texel(2) + fx * texel(3);
+        return (1 - fy) * top + fy * bottom;
+    }
 };
 
 
-class noise_texture : public texture {
+class noise_texture final : public texture {
   public:
-    noise_texture() {}
-    noise_texture(double sc) : scale(sc) {}
+    noise_texture() : texture(kind_t::noise) {}
+    noise_texture(double sc) : texture(kind_t::noise), scale(sc) {}
+
+    // With the turbulence baked over `bounds` (in the scene, where the textured object is) at
+    // resolution^3 points: for objects that don't move. See baked_turbulence.
+    noise_texture(double sc, const bbox& bounds, int resolution)
+      : texture(kind_t::noise), scale(sc),
+        baked(std::make_shared<baked_turbulence>(bbox(sc * point3(bounds.x.min, bounds.y.min, bounds.z.min),
+                                                      sc * point3(bounds.x.max, bounds.y.max, bounds.z.max)), resolution)) {}
 
 
     color get_value(double u, double v, const point3& p) const override {
         auto s = scale * p;
-        return color(1,1,1) * 0.5 * (1 + sin(s.z() + 10*noise.turb(s)));
+        auto t = baked ? baked->turb(s) : noise.turb(s);
+        return color(1,1,1) * 0.5 * (1 + sin(s.z() + 10*t));
+    }
+
+    // the pattern is perlin's shared table, the same in every run (baked turbulence isn't baked again)
+    std::string parameters() const override
+    {
+        return baked ? "" : "noise(" + exact(scale) + ",perlin-0x5eed)";
     }
 
   private:
     perlin noise;
     double scale;
+    std::shared_ptr<const baked_turbulence> baked;
 };
 
 
+// Bakes a procedural texture over a surface into an image texture of width x height pixels over (u,v),
+// which is then sampled as images are (MIP-mapped, paged through the texture cache) instead of being
+// evaluated at every hit. For objects that don't move or deform.
+//  - surface(u,v) is the point of the surface at (u,v), surface_name what tells it apart from other
+//    surfaces: with the texture's parameters() and the size, it makes the hash the bake is kept under
+//    in the texture cache's directory, and a later bake with the same hash reads that file instead,
+//  - pixels are the texture at their centers, in 8 bits (colors past [0,1] are clipped),
+//  - the baked texture is measured against the procedural one between its pixels and the error
+//    reported, with whether it was baked or read back.
+// Textures whose parameters() can't be told are returned as they are.
+inline std::shared_ptr<texture> bake_texture(const std::shared_ptr<texture>& procedural, const std::string& surface_name,
+                                             const std::function<point3(double, double)>& surface, int width, int height)
+{
+    auto parameters = procedural->parameters();
+    if (parameters.empty())
+    {
+        std::cerr << "ERROR: A texture whose parameters aren't known can't be baked; keeping it procedural.\n";
+        return procedural;
+    }
+    auto description = parameters + "@" + surface_name + ":" + std::to_string(width) + "x" + std::to_string(height);
+
+    auto begin = std::chrono::steady_clock::now();
+    bool made = false;
+    auto image = tiled_image::bake(surface_name, std::hash<std::string>{}(description), width, height,
+                                   [&](std::vector<unsigned char>& pixels)
+    {
+        parallel_for(height, [&](int y, int)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                auto u = (x + 0.5) / width, v = 1 - (y + 0.5) / height;   // image rows run from the top
+                auto c = texture_value(*procedural, u, v, surface(u, v));
+                for (int k = 0; k < 3; ++k)
+                    pixels[(static_cast<size_t>(y) * width + x) * 3 + k] = static_cast<unsigned char>(255.999 * fmin(fmax(c[k], 0.0), 1.0));
+            }
+        });
+    }, &made);
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    auto baked = std::make_shared<image_texture>(image);
+
+    // at points of a low-discrepancy sequence, each looked up bilinearly from the full-size level
+    const int points = 4096;
+    double error = 0, largest = 0;
+    for (int n = 0; n < points; ++n)
+    {
+        auto u = std::fmod(0.5 + n * 0.7548776662466927, 1.0), v = std::fmod(0.5 + n * 0.5698402909980532, 1.0);
+        auto p = surface(u, v);
+        auto difference = texture_value(*baked, u, v, p, 0.5 / width, 0.5 / height) - texture_value(*procedural, u, v, p);
+        auto e = fmax(fabs(difference.x()), fmax(fabs(difference.y()), fabs(difference.z())));
+        error += e;
+        largest = fmax(largest, e);
+    }
+    std::clog << "Baked texture '" << surface_name << "' " << width << "x" << height << ": "
+              << (made ? "baked in " : "read back in ") << seconds * 1000 << "ms, error against the procedural texture "
+              << error / points << " mean, " << largest << " largest" << std::endl;
+    return baked;
+}
+
+
+// Static dispatch: the textures above by a switch on their kind, each a direct call the compiler can
+// inline into the caller (the classes are final); every other texture through the virtual call.
+// du, dv: the lookup's footprint in (u,v), for the textures that filter (0: a point sample).
+inline color texture_value(const texture& t, double u, double v, const point3& p, double du, double dv)
+{
+    bool filtered = du > 0 || dv > 0;
+    switch (t.kind)
+    {
+    case texture::kind_t::solid:   return static_cast<const solid_color&>(t).get_value(u, v, p);
+    case texture::kind_t::checker: return filtered ? static_cast<const checker_board&>(t).get_filtered(u, v, p, du, dv)
+                                                   : static_cast<const checker_board&>(t).get_value(u, v, p);
+    case texture::kind_t::image:   return static_cast<const image_texture&>(t).get_filtered(u, v, p, du, dv);
+    case texture::kind_t::noise:   return static_cast<const noise_texture&>(t).get_value(u, v, p);
+    default:                       return filtered ? t.get_filtered(u, v, p, du, dv) : t.get_value(u, v, p);
+    }
+}
+
+
 #endif //TEXTURE_H
\ No newline at end of file
@@ -0,0 +1,645 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "rtw_stb_image.h"
+#include "texture_formats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Image textures paged in from disk a tile at a time, all under one memory budget:
+//  - the first time an image is opened it is decoded (rtw_image), its MIP pyramid built and the levels
+//    written out in tiles of 32x32 pixels to a cache directory (RTW_TEXTURE_CACHE, or a directory in
+//    the system's temp directory); later runs read that file for as long as the image is unchanged,
+//  - tiles are read when a lookup first needs them and kept in a least-recently-used cache shared by
+//    the render threads (RTW_TEXTURE_CACHE_MB, 256 MB by default), the oldest dropped when it is full,
+//  - an image opened by several textures is read and cached once,
+//  - images made in memory (baked textures) are written and read back the same way, their files
+//    named by a hash of what their pixels depend on.
+// Where the cache directory can't be written the image stays decoded in memory, as before.
+// RTW_TEXTURE_FORMAT=bc1 or bc7 keeps tiles block-compressed, on disk and in the cache (see
+// texture_formats.h): 6x or 3x more of them under the budget, each texel's block decoded on fetch.
+
+
+using texture_tile = std::vector<unsigned char>;
+
+class texture_cache
+{
+public:
+    static constexpr int tile_size = 32;   // pixels on a side
+    static constexpr int tile_bytes = tile_size * tile_size * 3;
+
+    explicit texture_cache(size_t budget_bytes) { set_budget(budget_bytes); }
+
+    static texture_cache& global()
+    {
+        static texture_cache cache([]()
+        {
+            auto mb = getenv("RTW_TEXTURE_CACHE_MB");
+            return static_cast<size_t>((mb ? atof(mb) : 256.0) * 1024 * 1024);
+        }());
+        return cache;
+    }
+
+    // the budget is split evenly over the shards; takes effect as tiles are next added
+    void set_budget(size_t bytes) { shard_budget = std::max<size_t>(bytes / shard_count, tile_bytes); }
+    size_t budget() const { return shard_budget * shard_count; }
+
+    size_t resident_bytes() const { return resident; }
+    size_t peak_bytes() const { return peak; }
+    uint64_t tiles_read() const { return reads; }
+    uint64_t tiles_evicted() const { return evictions; }
+
+    // tile `key` (see tiled_image), read by `load` if it isn't resident. The pixels stay valid
+    // until the calling thread's next lookup.
+    template <typename Load>
+    const unsigned char* lookup(uint64_t key, Load&& load)
+    {
+        // lookups in a row mostly land in the same few tiles (a bilinear footprint, a coherent
+        // bundle of rays): a small per-thread table answers those without touching a lock
+        struct front_slot
+        {
+            uint64_t key = 0;
+            std::shared_ptr<const texture_tile> tile;
+        };
+        static thread_local front_slot front[front_slots];
+
+        auto& slot = front[(key * 0x9E3779B97F4A7C15ull) >> (64 - front_bits)];
+        if (slot.key == key)
+        {
+            return slot.tile->data();
+        }
+
+        auto& s = shards[(key ^ (key >> 29)) % shard_count];
+        std::shared_ptr<const texture_tile> tile;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.entries.find(key);
+            if (it != s.entries.end())
+            {
+                s.lru.splice(s.lru.begin(), s.lru, it->second.position);
+                tile = it->second.tile;
+            }
+        }
+
+        if (!tile)
+        {
+            // read without the lock; another thread may read the same tile meanwhile, one copy is kept
+            tile = load();
+            ++reads;
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto inserted = s.entries.try_emplace(key);
+            auto& entry = inserted.first->second;
+            if (inserted.second)
+            {
+                s.lru.push_front(key);
+                entry.tile = tile;
+                entry.position = s.lru.begin();
+                s.bytes += tile->size();
+                add_resident(tile->size());
+                evict(s);
+            }
+            else
+            {
+                tile = entry.tile;
+            }
+        }
+
+        slot.key = key;
+        slot.tile = std::move(tile);
+        return slot.tile->data();
+    }
+
+    // drops every tile and zeroes the counters (tiles a thread looked up last stay with it)
+    void reset()
+    {
+        for (auto& s : shards)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.lru.clear();
+            s.entries.clear();
+            s.bytes = 0;
+        }
+        resident = 0;
+        peak = 0;
+        reads = 0;
+        evictions = 0;
+    }
+
+    void report(std::ostream& out) const
+    {
+        out << "Texture cache: " << reads << " tiles read, " << evictions << " evicted, "
+            << peak / (1024.0 * 1024.0) << " MB peak of a " << budget() / (1024 * 1024) << " MB budget" << std::endl;
+    }
+
+private:
+    static constexpr int shard_count = 16;
+    static constexpr int front_bits = 4;
+    static constexpr int front_slots = 1 << front_bits;
+
+    struct entry
+    {
+        std::shared_ptr<const texture_tile> tile;
+        std::list<uint64_t>::iterator position;
+    };
+
+    struct shard
+    {
+        std::mutex mutex;
+        std::list<uint64_t> lru;   // most recently used first
+        std::unordered_map<uint64_t, entry> entries;
+        size_t bytes = 0;
+    };
+
+    shard shards[shard_count];
+    std::atomic<size_t> shard_budget{0};
+    std::atomic<size_t> resident{0}, peak{0};
+    std::atomic<uint64_t> reads{0}, evictions{0};
+
+    void add_resident(size_t bytes)
+    {
+        auto now = resident += bytes;
+        auto before = peak.load();
+        while (now > before && !peak.compare_exchange_weak(before, now)) {}
+    }
+
+    // with the shard's lock held; the newest tile always stays
+    void evict(shard& s)
+    {
+        while (s.bytes > shard_budget && s.lru.size() > 1)
+        {
+            auto it = s.entries.find(s.lru.back());
+            auto size = it->second.tile->size();
+            s.bytes -= size;
+            resident -= size;
+            ++evictions;
+            s.entries.erase(it);
+            s.lru.pop_back();
+        }
+    }
+};
+
+
+// One image as it is paged through a texture_cache: its MIP levels (see rtw_image) in tiles.
+// pixel_data() has the meaning it has in rtw_image.
+class tiled_image
+{
+public:
+    tiled_image() = default;
+    ~tiled_image() { if (file) std::fclose(file); }
+
+    tiled_image(const tiled_image&) = delete;
+    tiled_image& operator=(const tiled_image&) = delete;
+
+    // Opens `image_filename`, searched for as rtw_image does, through the global cache.
+    // Images opened before are shared; an image that can't be found has no levels.
+    // Different images load in parallel when opened from several threads; the same image loads once,
+    // the other threads opening it wait for it.
+    static std::shared_ptr<const tiled_image> open(const char* image_filename)
+    {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, std::weak_ptr<tiled_image>> opened;
+
+        auto path = rtw_image::locate(image_filename);
+        if (path.empty())
+        {
+            std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+            return std::make_shared<tiled_image>();
+        }
+
+        std::error_code error;
+        auto key = std::filesystem::weakly_canonical(path, error).string();
+        if (error)
+        {
+            key = path;
+        }
+
+        std::shared_ptr<tiled_image> image;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            image = opened[key].lock();
+            if (!image)
+            {
+                image = std::make_shared<tiled_image>();
+                opened[key] = image;
+            }
+        }
+        std::call_once(image->loaded, [&]() { image->load(path, key); });
+        return image;
+    }
+
+    // An image made by `render` (width x height pixels of three bytes, row by row) instead of read from
+    // a file. It is kept in the cache directory under `name` and `parameters`, a hash of everything its
+    // pixels depend on, and made again only when there is no file for those parameters.
+    // `made`, if given, tells whether render ran.
+    static std::shared_ptr<const tiled_image> bake(const std::string& name, uint64_t parameters, int width, int height,
+                                                   const std::function<void(std::vector<unsigned char>&)>& render,
+                                                   bool* made = nullptr)
+    {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, std::weak_ptr<tiled_image>> baked;
+
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(parameters));
+        auto key = name + "-" + hash + ".baked";
+
+        std::shared_ptr<tiled_image> image;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            image = baked[key].lock();
+            if (!image)
+            {
+                image = std::make_shared<tiled_image>();
+                baked[key] = image;
+            }
+        }
+        if (made)
+        {
+            *made = false;
+        }
+        std::call_once(image->loaded, [&]() { image->load_baked(key, parameters, width, height, render, made); });
+        return image;
+    }
+
+    // the format tiles are kept in, from RTW_TEXTURE_FORMAT (rgb8 by default); for images opened from then on
+    static texel_format configured_format()
+    {
+        auto name = getenv("RTW_TEXTURE_FORMAT");
+        if (name && std::strcmp(name, "bc1") == 0) return texel_format::bc1;
+        if (name && std::strcmp(name, "bc7") == 0) return texel_format::bc7;
+        return texel_format::rgb8;
+    }
+
+    texel_format format() const { return resident ? texel_format::rgb8 : tile_format; }
+
+    int levels() const { return resident ? resident->levels() : static_cast<int>(level_table.size()); }
+    int width()  const { return width(0); }
+    int height() const { return height(0); }
+    int width(int level)  const { return resident ? resident->width(level)  : (levels() > 0 ? level_table[level].width : 0); }
+    int height(int level) const { return resident ? resident->height(level) : (levels() > 0 ? level_table[level].height : 0); }
+
+    const unsigned char* pixel_data(int x, int y) const { return pixel_data(x, y, 0); }
+
+    const unsigned char* pixel_data(int x, int y, int level) const
+    {
+        // Return the address of the three bytes of the pixel at x,y of a level, clamped to its edges
+        // (or magenta if no data). Valid until this thread's next lookup.
+        static unsigned char magenta[] = { 255, 0, 255 };
+        if (resident) return resident->pixel_data(x, y, level);
+        if (levels() == 0) return magenta;
+
+        const auto& l = level_table[level];
+        x = std::min(std::max(x, 0), l.width - 1);
+        y = std::min(std::max(y, 0), l.height - 1);
+        auto tx = static_cast<unsigned>(x) / texture_cache::tile_size, ty = static_cast<unsigned>(y) / texture_cache::tile_size;
+        auto index = static_cast<uint32_t>(ty * l.tiles_x + tx);
+        auto key = (id << 40) | (static_cast<uint64_t>(level) << 32) | index;
+
+        auto tile = texture_cache::global().lookup(key, [&]() { return read_tile(l, index); });
+        auto in_x = x % texture_cache::tile_size, in_y = y % texture_cache::tile_size;
+        if (tile_format != texel_format::rgb8)
+        {
+            return decoded_texel(key, tile, in_x, in_y);
+        }
+        return tile + (in_y * texture_cache::tile_size + in_x) * 3;
+    }
+
+    void pixel_block(int x, int y, int level, unsigned char block[12]) const
+    {
+        // The 2x2 pixels from x,y to x+1,y+1 of a level (clamped to its edges), row by row, as bilinear
+        // filtering wants them: a single tile lookup unless the block straddles two tiles.
+        const int last = texture_cache::tile_size - 1;
+        bool inside = !resident && levels() > 0 && x >= 0 && y >= 0 && x + 1 < level_table[level].width
+                   && y + 1 < level_table[level].height;
+        if (inside && tile_format != texel_format::rgb8 && (x & 3) != 3 && (y & 3) != 3)
+        {
+            // within one compressed block: its texels are decoded together, 4 to a row
+            auto p = pixel_data(x, y, level);
+            std::copy(p, p + 6, block);
+            std::copy(p + 12, p + 18, block + 6);
+            return;
+        }
+        if (inside && tile_format == texel_format::rgb8 && (x & last) != last && (y & last) != last)
+        {
+            auto p = pixel_data(x, y, level);
+            std::copy(p, p + 6, block);
+            std::copy(p + texture_cache::tile_size * 3, p + texture_cache::tile_size * 3 + 6, block + 6);
+            return;
+        }
+
+        for (int k = 0; k < 4; ++k)
+        {
+            auto p = pixel_data(x + (k & 1), y + (k >> 1), level);
+            std::copy(p, p + 3, block + 3 * k);
+        }
+    }
+
+    // bytes of the decoded pixels (all levels), paged or not
+    size_t image_bytes() const
+    {
+        size_t bytes = 0;
+        for (int level = 0; level < levels(); ++level)
+            bytes += static_cast<size_t>(width(level)) * height(level) * 3;
+        return bytes;
+    }
+
+private:
+    struct file_header
+    {
+        char magic[4] = { 'R', 'T', 'T', '1' };
+        uint32_t tile_size = texture_cache::tile_size;
+        uint32_t levels = 0;
+        uint32_t format = 0;       // texel_format of the tiles
+        uint64_t source_size = 0;  // for baked images, their parameters' hash
+        int64_t source_time = 0;   // the image's modification time, to notice changes (baked: its size)
+    };
+
+    struct level_entry
+    {
+        int32_t width, height;
+        int32_t tiles_x, tiles_y;
+        uint64_t offset;           // of the level's first tile, tiles row by row
+    };
+
+    uint64_t id = 0;               // tells this image's tiles apart in the cache
+    std::FILE* file = nullptr;
+    mutable std::mutex file_mutex;
+    std::once_flag loaded;
+    texel_format tile_format = texel_format::rgb8;
+    std::vector<level_entry> level_table;
+    std::unique_ptr<rtw_image> resident;   // the fallback: decoded in memory
+
+    static uint64_t new_id()
+    {
+        static std::atomic<uint64_t> next_id{1};
+        return next_id++;
+    }
+
+    void load(const std::string& path, const std::string& key)
+    {
+        id = new_id();
+        tile_format = configured_format();
+
+        file_header expected;
+        expected.format = static_cast<uint32_t>(tile_format);
+        std::error_code error;
+        expected.source_size = std::filesystem::file_size(path, error);
+        expected.source_time = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+
+        auto tiled = tiled_path(key, tile_format);
+        if (!tiled.empty() && (open_tiled(tiled, expected) || (convert(path, tiled, expected) && open_tiled(tiled, expected))))
+        {
+            return;
+        }
+
+        std::cerr << "ERROR: Could not write the tiled copy of '" << path << "', keeping it in memory.\n";
+        resident = std::make_unique<rtw_image>();
+        if (!resident->load(path))
+        {
+            std::cerr << "ERROR: Could not load image file '" << path << "'.\n";
+        }
+    }
+
+    void load_baked(const std::string& key, uint64_t parameters, int width, int height,
+                    const std::function<void(std::vector<unsigned char>&)>& render, bool* made)
+    {
+        id = new_id();
+        tile_format = configured_format();
+
+        file_header expected;
+        expected.format = static_cast<uint32_t>(tile_format);
+        expected.source_size = parameters;
+        expected.source_time = (static_cast<int64_t>(width) << 32) | static_cast<uint32_t>(height);
+
+        auto tiled = tiled_path(key, tile_format);
+        if (!tiled.empty() && open_tiled(tiled, expected))
+        {
+            return;
+        }
+
+        std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+        render(pixels);
+        if (made)
+        {
+            *made = true;
+        }
+        resident = std::make_unique<rtw_image>();
+        resident->load_pixels(width, height, pixels.data());
+        if (!tiled.empty() && write_tiled(*resident, tiled, expected) && open_tiled(tiled, expected))
+        {
+            resident.reset();
+            return;
+        }
+        std::cerr << "ERROR: Could not write the baked texture '" << key << "', keeping it in memory.\n";
+    }
+
+    static std::string tiled_path(std::string key, texel_format format)
+    {
+        if (format != texel_format::rgb8)
+        {
+            key += std::string("#") + texel_format_name(format);   // a file per format
+        }
+
+        std::error_code error;
+        auto dir = getenv("RTW_TEXTURE_CACHE");
+        auto directory = dir ? std::filesystem::path(dir) : std::filesystem::temp_directory_path(error) / "rtw_texture_cache";
+        if (error || (std::filesystem::create_directories(directory, error), error))
+        {
+            return "";
+        }
+
+        // the image's name for people looking into the directory, a hash of its full path to tell apart equal names
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(std::hash<std::string>{}(key)));
+        auto name = std::filesystem::path(key).stem().string() + "-" + hash + ".rtt";
+        return (directory / name).string();
+    }
+
+    bool open_tiled(const std::string& tiled, const file_header& expected)
+    {
+        auto f = std::fopen(tiled.c_str(), "rb");
+        if (!f)
+        {
+            return false;
+        }
+
+        file_header header;
+        bool valid = std::fread(&header, sizeof(header), 1, f) == 1
+                  && std::equal(header.magic, header.magic + 4, expected.magic)
+                  && header.tile_size == expected.tile_size
+                  && header.format == expected.format
+                  && header.source_size == expected.source_size
+                  && header.source_time == expected.source_time
+                  && header.levels > 0 && header.levels < 32;
+        if (valid)
+        {
+            level_table.resize(header.levels);
+            valid = std::fread(level_table.data(), sizeof(level_entry), header.levels, f) == header.levels;
+        }
+        if (!valid)
+        {
+            level_table.clear();
+            std::fclose(f);
+            return false;
+        }
+
+        file = f;
+        return true;
+    }
+
+    static bool convert(const std::string& path, const std::string& tiled, const file_header& header)
+    {
+        rtw_image image;
+        return image.load(path) && write_tiled(image, tiled, header);
+    }
+
+    static bool write_tiled(const rtw_image& image, const std::string& tiled, file_header header)
+    {
+        std::vector<level_entry> table(image.levels());
+        uint64_t offset = sizeof(file_header) + table.size() * sizeof(level_entry);
+        for (int level = 0; level < image.levels(); ++level)
+        {
+            auto& l = table[level];
+            l.width = image.width(level);
+            l.height = image.height(level);
+            l.tiles_x = (l.width + texture_cache::tile_size - 1) / texture_cache::tile_size;
+            l.tiles_y = (l.height + texture_cache::tile_size - 1) / texture_cache::tile_size;
+            l.offset = offset;
+            offset += static_cast<uint64_t>(l.tiles_x) * l.tiles_y * tile_bytes(static_cast<texel_format>(header.format));
+        }
+        header.levels = static_cast<uint32_t>(table.size());
+
+        // written aside and renamed, so a run in parallel never opens a half-written file
+        auto temporary = tiled + ".part" + std::to_string(std::random_device{}());
+        auto f = std::fopen(temporary.c_str(), "wb");
+        if (!f)
+        {
+            return false;
+        }
+
+        bool written = std::fwrite(&header, sizeof(header), 1, f) == 1
+                    && std::fwrite(table.data(), sizeof(level_entry), table.size(), f) == table.size();
+
+        auto format = static_cast<texel_format>(header.format);
+        texture_tile tile(texture_cache::tile_bytes), packed(tile_bytes(format));
+        for (int level = 0; level < image.levels() && written; ++level)
+        {
+            const auto& l = table[level];
+            for (int ty = 0; ty < l.tiles_y && written; ++ty)
+                for (int tx = 0; tx < l.tiles_x && written; ++tx)
+                {
+                    // pixels past the image's edges repeat the edge
+                    for (int y = 0; y < texture_cache::tile_size; ++y)
+                        for (int x = 0; x < texture_cache::tile_size; ++x)
+                        {
+                            auto pixel = image.pixel_data(tx * texture_cache::tile_size + x, ty * texture_cache::tile_size + y, level);
+                            std::copy(pixel, pixel + 3, tile.data() + (y * texture_cache::tile_size + x) * 3);
+                        }
+                    if (format != texel_format::rgb8)
+                    {
+                        pack_tile(format, tile, packed);
+                        written = std::fwrite(packed.data(), 1, packed.size(), f) == packed.size();
+                        continue;
+                    }
+                    written = std::fwrite(tile.data(), 1, tile.size(), f) == tile.size();
+                }
+        }
+
+        written = (std::fclose(f) == 0) && written;
+        std::error_code error;
+        if (written)
+        {
+            std::filesystem::rename(temporary, tiled, error);
+        }
+        if (!written || error)
+        {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+
+    std::shared_ptr<const texture_tile> read_tile(const level_entry& l, uint32_t index) const
+    {
+        auto tile = std::make_shared<texture_tile>(tile_bytes(tile_format));
+        std::lock_guard<std::mutex> lock(file_mutex);
+        auto offset = l.offset + static_cast<uint64_t>(index) * tile->size();
+        if (fseek_to(offset) || std::fread(tile->data(), 1, tile->size(), file) != tile->size())
+        {
+            std::fill(tile->begin(), tile->end(), 0);   // a damaged cache file: black rather than a crash
+        }
+        return tile;
+    }
+
+    static size_t tile_bytes(texel_format format)
+    {
+        return texel_bytes(format, texture_cache::tile_size, texture_cache::tile_size);
+    }
+
+    // an RGB tile into its 4x4 blocks, row by row
+    static void pack_tile(texel_format format, const texture_tile& tile, texture_tile& packed)
+    {
+        const int blocks = texture_cache::tile_size / 4;
+        unsigned char rgb[48];
+        for (int by = 0; by < blocks; ++by)
+            for (int bx = 0; bx < blocks; ++bx)
+            {
+                for (int y = 0; y < 4; ++y)
+                {
+                    auto row = tile.data() + ((by * 4 + y) * texture_cache::tile_size + bx * 4) * 3;
+                    std::copy(row, row + 12, rgb + 12 * y);
+                }
+                encode_block(format, rgb, packed.data() + (by * blocks + bx) * block_bytes(format));
+            }
+    }
+
+    // the texel's block decoded, from a small per-thread table of the blocks decoded last
+    // (a bilinear footprint touches up to four neighbours, each with a slot of its own)
+    const unsigned char* decoded_texel(uint64_t key, const unsigned char* tile, unsigned in_x, unsigned in_y) const
+    {
+        struct decoded
+        {
+            uint64_t key = ~0ull;
+            unsigned block = ~0u;
+            unsigned char rgb[48];
+        };
+        static thread_local decoded recent[4];
+
+        auto bx = in_x / 4, by = in_y / 4;
+        auto block = by * (texture_cache::tile_size / 4) + bx;
+        auto& d = recent[(bx & 1) | ((by & 1) << 1)];
+        if (d.key != key || d.block != block)
+        {
+            decode_block(tile_format, tile + block * block_bytes(tile_format), d.rgb);
+            d.key = key;
+            d.block = block;
+        }
+        return d.rgb + ((in_y & 3) * 4 + (in_x & 3)) * 3;
+    }
+
+    int fseek_to(uint64_t offset) const
+    {
+#if defined(_MSC_VER)
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET);
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    }
+};
+
+
+#endif //TEXTURE_CACHE_H
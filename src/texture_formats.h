@@ -0,0 +1,473 @@
+#ifndef TEXTURE_FORMATS_H
+#define TEXTURE_FORMATS_H
+
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Texel formats that keep textures smaller in memory than 3 bytes per texel, decoded on fetch:
+//  - bc1: blocks of 4x4 texels in 8 bytes (0.5 bytes a texel), two RGB 5:6:5 endpoints and four
+//    colors on the line between them, 2 bits a texel to pick one - the D3D/GL format of that name,
+//  - bc7: blocks of 4x4 texels in 16 bytes (1 byte a texel) in BC7's mode 6: two endpoints of 7 bits
+//    a channel and a shared low bit (p-bit) each, sixteen colors between them, 4 bits a texel. Alpha is
+//    written opaque; the encoder only makes mode 6 blocks, which is also all the decoder reads,
+//  - half floats (IEEE 754 binary16) for HDR texels past [0,1]: 6 bytes a texel against 12 for floats.
+// Encoding fits the endpoints along the block's principal color axis and picks each texel's nearest
+// color. Decoding expands one block at a time: the palette in SSE lanes, each texel's color picked from
+// it by byte shuffles (SSSE3, on CPUs with AVX2); half floats convert four at a time with F16C where the
+// CPU has it.
+
+
+enum class texel_format : uint32_t { rgb8 = 0, bc1 = 1, bc7 = 2 };
+
+inline const char* texel_format_name(texel_format f)
+{
+    switch (f)
+    {
+    case texel_format::bc1: return "BC1";
+    case texel_format::bc7: return "BC7";
+    default:                return "RGB8";
+    }
+}
+
+// bytes of a w x h region stored in a format (block formats round up to whole blocks)
+inline size_t texel_bytes(texel_format f, int w, int h)
+{
+    size_t blocks = static_cast<size_t>((w + 3) / 4) * ((h + 3) / 4);
+    switch (f)
+    {
+    case texel_format::bc1: return blocks * 8;
+    case texel_format::bc7: return blocks * 16;
+    default:                return static_cast<size_t>(w) * h * 3;
+    }
+}
+
+inline size_t block_bytes(texel_format f) { return f == texel_format::bc1 ? 8 : 16; }
+
+
+// Block encoding
+
+namespace texel_blocks
+{
+    // endpoints a, b of the line through the block's colors along their principal axis
+    inline void fit_endpoints(const unsigned char rgb[48], float a[3], float b[3])
+    {
+        float mean[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c)
+                mean[c] += rgb[3 * i + c] / 16.0f;
+
+        float cov[6] = { 0, 0, 0, 0, 0, 0 };   // xx xy xz yy yz zz
+        for (int i = 0; i < 16; ++i)
+        {
+            float d[3] = { rgb[3 * i] - mean[0], rgb[3 * i + 1] - mean[1], rgb[3 * i + 2] - mean[2] };
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+
+        // a few power iterations from the luminance direction
+        float axis[3] = { 0.3f, 0.6f, 0.1f };
+        for (int k = 0; k < 6; ++k)
+        {
+            float next[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                              cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                              cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+            auto length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (length < 1e-6f)
+                break;
+            for (int c = 0; c < 3; ++c)
+                axis[c] = next[c] / length;
+        }
+
+        float low = 1e30f, high = -1e30f;
+        for (int i = 0; i < 16; ++i)
+        {
+            auto t = (rgb[3 * i] - mean[0]) * axis[0] + (rgb[3 * i + 1] - mean[1]) * axis[1] + (rgb[3 * i + 2] - mean[2]) * axis[2];
+            low = std::min(low, t);
+            high = std::max(high, t);
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            a[c] = std::min(255.0f, std::max(0.0f, mean[c] + low * axis[c]));
+            b[c] = std::min(255.0f, std::max(0.0f, mean[c] + high * axis[c]));
+        }
+    }
+
+    // index of the palette color nearest to each texel
+    template <int Colors>
+    inline void nearest(const unsigned char rgb[48], const int palette[Colors][3], int index[16])
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, best_distance = 1 << 30;
+            for (int k = 0; k < Colors; ++k)
+            {
+                int dr = rgb[3 * i] - palette[k][0], dg = rgb[3 * i + 1] - palette[k][1], db = rgb[3 * i + 2] - palette[k][2];
+                int distance = dr * dr + dg * dg + db * db;
+                if (distance < best_distance)
+                {
+                    best = k;
+                    best_distance = distance;
+                }
+            }
+            index[i] = best;
+        }
+    }
+
+    inline uint16_t to_565(const float c[3])
+    {
+        auto r = static_cast<int>(c[0] * 31 / 255 + 0.5f), g = static_cast<int>(c[1] * 63 / 255 + 0.5f), b = static_cast<int>(c[2] * 31 / 255 + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    inline void from_565(uint16_t v, int c[3])
+    {
+        int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+        c[0] = (r << 3) | (r >> 2);
+        c[1] = (g << 2) | (g >> 4);
+        c[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC7's 4-bit interpolation weights, out of 64
+    static constexpr int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    inline void bc1_palette(uint16_t e0, uint16_t e1, int palette[4][3])
+    {
+        from_565(e0, palette[0]);
+        from_565(e1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+
+    inline void bc7_palette(const int e0[3], const int e1[3], int palette[16][3])
+    {
+        for (int k = 0; k < 16; ++k)
+            for (int c = 0; c < 3; ++c)
+                palette[k][c] = (e0[c] * (64 - bc7_weights[k]) + e1[c] * bc7_weights[k] + 32) >> 6;
+    }
+
+    // BC7 mode 6, bit by bit from bit 0 of byte 0: the mode (6 zeros and a one), the endpoints' 7-bit
+    // R0 R1 G0 G1 B0 B1 A0 A1, their p-bits P0 P1 (the low bit of all four channels of an endpoint),
+    // then the texels' indices, 3 bits for the first (its top bit is 0) and 4 for the other 15
+    constexpr uint64_t mode6 = 1 << 6;
+
+    // an endpoint as 7 bits a channel and a p-bit, whichever p-bit comes closer
+    inline void quantize_mode6(const float c[3], int e7[3], int& p)
+    {
+        float best = 1e30f;
+        for (int pbit = 0; pbit < 2; ++pbit)
+        {
+            int q[3];
+            float error = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                q[k] = std::min(127, std::max(0, static_cast<int>(std::lround((c[k] - pbit) / 2))));
+                auto d = c[k] - ((q[k] << 1) | pbit);
+                error += d * d;
+            }
+            if (error < best)
+            {
+                best = error;
+                p = pbit;
+                std::copy(q, q + 3, e7);
+            }
+        }
+    }
+
+    inline void mode6_endpoints(uint64_t lo, uint64_t hi, int e0[3], int e1[3])
+    {
+        auto p0 = static_cast<int>(lo >> 63), p1 = static_cast<int>(hi & 1);
+        for (int c = 0; c < 3; ++c)
+        {
+            e0[c] = static_cast<int>(((lo >> (7 + 14 * c)) & 0x7f) << 1) | p0;
+            e1[c] = static_cast<int>(((lo >> (14 + 14 * c)) & 0x7f) << 1) | p1;
+        }
+    }
+
+    // a block's colors as planes of 16 bytes, red green blue (entries past the palette are 0), and the
+    // index of each texel's color
+    struct unpacked_block
+    {
+        alignas(16) unsigned char palette[3][16];
+        alignas(16) unsigned char index[16];
+    };
+
+    inline void unpack_bc1(const unsigned char* block, unpacked_block& u)
+    {
+        int palette[4][3];
+        bc1_palette(static_cast<uint16_t>(block[0] | (block[1] << 8)), static_cast<uint16_t>(block[2] | (block[3] << 8)), palette);
+        std::memset(u.palette, 0, sizeof(u.palette));
+        for (int k = 0; k < 4; ++k)
+            for (int c = 0; c < 3; ++c)
+                u.palette[c][k] = static_cast<unsigned char>(palette[k][c]);
+
+        uint32_t bits;
+        std::memcpy(&bits, block + 4, 4);
+        for (int i = 0; i < 16; ++i, bits >>= 2)
+            u.index[i] = static_cast<unsigned char>(bits & 3);
+    }
+
+    inline void unpack_bc7(const unsigned char* block, unpacked_block& u)
+    {
+        uint64_t lo, hi;
+        std::memcpy(&lo, block, 8);
+        std::memcpy(&hi, block + 8, 8);
+        int e0[3], e1[3];
+        mode6_endpoints(lo, hi, e0, e1);
+
+        // the indices as 16 nibbles, the first one's missing top bit put back
+        auto packed = hi >> 1;
+        auto nibbles = (packed & 7) | ((packed >> 3) << 4);
+
+#if defined(RT_SIMD_SSE)
+        // sixteen colors a channel in 16-bit lanes, the same sums as bc7_palette
+        const auto w_lo = _mm_setr_epi16(0, 4, 9, 13, 17, 21, 26, 30), w_hi = _mm_setr_epi16(34, 38, 43, 47, 51, 55, 60, 64);
+        const auto w64 = _mm_set1_epi16(64), half = _mm_set1_epi16(32);
+        for (int c = 0; c < 3; ++c)
+        {
+            auto a = _mm_set1_epi16(static_cast<short>(e0[c])), b = _mm_set1_epi16(static_cast<short>(e1[c]));
+            auto mix = [&](__m128i w)
+            {
+                auto sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(w64, w)), _mm_mullo_epi16(b, w));
+                return _mm_srli_epi16(_mm_add_epi16(sum, half), 6);
+            };
+            _mm_store_si128(reinterpret_cast<__m128i*>(u.palette[c]), _mm_packus_epi16(mix(w_lo), mix(w_hi)));
+        }
+
+        auto v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&nibbles));
+        auto low = _mm_and_si128(v, _mm_set1_epi8(0x0f)), high = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+        _mm_store_si128(reinterpret_cast<__m128i*>(u.index), _mm_unpacklo_epi8(low, high));
+#else
+        int palette[16][3];
+        bc7_palette(e0, e1, palette);
+        for (int k = 0; k < 16; ++k)
+            for (int c = 0; c < 3; ++c)
+                u.palette[c][k] = static_cast<unsigned char>(palette[k][c]);
+        for (int i = 0; i < 16; ++i)
+            u.index[i] = static_cast<unsigned char>((nibbles >> (4 * i)) & 15);
+#endif
+    }
+
+#if defined(RT_SIMD_DISPATCH)
+    // where each output byte of the 48 comes from: [output vector][channel][byte], 0x80 for none
+    struct interleave_masks { alignas(16) unsigned char m[3][3][16]; };
+
+    constexpr interleave_masks make_interleave_masks()
+    {
+        interleave_masks t{};
+        for (int o = 0; o < 3; ++o)
+            for (int c = 0; c < 3; ++c)
+                for (int j = 0; j < 16; ++j)
+                {
+                    int g = 16 * o + j;
+                    t.m[o][c][j] = static_cast<unsigned char>(g % 3 == c ? g / 3 : 0x80);
+                }
+        return t;
+    }
+
+    inline constexpr interleave_masks rgb_interleave = make_interleave_masks();
+
+    // every texel's color out of each plane with one byte shuffle, then the planes interleaved to RGB
+    __attribute__((target("ssse3"))) inline void pick_texels_ssse3(const unpacked_block& u, unsigned char rgb[48])
+    {
+        auto index = _mm_load_si128(reinterpret_cast<const __m128i*>(u.index));
+        __m128i plane[3];
+        for (int c = 0; c < 3; ++c)
+            plane[c] = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(u.palette[c])), index);
+
+        for (int o = 0; o < 3; ++o)
+        {
+            auto out = _mm_setzero_si128();
+            for (int c = 0; c < 3; ++c)
+                out = _mm_or_si128(out, _mm_shuffle_epi8(plane[c], _mm_load_si128(reinterpret_cast<const __m128i*>(rgb_interleave.m[o][c]))));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + 16 * o), out);
+        }
+    }
+#endif
+
+    inline void pick_texels(const unpacked_block& u, unsigned char rgb[48])
+    {
+#if defined(RT_SIMD_DISPATCH)
+        if (active_simd_level() == simd_level::avx2)   // SSSE3 comes with it
+        {
+            pick_texels_ssse3(u, rgb);
+            return;
+        }
+#endif
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c)
+                rgb[3 * i + c] = u.palette[c][u.index[i]];
+    }
+}
+
+// a 4x4 block of RGB texels (row by row) into `out`, block_bytes(f) of it
+inline void encode_block(texel_format f, const unsigned char rgb[48], unsigned char* out)
+{
+    using namespace texel_blocks;
+    float a[3], b[3];
+    fit_endpoints(rgb, a, b);
+    int index[16];
+
+    if (f == texel_format::bc1)
+    {
+        auto e0 = to_565(b), e1 = to_565(a);
+        if (e0 < e1)
+            std::swap(e0, e1);
+        uint32_t bits = 0;
+        if (e0 != e1)   // e0 > e1: the four-color mode
+        {
+            int palette[4][3];
+            bc1_palette(e0, e1, palette);
+            nearest<4>(rgb, palette, index);
+            for (int i = 0; i < 16; ++i)
+                bits |= static_cast<uint32_t>(index[i]) << (2 * i);
+        }
+        out[0] = e0 & 0xff; out[1] = e0 >> 8;
+        out[2] = e1 & 0xff; out[3] = e1 >> 8;
+        std::memcpy(out + 4, &bits, 4);
+        return;
+    }
+
+    int q0[3], q1[3], p0 = 0, p1 = 0;
+    quantize_mode6(a, q0, p0);
+    quantize_mode6(b, q1, p1);
+    int e0[3], e1[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        e0[c] = (q0[c] << 1) | p0;
+        e1[c] = (q1[c] << 1) | p1;
+    }
+    int palette[16][3];
+    bc7_palette(e0, e1, palette);
+    nearest<16>(rgb, palette, index);
+
+    // the first index has no top bit: swapping the endpoints turns index k into 15 - k (the weights are symmetric)
+    if (index[0] & 8)
+    {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (auto& k : index)
+            k = 15 - k;
+    }
+
+    uint64_t lo = mode6;
+    for (int c = 0; c < 3; ++c)
+        lo |= static_cast<uint64_t>(q0[c]) << (7 + 14 * c) | static_cast<uint64_t>(q1[c]) << (14 + 14 * c);
+    lo |= uint64_t(0x7f) << 49 | uint64_t(0x7f) << 56;   // alpha: opaque
+    lo |= static_cast<uint64_t>(p0) << 63;
+
+    uint64_t nibbles = 0;
+    for (int i = 0; i < 16; ++i)
+        nibbles |= static_cast<uint64_t>(index[i]) << (4 * i);
+    uint64_t hi = static_cast<uint64_t>(p1) | ((nibbles & 7) | ((nibbles >> 4) << 3)) << 1;
+
+    std::memcpy(out, &lo, 8);
+    std::memcpy(out + 8, &hi, 8);
+}
+
+// the 16 texels of a block, row by row, 3 bytes each
+inline void decode_block(texel_format f, const unsigned char* block, unsigned char rgb[48])
+{
+    using namespace texel_blocks;
+    unpacked_block u;
+    if (f == texel_format::bc1)
+        unpack_bc1(block, u);
+    else
+        unpack_bc7(block, u);
+    pick_texels(u, rgb);
+}
+
+
+// Half floats
+
+inline uint16_t float_to_half(float value)
+{
+    // rounded to nearest even; too large for a half becomes infinity, too small zero
+    uint32_t f;
+    std::memcpy(&f, &value, 4);
+    uint32_t sign = (f >> 16) & 0x8000;
+    int exponent = static_cast<int>((f >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = f & 0x7fffff;
+
+    if (((f >> 23) & 0xff) == 0xff)   // infinity, NaN
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 31)
+        return static_cast<uint16_t>(sign | 0x7c00);
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1)))
+            ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half;   // may carry into the exponent, which is right
+    return static_cast<uint16_t>(sign | half);
+}
+
+inline float half_to_float(uint16_t h)
+{
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 31, mantissa = h & 0x3ff;
+    uint32_t f;
+    if (exponent == 31)
+        f = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        f = sign;
+    else
+    {
+        // subnormal: normalize
+        int shift = 0;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            ++shift;
+        }
+        f = sign | ((113 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    std::memcpy(&value, &f, 4);
+    return value;
+}
+
+#if defined(RT_SIMD_DISPATCH)
+// every CPU with AVX2 has F16C, so the avx2 level of active_simd_level() stands for it
+__attribute__((target("f16c"))) inline void halves_to_floats_f16c(const uint16_t* h, float* out, int count)
+{
+    for (int i = 0; i < count; i += 4)
+        _mm_storeu_ps(out + i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(h + i))));
+}
+#endif
+
+// count (a multiple of 4) half floats to floats
+inline void halves_to_floats(const uint16_t* h, float* out, int count)
+{
+#if defined(RT_SIMD_DISPATCH)
+    if (active_simd_level() == simd_level::avx2)
+    {
+        halves_to_floats_f16c(h, out, count);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+        out[i] = half_to_float(h[i]);
+}
+
+
+#endif //TEXTURE_FORMATS_H
@@ -0,0 +1,162 @@
+#ifndef TRIANGLE_PACKET_H
+#define TRIANGLE_PACKET_H
+
+#include "utility.h"
+#include "ray.h"
+#include "simd.h"
+
+#include <cstdint>
+
+// Leaf kernel: one ray against eight triangles at once.
+//  - triangles are stored structure-of-arrays, one float lane per triangle, so the lane loops below
+//    compile to 4-wide (SSE) or 8-wide (AVX) instructions without intrinsics,
+//  - the test is the watertight one of Woop, Benthin and Wald (2013): the ray is sheared onto the
+//    z axis once per ray, and the three 2D edge functions share their values between neighbouring
+//    triangles, so rays through a shared edge or vertex cannot slip between them,
+//  - positions are float; the edge functions are double (see intersect_packet_lanes),
+//  - the kernel is compiled for the baseline and for AVX2, and intersect_packet is the one for this CPU.
+
+
+class triangle_packet
+{
+public:
+    static const int width = 8;
+    static const uint32_t empty = UINT32_MAX;
+
+    alignas(32) float v[3][3][width];   // [vertex][axis][lane]
+    uint32_t triangle[width];           // index of the lane's triangle in its mesh, `empty` for padding
+
+    triangle_packet()
+    {
+        for (int i = 0; i < 3; ++i)
+            for (int a = 0; a < 3; ++a)
+                for (int l = 0; l < width; ++l)
+                    v[i][a][l] = 0;   // a degenerate triangle never reports a hit
+        for (int l = 0; l < width; ++l)
+            triangle[l] = empty;
+    }
+
+    void set(int lane, const float* p0, const float* p1, const float* p2, uint32_t tri)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            v[0][a][lane] = p0[a];
+            v[1][a][lane] = p1[a];
+            v[2][a][lane] = p2[a];
+        }
+        triangle[lane] = tri;
+    }
+};
+
+
+// per-ray constants of the watertight test
+class packet_ray
+{
+public:
+    float origin[3];
+    int kx, ky, kz;                        // axis permutation: kz is the largest direction component
+    float Sx, Sy, Sz;                      // shear taking the direction onto +z
+
+    packet_ray(const ray& r)
+    {
+        const auto& d = r.direction();
+        kz = 0;
+        if (fabs(d[1]) > fabs(d[kz])) kz = 1;
+        if (fabs(d[2]) > fabs(d[kz])) kz = 2;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (d[kz] < 0)
+            std::swap(kx, ky);   // keep the winding
+
+        Sx = static_cast<float>(d[kx] / d[kz]);
+        Sy = static_cast<float>(d[ky] / d[kz]);
+        Sz = static_cast<float>(1 / d[kz]);
+
+        for (int a = 0; a < 3; ++a)
+        {
+            origin[a] = static_cast<float>(r.origin()[a]);
+        }
+    }
+};
+
+
+// Closest hit of r among the packet's triangles with t in (t_min, t_max).
+// Returns its lane (and shrinks t_max, fills the barycentrics of vertices 1 and 2) or -1.
+RT_ALWAYS_INLINE int intersect_packet_lanes(const triangle_packet& p, const packet_ray& r, float t_min, float& t_max, float& b1, float& b2)
+{
+    const int W = triangle_packet::width;
+    alignas(64) double U[W], V[W], Wt[W], T[W];
+
+    // translate, shear and evaluate the edge functions, all lanes alike.
+    // The 2D cross products are taken in double: a product of two floats is exact there, so a fused
+    // multiply-add cannot change it and an edge shared by two triangles gets exactly opposite values.
+    // This replaces the paper's double-precision fallback for edge functions that round to zero.
+    for (int l = 0; l < W; ++l)
+    {
+        auto Akz = p.v[0][r.kz][l] - r.origin[r.kz];
+        auto Bkz = p.v[1][r.kz][l] - r.origin[r.kz];
+        auto Ckz = p.v[2][r.kz][l] - r.origin[r.kz];
+
+        double Ax = (p.v[0][r.kx][l] - r.origin[r.kx]) - r.Sx * Akz;
+        double Ay = (p.v[0][r.ky][l] - r.origin[r.ky]) - r.Sy * Akz;
+        double Bx = (p.v[1][r.kx][l] - r.origin[r.kx]) - r.Sx * Bkz;
+        double By = (p.v[1][r.ky][l] - r.origin[r.ky]) - r.Sy * Bkz;
+        double Cx = (p.v[2][r.kx][l] - r.origin[r.kx]) - r.Sx * Ckz;
+        double Cy = (p.v[2][r.ky][l] - r.origin[r.ky]) - r.Sy * Ckz;
+
+        U[l] = Cx * By - Cy * Bx;
+        V[l] = Ax * Cy - Ay * Cx;
+        Wt[l] = Bx * Ay - By * Ax;
+        T[l] = r.Sz * (U[l] * Akz + V[l] * Bkz + Wt[l] * Ckz);
+    }
+
+    int hit = -1;
+    for (int l = 0; l < W; ++l)
+    {
+        auto u = U[l], v = V[l], w = Wt[l];
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            continue;   // edge functions disagree: outside
+        auto det = u + v + w;
+        if (det == 0 || p.triangle[l] == triangle_packet::empty)
+            continue;
+
+        auto t = T[l] / det;
+        if (!(t > t_min && t < t_max))
+            continue;
+
+        t_max = static_cast<float>(t);
+        b1 = static_cast<float>(v / det);
+        b2 = static_cast<float>(w / det);
+        hit = l;
+    }
+
+    return hit;
+}
+
+// the same source for each instruction set: the lane loops widen to what the target allows
+inline int intersect_packet_baseline(const triangle_packet& p, const packet_ray& r, float t_min, float& t_max, float& b1, float& b2)
+{
+    return intersect_packet_lanes(p, r, t_min, t_max, b1, b2);
+}
+
+#if defined(RT_SIMD_DISPATCH)
+RT_TARGET_AVX2 inline int intersect_packet_avx2(const triangle_packet& p, const packet_ray& r, float t_min, float& t_max, float& b1, float& b2)
+{
+    return intersect_packet_lanes(p, r, t_min, t_max, b1, b2);
+}
+#endif
+
+using intersect_packet_kernel = int (*)(const triangle_packet&, const packet_ray&, float, float&, float&, float&);
+
+// the build for this CPU, picked once when the program starts
+inline const intersect_packet_kernel intersect_packet = []()
+{
+#if defined(RT_SIMD_DISPATCH)
+    if (active_simd_level() == simd_level::avx2)
+        return &intersect_packet_avx2;
+#endif
+    return &intersect_packet_baseline;
+}();
+
+
+#endif //TRIANGLE_PACKET_H
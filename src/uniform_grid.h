@@ -0,0 +1,397 @@
+#ifndef UNIFORM_GRID_H
+#define UNIFORM_GRID_H
+
+#include "utility.h"
+#include "object.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Grid accelerator over a list of objects, an alternative to bvh_node for dense, evenly spread scenes:
+//  - the scene's bounds are cut into cells, about `density` cells per object, each cell listing
+//    the objects whose bounds overlap it; a ray walks the cells it crosses front to back (3D DDA)
+//    and stops at the first cell that holds a hit,
+//  - two-level: a coarse grid whose crowded cells get a finer grid of their own, for scenes where
+//    a few large objects stretch the bounds over many small ones (teapot in a stadium),
+//  - an object overlapping several cells is only tested in the cell where the ray enters its
+//    bounds, so it is never tested twice and media are attenuated once.
+
+
+class uniform_grid : public object
+{
+public:
+    uniform_grid(const scene& world, bool two_level = false) : uniform_grid(world.objects, two_level) {}
+
+    uniform_grid(const std::vector<shared_ptr<object>>& object_list, bool two_level = false)
+      : uniform_grid(object_list, two_level ? coarse_density : fine_density, two_level, bbox()) {}
+
+
+    // Method
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    int cells(int axis) const { return resolution[axis]; }
+    size_t subgrid_count() const { return subgrids.size(); }
+
+    size_t memory_bytes() const
+    {
+        auto bytes = cell_start.size() * sizeof(uint32_t) + cell_objects.size() * sizeof(uint32_t)
+                   + (cell_subgrid.size() + subgrid_large.size()) * sizeof(int32_t) + objects.size() * (sizeof(shared_ptr<object>) + sizeof(bbox));
+        for (const auto& sub : subgrids)
+            bytes += sub->memory_bytes();
+        return bytes;
+    }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        deferred_hit hit;
+        if (!intersect_deferred(r, ray_t, rec, hit))
+            return false;
+
+        finish_hit(r, hit, rec);
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        bool hit_anything = false;
+        intersect_record temp_rec;
+        deferred_hit temp_hit;
+
+        // the closest hit so far; its record is copied in only if it was filled already
+        auto take = [&]()
+        {
+            hit_anything = true;
+            ray_t.max = temp_hit.t;
+            hit = temp_hit;
+            if (!hit.primitive)
+                rec = temp_rec;
+        };
+
+        walk(r, ray_t, [&](size_t cell, double t_in, double t_out)
+        {
+            // a crowded cell: its large objects here, the rest in its subgrid
+            auto sub = cell_subgrid.empty() ? -1 : cell_subgrid[cell];
+            auto end = sub >= 0 ? cell_start[cell] + subgrid_large[sub] : cell_start[cell + 1];
+
+            for (auto k = cell_start[cell]; k < end; ++k)
+            {
+                auto i = cell_objects[k];
+                if (!enters_here(i, r, ray_t, t_in, t_out))
+                    continue;
+
+                if (objects[i]->intersect_deferred(r, ray_t, temp_rec, temp_hit))
+                    take();
+            }
+
+            if (sub >= 0 && subgrids[sub]->intersect_deferred(r, ray_t, temp_rec, temp_hit))
+                take();
+
+            // the cells further on are all behind a hit inside this one
+            return !(hit_anything && ray_t.max <= t_out);
+        });
+
+        return hit_anything;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        // the cell lists only (they still hold every object of a crowded cell), every object once
+        auto tr = 1.0;
+        walk(r, ray_t, [&](size_t cell, double t_in, double t_out)
+        {
+            for (auto k = cell_start[cell]; k < cell_start[cell + 1]; ++k)
+            {
+                auto i = cell_objects[k];
+                if (!enters_here(i, r, ray_t, t_in, t_out))
+                    continue;
+
+                tr *= objects[i]->transmittance(r, ray_t);
+                if (tr <= 0)
+                    return false;   // blocked, no need to look further
+            }
+            return true;
+        });
+
+        return tr;
+    }
+
+private:
+    std::vector<shared_ptr<object>> objects;
+    std::vector<bbox> object_boxes;
+    int resolution[3] = { 1, 1, 1 };
+    vec3 cell_size, inv_cell_size;
+    std::vector<uint32_t> cell_start;               // objects of cell c: cell_objects[cell_start[c] .. cell_start[c + 1])
+    std::vector<uint32_t> cell_objects;
+    std::vector<int32_t> cell_subgrid;              // two-level: index into subgrids, -1 for a plain cell; empty otherwise
+    std::vector<shared_ptr<uniform_grid>> subgrids;
+    std::vector<uint32_t> subgrid_large;            // objects its cell's list keeps for itself, at the front of it
+    bbox bounds;                                    // of the cells
+    bbox bounding_box;
+
+    static constexpr double fine_density = 4.0;     // cells per object of a one-level grid or a subgrid
+    static constexpr double coarse_density = 0.5;   // cells per object of the coarse level
+    static const int crowded = 8;                   // objects in a coarse cell that earn it a subgrid
+    static const int max_resolution = 256;          // cells along an axis
+
+    // clip: bounds of the cells (a subgrid's parent cell), or empty for the objects' own bounds
+    uniform_grid(const std::vector<shared_ptr<object>>& object_list, double density, bool two_level, const bbox& clip)
+      : objects(object_list)
+    {
+        for (const auto& o : objects)
+        {
+            object_boxes.push_back(o->get_bbox());
+            bounding_box = bbox(bounding_box, object_boxes.back());
+        }
+        bounds = clip.x.size() > 0 ? clip : bounding_box;
+        bounding_box = bounds;
+        if (objects.empty())
+        {
+            cell_start.assign(2, 0);
+            return;
+        }
+
+        choose_resolution(density);
+        fill_cells();
+
+        if (two_level)
+            build_subgrids();
+    }
+
+    // about density * objects cells, as close to cubes as the bounds allow; flat axes get one cell
+    void choose_resolution(double density)
+    {
+        double extent[3], largest = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            extent[a] = bounds.axis(a).size();
+            largest = fmax(largest, extent[a]);
+        }
+
+        double volume = 1;
+        int dimensions = 0;
+        bool flat[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            flat[a] = extent[a] <= 1e-3 * largest;   // e.g. a layer of quads: a 2D grid
+            if (!flat[a])
+            {
+                volume *= extent[a];
+                ++dimensions;
+            }
+        }
+
+        auto cells_per_unit = dimensions > 0 ? pow(density * objects.size() / volume, 1.0 / dimensions) : 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            auto n = flat[a] ? 1 : static_cast<int>(extent[a] * cells_per_unit + 0.5);
+            resolution[a] = std::min(std::max(n, 1), max_resolution);
+            cell_size[a] = fmax(extent[a], 1e-12) / resolution[a];
+            inv_cell_size[a] = 1 / cell_size[a];
+        }
+    }
+
+    size_t cell_index(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z) * resolution[1] + y) * resolution[0] + x;
+    }
+
+    int cell_along(int axis, double p) const
+    {
+        auto c = static_cast<int>(floor((p - bounds.axis(axis).min) * inv_cell_size[axis]));
+        return std::min(std::max(c, 0), resolution[axis] - 1);
+    }
+
+    // the cells an object's bounds overlap, a little wider so rounding cannot lose it from one
+    void cell_range(const bbox& b, int lo[3], int hi[3]) const
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            auto margin = 1e-6 * cell_size[a];
+            lo[a] = cell_along(a, b.axis(a).min - margin);
+            hi[a] = cell_along(a, b.axis(a).max + margin);
+        }
+    }
+
+    void fill_cells()
+    {
+        // count, prefix sum, then place: two passes over the objects, one array for all lists
+        auto cell_count = cell_index(0, 0, resolution[2]);
+        cell_start.assign(cell_count + 1, 0);
+
+        auto for_each_cell = [&](const bbox& b, auto func)
+        {
+            int lo[3] = {}, hi[3] = {};
+            cell_range(b, lo, hi);
+            for (int z = lo[2]; z <= hi[2]; ++z)
+                for (int y = lo[1]; y <= hi[1]; ++y)
+                    for (int x = lo[0]; x <= hi[0]; ++x)
+                        func(cell_index(x, y, z));
+        };
+
+        for (const auto& b : object_boxes)
+            for_each_cell(b, [&](size_t c) { ++cell_start[c + 1]; });
+        for (size_t c = 0; c < cell_count; ++c)
+            cell_start[c + 1] += cell_start[c];
+
+        cell_objects.resize(cell_start[cell_count]);
+        std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+        for (size_t i = 0; i < objects.size(); ++i)
+            for_each_cell(object_boxes[i], [&](size_t c) { cell_objects[fill[c]++] = static_cast<uint32_t>(i); });
+    }
+
+    void build_subgrids()
+    {
+        cell_subgrid.assign(cell_start.size() - 1, -1);
+        for (int z = 0; z < resolution[2]; ++z)
+        {
+            for (int y = 0; y < resolution[1]; ++y)
+            {
+                for (int x = 0; x < resolution[0]; ++x)
+                {
+                    auto c = cell_index(x, y, z);
+                    if (cell_start[c + 1] - cell_start[c] <= static_cast<uint32_t>(crowded))
+                        continue;
+
+                    auto lo = point3(bounds.x.min + x * cell_size[0], bounds.y.min + y * cell_size[1], bounds.z.min + z * cell_size[2]);
+                    auto hi = lo + cell_size;
+
+                    // objects filling much of the cell stay in its list, first; the rest go to the subgrid,
+                    // which only spans them: a large object must not stretch it over empty space
+                    auto large = [&](uint32_t i)
+                    {
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            auto overlap = fmin(object_boxes[i].axis(a).max, hi[a]) - fmax(object_boxes[i].axis(a).min, lo[a]);
+                            if (overlap < 0.5 * cell_size[a])
+                                return false;
+                        }
+                        return true;
+                    };
+                    auto first = cell_objects.begin() + cell_start[c], last = cell_objects.begin() + cell_start[c + 1];
+                    auto small = std::stable_partition(first, last, large);
+                    if (last - small <= crowded)
+                        continue;
+
+                    std::vector<shared_ptr<object>> inside;
+                    bbox span;
+                    for (auto k = small; k != last; ++k)
+                    {
+                        inside.push_back(objects[*k]);
+                        span = bbox(span, object_boxes[*k]);
+                    }
+                    auto clip = bbox(interval(fmax(span.x.min, lo[0]), fmin(span.x.max, hi[0])),
+                                     interval(fmax(span.y.min, lo[1]), fmin(span.y.max, hi[1])),
+                                     interval(fmax(span.z.min, lo[2]), fmin(span.z.max, hi[2])));
+
+                    cell_subgrid[c] = static_cast<int32_t>(subgrids.size());
+                    subgrid_large.push_back(static_cast<uint32_t>(small - first));
+                    subgrids.push_back(shared_ptr<uniform_grid>(new uniform_grid(inside, fine_density, false, clip)));
+                }
+            }
+        }
+    }
+
+    // true if the part of r within ray_t first meets object i's bounds in the cell spanning [t_in, t_out)
+    bool enters_here(uint32_t i, const ray& r, const interval& ray_t, double t_in, double t_out) const
+    {
+        const auto& b = object_boxes[i];
+        auto t_min = ray_t.min, t_max = ray_t.max;
+        for (int a = 0; a < 3; ++a)
+        {
+            auto inv_dir = 1 / r.direction()[a];
+            auto t0 = (b.axis(a).min - r.origin()[a]) * inv_dir;
+            auto t1 = (b.axis(a).max - r.origin()[a]) * inv_dir;
+            if (inv_dir < 0)
+                std::swap(t0, t1);
+            t_min = fmax(t_min, t0);
+            t_max = fmin(t_max, t1);
+            if (t_max < t_min)
+                return false;
+        }
+        return t_min >= t_in && t_min < t_out;
+    }
+
+    // Calls visit(cell, t_in, t_out) for the cells r crosses within ray_t, front to back, while it
+    // returns true. ray_t is shared by reference: visit may shrink ray_t.max to stop early.
+    template<typename Func>
+    void walk(const ray& r, interval& ray_t, Func visit) const
+    {
+        if (objects.empty())
+            return;
+
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+
+        // the part of the ray inside the cells
+        auto t = ray_t.min, t_exit = ray_t.max;
+        for (int a = 0; a < 3; ++a)
+        {
+            auto inv_dir = 1 / d[a];
+            auto t0 = (bounds.axis(a).min - o[a]) * inv_dir;
+            auto t1 = (bounds.axis(a).max - o[a]) * inv_dir;
+            if (inv_dir < 0)
+                std::swap(t0, t1);
+            t = fmax(t, t0);
+            t_exit = fmin(t_exit, t1);
+        }
+        if (t > t_exit)
+            return;
+
+        // the start cell, and per axis: the step, where the ray crosses the next cell face and how far apart those are
+        int cell[3], step[3], end[3];
+        double t_next[3], t_delta[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            cell[a] = cell_along(a, o[a] + t * d[a]);
+            if (d[a] > 0)
+            {
+                step[a] = 1;
+                end[a] = resolution[a];
+                t_next[a] = (bounds.axis(a).min + (cell[a] + 1) * cell_size[a] - o[a]) / d[a];
+                t_delta[a] = cell_size[a] / d[a];
+            }
+            else if (d[a] < 0)
+            {
+                step[a] = -1;
+                end[a] = -1;
+                t_next[a] = (bounds.axis(a).min + cell[a] * cell_size[a] - o[a]) / d[a];
+                t_delta[a] = -cell_size[a] / d[a];
+            }
+            else
+            {
+                step[a] = 0;
+                end[a] = -2;
+                t_next[a] = infinity;
+                t_delta[a] = infinity;
+            }
+        }
+
+        // the first cell reaches back to the start of the ray: a subgrid's objects may stick out of it,
+        // and the ray may meet them before it gets to the subgrid
+        auto t_in = -infinity;
+        while (true)
+        {
+            int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            auto t_out = fmin(t_next[axis], t_exit);
+            auto last = t_out >= fmin(t_exit, ray_t.max);
+
+            // the last cell reaches on past ray_t.max, so objects met right at the end are not lost
+            if (!visit(cell_index(cell[0], cell[1], cell[2]), t_in, last ? infinity : t_out))
+                return;
+            if (last || t_out >= ray_t.max)
+                return;
+
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis])
+                return;
+            t_in = t_out;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+
+#endif //UNIFORM_GRID_H
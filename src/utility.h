@@ -1,6 +1,7 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <random>
@@ -14,6 +15,15 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Scalar of the geometry types (vec3, ray, interval, bbox): float with RT_FLOAT32 (xmake f --float32=y),
+// double otherwise. Colors are vec3 and follow it; pdfs, sampling and texture math stay double.
+
+#ifdef RT_FLOAT32
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -27,7 +37,12 @@ inline double degrees_to_radians(double degrees) {
 
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Every thread owns a generator, so parallel render passes neither race on nor
+    // serialize through rand()'s shared state. Seeds are handed out in thread start
+    // order, which keeps scene construction on the main thread reproducible.
+    static std::atomic<unsigned int> next_seed{0};
+    thread_local std::mt19937 generator(next_seed++);
+    return generator() / 4294967296.0;
 }
 
 inline double random_double(double min, double max)
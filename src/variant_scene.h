@@ -0,0 +1,183 @@
+#ifndef VARIANT_SCENE_H
+#define VARIANT_SCENE_H
+
+#include "utility.h"
+#include "object.h"
+#include "scene.h"
+#include "flat_bvh.h"
+#include "sphere.h"
+#include "quad.h"
+#include "cuboid.h"
+#include "mesh.h"
+
+#include <iostream>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// A scene's geometry with static dispatch: spheres, quads, boxes and meshes are held in a std::variant,
+// so intersecting one is a switch on the variant's index and a direct call the compiler can inline
+// (the classes are final), instead of a virtual call through a shared_ptr:
+//  - every other object (media, pools, grids, heightfields, ...) takes the variant's last slot,
+//    a shared_ptr<object> called through its virtual functions as before,
+//  - nested scene lists are flattened into it,
+//  - a BVH (flat_bvh.h) over the elements, stored in leaf order,
+//  - spheres, quads and boxes report only their distance while the BVH is searched; the record
+//    (normal, (u,v)) is filled once, for the closest hit (object::intersect_deferred).
+// Spheres, quads and boxes are copied in: changing the originals later doesn't change this scene.
+
+
+using object_variant = std::variant<sphere, quad, cuboid, shared_ptr<triangle_mesh>, shared_ptr<object>>;
+
+// f(o) with o the element itself: as its own class for the closed set, as an object for the fallback
+template <typename Variant, typename F>
+inline decltype(auto) visit_object(Variant&& v, F&& f)
+{
+    return std::visit([&](auto&& alternative) -> decltype(auto)
+    {
+        using T = std::decay_t<decltype(alternative)>;
+        if constexpr (std::is_same_v<T, shared_ptr<triangle_mesh>> || std::is_same_v<T, shared_ptr<object>>)
+            return f(*alternative);
+        else
+            return f(alternative);
+    }, std::forward<Variant>(v));
+}
+
+
+class variant_scene : public object
+{
+public:
+    variant_scene(const scene& list)
+    {
+        add(list);
+        build();
+    }
+
+
+    // Method
+
+    size_t size() const { return elements.size(); }
+
+    // elements called through the virtual fallback
+    size_t fallback_count() const
+    {
+        size_t count = 0;
+        for (const auto& e : elements)
+            count += std::holds_alternative<shared_ptr<object>>(e);
+        return count;
+    }
+
+    bbox get_bbox() const override { return bounding_box; }
+
+    bool intersect(const ray& r, interval ray_t, intersect_record& rec) const override
+    {
+        deferred_hit hit;
+        if (!intersect_deferred(r, ray_t, rec, hit))
+            return false;
+
+        finish_hit(r, hit, rec);
+        return true;
+    }
+
+    bool intersect_deferred(const ray& r, interval ray_t, intersect_record& rec, deferred_hit& hit) const override
+    {
+        bool found = false;
+        bvh.traverse(r, ray_t, [&](const flat_bvh::node& leaf)
+        {
+            for (auto i = leaf.offset; i < leaf.offset + leaf.count; ++i)
+            {
+                if (visit_object(elements[i], [&](const auto& o) { return o.intersect_deferred(r, ray_t, rec, hit); }))
+                {
+                    found = true;
+                    ray_t.max = hit.t;
+                }
+            }
+        });
+        return found;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override
+    {
+        auto tr = 1.0;
+        auto span = ray_t;   // traversal only; emptied to stop once blocked
+        bvh.traverse(r, span, [&](const flat_bvh::node& leaf)
+        {
+            for (auto i = leaf.offset; i < leaf.offset + leaf.count && tr > 0; ++i)
+                tr *= visit_object(elements[i], [&](const auto& o) { return o.transmittance(r, ray_t); });
+            if (tr <= 0)
+                span.max = -infinity;
+        });
+        return tr > 0 ? tr : 0;
+    }
+
+    // the fallback objects are shared with their other owners and turn there as well
+    void rotate(double degree, int axis) override
+    {
+        for (auto& e : elements)
+            visit_object(e, [&](auto& o) { o.rotate(degree, axis); });
+        build();
+    }
+
+    void translate(vec3 dir) override
+    {
+        for (auto& e : elements)
+            visit_object(e, [&](auto& o) { o.translate(dir); });
+        build();
+    }
+
+private:
+    std::vector<object_variant> elements;
+    flat_bvh bvh;   // leaf offsets index elements
+    bbox bounding_box;
+
+    static const int max_leaf_size = 4;
+
+    void add(const scene& list)
+    {
+        for (const auto& o : list.objects)
+        {
+            if (auto s = std::dynamic_pointer_cast<sphere>(o))
+                elements.emplace_back(*s);
+            else if (auto q = std::dynamic_pointer_cast<quad>(o))
+                elements.emplace_back(*q);
+            else if (auto c = std::dynamic_pointer_cast<cuboid>(o))
+                elements.emplace_back(*c);
+            else if (auto m = std::dynamic_pointer_cast<triangle_mesh>(o))
+                elements.emplace_back(m);
+            else if (auto nested = std::dynamic_pointer_cast<scene>(o))
+                add(*nested);
+            else
+                elements.emplace_back(o);
+        }
+    }
+
+    void build()
+    {
+        auto count = elements.size();
+        std::vector<flat_bvh::build_ref> refs(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& ref = refs[i];
+            ref.index = static_cast<uint32_t>(i);
+            auto b = visit_object(elements[i], [](const auto& o) { return o.get_bbox(); });
+            for (int a = 0; a < 3; ++a)
+            {
+                ref.lo[a] = static_cast<float>(b.axis(a).min);
+                ref.hi[a] = static_cast<float>(b.axis(a).max);
+                ref.centroid[a] = 0.5f * (ref.lo[a] + ref.hi[a]);
+            }
+        }
+
+        bvh.build(refs, max_leaf_size);
+        bounding_box = bvh.bounds();
+
+        std::vector<object_variant> sorted;
+        sorted.reserve(count);
+        for (const auto& ref : refs)
+            sorted.push_back(std::move(elements[ref.index]));
+        elements.swap(sorted);
+    }
+};
+
+
+#endif //VARIANT_SCENE_H
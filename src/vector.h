@@ -6,62 +6,69 @@
 
 using std::sqrt;
 
-class vec3 {
+// The vector of the renderer is basic_vec3<real>, real being float or double (utility.h).
+// The scalar operators are friends so a double constant scales a float vector without a cast.
+template <typename T>
+class basic_vec3 {
   public:
-    double e[3];
+    T e[3];
 
     // initialize
 
 
-    vec3() : e{0,0,0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    basic_vec3() : e{0,0,0} {}
+    basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
+
+    // from the other precision
+    template <typename U>
+    explicit basic_vec3(const basic_vec3<U>& v) : e{static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2])} {}
 
 
     // functions
 
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
 
-    vec3& operator+=(const vec3 &v) {
+    basic_vec3& operator+=(const basic_vec3 &v) {
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
     }
 
-    vec3& operator*=(double t) {
+    basic_vec3& operator*=(T t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    vec3& operator/=(double t) {
+    basic_vec3& operator/=(T t) {
         return *this *= 1/t;
     }
 
-    double length() const {
+    T length() const {
         return sqrt(length_squared());
     }
 
-    double length_squared() const {
+    T length_squared() const {
         return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
     }
 
-    static vec3 random()
+    static basic_vec3 random()
     {
-        return vec3(random_double(), random_double(), random_double());
+        return basic_vec3(random_double(), random_double(), random_double());
     }
 
-    static vec3 random(double min, double max)
+    static basic_vec3 random(double min, double max)
     {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        return basic_vec3(random_double(min, max), random_double(min, max), random_double(min, max));
     }
 
     bool near_zero() const {
@@ -69,57 +76,60 @@ class vec3 {
         auto s = 1e-8;
         return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
     }
-};
 
-// point3 is just an alias for vec3, but useful for geometric clarity in the code.
-using point3 = vec3;
 
+    // Vector Utility Functions
 
-// Vector Utility Functions
+    friend std::ostream& operator<<(std::ostream &out, const basic_vec3 &v) {
+        return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+    }
 
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
-}
+    friend basic_vec3 operator+(const basic_vec3 &u, const basic_vec3 &v) {
+        return basic_vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
-}
+    friend basic_vec3 operator-(const basic_vec3 &u, const basic_vec3 &v) {
+        return basic_vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
-}
+    friend basic_vec3 operator*(const basic_vec3 &u, const basic_vec3 &v) {
+        return basic_vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
-}
+    friend basic_vec3 operator*(T t, const basic_vec3 &v) {
+        return basic_vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+    }
 
-inline vec3 operator*(double t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
-}
+    friend basic_vec3 operator*(const basic_vec3 &v, T t) {
+        return t * v;
+    }
 
-inline vec3 operator*(const vec3 &v, double t) {
-    return t * v;
-}
+    friend basic_vec3 operator/(basic_vec3 v, T t) {
+        return (1/t) * v;
+    }
 
-inline vec3 operator/(vec3 v, double t) {
-    return (1/t) * v;
-}
+    friend T dot(const basic_vec3 &u, const basic_vec3 &v) {
+        return u.e[0] * v.e[0]
+             + u.e[1] * v.e[1]
+             + u.e[2] * v.e[2];
+    }
 
-inline double dot(const vec3 &u, const vec3 &v) {
-    return u.e[0] * v.e[0]
-         + u.e[1] * v.e[1]
-         + u.e[2] * v.e[2];
-}
+    friend basic_vec3 cross(const basic_vec3 &u, const basic_vec3 &v) {
+        return basic_vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                          u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                          u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
-}
+    friend basic_vec3 unit_vector(basic_vec3 v) {
+        return v / v.length();
+    }
+};
+
+using vec3 = basic_vec3<real>;
+
+// point3 is just an alias for vec3, but useful for geometric clarity in the code.
+using point3 = vec3;
 
-inline vec3 unit_vector(vec3 v) {
-    return v / v.length();
-}
 
 inline vec3 randomSample_unit_disk()
 {
@@ -0,0 +1,227 @@
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include "utility.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Sparse density grid:
+//  - voxels are grouped into 8x8x8 bricks (2 KB, contiguous), only bricks holding density are allocated,
+//  - a coarse grid with one entry per brick indexes the brick pool (-1 marks an empty brick)
+//    and stores the brick's majorant: the largest density trilinear lookups can return inside it.
+// A 512^3 grid needs a 64^3 coarse grid (2 MB with the majorants) plus its non-empty bricks.
+//
+// Voxel files (little endian):
+//  - dense:  "VOXD", int32 nx ny nz, then nx*ny*nz float32 densities, x fastest
+//  - sparse: "VOXS", int32 nx ny nz, uint64 count, then count * (int32 x y z, float32 density)
+
+
+class voxel_grid
+{
+public:
+    static const int brick_size = 8;
+    static const int brick_voxels = brick_size * brick_size * brick_size;
+
+    voxel_grid() {}
+    voxel_grid(int _nx, int _ny, int _nz) { resize(_nx, _ny, _nz); }
+
+
+    // Method
+
+    int size_x() const { return nx; }
+    int size_y() const { return ny; }
+    int size_z() const { return nz; }
+
+    int bricks_x() const { return bx; }
+    int bricks_y() const { return by; }
+    int bricks_z() const { return bz; }
+
+    size_t brick_count() const { return brick_data.size() / brick_voxels; }
+    size_t memory_bytes() const
+    {
+        return brick_data.size() * sizeof(float) + brick_index.size() * sizeof(int32_t) + majorants.size() * sizeof(float);
+    }
+
+    float max_density() const { return max_majorant; }
+
+    void set(int x, int y, int z, float density)
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz)
+            return;
+
+        auto b = brick_of(x, y, z);
+        if (brick_index[b] < 0)
+        {
+            if (density == 0)
+                return;   // keep empty space unallocated
+            brick_index[b] = static_cast<int32_t>(brick_count());
+            brick_data.resize(brick_data.size() + brick_voxels, 0.0f);
+        }
+        brick_data[static_cast<size_t>(brick_index[b]) * brick_voxels + voxel_in_brick(x, y, z)] = density;
+    }
+
+    float voxel(int x, int y, int z) const
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= nx || y >= ny || z >= nz)
+            return 0;
+
+        auto b = brick_index[brick_of(x, y, z)];
+        return b < 0 ? 0 : brick_data[static_cast<size_t>(b) * brick_voxels + voxel_in_brick(x, y, z)];
+    }
+
+    // trilinear density at grid coordinates (voxel i covers [i, i+1), its value sits at the centre).
+    double density(double gx, double gy, double gz) const
+    {
+        gx -= 0.5; gy -= 0.5; gz -= 0.5;
+        auto x0 = static_cast<int>(floor(gx));
+        auto y0 = static_cast<int>(floor(gy));
+        auto z0 = static_cast<int>(floor(gz));
+        auto fx = gx - x0, fy = gy - y0, fz = gz - z0;
+
+        double accum = 0;
+        for (int k = 0; k < 2; ++k)
+            for (int j = 0; j < 2; ++j)
+                for (int i = 0; i < 2; ++i)
+                {
+                    auto w = (i ? fx : 1 - fx) * (j ? fy : 1 - fy) * (k ? fz : 1 - fz);
+                    accum += w * voxel(x0 + i, y0 + j, z0 + k);
+                }
+        return accum;
+    }
+
+    float brick_majorant(int x, int y, int z) const { return majorants[(static_cast<size_t>(z) * by + y) * bx + x]; }
+
+    // Recomputes the coarse majorants; call after the last `set`.
+    void build_majorants()
+    {
+        // per-brick maxima first, then every brick takes the max of its 3x3x3 neighbourhood:
+        // trilinear lookups near a brick face blend in voxels of the neighbouring brick.
+        std::vector<float> brick_max(brick_index.size(), 0.0f);
+        for (size_t b = 0; b < brick_index.size(); ++b)
+        {
+            if (brick_index[b] < 0)
+                continue;
+            auto first = brick_data.begin() + static_cast<size_t>(brick_index[b]) * brick_voxels;
+            brick_max[b] = *std::max_element(first, first + brick_voxels);
+        }
+
+        max_majorant = 0;
+        for (int z = 0; z < bz; ++z)
+            for (int y = 0; y < by; ++y)
+                for (int x = 0; x < bx; ++x)
+                {
+                    float m = 0;
+                    for (int k = std::max(z - 1, 0); k <= std::min(z + 1, bz - 1); ++k)
+                        for (int j = std::max(y - 1, 0); j <= std::min(y + 1, by - 1); ++j)
+                            for (int i = std::max(x - 1, 0); i <= std::min(x + 1, bx - 1); ++i)
+                                m = std::max(m, brick_max[(static_cast<size_t>(k) * by + j) * bx + i]);
+
+                    majorants[(static_cast<size_t>(z) * by + y) * bx + x] = m;
+                    max_majorant = std::max(max_majorant, m);
+                }
+    }
+
+    // Loads a dense or sparse voxel file (see above). Prints an error and returns false on failure.
+    bool load(const std::string& filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "ERROR: Could not open voxel file '" << filename << "'.\n";
+            return false;
+        }
+
+        char magic[4];
+        int32_t dims[3];
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+        if (!in || dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0)
+        {
+            std::cerr << "ERROR: Bad voxel file header in '" << filename << "'.\n";
+            return false;
+        }
+
+        resize(dims[0], dims[1], dims[2]);
+
+        if (std::string(magic, 4) == "VOXD")
+        {
+            // one row at a time, so a 512^3 file never needs a dense copy in memory
+            std::vector<float> row(nx);
+            for (int z = 0; z < nz && in; ++z)
+                for (int y = 0; y < ny && in; ++y)
+                {
+                    in.read(reinterpret_cast<char*>(row.data()), nx * sizeof(float));
+                    for (int x = 0; x < nx; ++x)
+                        set(x, y, z, row[x]);
+                }
+        }
+        else if (std::string(magic, 4) == "VOXS")
+        {
+            uint64_t count = 0;
+            in.read(reinterpret_cast<char*>(&count), sizeof(count));
+            for (uint64_t i = 0; i < count && in; ++i)
+            {
+                int32_t p[3];
+                float d;
+                in.read(reinterpret_cast<char*>(p), sizeof(p));
+                in.read(reinterpret_cast<char*>(&d), sizeof(d));
+                set(p[0], p[1], p[2], d);
+            }
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown voxel file type in '" << filename << "'.\n";
+            return false;
+        }
+
+        if (!in)
+        {
+            std::cerr << "ERROR: Voxel file '" << filename << "' is truncated.\n";
+            return false;
+        }
+
+        build_majorants();
+        std::clog << "Voxel grid: " << nx << "x" << ny << "x" << nz << ", " << brick_count() << " of "
+                  << brick_index.size() << " bricks allocated, " << memory_bytes() / (1024 * 1024) << " MB" << std::endl;
+        return true;
+    }
+
+private:
+    int nx = 0, ny = 0, nz = 0;
+    int bx = 0, by = 0, bz = 0;
+    std::vector<int32_t> brick_index;   // coarse grid -> brick in brick_data, -1 if empty
+    std::vector<float> majorants;       // coarse grid -> majorant of the brick
+    std::vector<float> brick_data;      // allocated bricks, brick_voxels floats each
+    float max_majorant = 0;
+
+    void resize(int _nx, int _ny, int _nz)
+    {
+        nx = _nx; ny = _ny; nz = _nz;
+        bx = (nx + brick_size - 1) / brick_size;
+        by = (ny + brick_size - 1) / brick_size;
+        bz = (nz + brick_size - 1) / brick_size;
+
+        brick_index.assign(static_cast<size_t>(bx) * by * bz, -1);
+        majorants.assign(brick_index.size(), 0.0f);
+        brick_data.clear();
+        max_majorant = 0;
+    }
+
+    size_t brick_of(int x, int y, int z) const
+    {
+        return (static_cast<size_t>(z / brick_size) * by + y / brick_size) * bx + x / brick_size;
+    }
+
+    static int voxel_in_brick(int x, int y, int z)
+    {
+        return ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size;
+    }
+};
+
+
+#endif //VOXEL_GRID_H
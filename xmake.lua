@@ -1,10 +1,91 @@
 add_rules("mode.debug", "mode.release")
 
+-- geometry in float instead of double: xmake f --float32=y
+option("float32")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build vec3, ray, interval and bbox on float")
+    add_defines("RT_FLOAT32")
+option_end()
+
 target("PathTracingInOneWeekend")
     set_kind("binary")
+    add_options("float32")
     add_files("src/*.cpp")
     add_headerfiles("src/*.h")
     add_headerfiles("external/stb_image.h")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
+
+-- microbenchmarks, not built by default: xmake build triangle_bench && xmake run triangle_bench
+target("triangle_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/triangle_bench.cpp")
+
+-- xmake build grid_bench && xmake run grid_bench
+target("grid_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/grid_bench.cpp")
+
+-- xmake build precision_bench && xmake run precision_bench
+target("precision_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/precision_bench.cpp")
+
+-- xmake build dispatch_bench && xmake run dispatch_bench
+target("dispatch_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/dispatch_bench.cpp")
+
+-- xmake build texture_cache_bench && xmake run texture_cache_bench
+target("texture_cache_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/texture_cache_bench.cpp")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
+
+-- xmake build loading_bench && xmake run loading_bench
+target("loading_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/loading_bench.cpp")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
+
+-- xmake build noise_bench && xmake run noise_bench
+target("noise_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/noise_bench.cpp")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
+
+-- xmake build bake_bench && xmake run bake_bench
+target("bake_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bake_bench.cpp")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
+
+-- xmake build texture_format_bench && xmake run texture_format_bench
+target("texture_format_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/texture_format_bench.cpp")
+    if is_plat("linux", "macosx") then
+        add_syslinks("pthread")
+    end
 
 --
 -- If you want to known more usage about xmake, please see https://xmake.io